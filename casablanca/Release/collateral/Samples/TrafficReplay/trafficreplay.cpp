@@ -0,0 +1,155 @@
+/***
+* ==++==
+*
+* Copyright (c) Microsoft Corporation. All rights reserved.
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* ==--==
+* =+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+
+*
+* trafficreplay.cpp - Simple cmd line application that replays the requests of a traffic capture, written by
+*      http::client::traffic_recorder, against a server and reports how it answered.
+*
+* =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+****/
+
+#include <http_client.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+using namespace utility;
+using namespace web::http;
+using namespace web::http::client;
+
+/// <summary>
+/// The outcome of one replayed request.
+/// </summary>
+struct replay_result
+{
+    std::chrono::microseconds latency;
+    status_code status;
+    bool failed;
+};
+
+/// <summary>
+/// Builds the request of a captured exchange. The Host and Content-Length headers are left to the client.
+/// </summary>
+http_request make_request(const captured_exchange &exchange)
+{
+    http_request request(exchange.method);
+    request.set_request_uri(exchange.request_uri);
+    for (auto it = exchange.request_headers.begin(); it != exchange.request_headers.end(); ++it)
+    {
+        if (it->first != header_names::host && it->first != header_names::content_length)
+        {
+            request.headers().add(it->first, it->second);
+        }
+    }
+    if (!exchange.request_body.empty())
+    {
+        string_t content_type = exchange.request_headers.content_type();
+        request.set_body(exchange.request_body);
+        if (!content_type.empty())
+        {
+            request.headers().set_content_type(content_type);
+        }
+    }
+    return request;
+}
+
+#ifdef _MS_WINDOWS
+int wmain(int argc, wchar_t *args[])
+#else
+int main(int argc, char *args[])
+#endif
+{
+    if(argc != 3 && argc != 4)
+    {
+        printf("Usage: TrafficReplay.exe capture_file base_uri [rate]\n");
+        printf("  rate: 1 replays at the captured pace, 2 twice as fast, 0 as fast as possible. Defaults to 1.\n");
+        return -1;
+    }
+    const string_t captureFileName = args[1];
+    const string_t baseUri = args[2];
+    const double rate = argc == 4 ? std::stod(utility::conversions::to_utf8string(args[3])) : 1.0;
+
+    const std::vector<captured_exchange> exchanges = read_traffic_capture(captureFileName);
+    if (exchanges.empty())
+    {
+        printf("The capture has no requests.\n");
+        return 0;
+    }
+
+    http_client client(baseUri);
+    std::vector<pplx::task<replay_result>> results;
+    const auto start = std::chrono::steady_clock::now();
+    const auto first_offset = exchanges.front().offset;
+
+    // Issue the requests on the captured schedule, scaled by the rate, without waiting for responses.
+    for (auto it = exchanges.begin(); it != exchanges.end(); ++it)
+    {
+        if (rate > 0)
+        {
+            const std::chrono::microseconds due(static_cast<int64_t>((it->offset - first_offset) / rate));
+            std::this_thread::sleep_until(start + due);
+        }
+
+        const auto sent = std::chrono::steady_clock::now();
+        results.push_back(client.request(make_request(*it)).then([sent](pplx::task<http_response> response_task)
+        {
+            replay_result result = { std::chrono::microseconds(0), 0, false };
+            try
+            {
+                http_response response = response_task.get();
+                result.status = response.status_code();
+                response.content_ready().wait();
+            }
+            catch (const std::exception &)
+            {
+                result.failed = true;
+            }
+            result.latency = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - sent);
+            return result;
+        }));
+    }
+
+    // Wait for everything to complete.
+    std::vector<std::chrono::microseconds> latencies;
+    size_t failed = 0, mismatched = 0;
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const replay_result result = results[i].get();
+        if (result.failed)
+        {
+            ++failed;
+            continue;
+        }
+        if (result.status != exchanges[i].status_code)
+        {
+            ++mismatched;
+        }
+        latencies.push_back(result.latency);
+    }
+    const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+
+    printf("Replayed %u requests in %u ms: %u failed, %u answered with a different status than captured.\n",
+        static_cast<unsigned>(exchanges.size()), static_cast<unsigned>(elapsed.count()), static_cast<unsigned>(failed), static_cast<unsigned>(mismatched));
+    if (!latencies.empty())
+    {
+        std::sort(latencies.begin(), latencies.end());
+        auto percentile = [&latencies](double p) { return static_cast<unsigned>(latencies[static_cast<size_t>(p * (latencies.size() - 1))].count()); };
+        printf("Latency (us): p50 %u, p90 %u, p99 %u, max %u\n", percentile(0.5), percentile(0.9), percentile(0.99), percentile(1.0));
+    }
+
+    return failed == 0 ? 0 : 1;
+}
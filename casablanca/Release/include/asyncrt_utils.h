@@ -281,6 +281,13 @@ inline utility::string_t __cdecl create_error_message(unsigned long errorCode)
     return utility::conversions::to_string_t(create_error_code(errorCode).message());
 }
 
+/// <summary>
+/// Reads a monotonic clock, for measuring intervals. Unlike std::chrono::steady_clock, it is also
+/// available with Visual Studio 2010.
+/// </summary>
+/// <returns>Microseconds since an unspecified point in time.</returns>
+_ASYNCRTIMP uint64_t __cdecl steady_clock_microseconds();
+
 }
 
 class datetime
@@ -217,4 +217,13 @@ _ASYNCRTIMP size_t _seekrdtoend_fsb(_In_ concurrency::streams::details::_file_in
 /// <param name="pos">The new position (offset from the start) in the file stream</param>
 /// <returns>True if the request was initiated</returns>
 _ASYNCRTIMP size_t _seekwrpos_fsb(_In_ concurrency::streams::details::_file_info *info, size_t pos, size_t char_size);
+
+#if !defined(_MS_WINDOWS)
+/// <summary>
+/// Get the file descriptor of a file stream, for transfers such as sendfile(2) that bypass the stream buffer.
+/// </summary>
+/// <param name="info">The file info record of the file</param>
+/// <returns>The file descriptor, or -1 if the file is closed</returns>
+_ASYNCRTIMP int _get_fsb_handle(_In_ concurrency::streams::details::_file_info *info);
+#endif
 }
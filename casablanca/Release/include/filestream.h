@@ -67,6 +67,14 @@ namespace Concurrency { namespace streams
         typedef typename basic_streambuf<_CharType>::off_type off_type;
 
         virtual ~basic_file_buffer() { this->close().wait(); }
+
+#if !defined(_MS_WINDOWS)
+        /// <summary>
+        /// Gets the file descriptor of the file, or -1 if it is closed.
+        /// </summary>
+        /// <remarks>Data written to the descriptor directly bypasses the stream's read buffer and position.</remarks>
+        int _native_handle() const { return _get_fsb_handle(m_info); }
+#endif
     protected:
 
         /// <summary>
@@ -0,0 +1,280 @@
+/***
+* ==++==
+*
+* Copyright (c) Microsoft Corporation. All rights reserved.
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* ==--==
+* =+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+
+*
+* http2_helpers.h - Implementation Details of the HTTP/2 transport
+*
+* Frame layout (RFC 7540) and HPACK header compression (RFC 7541), shared by the h2c client
+* transport and its tests. Header fields are handled as raw octet strings.
+*
+* =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+****/
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+#include <utility>
+
+#include "xxpublic.h"
+
+namespace web { namespace http
+{
+namespace details
+{
+namespace http2
+{
+    // The client connection preface, sent ahead of the client's first SETTINGS frame.
+    static const char connection_preface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+    static const size_t connection_preface_size = sizeof(connection_preface) - 1;
+
+    // Protocol defaults and limits.
+    static const size_t frame_header_size = 9;
+    static const uint32_t default_initial_window_size = 65535;
+    static const uint32_t default_max_frame_size = 16384;
+    static const uint32_t max_allowed_frame_size = 16777215;
+    static const uint32_t default_header_table_size = 4096;
+    static const uint32_t max_window_size = 0x7fffffff;
+
+    // Streams opened before the server's first SETTINGS frame says how many it allows: the least that
+    // RFC 7540 recommends a server to allow.
+    static const uint32_t initial_max_concurrent_streams = 100;
+
+    namespace frame_types
+    {
+        enum frame_type
+        {
+            data = 0x0,
+            headers = 0x1,
+            priority = 0x2,
+            rst_stream = 0x3,
+            settings = 0x4,
+            push_promise = 0x5,
+            ping = 0x6,
+            goaway = 0x7,
+            window_update = 0x8,
+            continuation = 0x9
+        };
+    }
+
+    namespace frame_flags
+    {
+        static const uint8_t end_stream = 0x1;
+        static const uint8_t ack = 0x1;
+        static const uint8_t end_headers = 0x4;
+        static const uint8_t padded = 0x8;
+        static const uint8_t priority = 0x20;
+    }
+
+    namespace settings_ids
+    {
+        enum settings_id
+        {
+            header_table_size = 0x1,
+            enable_push = 0x2,
+            max_concurrent_streams = 0x3,
+            initial_window_size = 0x4,
+            max_frame_size = 0x5,
+            max_header_list_size = 0x6
+        };
+    }
+
+    namespace error_codes
+    {
+        enum error_code
+        {
+            no_error = 0x0,
+            protocol_error = 0x1,
+            internal_error = 0x2,
+            flow_control_error = 0x3,
+            settings_timeout = 0x4,
+            stream_closed = 0x5,
+            frame_size_error = 0x6,
+            refused_stream = 0x7,
+            cancel = 0x8,
+            compression_error = 0x9,
+            connect_error = 0xa,
+            enhance_your_calm = 0xb,
+            inadequate_security = 0xc,
+            http_1_1_required = 0xd
+        };
+    }
+
+    /// <summary>
+    /// The fixed nine octet header that starts every frame.
+    /// </summary>
+    struct frame_header
+    {
+        frame_header() : length(0), type(0), flags(0), stream_id(0) {}
+
+        frame_header(uint32_t length, uint8_t type, uint8_t flags, uint32_t stream_id)
+            : length(length), type(type), flags(flags), stream_id(stream_id) {}
+
+        uint32_t length;
+        uint8_t type;
+        uint8_t flags;
+        uint32_t stream_id;
+
+        /// <summary>
+        /// Writes the header into the first frame_header_size octets of out.
+        /// </summary>
+        _ASYNCRTIMP void write(uint8_t *out) const;
+
+        /// <summary>
+        /// Reads a header from the first frame_header_size octets of in. The reserved bit of the stream id is dropped.
+        /// </summary>
+        _ASYNCRTIMP static frame_header read(const uint8_t *in);
+    };
+
+    /// <summary>
+    /// Appends a 32 bit value in network byte order.
+    /// </summary>
+    _ASYNCRTIMP void append_uint32(std::vector<uint8_t> &out, uint32_t value);
+
+    /// <summary>
+    /// Reads a 32 bit value stored in network byte order.
+    /// </summary>
+    _ASYNCRTIMP uint32_t read_uint32(const uint8_t *in);
+
+    // A header field, as (name, value). Names are lower case on the wire.
+    typedef std::pair<std::string, std::string> header_field;
+
+    /// <summary>
+    /// Appends the Huffman encoding (RFC 7541 appendix B) of the given string.
+    /// </summary>
+    _ASYNCRTIMP void huffman_encode(const std::string &str, std::vector<uint8_t> &out);
+
+    /// <summary>
+    /// Returns the number of octets the Huffman encoding of the given string takes.
+    /// </summary>
+    _ASYNCRTIMP size_t huffman_encoded_size(const std::string &str);
+
+    /// <summary>
+    /// Decodes a Huffman encoded string. Returns false if the input is not a valid encoding.
+    /// </summary>
+    _ASYNCRTIMP bool huffman_decode(const uint8_t *data, size_t size, std::string &out);
+
+    /// <summary>
+    /// The HPACK dynamic table. Entries are numbered from 1, newest first, and come after the static table.
+    /// </summary>
+    class hpack_table
+    {
+    public:
+        // Number of entries in the static table.
+        static const size_t static_table_size = 61;
+
+        // Per entry overhead counted against the table size.
+        static const size_t entry_overhead = 32;
+
+        hpack_table() : m_size(0), m_max_size(default_header_table_size) {}
+
+        /// <summary>
+        /// Looks up a field by its HPACK index, covering the static and dynamic tables. Returns nullptr for invalid indices.
+        /// </summary>
+        _ASYNCRTIMP const header_field *get(size_t index) const;
+
+        /// <summary>
+        /// Finds the index of the given field. Returns the index of a full match, or of an entry with a matching
+        /// name if no full match exists (setting name_only), or zero if neither is found.
+        /// </summary>
+        _ASYNCRTIMP size_t find(const std::string &name, const std::string &value, bool &name_only) const;
+
+        /// <summary>
+        /// Adds an entry, evicting the oldest entries as needed.
+        /// </summary>
+        _ASYNCRTIMP void add(const header_field &field);
+
+        /// <summary>
+        /// Changes the maximum size of the table, evicting the oldest entries as needed.
+        /// </summary>
+        _ASYNCRTIMP void set_max_size(size_t max_size);
+
+        size_t size() const { return m_size; }
+        size_t max_size() const { return m_max_size; }
+        size_t entry_count() const { return m_entries.size(); }
+
+    private:
+        void evict(size_t max_size);
+
+        std::deque<header_field> m_entries;
+        size_t m_size;
+        size_t m_max_size;
+    };
+
+    /// <summary>
+    /// Encodes header lists into header blocks. Fields found in either table are sent as an index,
+    /// the rest are added to the dynamic table, except for sensitive ones which are never indexed.
+    /// </summary>
+    class hpack_encoder
+    {
+    public:
+        hpack_encoder() : m_pending_size_update(false) {}
+
+        /// <summary>
+        /// Appends the header block for the given fields. Names must already be lower case.
+        /// </summary>
+        _ASYNCRTIMP void encode(const std::vector<header_field> &fields, std::vector<uint8_t> &block);
+
+        /// <summary>
+        /// Applies the peer's SETTINGS_HEADER_TABLE_SIZE. The change is signalled at the start of the next block.
+        /// </summary>
+        _ASYNCRTIMP void set_max_table_size(size_t max_size);
+
+        const hpack_table &table() const { return m_table; }
+
+    private:
+        hpack_table m_table;
+        bool m_pending_size_update;
+    };
+
+    /// <summary>
+    /// Decodes header blocks into header lists.
+    /// </summary>
+    class hpack_decoder
+    {
+    public:
+        hpack_decoder() : m_max_table_size(default_header_table_size) {}
+
+        /// <summary>
+        /// Decodes a complete header block, appending to fields. Returns false on a compression error,
+        /// after which the decoder must not be used again.
+        /// </summary>
+        _ASYNCRTIMP bool decode(const uint8_t *data, size_t size, std::vector<header_field> &fields);
+
+        const hpack_table &table() const { return m_table; }
+
+    private:
+        hpack_table m_table;
+
+        // The limit we advertised in SETTINGS_HEADER_TABLE_SIZE.
+        size_t m_max_table_size;
+    };
+
+    /// <summary>
+    /// Appends an HPACK integer with the given prefix length; the bits above the prefix in the first octet are taken from first_byte.
+    /// </summary>
+    _ASYNCRTIMP void hpack_encode_integer(size_t value, int prefix_bits, uint8_t first_byte, std::vector<uint8_t> &out);
+
+    /// <summary>
+    /// Decodes an HPACK integer with the given prefix length, advancing pos. Returns false if the input is truncated or overflows.
+    /// </summary>
+    _ASYNCRTIMP bool hpack_decode_integer(const uint8_t *data, size_t size, size_t &pos, int prefix_bits, size_t &value);
+
+} // namespace http2
+} // namespace details
+}} // namespace web::http
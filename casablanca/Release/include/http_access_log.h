@@ -0,0 +1,203 @@
+/***
+* ==++==
+*
+* Copyright (c) Microsoft Corporation. All rights reserved.
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* ==--==
+* =+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+
+*
+* http_access_log.h
+*
+* HTTP Library: binary access log of the exchanges completed by http_client and http_listener
+*
+* =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+****/
+#pragma once
+
+#include "http_msg.h"
+
+#if !defined(_MS_WINDOWS) || (_MSC_VER >= 1700)
+
+#include <chrono>
+#include <cstdint>
+
+namespace web { namespace http
+{
+
+namespace access_log_source
+{
+    /// <summary>
+    /// The side of an exchange an access log entry was recorded by.
+    /// </summary>
+    enum source
+    {
+        client = 1,
+        listener = 2
+    };
+}
+
+namespace access_log_failure
+{
+    /// <summary>
+    /// How an exchange in the access log went wrong.
+    /// </summary>
+    enum kind
+    {
+        /// <summary>
+        /// The exchange completed.
+        /// </summary>
+        none = 0,
+
+        /// <summary>
+        /// The exchange ended in an error instead of a complete response.
+        /// </summary>
+        error = 1,
+
+        /// <summary>
+        /// A listener's handler threw, or replied with an exception, and the request was answered with a 500.
+        /// </summary>
+        handler_exception = 2
+    };
+}
+
+/// <summary>
+/// One completed HTTP exchange, as written to the access log. Entries are written to the file back to back,
+/// in the byte order of the machine that wrote them.
+/// </summary>
+struct access_log_entry
+{
+    /// <summary>
+    /// When the request started, in microseconds since the epoch.
+    /// </summary>
+    uint64_t start_time;
+
+    /// <summary>
+    /// The FNV-1a hash of the request URI's path and query, as returned by access_log::hash_uri.
+    /// </summary>
+    uint64_t uri_hash;
+
+    /// <summary>
+    /// The size of the request body, sent by a client or received by a listener.
+    /// </summary>
+    uint64_t request_size;
+
+    /// <summary>
+    /// The size of the response body, received by a client or sent by a listener.
+    /// </summary>
+    uint64_t response_size;
+
+    /// <summary>
+    /// Microseconds from the start of the request to its response headers: received by a client, or ready to
+    /// be sent by a listener.
+    /// </summary>
+    uint32_t headers_time;
+
+    /// <summary>
+    /// Microseconds from the start of the request to the end of the response body.
+    /// </summary>
+    uint32_t total_time;
+
+    uint16_t status_code;
+
+    /// <summary>
+    /// An access_log_source.
+    /// </summary>
+    uint8_t source;
+
+    /// <summary>
+    /// The request method, as returned by access_log::method_code.
+    /// </summary>
+    uint8_t method;
+
+    /// <summary>
+    /// An access_log_failure: whether, and how, the exchange went wrong.
+    /// </summary>
+    uint8_t failed;
+
+    uint8_t reserved[3];
+};
+
+/// <summary>
+/// A low overhead log of the exchanges completed by http_client and http_listener.
+/// </summary>
+/// <remarks>
+/// Each thread records entries into a ring buffer of its own, without locking or formatting. A background
+/// thread drains the rings to the log file at an interval. A ring that is full when an entry is recorded drops
+/// the entry, and the drop is counted. When a thread exits its ring is handed to the next thread that records
+/// an entry; rings are only freed with the process. The access log needs Visual Studio 2012 or later on Windows.
+/// </remarks>
+class access_log
+{
+public:
+    /// <summary>
+    /// Starts recording entries, appending them to a file.
+    /// </summary>
+    /// <param name="file_name">The log file.</param>
+    /// <param name="flush_interval">How often the recorded entries are written to the file.</param>
+    /// <param name="ring_entries">The number of entries in the ring buffer of each thread, rounded up to a power of 2.
+    /// Only applies to rings created from now on, not to those already in use or left by threads that exited.</param>
+    _ASYNCRTIMP static void start(const utility::string_t &file_name,
+        std::chrono::milliseconds flush_interval = std::chrono::milliseconds(1000), size_t ring_entries = 4096);
+
+    /// <summary>
+    /// Stops recording entries, writes those already recorded, and closes the file. An entry recorded while the log
+    /// stops is either written to the file or, if the log had already stopped, not recorded.
+    /// </summary>
+    _ASYNCRTIMP static void stop();
+
+    /// <summary>
+    /// Checks if entries are being recorded.
+    /// </summary>
+    _ASYNCRTIMP static bool enabled();
+
+    /// <summary>
+    /// Records an entry, if the log is started.
+    /// </summary>
+    _ASYNCRTIMP static void record(const access_log_entry &entry);
+
+    /// <summary>
+    /// Records the entry of an exchange, if the log is started.
+    /// </summary>
+    /// <param name="source">The side of the exchange recording it.</param>
+    /// <param name="request">The request.</param>
+    /// <param name="status">The response status code, or 0 if there is none.</param>
+    /// <param name="headers_time">Microseconds from the start of the request to the response headers being received
+    /// or ready to be sent.</param>
+    /// <param name="total_time">Microseconds from the start of the request to now, the end of the exchange.</param>
+    /// <param name="request_size">The size of the request body.</param>
+    /// <param name="response_size">The size of the response body.</param>
+    /// <param name="failed">How the exchange went wrong, if it did.</param>
+    _ASYNCRTIMP static void record(access_log_source::source source, const http_request &request, status_code status,
+        uint64_t headers_time, uint64_t total_time, uint64_t request_size, uint64_t response_size,
+        access_log_failure::kind failed);
+
+    /// <summary>
+    /// Gets the number of entries dropped for finding their thread's ring buffer full.
+    /// </summary>
+    _ASYNCRTIMP static size_t dropped();
+
+    /// <summary>
+    /// Gets the hash of a URI's path and query that identifies it in the log.
+    /// </summary>
+    _ASYNCRTIMP static uint64_t hash_uri(const uri &request_uri);
+
+    /// <summary>
+    /// Gets the code of a method in the log: 1 to 10 for GET, POST, PUT, DEL, HEAD, OPTIONS, TRCE, CONNECT,
+    /// MERGE and PATCH, 0 for others.
+    /// </summary>
+    _ASYNCRTIMP static uint8_t method_code(const method &request_method);
+};
+
+}} // namespace web::http
+
+#endif // !defined(_MS_WINDOWS) || (_MSC_VER >= 1700)
@@ -30,6 +30,7 @@
 
 #include <memory>
 #include <limits>
+#include <vector>
 
 #include "xxpublic.h"
 #include "http_msg.h"
@@ -126,6 +127,298 @@ private:
     http::client::credentials m_credentials;
 };
 
+/// <summary>
+/// socket_options holds the tuning options applied to the sockets an http_client connects.
+/// Every option defaults to the operating system's behavior. Options are applied on a best effort
+/// basis; ones the system does not support are ignored. Currently only applied on Linux.
+/// </summary>
+class socket_options
+{
+public:
+    socket_options() :
+        m_no_delay(false),
+        m_send_buffer_size(0),
+        m_receive_buffer_size(0),
+        m_keep_alive(false),
+        m_keep_alive_idle(0),
+        m_keep_alive_interval(0),
+        m_keep_alive_count(0),
+        m_quick_ack(false),
+        m_fast_open(false)
+    {
+    }
+
+    /// <summary>
+    /// Get the 'no delay' property
+    /// </summary>
+    /// <returns>The value of the property.</returns>
+    bool no_delay() const { return m_no_delay; }
+
+    /// <summary>
+    /// Set the 'no delay' property. When set, Nagle's algorithm is disabled (TCP_NODELAY), so the
+    /// request head and body are sent without waiting for the acknowledgment of earlier segments.
+    /// </summary>
+    /// <param name="no_delay">The value of the property.</param>
+    void set_no_delay(bool no_delay) { m_no_delay = no_delay; }
+
+    /// <summary>
+    /// Get the send buffer size
+    /// </summary>
+    /// <returns>The size in bytes of the socket send buffer (SO_SNDBUF), 0 for the system default.</returns>
+    int send_buffer_size() const { return m_send_buffer_size; }
+
+    /// <summary>
+    /// Set the send buffer size
+    /// </summary>
+    /// <param name="size">The size in bytes of the socket send buffer (SO_SNDBUF), 0 for the system default.</param>
+    void set_send_buffer_size(int size) { m_send_buffer_size = size; }
+
+    /// <summary>
+    /// Get the receive buffer size
+    /// </summary>
+    /// <returns>The size in bytes of the socket receive buffer (SO_RCVBUF), 0 for the system default.</returns>
+    int receive_buffer_size() const { return m_receive_buffer_size; }
+
+    /// <summary>
+    /// Set the receive buffer size. It is applied before connecting, so that the TCP window scale
+    /// negotiated with the server accounts for it.
+    /// </summary>
+    /// <param name="size">The size in bytes of the socket receive buffer (SO_RCVBUF), 0 for the system default.</param>
+    void set_receive_buffer_size(int size) { m_receive_buffer_size = size; }
+
+    /// <summary>
+    /// Get the 'keep alive' property
+    /// </summary>
+    /// <returns>The value of the property.</returns>
+    bool keep_alive() const { return m_keep_alive; }
+
+    /// <summary>
+    /// Set the 'keep alive' property. When set, TCP keepalive probes (SO_KEEPALIVE) are sent on idle connections.
+    /// </summary>
+    /// <param name="keep_alive">The value of the property.</param>
+    void set_keep_alive(bool keep_alive) { m_keep_alive = keep_alive; }
+
+    /// <summary>
+    /// Get the keepalive idle time
+    /// </summary>
+    /// <returns>The time a connection is idle before the first probe is sent (TCP_KEEPIDLE), 0 for the system default.</returns>
+    utility::seconds keep_alive_idle() const { return m_keep_alive_idle; }
+
+    /// <summary>
+    /// Set the keepalive idle time. Only used when 'keep alive' is set.
+    /// </summary>
+    /// <param name="idle">The time a connection is idle before the first probe is sent (TCP_KEEPIDLE), 0 for the system default.</param>
+    void set_keep_alive_idle(utility::seconds idle) { m_keep_alive_idle = idle; }
+
+    /// <summary>
+    /// Get the keepalive interval
+    /// </summary>
+    /// <returns>The time between probes (TCP_KEEPINTVL), 0 for the system default.</returns>
+    utility::seconds keep_alive_interval() const { return m_keep_alive_interval; }
+
+    /// <summary>
+    /// Set the keepalive interval. Only used when 'keep alive' is set.
+    /// </summary>
+    /// <param name="interval">The time between probes (TCP_KEEPINTVL), 0 for the system default.</param>
+    void set_keep_alive_interval(utility::seconds interval) { m_keep_alive_interval = interval; }
+
+    /// <summary>
+    /// Get the keepalive probe count
+    /// </summary>
+    /// <returns>The number of unanswered probes before the connection is dropped (TCP_KEEPCNT), 0 for the system default.</returns>
+    int keep_alive_count() const { return m_keep_alive_count; }
+
+    /// <summary>
+    /// Set the keepalive probe count. Only used when 'keep alive' is set.
+    /// </summary>
+    /// <param name="count">The number of unanswered probes before the connection is dropped (TCP_KEEPCNT), 0 for the system default.</param>
+    void set_keep_alive_count(int count) { m_keep_alive_count = count; }
+
+    /// <summary>
+    /// Get the 'quick ack' property
+    /// </summary>
+    /// <returns>The value of the property.</returns>
+    bool quick_ack() const { return m_quick_ack; }
+
+    /// <summary>
+    /// Set the 'quick ack' property. When set, delayed acknowledgments are turned off (TCP_QUICKACK)
+    /// after connecting and again before the response is read.
+    /// </summary>
+    /// <param name="quick_ack">The value of the property.</param>
+    void set_quick_ack(bool quick_ack) { m_quick_ack = quick_ack; }
+
+    /// <summary>
+    /// Get the 'fast open' property
+    /// </summary>
+    /// <returns>The value of the property.</returns>
+    bool fast_open() const { return m_fast_open; }
+
+    /// <summary>
+    /// Set the 'fast open' property. When set, connections use TCP Fast Open (TCP_FASTOPEN_CONNECT),
+    /// which sends the start of the request with the SYN once the client holds a cookie for the server.
+    /// </summary>
+    /// <param name="fast_open">The value of the property.</param>
+    void set_fast_open(bool fast_open) { m_fast_open = fast_open; }
+
+private:
+    bool m_no_delay;
+    int m_send_buffer_size;
+    int m_receive_buffer_size;
+    bool m_keep_alive;
+    utility::seconds m_keep_alive_idle;
+    utility::seconds m_keep_alive_interval;
+    int m_keep_alive_count;
+    bool m_quick_ack;
+    bool m_fast_open;
+};
+
+namespace details
+{
+    struct concurrency_limiter_state;
+    struct traffic_recorder_state;
+}
+
+/// <summary>
+/// Pipeline stage that caps the number of requests in flight, adapting the cap to the round trip times
+/// and failures observed on completed requests. Requests over the cap wait in a queue, or are failed
+/// with an http_exception once the queue is full.
+/// </summary>
+/// <remarks>
+/// The round trip time is measured until the response headers arrive. Errors and 429 or 503
+/// responses count as drops, which cut the limit down.
+/// Add it as the last stage, so that the time spent in other stages is not taken for backend latency.
+/// </remarks>
+class adaptive_concurrency_limiter : public http::http_pipeline_stage
+{
+public:
+    /// <summary>
+    /// The algorithms that adjust the limit.
+    /// </summary>
+    enum algorithm
+    {
+        /// <summary>
+        /// Additive increase, multiplicative decrease: the limit grows by one per round trip while it is
+        /// in use, and shrinks by 10% on each drop. Only reacts to drops.
+        /// </summary>
+        aimd,
+
+        /// <summary>
+        /// The limit follows the ratio between the long-term and the recent round trip times, so it
+        /// shrinks as soon as requests start queuing at the backend, before any drop.
+        /// </summary>
+        gradient
+    };
+
+    /// <summary>
+    /// Creates a new limiter.
+    /// </summary>
+    /// <param name="alg">The algorithm adjusting the limit.</param>
+    /// <param name="initial_limit">The limit until the first requests complete.</param>
+    /// <param name="min_limit">The lowest the limit can go.</param>
+    /// <param name="max_limit">The highest the limit can go.</param>
+    /// <param name="max_queued">The number of requests that may wait for a slot; further requests are rejected.</param>
+    _ASYNCRTIMP adaptive_concurrency_limiter(algorithm alg = gradient, size_t initial_limit = 20, size_t min_limit = 1, size_t max_limit = 1000, size_t max_queued = 1000);
+
+    /// <summary>
+    /// Get the current limit
+    /// </summary>
+    /// <returns>The number of requests that may currently be in flight.</returns>
+    _ASYNCRTIMP size_t limit() const;
+
+    /// <summary>
+    /// Get the number of requests in flight
+    /// </summary>
+    /// <returns>The number of requests sent but not yet answered.</returns>
+    _ASYNCRTIMP size_t in_flight() const;
+
+    /// <summary>
+    /// Sends the request on, or queues it if the limit is reached.
+    /// </summary>
+    _ASYNCRTIMP virtual pplx::task<http_response> propagate(http_request request);
+
+private:
+    std::shared_ptr<details::concurrency_limiter_state> m_state;
+};
+
+/// <summary>
+/// One request and response exchange read back from a traffic capture.
+/// </summary>
+struct captured_exchange
+{
+    /// <summary>
+    /// Microseconds from the start of the capture to the request being sent.
+    /// </summary>
+    uint64_t offset;
+
+    /// <summary>
+    /// Microseconds from the request being sent to the response body being received.
+    /// </summary>
+    uint64_t duration;
+
+    http::method method;
+
+    /// <summary>
+    /// The request URI, relative to the base URI of the client that sent it.
+    /// </summary>
+    utility::string_t request_uri;
+    http_headers request_headers;
+    std::vector<unsigned char> request_body;
+
+    /// <summary>
+    /// The response status code, or 0 if the request failed without a response.
+    /// </summary>
+    http::status_code status_code;
+    http::reason_phrase reason_phrase;
+    http_headers response_headers;
+    std::vector<unsigned char> response_body;
+};
+
+/// <summary>
+/// Pipeline stage that captures every exchange going through it, with its timing, to a file. The capture can be
+/// read back with read_traffic_capture, to replay the traffic against another server.
+/// </summary>
+/// <remarks>
+/// Bodies are read whole to capture them: a request is sent on once its body has been read, and a response is
+/// passed back once its body has arrived. The body of a response written to a stream of the caller's, or not kept
+/// because of the request's response_body_mode, is not captured.
+/// Add it as the first stage, so that the captured timing covers the other stages.
+/// </remarks>
+class traffic_recorder : public http::http_pipeline_stage
+{
+public:
+    /// <summary>
+    /// Creates a recorder, capturing to a new file.
+    /// </summary>
+    /// <param name="file_name">The capture file; an existing file is overwritten.</param>
+    _ASYNCRTIMP traffic_recorder(const utility::string_t &file_name);
+
+    /// <summary>
+    /// Writes out the exchanges completed so far and closes the file.
+    /// </summary>
+    _ASYNCRTIMP ~traffic_recorder();
+
+    /// <summary>
+    /// Get the number of exchanges captured
+    /// </summary>
+    /// <returns>The number of exchanges completed and written, or being written, to the file.</returns>
+    _ASYNCRTIMP size_t captured() const;
+
+    /// <summary>
+    /// Sends the request on and captures it with its response.
+    /// </summary>
+    _ASYNCRTIMP virtual pplx::task<http_response> propagate(http_request request);
+
+private:
+    std::shared_ptr<details::traffic_recorder_state> m_state;
+};
+
+/// <summary>
+/// Reads the exchanges of a traffic capture written by a traffic_recorder.
+/// </summary>
+/// <param name="file_name">The capture file.</param>
+/// <returns>The exchanges, in the order their requests were sent.</returns>
+_ASYNCRTIMP std::vector<captured_exchange> read_traffic_capture(const utility::string_t &file_name);
+
 /// <summary>
 /// HTTP client configuration class, used to set the possible configuration options
 /// used to create an http_client instance.
@@ -135,7 +428,9 @@ class http_client_config
 public:
     http_client_config() : 
         m_guarantee_order(false),
-        m_timeout(utility::seconds(30)) 
+        m_timeout(utility::seconds(30)),
+        m_use_http2(false),
+        m_max_connections(0)
     {
     }
 
@@ -211,12 +506,76 @@ public:
         m_timeout = timeout;
     }
 
+    /// <summary>
+    /// Get the 'use HTTP/2' property
+    /// </summary>
+    /// <returns>The value of the property.</returns>
+    bool use_http2() const
+    {
+        return m_use_http2;
+    }
+
+    /// <summary>
+    /// Set the 'use HTTP/2' property. When set, requests to "http" URIs are sent as HTTP/2 streams
+    /// multiplexed over a single connection. The server must accept HTTP/2 over cleartext TCP without
+    /// an upgrade (prior knowledge). Currently only supported on Linux; ignored on other platforms.
+    /// </summary>
+    /// <param name="use_http2">The value of the property.</param>
+    void set_use_http2(bool use_http2)
+    {
+        m_use_http2 = use_http2;
+    }
+
+    /// <summary>
+    /// Get the maximum number of connections
+    /// </summary>
+    /// <returns>The maximum number of requests the client sends at once, 0 if there is no limit.</returns>
+    size_t max_connections() const
+    {
+        return m_max_connections;
+    }
+
+    /// <summary>
+    /// Set the maximum number of connections. Requests over the limit are held back and sent as
+    /// earlier ones complete, highest <see cref="request_priority"/> first. A request gains one priority
+    /// class for every second it waits, so lower priority requests are not starved. With HTTP/2 the
+    /// limit applies to the streams on the shared connection. Ignored when 'guarantee order' is set.
+    /// </summary>
+    /// <param name="max_connections">The maximum number of requests the client sends at once, 0 for no limit.</param>
+    void set_max_connections(size_t max_connections)
+    {
+        m_max_connections = max_connections;
+    }
+
+    /// <summary>
+    /// Get the socket options
+    /// </summary>
+    /// <returns>A reference to the socket options.</returns>
+    const http::client::socket_options& socket_options() const
+    {
+        return m_socket_options;
+    }
+
+    /// <summary>
+    /// Set the socket options
+    /// </summary>
+    /// <param name="options">A reference to the socket options.</param>
+    void set_socket_options(const http::client::socket_options& options)
+    {
+        m_socket_options = options;
+    }
+
 private:
     web_proxy m_proxy;
     http::client::credentials m_credentials;
     // Whether or not to guarantee ordering, i.e. only using one underlying TCP connection.
     bool m_guarantee_order;
     utility::seconds m_timeout;
+    // Whether or not to send requests over HTTP/2 (h2c, prior knowledge).
+    bool m_use_http2;
+    // Maximum number of requests in flight, 0 for no limit.
+    size_t m_max_connections;
+    http::client::socket_options m_socket_options;
 };
 
 /// <summary>
@@ -228,15 +587,36 @@ public:
     /// <summary>
     /// Creates a new http_client connected to specified uri.
     /// </summary>
-    /// <param name="base_uri">A string representation of the base uri to be used for all requests. Must start with either "http://" or "https://"</param>
+    /// <param name="base_uri">A string representation of the base uri to be used for all requests. Must start with either "http://" or "https://".
+    /// On Linux it may also name a Unix domain socket, as in "unix:///path/to/socket", in which case request paths are sent as is.</param>
     _ASYNCRTIMP http_client(const uri &base_uri);
 
     /// <summary>
     /// Creates a new http_client connected to specified uri.
     /// </summary>
-    /// <param name="base_uri">A string representation of the base uri to be used for all requests. Must start with either "http://" or "https://"</param>
+    /// <param name="base_uri">A string representation of the base uri to be used for all requests. Must start with either "http://" or "https://".
+    /// On Linux it may also name a Unix domain socket, as in "unix:///path/to/socket", in which case request paths are sent as is.</param>
     _ASYNCRTIMP http_client(const uri &base_uri, const http_client_config& client_config);
 
+    /// <summary>
+    /// Creates a new http_client that spreads requests over several equivalent base uris.
+    /// </summary>
+    /// <param name="base_uris">The base uris of the backends, each following the same rules as a single base uri.</param>
+    /// <remarks>Each request goes to the better of two backends picked at random, favoring the ones with fewer
+    /// outstanding requests and lower latency. A backend that fails several requests in a row, with an error or a
+    /// 5xx status code, is left out for a while.</remarks>
+    _ASYNCRTIMP http_client(const std::vector<uri> &base_uris);
+
+    /// <summary>
+    /// Creates a new http_client that spreads requests over several equivalent base uris.
+    /// </summary>
+    /// <param name="base_uris">The base uris of the backends, each following the same rules as a single base uri.</param>
+    /// <param name="client_config">The configuration used for the connections to every backend.</param>
+    /// <remarks>Each request goes to the better of two backends picked at random, favoring the ones with fewer
+    /// outstanding requests and lower latency. A backend that fails several requests in a row, with an error or a
+    /// 5xx status code, is left out for a while.</remarks>
+    _ASYNCRTIMP http_client(const std::vector<uri> &base_uris, const http_client_config& client_config);
+
     /// <summary>
     /// Move constructor.
     /// </summary>
@@ -263,6 +643,15 @@ public:
         append(hndlr);
     }
 
+    /// <summary>
+    /// Add an HTTP pipeline stage to the client.
+    /// </summary>
+    /// <param name="stage">A shared pointer to a pipeline stage.</param>
+    void add_handler(std::shared_ptr<http::http_pipeline_stage> stage)
+    {
+        append(stage);
+    }
+
     /// <summary>
     /// Asynchronously sends an HTTP request.
     /// </summary>
@@ -281,6 +670,23 @@ public:
         return request(msg);
     }
 
+    /// <summary>
+    /// Connects to the base uri ahead of traffic, so the next requests do not have to wait for
+    /// name resolution and connection setup. The connections are kept in the client's idle pool.
+    /// Requests are sent with 'Connection: close', so a prewarmed connection serves a single request
+    /// and is not reused; as each one is handed to a request, a replacement is connected in the
+    /// background, keeping the pool at the prewarmed size while requests keep coming. A request
+    /// made before its replacement is ready connects on its own as usual. The pool holds at most 64
+    /// connections, and a connection left unused for 30 seconds is closed rather than used, without
+    /// being replaced. With HTTP/2 the single shared connection is opened instead.
+    /// With several base uris, each one gets the given number of connections.
+    /// Currently only supported on Linux; completes right away on other platforms.
+    /// </summary>
+    /// <param name="connections">The number of connections to establish, up to the pool's free room.</param>
+    /// <returns>An asynchronous operation that is completed once all connection attempts are over. It fails
+    /// only if no connection could be established.</returns>
+    _ASYNCRTIMP pplx::task<void> prewarm(size_t connections);
+
     /// <summary>
     /// Get client configuration object
     /// </summary>
@@ -120,5 +120,39 @@ namespace details
         _ASYNCRTIMP size_t add_chunked_delimiters(_Out_writes_ (buffer_size) uint8_t *data, _In_ size_t buffer_size, size_t bytes_read);
     }
 
+#if !defined(_MS_WINDOWS)
+    /// <summary>
+    /// An integer valued socket option, for options boost::asio::socket_base does not offer. Satisfies the
+    /// SettableSocketOption and GettableSocketOption requirements of boost::asio; flags are 1 or 0.
+    /// </summary>
+    template <int _Level, int _Name>
+    class integer_socket_option
+    {
+    public:
+        integer_socket_option() : m_value(0) {}
+        explicit integer_socket_option(int value) : m_value(value) {}
+
+        int value() const { return m_value; }
+
+        template <typename _Protocol> int level(const _Protocol &) const { return _Level; }
+        template <typename _Protocol> int name(const _Protocol &) const { return _Name; }
+        template <typename _Protocol> int *data(const _Protocol &) { return &m_value; }
+        template <typename _Protocol> const int *data(const _Protocol &) const { return &m_value; }
+        template <typename _Protocol> size_t size(const _Protocol &) const { return sizeof(m_value); }
+
+        template <typename _Protocol>
+        void resize(const _Protocol &, size_t size)
+        {
+            if (size != sizeof(m_value))
+            {
+                throw std::length_error("integer_socket_option resize");
+            }
+        }
+
+    private:
+        int m_value;
+    };
+#endif
+
 } // namespace details
 }} // namespace web::http
@@ -0,0 +1,442 @@
+/*
+* Copyright (c) Microsoft Corporation. All rights reserved.
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* http_linux_server.h
+*
+* HTTP Library: HTTP server transport for Linux, on boost::asio.
+*/
+
+#pragma once
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/algorithm/string/predicate.hpp>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <set>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "http_server.h"
+
+namespace web
+{
+
+namespace http
+{
+
+namespace listener
+{
+
+class http_linux_server;
+
+namespace details
+{
+
+
+struct linux_request_context : web::http::details::_http_server_context
+{
+    linux_request_context(){}
+
+    pplx::task_completion_event<void> m_response_completed;
+
+private:
+    linux_request_context(const linux_request_context&);
+    linux_request_context& operator=(const linux_request_context&);
+};
+
+// Decides which requests are answered 503 instead of being handled, by how long they waited for a
+// thread after arriving. A request is shed if it waited longer than the budget. With a target set, the
+// shedder also follows CoDel: when even the shortest wait over an interval exceeded the target, the
+// queue is standing rather than absorbing a burst, and requests that waited over twice the target are
+// shed until an interval passes with a wait under it.
+class queue_time_shedder
+{
+public:
+    typedef std::chrono::steady_clock clock;
+
+    queue_time_shedder()
+    : m_budget(clock::duration::zero())
+    , m_target(clock::duration::zero())
+    , m_interval(std::chrono::milliseconds(100))
+    , m_interval_end()
+    , m_min_wait(clock::duration::max())
+    , m_standing_queue(false)
+    , m_shed(0)
+    {
+    }
+
+    void set_budget(clock::duration budget) { m_budget = budget; }
+    void set_target(clock::duration target, clock::duration interval) { m_target = target; m_interval = interval; }
+
+    // Returns false for a request that should be shed. waited is how long the request waited; now is
+    // the time it was taken up.
+    bool admit(clock::duration waited, clock::time_point now);
+
+    size_t shed_count() const { return m_shed; }
+
+private:
+    clock::duration m_budget;
+    clock::duration m_target;
+    clock::duration m_interval;
+
+    pplx::critical_section m_lock;
+    clock::time_point m_interval_end;
+    clock::duration m_min_wait;
+    bool m_standing_queue;
+
+    std::atomic<size_t> m_shed;
+};
+
+class hostport_listener;
+class response_compressor;
+
+class connection
+{
+private:
+    std::unique_ptr<boost::asio::ip::tcp::socket> m_socket;
+    boost::asio::io_service& m_service; // the shard's io_service, which m_socket belongs to
+    // Both buffers live as long as the connection and are reused by every request on it; bytes of
+    // pipelined requests read along with an earlier one stay in m_request_buf until their turn.
+    boost::asio::streambuf m_request_buf;
+    boost::asio::streambuf m_response_buf;
+    boost::asio::steady_timer m_idle_timer;
+    http_linux_server* m_p_server;
+    hostport_listener* m_p_parent;
+    http_request m_request;
+    uint64_t m_arrival; // when the current request's headers were read, in utility::details::steady_clock_microseconds
+    uint64_t m_response_start; // when the current response started to be sent, likewise
+    size_t m_read, m_write;
+    size_t m_read_size, m_write_size;
+    bool m_close;
+	bool m_chunked;
+    int m_file_handle; // descriptor of a file body sent with sendfile, -1 for other bodies
+    size_t m_file_offset, m_file_end;
+    std::unique_ptr<response_compressor> m_compressor; // set while a response body is being compressed
+    bool m_handler_failed; // the handler threw, or replied with an exception, for the current request
+    std::atomic<int> m_refs; // track how many threads are still referring to this
+
+public:
+    connection(std::unique_ptr<boost::asio::ip::tcp::socket> socket, boost::asio::io_service& service, http_linux_server* server, hostport_listener* parent);
+    ~connection();
+
+    connection(const connection&) = delete;
+    connection& operator=(const connection&) = delete;
+
+    void close();
+
+private:
+    void start_request_response();
+    void handle_http_line(const boost::system::error_code& ec);
+    void handle_headers(bool http_1_0);
+    void handle_body(const boost::system::error_code& ec);
+	void handle_chunked_header(const boost::system::error_code& ec);
+	void handle_chunked_body(const boost::system::error_code& ec, int toWrite);
+    void handle_chunked_trailer(const boost::system::error_code& ec, size_t size);
+    void handle_idle_timeout(const boost::system::error_code& ec);
+    void dispatch_request_to_listener();
+    void invoke_listener(http_listener_interface* pListener, http_request request);
+    void request_data_avail(size_t size);
+    void do_response();
+    template <typename ReadHandler>
+    void async_read_until_buffersize(size_t size, ReadHandler handler);
+    void async_process_response(http_response response);
+    void prepare_file_response(http_response response);
+    void prepare_compressed_response(http_response response);
+    void handle_headers_written(http_response response, const boost::system::error_code& ec);
+    void handle_write_large_response(http_response response, const boost::system::error_code& ec);
+    void handle_write_chunked_response(http_response response, const boost::system::error_code& ec);
+    void handle_write_file_response(http_response response, const boost::system::error_code& ec);
+    void handle_write_compressed_response(http_response response, const boost::system::error_code& ec);
+    void write_compressed_chunk(http_response response);
+    void handle_response_written(http_response response, const boost::system::error_code& ec);
+    void finish_request_response();
+};
+
+// Runs pplx tasks on an acceptor shard's thread, by posting them to the shard's io_service. Once the shard
+// detaches it, as it stops, tasks go to the shared thread pool instead.
+class shard_scheduler : public pplx::scheduler
+{
+public:
+    shard_scheduler(boost::asio::io_service& service) : m_p_service(&service) { }
+
+    virtual void schedule(pplx::TaskProc proc, void* param);
+
+    void detach();
+
+private:
+    pplx::critical_section m_lock;
+    boost::asio::io_service* m_p_service;
+};
+
+// One accepting thread of a hostport_listener. Each shard has its own io_service, run by its own
+// thread, and its own SO_REUSEPORT acceptor, so the kernel spreads incoming connections over the
+// shards. A connection stays on the shard that accepted it: its socket belongs to that io_service.
+// In thread-per-core mode the shard's thread is pinned to a core, the cores being handed out in turn
+// to the shards of all the listeners in the process, and is also the pplx scheduler of the
+// tasks started on it, so the handlers and continuations of its connections run there too.
+class acceptor_shard
+{
+public:
+    acceptor_shard(hostport_listener* parent, size_t index)
+    : m_p_parent(parent)
+    , m_index(index)
+    , m_service()
+    , m_work(new boost::asio::io_service::work(m_service))
+    , m_acceptor(m_service)
+    , m_scheduler()
+    {
+    }
+
+    ~acceptor_shard()
+    {
+        stop();
+    }
+
+    // Binds the acceptor to the endpoint and starts the shard's thread.
+    void start(const boost::asio::ip::tcp::endpoint& endpoint);
+
+    // Stops accepting; connections already accepted keep running until closed.
+    void stop_accepting();
+
+    // Stops the shard's thread, once its connections are gone.
+    void stop();
+
+    boost::asio::ip::tcp::endpoint local_endpoint() const { return m_acceptor.local_endpoint(); }
+
+private:
+    void accept();
+    void on_accept(boost::asio::ip::tcp::socket* socket, const boost::system::error_code& ec);
+
+    void run();
+
+    hostport_listener* m_p_parent;
+    size_t m_index;
+    boost::asio::io_service m_service;
+    std::unique_ptr<boost::asio::io_service::work> m_work;
+    boost::asio::ip::tcp::acceptor m_acceptor;
+    std::shared_ptr<shard_scheduler> m_scheduler;
+    std::thread m_thread;
+
+    friend class hostport_listener;
+
+    acceptor_shard(const acceptor_shard&);
+    acceptor_shard& operator=(const acceptor_shard&);
+};
+
+class hostport_listener
+{
+private:
+    friend class connection;
+    friend class acceptor_shard;
+
+    std::vector<std::unique_ptr<acceptor_shard>> m_shards;
+    std::map<std::string, http_listener_interface* > m_listeners;
+    pplx::reader_writer_lock m_listeners_lock;
+
+    pplx::recursive_lock m_connections_lock;
+    pplx::notification_event m_all_connections_complete;
+    std::set<connection*> m_connections;
+
+    http_linux_server* m_p_server;
+
+    std::string m_host;
+    std::string m_port;
+
+public:
+     hostport_listener(http_linux_server* server, const std::string& hostport)
+    : m_shards()
+    , m_listeners()
+    , m_listeners_lock()
+    , m_connections_lock()
+    , m_connections()
+    , m_p_server(server)
+    {
+        m_all_connections_complete.set();
+
+        std::istringstream hostport_in(hostport);
+
+        std::getline(hostport_in, m_host, ':');
+        std::getline(hostport_in, m_port);
+    }
+
+    ~hostport_listener()
+    {
+        stop();
+    }
+
+    void start();
+    void stop();
+
+    void add_listener(const std::string& path, http_listener_interface* listener);
+    void remove_listener(const std::string& path, http_listener_interface* listener);
+
+private:
+    void add_connection(std::unique_ptr<boost::asio::ip::tcp::socket> socket, boost::asio::io_service& service);
+};
+
+
+}
+
+struct iequal_to
+{
+    bool operator()(const std::string& left, const std::string& right) const
+    {
+        return boost::ilexicographical_compare(left, right);
+    }
+};
+
+/// <summary>
+/// The HTTP server used by http_listener on Linux. Each host and port listened on is served by a set of
+/// acceptor threads, each with its own SO_REUSEPORT socket and io_service; a connection is handled by the
+/// thread that accepted it.
+/// </summary>
+/// <remarks>
+/// A server with a non-default number of acceptor threads is put in place with
+/// http_server_api::register_server_api, before any listener is opened.
+/// </remarks>
+class http_linux_server : public http_server
+{
+private:
+    friend class http::listener::details::connection;
+    friend class http::listener::details::hostport_listener;
+
+    pplx::reader_writer_lock m_listeners_lock;
+    std::map<std::string, std::unique_ptr<details::hostport_listener>, iequal_to> m_listeners;
+    std::unordered_map<http_listener_interface*, std::unique_ptr<pplx::reader_writer_lock>> m_registered_listeners;
+    bool m_started;
+    size_t m_acceptor_threads;
+    utility::seconds m_keep_alive_timeout;
+    details::queue_time_shedder m_shedder;
+    int m_compression_level;
+    size_t m_compression_min_size;
+    bool m_thread_per_core;
+
+public:
+    /// <summary>
+    /// Creates the server.
+    /// </summary>
+    /// <param name="acceptor_threads">The number of acceptor threads for each host and port listened on;
+    /// 0 for one per hardware thread.</param>
+    http_linux_server(size_t acceptor_threads = 0)
+    : m_listeners_lock()
+    , m_listeners()
+    , m_started(false)
+    , m_acceptor_threads(acceptor_threads)
+    , m_keep_alive_timeout(60)
+    , m_compression_level(0)
+    , m_compression_min_size(0)
+    , m_thread_per_core(false)
+    {
+        if (m_acceptor_threads == 0)
+        {
+            m_acceptor_threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+        }
+    }
+
+    ~http_linux_server()
+    {
+        stop();
+    }
+
+    /// <summary>
+    /// Gets the number of acceptor threads for each host and port listened on.
+    /// </summary>
+    size_t acceptor_threads() const { return m_acceptor_threads; }
+
+    /// <summary>
+    /// Checks if the server runs in thread-per-core mode.
+    /// </summary>
+    bool thread_per_core() const { return m_thread_per_core; }
+
+    /// <summary>
+    /// Turns thread-per-core mode on or off. In this mode each acceptor thread is pinned to a core, and the
+    /// handlers of the requests it reads, with the tasks and continuations they start, run on that thread
+    /// instead of the shared thread pool. A request and its buffers then stay on the core that accepted the
+    /// connection. Applies to hosts and ports opened afterwards.
+    /// </summary>
+    /// <remarks>
+    /// A handler must not wait on a task in this mode: the task would be scheduled on the thread that waits.
+    /// </remarks>
+    void set_thread_per_core(bool enabled) { m_thread_per_core = enabled; }
+
+    /// <summary>
+    /// Gets how long a connection may wait for its next request before it is closed.
+    /// </summary>
+    utility::seconds keep_alive_timeout() const { return m_keep_alive_timeout; }
+
+    /// <summary>
+    /// Sets how long a connection may wait for its next request before it is closed. The time covers
+    /// the wait for the complete request line and headers. Applies to requests started afterwards.
+    /// </summary>
+    void set_keep_alive_timeout(utility::seconds timeout) { m_keep_alive_timeout = timeout; }
+
+    /// <summary>
+    /// Turns on compression of textual response bodies, for clients that accept gzip or deflate. Compressed
+    /// bodies are streamed in chunked encoding as they are produced.
+    /// </summary>
+    /// <param name="level">The zlib compression level, from 1 (fastest) to 9 (smallest); 0, the default, turns compression off.</param>
+    /// <param name="min_size">Bodies with a Content-Length below this are sent as they are; bodies of unknown length are always compressed.</param>
+    void set_compression(int level, size_t min_size = 1024)
+    {
+        m_compression_level = std::max(0, std::min(level, 9));
+        m_compression_min_size = min_size;
+    }
+
+    /// <summary>
+    /// Gets the compression level of response bodies, or 0 if they are not compressed.
+    /// </summary>
+    int compression_level() const { return m_compression_level; }
+
+    /// <summary>
+    /// Gets the smallest Content-Length of a response body that is compressed.
+    /// </summary>
+    size_t compression_min_size() const { return m_compression_min_size; }
+
+    /// <summary>
+    /// Sets the longest a request may wait for a thread to run its handler. A request that waited longer is
+    /// answered 503 (Service Unavailable) without running the handler, as its client has likely given up on it.
+    /// Zero, the default, never sheds on queue time.
+    /// </summary>
+    void set_queue_time_budget(std::chrono::milliseconds budget) { m_shedder.set_budget(budget); }
+
+    /// <summary>
+    /// Sets a CoDel target queue time. Once every request over an interval has waited longer than the target,
+    /// requests that waited over twice the target are answered 503 until the queue drains. Zero, the default,
+    /// turns this off.
+    /// </summary>
+    /// <param name="target">The acceptable queue time.</param>
+    /// <param name="interval">How long queue times must stay above the target before shedding starts.</param>
+    void set_queue_delay_target(std::chrono::milliseconds target, std::chrono::milliseconds interval = std::chrono::milliseconds(100))
+    {
+        m_shedder.set_target(target, interval);
+    }
+
+    /// <summary>
+    /// Gets the number of requests answered 503 for waiting too long.
+    /// </summary>
+    size_t shed_requests() const { return m_shedder.shed_count(); }
+
+    virtual unsigned long start();
+    virtual unsigned long stop();
+
+    virtual unsigned long register_listener(http_listener_interface* listener);
+    virtual unsigned long unregister_listener(http_listener_interface* listener);
+
+    pplx::task<void> respond(http::http_response response);
+};
+
+}
+
+}
+}
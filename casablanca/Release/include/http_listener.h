@@ -32,6 +32,7 @@
 #include <functional>
 
 #include "http_msg.h"
+#include "http_router.h"
 
 namespace web { 
 
@@ -214,6 +215,34 @@ public:
         return *this;
     }
 
+    /// <summary>
+    /// Add a route for a specific HTTP method and path pattern. Routes are tried before the handlers added with support().
+    /// </summary>
+    /// <param name="method">An HTTP method.</param>
+    /// <param name="pattern">A path pattern relative to the listener's URI, see <c>http_router</c>.</param>
+    /// <param name="handler">Function object to be called with the request and the path parameters.</param>
+    /// <returns>A reference to this http_listener to enable chaining.</returns>
+    template <typename Functor>
+    http_listener &route(const http::method &method, const utility::string_t &pattern, Functor handler)
+    {
+        m_router.add(method, pattern, http_router::handler(handler));
+        return *this;
+    }
+
+    /// <summary>
+    /// Add a route for a set of HTTP methods and a path pattern. Routes are tried before the handlers added with support().
+    /// </summary>
+    /// <param name="methods">The HTTP methods.</param>
+    /// <param name="pattern">A path pattern relative to the listener's URI, see <c>http_router</c>.</param>
+    /// <param name="handler">Function object to be called with the request and the path parameters.</param>
+    /// <returns>A reference to this http_listener to enable chaining.</returns>
+    template <typename Functor>
+    http_listener &route(const std::vector<http::method> &methods, const utility::string_t &pattern, Functor handler)
+    {
+        m_router.add(methods, pattern, http_router::handler(handler));
+        return *this;
+    }
+
     /// <summary>
     /// Add an HTTP pipeline stage to the client. It will be invoked after any already existing stages.
     /// </summary>
@@ -292,6 +321,7 @@ private:
             this->m_uri = std::move(other.m_uri);
             this->m_all_requests = std::move(other.m_all_requests);
             this->m_supported_methods = std::move(other.m_supported_methods);
+            this->m_router = std::move(other.m_router);
 
             this->m_pipeline_stage = other.m_pipeline_stage;
             other.m_pipeline_stage = nullptr;
@@ -335,6 +365,7 @@ private:
     http::uri m_uri;
     std::function<void(http_request)> m_all_requests;
     std::map<http::method, std::function<void(http_request)>> m_supported_methods;
+    http_router m_router;
 
     // Default implementation for TRACE and OPTIONS.
     void handle_trace(http_request message);
@@ -24,10 +24,14 @@
 ****/
 #pragma once
 
+#include <functional>
 #include <map>
 #include <memory>
+#include <new>
 #include <string>
 #include <vector>
+#include <iterator>
+#include <type_traits>
 #include <system_error>
 
 #include "pplxtasks.h"
@@ -57,6 +61,10 @@ namespace http
 namespace client
 {
     class http_client;
+namespace details
+{
+    class request_context;
+}
 }
 
 /// <summary>
@@ -126,53 +134,29 @@ namespace header_names
     /// <summary>
     /// Constants for the HTTP headers mentioned in RFC 2616.
     /// </summary>
-    const utility::string_t accept = U("Accept");
-    const utility::string_t accept_charset = U("Accept-Charset");
-    const utility::string_t accept_encoding = U("Accept-Encoding");
-    const utility::string_t accept_language = U("Accept-Language");
-    const utility::string_t accept_ranges = U("Accept-Ranges");
-    const utility::string_t age = U("Age");
-    const utility::string_t allow = U("Allow");
-    const utility::string_t authorization = U("Authorization");
-    const utility::string_t cache_control = U("Cache-Control");
-    const utility::string_t connection = U("Connection");
-    const utility::string_t content_encoding = U("Content-Encoding");
-    const utility::string_t content_language = U("Content-Language");
-    const utility::string_t content_length = U("Content-Length");
-    const utility::string_t content_location = U("Content-Location");
-    const utility::string_t content_md5 = U("Content-MD5");
-    const utility::string_t content_range = U("Content-Range");
-    const utility::string_t content_type = U("Content-Type");
-    const utility::string_t date = U("Date");
-    const utility::string_t etag = U("ETag");
-    const utility::string_t expect = U("Expect");
-    const utility::string_t expires = U("Expires");
-    const utility::string_t from = U("From");
-    const utility::string_t host = U("Host");
-    const utility::string_t if_match = U("If-Match");
-    const utility::string_t if_modified_since = U("If-Modified-Since");
-    const utility::string_t if_none_match = U("If-None-Match");
-    const utility::string_t if_range = U("If-Range");
-    const utility::string_t if_unmodified_since = U("If-Unmodified-Since");
-    const utility::string_t last_modified = U("Last-Modified");
-    const utility::string_t location = U("Location");
-    const utility::string_t max_forwards = U("Max-Forwards");
-    const utility::string_t pragma = U("Pragma");
-    const utility::string_t proxy_authenticate = U("Proxy-Authenticate");
-    const utility::string_t proxy_authorization = U("Proxy-Authorization");
-    const utility::string_t range = U("Range");
-    const utility::string_t referer = U("Referer");
-    const utility::string_t retry_after = U("Retry-After");
-    const utility::string_t server = U("Server");
-    const utility::string_t te = U("TE");
-    const utility::string_t trailer = U("Trailer");
-    const utility::string_t transfer_encoding = U("Transfer-Encoding");
-    const utility::string_t upgrade = U("Upgrade");
-    const utility::string_t user_agent = U("User-Agent");
-    const utility::string_t vary = U("Vary");
-    const utility::string_t via = U("Via");
-    const utility::string_t warning = U("Warning");
-    const utility::string_t www_authenticate = U("WWW-Authenticate");
+#define _HEADER_NAMES
+#define DAT(a,b) const utility::string_t a = b;
+#include "http_constants.dat"
+#undef _HEADER_NAMES
+#undef DAT
+}
+
+namespace header_ids
+{
+    /// <summary>
+    /// Identifiers for the HTTP headers mentioned in RFC 2616, parallel to <c>header_names</c>.
+    /// Looking a header up by id uses a pre-computed hash instead of hashing the name on every call.
+    /// </summary>
+    enum id
+    {
+        unknown = 0,
+#define _HEADER_NAMES
+#define DAT(a,b) a,
+#include "http_constants.dat"
+#undef _HEADER_NAMES
+#undef DAT
+        _count
+    };
 }
 
 /// <summary>
@@ -238,9 +222,277 @@ private:
     std::error_code m_errorCode;
 };
 
+namespace details
+{
+    /// <summary>
+    /// Case folded FNV-1a hash of an HTTP header field name. Field names are ASCII tokens (RFC 2616 section 4.2),
+    /// so only 'A'-'Z' need to be folded.
+    /// </summary>
+    inline uint32_t _hash_header_name(const utility::char_t *name, size_t length)
+    {
+        uint32_t hash = 2166136261u;
+        for (size_t i = 0; i < length; ++i)
+        {
+            utility::char_t c = name[i];
+            if (c >= 'A' && c <= 'Z')
+            {
+                c = static_cast<utility::char_t>(c + ('a' - 'A'));
+            }
+            hash = (hash ^ static_cast<uint32_t>(c)) * 16777619u;
+        }
+        return hash;
+    }
+
+    inline uint32_t _hash_header_name(const utility::string_t &name)
+    {
+        return _hash_header_name(name.c_str(), name.size());
+    }
+
+    /// <summary>
+    /// ASCII case insensitive equality of two HTTP header field names.
+    /// </summary>
+    inline bool _header_name_equals(const utility::string_t &left, const utility::string_t &right)
+    {
+        if (left.size() != right.size())
+        {
+            return false;
+        }
+        for (size_t i = 0; i < left.size(); ++i)
+        {
+            utility::char_t l = left[i], r = right[i];
+            if (l == r) continue;
+            if (l >= 'A' && l <= 'Z') l = static_cast<utility::char_t>(l + ('a' - 'A'));
+            if (r >= 'A' && r <= 'Z') r = static_cast<utility::char_t>(r + ('a' - 'A'));
+            if (l != r) return false;
+        }
+        return true;
+    }
+
+    /// <summary>
+    /// ASCII case insensitive equality of an HTTP header field name and a null terminated one.
+    /// </summary>
+    inline bool _header_name_equals(const utility::string_t &left, const utility::char_t *right)
+    {
+        size_t i = 0;
+        for (; i < left.size(); ++i)
+        {
+            utility::char_t l = left[i], r = right[i];
+            if (r == 0) return false;
+            if (l == r) continue;
+            if (l >= 'A' && l <= 'Z') l = static_cast<utility::char_t>(l + ('a' - 'A'));
+            if (r >= 'A' && r <= 'Z') r = static_cast<utility::char_t>(r + ('a' - 'A'));
+            if (l != r) return false;
+        }
+        return right[i] == 0;
+    }
+
+    /// <summary>
+    /// Returns the name of a well known header.
+    /// </summary>
+    _ASYNCRTIMP const utility::char_t * _known_header_name(header_ids::id id);
+
+    /// <summary>
+    /// Returns the pre-computed <c>_hash_header_name</c> of a well known header.
+    /// </summary>
+    _ASYNCRTIMP uint32_t _known_header_hash(header_ids::id id);
+
+    /// <summary>
+    /// A vector which keeps its first N elements inline, only going to the heap once it grows beyond that.
+    /// Elements are kept contiguous, so raw pointers serve as random access iterators.
+    /// </summary>
+    template<typename _Type, size_t _InlineCount>
+    class _small_vector
+    {
+    public:
+        typedef _Type value_type;
+        typedef size_t size_type;
+
+        _small_vector() : m_data(_inline_data()), m_size(0), m_capacity(_InlineCount) {}
+
+        _small_vector(const _small_vector &other) : m_data(_inline_data()), m_size(0), m_capacity(_InlineCount)
+        {
+            reserve(other.m_size);
+            for (size_type i = 0; i < other.m_size; ++i)
+            {
+                push_back(other.m_data[i]);
+            }
+        }
+
+        _small_vector(_small_vector &&other) : m_data(_inline_data()), m_size(0), m_capacity(_InlineCount)
+        {
+            _take(std::move(other));
+        }
+
+        _small_vector &operator=(const _small_vector &other)
+        {
+            if (this != &other)
+            {
+                clear();
+                reserve(other.m_size);
+                for (size_type i = 0; i < other.m_size; ++i)
+                {
+                    push_back(other.m_data[i]);
+                }
+            }
+            return *this;
+        }
+
+        _small_vector &operator=(_small_vector &&other)
+        {
+            if (this != &other)
+            {
+                clear();
+                _release_heap();
+                _take(std::move(other));
+            }
+            return *this;
+        }
+
+        ~_small_vector()
+        {
+            clear();
+            _release_heap();
+        }
+
+        _Type *begin() { return m_data; }
+        const _Type *begin() const { return m_data; }
+        _Type *end() { return m_data + m_size; }
+        const _Type *end() const { return m_data + m_size; }
+
+        _Type &operator[](size_type index) { return m_data[index]; }
+        const _Type &operator[](size_type index) const { return m_data[index]; }
+
+        _Type &back() { return m_data[m_size - 1]; }
+
+        size_type size() const { return m_size; }
+        bool empty() const { return m_size == 0; }
+
+        void push_back(const _Type &value)
+        {
+            if (m_size == m_capacity)
+            {
+                _Type copy(value); // value may live inside this vector
+                _grow(m_capacity * 2);
+                new (m_data + m_size) _Type(std::move(copy));
+            }
+            else
+            {
+                new (m_data + m_size) _Type(value);
+            }
+            ++m_size;
+        }
+
+        void push_back(_Type &&value)
+        {
+            if (m_size == m_capacity)
+            {
+                _Type moved(std::move(value));
+                _grow(m_capacity * 2);
+                new (m_data + m_size) _Type(std::move(moved));
+            }
+            else
+            {
+                new (m_data + m_size) _Type(std::move(value));
+            }
+            ++m_size;
+        }
+
+        /// <summary>
+        /// Removes the element at the given position, keeping the order of the remaining ones.
+        /// </summary>
+        void erase(size_type index)
+        {
+            // Reconstructs rather than assigns, so element types with const members can be stored.
+            for (size_type i = index + 1; i < m_size; ++i)
+            {
+                m_data[i - 1].~_Type();
+                new (m_data + i - 1) _Type(std::move(m_data[i]));
+            }
+            m_data[--m_size].~_Type();
+        }
+
+        void clear()
+        {
+            for (size_type i = 0; i < m_size; ++i)
+            {
+                m_data[i].~_Type();
+            }
+            m_size = 0;
+        }
+
+        void reserve(size_type capacity)
+        {
+            if (capacity > m_capacity)
+            {
+                _grow(capacity);
+            }
+        }
+
+    private:
+        _Type *_inline_data() { return reinterpret_cast<_Type *>(&m_inline); }
+
+        bool _is_inline() const { return m_data == reinterpret_cast<const _Type *>(&m_inline); }
+
+        void _grow(size_type capacity)
+        {
+            _Type *data = static_cast<_Type *>(::operator new(capacity * sizeof(_Type)));
+            for (size_type i = 0; i < m_size; ++i)
+            {
+                new (data + i) _Type(std::move(m_data[i]));
+                m_data[i].~_Type();
+            }
+            _release_heap();
+            m_data = data;
+            m_capacity = capacity;
+        }
+
+        void _release_heap()
+        {
+            if (!_is_inline())
+            {
+                ::operator delete(m_data);
+                m_data = _inline_data();
+                m_capacity = _InlineCount;
+            }
+        }
+
+        // Expects this to be empty and inline.
+        void _take(_small_vector &&other)
+        {
+            if (other._is_inline())
+            {
+                for (size_type i = 0; i < other.m_size; ++i)
+                {
+                    new (m_data + i) _Type(std::move(other.m_data[i]));
+                }
+                m_size = other.m_size;
+                other.clear();
+            }
+            else
+            {
+                m_data = other.m_data;
+                m_size = other.m_size;
+                m_capacity = other.m_capacity;
+                other.m_data = other._inline_data();
+                other.m_size = 0;
+                other.m_capacity = _InlineCount;
+            }
+        }
+
+        _Type *m_data;
+        size_type m_size;
+        size_type m_capacity;
+        typename std::aligned_storage<sizeof(_Type) * _InlineCount, std::alignment_of<_Type>::value>::type m_inline;
+    };
+}
+
 /// <summary>
 /// Represents HTTP headers, acts like a map.
 /// </summary>
+/// <remarks>
+/// Header fields are kept in a flat array in insertion order, together with a case folded hash of each
+/// field name. Typical messages fit in the inline storage and don't allocate for the container itself.
+/// </remarks>
 class http_headers
 {
 public:
@@ -260,19 +512,25 @@ public:
     /// <summary>
     /// STL-style typedefs
     /// </summary>
-    typedef std::map<utility::string_t, utility::string_t, _case_insensitive_cmp>::key_type key_type;
-    typedef std::map<utility::string_t, utility::string_t, _case_insensitive_cmp>::key_compare key_compare;
-    typedef std::map<utility::string_t, utility::string_t, _case_insensitive_cmp>::allocator_type allocator_type;
-    typedef std::map<utility::string_t, utility::string_t, _case_insensitive_cmp>::size_type size_type;
-    typedef std::map<utility::string_t, utility::string_t, _case_insensitive_cmp>::difference_type difference_type;
-    typedef std::map<utility::string_t, utility::string_t, _case_insensitive_cmp>::pointer pointer;
-    typedef std::map<utility::string_t, utility::string_t, _case_insensitive_cmp>::const_pointer const_pointer;
-    typedef std::map<utility::string_t, utility::string_t, _case_insensitive_cmp>::reference reference;
-    typedef std::map<utility::string_t, utility::string_t, _case_insensitive_cmp>::const_reference const_reference;
-    typedef std::map<utility::string_t, utility::string_t, _case_insensitive_cmp>::iterator iterator;
-    typedef std::map<utility::string_t, utility::string_t, _case_insensitive_cmp>::const_iterator const_iterator;
-    typedef std::map<utility::string_t, utility::string_t, _case_insensitive_cmp>::reverse_iterator reverse_iterator;
-    typedef std::map<utility::string_t, utility::string_t, _case_insensitive_cmp>::const_reverse_iterator const_reverse_iterator;
+    typedef utility::string_t key_type;
+    typedef _case_insensitive_cmp key_compare;
+    typedef std::pair<const utility::string_t, utility::string_t> value_type;
+    typedef std::allocator<value_type> allocator_type;
+    typedef size_t size_type;
+    typedef ptrdiff_t difference_type;
+    typedef value_type *pointer;
+    typedef const value_type *const_pointer;
+    typedef value_type &reference;
+    typedef const value_type &const_reference;
+    typedef value_type *iterator;
+    typedef const value_type *const_iterator;
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
+    /// <summary>
+    /// Number of header fields stored without a heap allocation.
+    /// </summary>
+    static const size_t inline_capacity = 8;
 
     /// <summary>
     /// Constructs an empty set of HTTP headers.
@@ -283,7 +541,7 @@ public:
     /// Copy constructor.
     /// </summary>
     /// <param name="other">An <c>http_headers</c> object to copy from.</param>
-    http_headers(const http_headers &other) : m_headers(other.m_headers) {}
+    http_headers(const http_headers &other) : m_headers(other.m_headers), m_hashes(other.m_hashes) {}
 
     /// <summary>
     /// Assignment operator.
@@ -294,6 +552,7 @@ public:
         if(this != &other)
         {
             m_headers = other.m_headers;
+            m_hashes = other.m_hashes;
         }
         return *this;
     }
@@ -302,7 +561,7 @@ public:
     /// Move constructor.
     /// </summary>
     /// <param name="other">An <c>http_headers</c> object to move.</param>
-    http_headers(http_headers &&other) : m_headers(std::move(other.m_headers)) {}
+    http_headers(http_headers &&other) : m_headers(std::move(other.m_headers)), m_hashes(std::move(other.m_hashes)) {}
 
     /// <summary>
     /// Move assignment operator.
@@ -313,6 +572,7 @@ public:
         if(this != &other)
         {
             m_headers = std::move(other.m_headers);
+            m_hashes = std::move(other.m_hashes);
         }
         return *this;
     }
@@ -324,7 +584,7 @@ public:
     template<typename _t1>
     void add(const key_type& name, const _t1& value)
     {
-        m_headers[name] = utility::conversions::print_string(value);
+        _field(name, details::_hash_header_name(name)) = utility::conversions::print_string(value);
     }
 
     /// <summary>
@@ -334,7 +594,7 @@ public:
     /// <param name="value">The value of the header field.</param>
     void add(const key_type& name, utility::string_t value)
     {
-        m_headers[name] = std::move(value);
+        _field(name, details::_hash_header_name(name)) = std::move(value);
     }
 
     /// <summary>
@@ -347,13 +607,53 @@ public:
         add(name, utility::string_t(value));
     }
 
+    /// <summary>
+    /// Add a well known header field.
+    /// </summary>
+    /// <param name="id">The id of the header field.</param>
+    /// <param name="value">The value of the header field.</param>
+    template<typename _t1>
+    void add(header_ids::id id, const _t1& value)
+    {
+        _field(details::_known_header_name(id), details::_known_header_hash(id)) = utility::conversions::print_string(value);
+    }
+
+    /// <summary>
+    /// Add a well known header field.
+    /// </summary>
+    /// <param name="id">The id of the header field.</param>
+    /// <param name="value">The value of the header field.</param>
+    void add(header_ids::id id, utility::string_t value)
+    {
+        _field(details::_known_header_name(id), details::_known_header_hash(id)) = std::move(value);
+    }
+
+    /// <summary>
+    /// Add a well known header field.
+    /// </summary>
+    /// <param name="id">The id of the header field.</param>
+    /// <param name="value">The value of the header field.</param>
+    void add(header_ids::id id, const utility::char_t* const value)
+    {
+        add(id, utility::string_t(value));
+    }
+
     /// <summary>
     /// Removes a header field.
     /// </summary>
     /// <param name="name">The name of the header field.</param>
     void remove(const key_type& name)
     {
-        m_headers.erase(name);
+        _erase(_index_of(name, details::_hash_header_name(name)));
+    }
+
+    /// <summary>
+    /// Removes a well known header field.
+    /// </summary>
+    /// <param name="id">The id of the header field.</param>
+    void remove(header_ids::id id)
+    {
+        _erase(_index_of(details::_known_header_name(id), details::_known_header_hash(id)));
     }
 
     /// <summary>
@@ -361,7 +661,14 @@ public:
     /// </summary>
     /// <param name="name">The name of the header field.</param>
     /// <returns>True if there is a header with the given name, false otherwise.</returns>
-    bool has(const key_type& name) const { return m_headers.find(name) != m_headers.end(); }
+    bool has(const key_type& name) const { return find(name) != end(); }
+
+    /// <summary>
+    /// Checks if there is a well known header with the given id.
+    /// </summary>
+    /// <param name="id">The id of the header field.</param>
+    /// <returns>True if there is a header with the given id, false otherwise.</returns>
+    bool has(header_ids::id id) const { return find(id) != end(); }
 
     /// <summary>
     /// Returns the number of header fields.
@@ -377,14 +684,17 @@ public:
     /// <summary>
     /// Returns a reference to header field with given name, if there is no header field one is inserted.
     /// </summary>
-    utility::string_t & operator[](const key_type &name) { return m_headers[name]; }
+    utility::string_t & operator[](const key_type &name) { return _field(name, details::_hash_header_name(name)); }
+    utility::string_t & operator[](header_ids::id id) { return _field(details::_known_header_name(id), details::_known_header_hash(id)); }
 
     /// <summary>
     /// Checks if a header field exists with given name and returns an iterator if found. Otherwise
     /// and iterator to end is returned.
     /// </summary>
-    iterator find(const key_type &name) { return m_headers.find(name); }
-    const_iterator find(const key_type &name) const { return m_headers.find(name); }
+    iterator find(const key_type &name) { return _at(_index_of(name, details::_hash_header_name(name))); }
+    const_iterator find(const key_type &name) const { return _at(_index_of(name, details::_hash_header_name(name))); }
+    iterator find(header_ids::id id) { return _at(_index_of(details::_known_header_name(id), details::_known_header_hash(id))); }
+    const_iterator find(header_ids::id id) const { return _at(_index_of(details::_known_header_name(id), details::_known_header_hash(id))); }
 
     /// <summary>
     /// Attempts to match a header field with the given name using the '>>' operator.
@@ -395,21 +705,19 @@ public:
     template<typename _t1>
     bool match(const key_type &name, _t1 &value) const
     {
-        auto iter = m_headers.find(name);
-        if (iter != m_headers.end())
-        {
-            // Check to see if doesn't have a value.
-            if(iter->second.empty())
-            {
-                http::bind(iter->second, value);
-                return true;
-            }
-            return http::bind(iter->second, value);
-        }
-        else
-        {
-            return false;
-        }
+        return _match(find(name), value);
+    }
+
+    /// <summary>
+    /// Attempts to match a well known header field using the '>>' operator.
+    /// </summary>
+    /// <param name="id">The id of the header field.</param>
+    /// <param name="value">The value of the header field.</param>
+    /// <returns>True if header field was found and successfully stored in value parameter.</returns>
+    template<typename _t1>
+    bool match(header_ids::id id, _t1 &value) const
+    {
+        return _match(find(id), value);
     }
 
     /// <summary>
@@ -474,11 +782,111 @@ public:
 
 private:
 
+    static const size_t npos = static_cast<size_t>(-1);
+
+    // The name is a utility::string_t, or the null terminated name of a well known header.
+    template<typename _Name>
+    size_t _index_of(const _Name &name, uint32_t hash) const
+    {
+        for (size_t i = 0; i < m_hashes.size(); ++i)
+        {
+            if (m_hashes[i] == hash && details::_header_name_equals(m_headers[i].first, name))
+            {
+                return i;
+            }
+        }
+        return npos;
+    }
+
+    iterator _at(size_t index) { return index == npos ? end() : begin() + index; }
+    const_iterator _at(size_t index) const { return index == npos ? end() : begin() + index; }
+
+    // Returns the value of the named field, inserting an empty one if it isn't present.
+    template<typename _Name>
+    utility::string_t &_field(const _Name &name, uint32_t hash)
+    {
+        size_t index = _index_of(name, hash);
+        if (index != npos)
+        {
+            return m_headers[index].second;
+        }
+        m_headers.push_back(value_type(utility::string_t(name), utility::string_t()));
+        m_hashes.push_back(hash);
+        return m_headers.back().second;
+    }
+
+    void _erase(size_t index)
+    {
+        if (index != npos)
+        {
+            m_headers.erase(index);
+            m_hashes.erase(index);
+        }
+    }
+
+    template<typename _t1>
+    bool _match(const_iterator iter, _t1 &value) const
+    {
+        if (iter != end())
+        {
+            // Check to see if doesn't have a value.
+            if(iter->second.empty())
+            {
+                http::bind(iter->second, value);
+                return true;
+            }
+            return http::bind(iter->second, value);
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    // Header fields in insertion order, names compared case insensitively.
+    details::_small_vector<value_type, inline_capacity> m_headers;
 
-    // Headers are stored in a map with case insensitive key.
-    std::map<utility::string_t, utility::string_t, _case_insensitive_cmp> m_headers;
+    // Case folded hash of each field name, parallel to m_headers so lookups scan a compact array.
+    details::_small_vector<uint32_t, inline_capacity> m_hashes;
 };
 
+namespace response_body_mode
+{
+    /// <summary>
+    /// Ways an http_client can consume the body of a response. Except for 'buffer', the body is read off
+    /// the network and dropped, and cannot be read from the response.
+    /// </summary>
+    enum mode
+    {
+        /// <summary>
+        /// The body is kept, to be read from the response. The default.
+        /// </summary>
+        buffer,
+
+        /// <summary>
+        /// The body is dropped.
+        /// </summary>
+        discard,
+
+        /// <summary>
+        /// The body is dropped, and its size is reported by http_response::received_body_size().
+        /// </summary>
+        count,
+
+        /// <summary>
+        /// The body is handed, block by block, to a function supplied with http_request::set_response_body_digest,
+        /// and its size is reported by http_response::received_body_size(). This is only a hook: the library
+        /// computes no digest itself, the function feeds whatever hash the caller wants.
+        /// </summary>
+        digest,
+
+        /// <summary>
+        /// The body is passed to a callback as it arrives, and the callback paces the reading.
+        /// </summary>
+        callback
+    };
+}
+
 namespace details
 {
 
@@ -540,6 +948,67 @@ public:
     /// </summary>
     _ASYNCRTIMP void _prepare_to_receive_data();
 
+    /// <summary>
+    /// Presize the buffer receiving the body to the content length, up to a limit, so the body is kept contiguous
+    /// </summary>
+    _ASYNCRTIMP void _reserve_body(size_t content_length);
+
+    /// <summary>
+    /// Set how a received body is consumed when no output stream was given
+    /// </summary>
+    void _set_body_sink(response_body_mode::mode mode, std::function<void(const unsigned char *, size_t)> digest)
+    {
+        m_body_mode = mode;
+        m_body_digest = std::move(digest);
+    }
+
+    /// <summary>
+    /// Get how a received body is consumed when no output stream was given
+    /// </summary>
+    response_body_mode::mode _body_mode() const { return m_body_mode; }
+
+    /// <summary>
+    /// Whether a received body goes to the sink set by _set_body_sink rather than to the output stream
+    /// </summary>
+    bool _has_body_sink() const { return m_body_mode != response_body_mode::buffer && !m_outStream; }
+
+    /// <summary>
+    /// Hands received body data to the sink
+    /// </summary>
+    void _sink_body(const unsigned char *data, size_t size)
+    {
+        if (m_body_mode != response_body_mode::discard)
+        {
+            m_received_body_size += size;
+            if (m_body_mode == response_body_mode::digest)
+            {
+                m_body_digest(data, size);
+            }
+        }
+    }
+
+    /// <summary>
+    /// Set the callback that receives the body in the 'callback' mode
+    /// </summary>
+    void _set_body_callback(std::function<pplx::task<void>(const unsigned char *, size_t)> callback)
+    {
+        m_body_callback = std::move(callback);
+    }
+
+    /// <summary>
+    /// Hands received body data to the callback; the data must stay valid until the returned task completes
+    /// </summary>
+    pplx::task<void> _deliver_body(const unsigned char *data, size_t size)
+    {
+        m_received_body_size += size;
+        return m_body_callback(data, size);
+    }
+
+    /// <summary>
+    /// Get the number of body bytes handed to the sink
+    /// </summary>
+    size_t _received_body_size() const { return m_received_body_size; }
+
     /// <summary>
     /// Determine the content length
     /// </summary>
@@ -580,6 +1049,14 @@ protected:
     pplx::task_completion_event<size_t> m_data_available;
 
     http_headers m_headers;
+
+    /// <summary>
+    /// How a received body is consumed when there is no output stream, and what the sink has seen so far.
+    /// </summary>
+    response_body_mode::mode m_body_mode;
+    std::function<void(const unsigned char *, size_t)> m_body_digest;
+    std::function<pplx::task<void>(const unsigned char *, size_t)> m_body_callback;
+    size_t m_received_body_size;
 };
 
 /// <summary>
@@ -872,6 +1349,12 @@ public:
         return pplx::create_task(impl->_get_data_available()).then([impl](size_t) -> http_response { return http_response(impl); });
     }
 
+    /// <summary>
+    /// Gets the size of the body received for a request whose response body mode is 'count', 'digest' or 'callback'.
+    /// </summary>
+    /// <returns>The number of body bytes received so far; the final size once content_ready() has completed.</returns>
+    size_t received_body_size() const { return _m_impl->_received_body_size(); }
+
     /// <summary>
     /// Gets the error code of the response. This is used for errors other than HTTP status codes.
     /// </summary>
@@ -890,6 +1373,7 @@ public:
     void _set_server_context(std::shared_ptr<http::details::_http_server_context> server_context) { _m_impl->_set_server_context(std::move(server_context)); }
 
 private:
+    friend class http::client::details::request_context;
 
     http_response(std::shared_ptr<http::details::_http_response> impl)
         : _m_impl(impl)
@@ -902,6 +1386,31 @@ private:
 
 #pragma endregion
 
+namespace request_priority
+{
+    /// <summary>
+    /// Priority classes of client requests. When an http_client holds requests back, because it has
+    /// reached its connection limit, higher priority requests are sent first.
+    /// </summary>
+    enum level
+    {
+        /// <summary>
+        /// Bulk work nobody is waiting on.
+        /// </summary>
+        background,
+
+        /// <summary>
+        /// The default priority.
+        /// </summary>
+        normal,
+
+        /// <summary>
+        /// Requests a user is waiting on.
+        /// </summary>
+        interactive
+    };
+}
+
 namespace details {
 /// <summary>
 /// Internal representation of an HTTP request message.
@@ -913,7 +1422,7 @@ public:
     _ASYNCRTIMP _http_request();
 
     _http_request(const http::method& mtd)
-        :  m_method(mtd), m_initiated_response(0), m_server_context(), m_listener_path(U(""))
+        :  m_method(mtd), m_initiated_response(0), m_server_context(), m_listener_path(U("")), m_priority(request_priority::normal), m_response_body_mode(http::response_body_mode::buffer)
     {
         if(mtd.empty())
         {
@@ -957,6 +1466,39 @@ public:
 
     void _set_listener_path(const utility::string_t &path) { m_listener_path = path; }
 
+    request_priority::level priority() const { return m_priority; }
+
+    void set_priority(request_priority::level priority) { m_priority = priority; }
+
+    http::response_body_mode::mode response_body_mode() const { return m_response_body_mode; }
+
+    const std::function<void(const unsigned char *, size_t)> &response_body_digest() const { return m_response_body_digest; }
+
+    void set_response_body_sink(http::response_body_mode::mode mode, std::function<void(const unsigned char *, size_t)> digest)
+    {
+        if (mode == http::response_body_mode::callback)
+        {
+            throw std::invalid_argument("The callback response body mode is set with set_response_body_callback.");
+        }
+        if (mode == http::response_body_mode::digest && !digest)
+        {
+            throw std::invalid_argument("The digest response body mode needs a digest function.");
+        }
+        m_response_body_mode = mode;
+        m_response_body_digest = std::move(digest);
+    }
+
+    const std::function<pplx::task<void>(const unsigned char *, size_t)> &response_body_callback() const { return m_response_body_callback; }
+
+    void set_response_body_callback(std::function<pplx::task<void>(const unsigned char *, size_t)> callback)
+    {
+        if (!callback)
+        {
+            throw std::invalid_argument("The callback response body mode needs a callback.");
+        }
+        m_response_body_mode = http::response_body_mode::callback;
+        m_response_body_callback = std::move(callback);
+    }
 
 private:
 
@@ -975,6 +1517,12 @@ private:
     concurrency::streams::ostream m_response_stream;
 
     pplx::task_completion_event<http_response> m_response;
+
+    request_priority::level m_priority;
+
+    http::response_body_mode::mode m_response_body_mode;
+    std::function<void(const unsigned char *, size_t)> m_response_body_digest;
+    std::function<pplx::task<void>(const unsigned char *, size_t)> m_response_body_callback;
 };
 
 
@@ -1045,6 +1593,64 @@ public:
     /// <param name="uri">The uri for this message.</param>
     void set_request_uri(const uri& uri) { return _m_impl->set_request_uri(uri); }
 
+    /// <summary>
+    /// Get the priority of the request.
+    /// </summary>
+    /// <returns>The priority class of this request.</returns>
+    request_priority::level priority() const { return _m_impl->priority(); }
+
+    /// <summary>
+    /// Set the priority of the request. It only matters when the http_client holds requests back
+    /// because it has reached its connection limit.
+    /// </summary>
+    /// <param name="priority">The priority class of this request.</param>
+    void set_priority(request_priority::level priority) { _m_impl->set_priority(priority); }
+
+    /// <summary>
+    /// Get how the body of the response to this request is consumed.
+    /// </summary>
+    /// <returns>The response body mode.</returns>
+    http::response_body_mode::mode response_body_mode() const { return _m_impl->response_body_mode(); }
+
+    /// <summary>
+    /// Set how the body of the response to this request is consumed. In the 'discard' and 'count' modes
+    /// the body is drained from the network without being stored. Ignored if a response stream is set.
+    /// Currently only applied on Linux; on other platforms the body is always stored.
+    /// </summary>
+    /// <param name="mode">The response body mode. 'digest' and 'callback' need a function, and are set with
+    /// set_response_body_digest and set_response_body_callback; passing them here throws std::invalid_argument.</param>
+    void set_response_body_mode(http::response_body_mode::mode mode) { _m_impl->set_response_body_sink(mode, nullptr); }
+
+    /// <summary>
+    /// Have the body of the response to this request drained from the network and passed, block by
+    /// block, to a digest function instead of being stored. Ignored if a response stream is set.
+    /// Currently only applied on Linux; on other platforms the body is stored and the function is never called.
+    /// </summary>
+    /// <param name="update">Called with each block of body data as it arrives, in order. It must not block.
+    /// An empty function throws std::invalid_argument.</param>
+    void set_response_body_digest(std::function<void(const unsigned char *, size_t)> update)
+    {
+        _m_impl->set_response_body_sink(http::response_body_mode::digest, std::move(update));
+    }
+
+    /// <summary>
+    /// Have the body of the response to this request handed to a callback, block by block, as soon as
+    /// each block arrives from the network, instead of being stored. Ignored if a response stream is set.
+    /// </summary>
+    /// <param name="on_block">Called with each contiguous block of body data, in order. The data stays valid,
+    /// and no further data is read, until the returned task completes; a faulted task fails the response.
+    /// An empty function throws std::invalid_argument.</param>
+    /// <remarks>
+    /// The response to the request is delivered once its headers arrive, before the callback has seen the body;
+    /// http_response::content_ready() completes after the last block has been handed over.
+    /// Currently only supported on Linux. On other platforms the callback is never called, and the body is
+    /// stored in the response as if no callback had been set.
+    /// </remarks>
+    void set_response_body_callback(std::function<pplx::task<void>(const unsigned char *, size_t)> on_block)
+    {
+        _m_impl->set_response_body_callback(std::move(on_block));
+    }
+
     /// <summary>
     /// Gets a reference the URI path, query, and fragment part of this request message.
     /// This will be appended to the base URI specified at construction of the http_client.
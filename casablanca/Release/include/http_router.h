@@ -0,0 +1,171 @@
+/***
+* ==++==
+*
+* Copyright (c) Microsoft Corporation. All rights reserved.
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* ==--==
+* =+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+
+*
+* http_router.h
+*
+* HTTP Library: request routing for http_listener, on a radix tree of path patterns
+*
+* =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+****/
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "http_msg.h"
+
+namespace web { namespace http
+{
+namespace listener
+{
+
+/// <summary>
+/// The path parameters captured by a route of an http_router.
+/// </summary>
+/// <remarks>
+/// The parameters point into the path of the request being dispatched and are only valid for the duration
+/// of the handler call.
+/// </remarks>
+class route_params
+{
+public:
+    /// <summary>
+    /// The most parameters a route can have.
+    /// </summary>
+    static const size_t max_params = 16;
+
+    route_params() : m_names(nullptr), m_count(0) { }
+
+    /// <summary>
+    /// Gets the number of parameters captured.
+    /// </summary>
+    size_t size() const { return m_count; }
+
+    /// <summary>
+    /// Checks if a parameter of the given name was captured.
+    /// </summary>
+    _ASYNCRTIMP bool has(const utility::string_t &name) const;
+
+    /// <summary>
+    /// Gets the decoded value of a parameter.
+    /// </summary>
+    /// <param name="name">The parameter name, as written between braces in the route pattern.</param>
+    /// <returns>The value, or an empty string if the route has no such parameter.</returns>
+    _ASYNCRTIMP utility::string_t get(const utility::string_t &name) const;
+
+    /// <summary>
+    /// Gets the value of a parameter as it appears in the request path, still percent-encoded.
+    /// </summary>
+    _ASYNCRTIMP utility::string_t raw(const utility::string_t &name) const;
+
+private:
+    friend class http_router;
+
+    bool find(const utility::string_t &name, size_t &index) const;
+
+    const std::vector<utility::string_t> *m_names;
+    const utility::char_t *m_values[max_params];
+    size_t m_lengths[max_params];
+    size_t m_count;
+};
+
+/// <summary>
+/// Routes requests to handlers by method and path pattern.
+/// </summary>
+/// <remarks>
+/// A pattern is a path made of literal segments, <c>{name}</c> segments that match any one segment, and an optional
+/// final <c>{*name}</c> segment that matches the rest of the path. Patterns are stored in a radix tree and matched
+/// against the percent-encoded request path without decoding it or allocating. Where several patterns match, literal
+/// segments are preferred over parameters, and parameters over the rest of the path.
+/// Routes must all be added before the router is used to dispatch requests.
+/// </remarks>
+class http_router
+{
+public:
+    typedef std::function<void(http_request, const route_params &)> handler;
+
+    _ASYNCRTIMP http_router();
+    _ASYNCRTIMP ~http_router();
+
+    /// <summary>
+    /// Move constructor.
+    /// </summary>
+    _ASYNCRTIMP http_router(http_router &&other);
+
+    /// <summary>
+    /// Move assignment operator.
+    /// </summary>
+    _ASYNCRTIMP http_router &operator=(http_router &&other);
+
+    /// <summary>
+    /// Adds a route for one method.
+    /// </summary>
+    /// <param name="method">The HTTP method the route handles.</param>
+    /// <param name="pattern">The path pattern, starting with '/'.</param>
+    /// <param name="route_handler">Function object called for requests matching the route.</param>
+    /// <returns>A reference to this http_router to enable chaining.</returns>
+    _ASYNCRTIMP http_router &add(const http::method &method, const utility::string_t &pattern, handler route_handler);
+
+    /// <summary>
+    /// Adds a route for a set of methods, all handled by the same function object.
+    /// </summary>
+    /// <param name="methods">The HTTP methods the route handles.</param>
+    /// <param name="pattern">The path pattern, starting with '/'.</param>
+    /// <param name="route_handler">Function object called for requests matching the route.</param>
+    /// <returns>A reference to this http_router to enable chaining.</returns>
+    _ASYNCRTIMP http_router &add(const std::vector<http::method> &methods, const utility::string_t &pattern, handler route_handler);
+
+    /// <summary>
+    /// Checks if the router has no routes.
+    /// </summary>
+    bool empty() const { return m_routes == 0; }
+
+    /// <summary>
+    /// Finds the handler of the route matching a method and path.
+    /// </summary>
+    /// <param name="method">The request method.</param>
+    /// <param name="path">The percent-encoded request path.</param>
+    /// <param name="length">The length of the path.</param>
+    /// <param name="params">Receives the parameters captured by the route.</param>
+    /// <returns>The handler, or nullptr if no route matches.</returns>
+    _ASYNCRTIMP const handler *find(const http::method &method, const utility::char_t *path, size_t length, route_params &params) const;
+
+    /// <summary>
+    /// Dispatches a request to the route matching its method and path. A path that matches a route but not any of its
+    /// methods is answered with 405 (Method Not Allowed) and the route's methods.
+    /// </summary>
+    /// <param name="request">The request.</param>
+    /// <param name="path">The percent-encoded request path the routes are matched against.</param>
+    /// <param name="length">The length of the path.</param>
+    /// <returns>True if the request was dispatched or answered, false if no route matches its path.</returns>
+    _ASYNCRTIMP bool dispatch(http_request request, const utility::char_t *path, size_t length) const;
+
+private:
+    struct node;
+
+    std::unique_ptr<node> m_root;
+    size_t m_routes;
+
+    // No copy or assignment.
+    http_router(const http_router &);
+    http_router &operator=(const http_router &);
+};
+
+} // namespace listener
+}} // namespace web::http
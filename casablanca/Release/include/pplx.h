@@ -59,6 +59,14 @@ _PPLXIMP void __cdecl set_ambient_scheduler(std::shared_ptr< ::pplx::scheduler>
 /// </summary>
 _PPLXIMP std::shared_ptr< ::pplx::scheduler> __cdecl get_ambient_scheduler();
 
+/// <summary>
+/// Sets the scheduler used by the PPL constructs created on the calling thread, in place of the ambient scheduler.
+/// Continuations run on the scheduler of the task they continue, so work started on the thread stays on its scheduler.
+/// </summary>
+/// <param name="_Scheduler">The scheduler for the calling thread, or nullptr to go back to the ambient scheduler.
+/// A thread that sets a scheduler should reset it to nullptr before it exits.</param>
+_PPLXIMP void __cdecl set_thread_scheduler(std::shared_ptr< ::pplx::scheduler> _Scheduler);
+
 /// <summary>
 ///     Describes the execution status of a <c>task_group</c> or <c>structured_task_group</c> object.  A value of this type is returned
 ///     by numerous methods that wait on tasks scheduled to a task group to complete.
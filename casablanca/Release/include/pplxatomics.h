@@ -58,6 +58,12 @@ namespace pplx
 typedef std::atomic<long> atomic_long;
 typedef std::atomic<size_t> atomic_size_t;
 
+template<typename _T>
+struct atomic_pointer
+{
+    typedef std::atomic<_T *> type;
+};
+
 template<typename _T>
 _T atomic_compare_exchange(std::atomic<_T>& _Target, _T _Exchange, _T _Comparand)
 {
@@ -95,12 +101,24 @@ _T atomic_add(std::atomic<_T>& _Target, _T value)
 typedef long volatile atomic_long;
 typedef size_t volatile atomic_size_t;
 
+template<typename _T>
+struct atomic_pointer
+{
+    typedef _T * volatile type;
+};
+
 template<class T>
 inline T atomic_exchange(T volatile& _Target, T _Value)
 {
     return _InterlockedExchange(&_Target, _Value);
 }
 
+template<class T>
+inline T * atomic_exchange(T * volatile& _Target, T * _Value)
+{
+    return static_cast<T *>(_InterlockedExchangePointer(reinterpret_cast<void * volatile *>(&_Target), _Value));
+}
+
 inline long atomic_increment(long volatile & _Target)
 {
     return _InterlockedIncrement(&_Target);
@@ -148,6 +166,12 @@ inline size_t atomic_compare_exchange(size_t volatile & _Target, size_t _Exchang
     return static_cast<size_t>(_InterlockedCompareExchange64(reinterpret_cast<__int64 volatile *>(_Target), static_cast<__int64>(_Exchange), static_cast<__int64>(_Comparand)));
 #endif
 }
+
+template<class T>
+inline T * atomic_compare_exchange(T * volatile& _Target, T * _Exchange, T * _Comparand)
+{
+    return static_cast<T *>(_InterlockedCompareExchangePointer(reinterpret_cast<void * volatile *>(&_Target), _Exchange, _Comparand));
+}
 #endif // _USE_REAL_ATOMICS
 
 } // namespace pplx
@@ -255,6 +255,39 @@ namespace details
         _PPLXIMP virtual void schedule( TaskProc proc, _In_ void* param);
     };
 
+    struct work_stealing_state;
+
+    /// <summary>
+    /// Scheduler that runs chores on its own pool of worker threads. Each worker has a deque of chores: chores
+    /// scheduled from a worker go to the bottom of its deque, and the worker takes its newest chore first.
+    /// Idle workers steal the oldest chore of a worker picked at random. Chores scheduled from other threads
+    /// go to a shared lock-free stack, which a worker empties into its own deque.
+    /// </summary>
+    class work_stealing_scheduler : public pplx::scheduler
+    {
+    public:
+        /// <summary>
+        /// Creates the scheduler and starts its workers.
+        /// </summary>
+        /// <param name="threads">The number of workers; 0 for one per hardware thread, and at least four, as chores may block.</param>
+        _PPLXIMP work_stealing_scheduler(size_t threads = 0);
+
+        /// <summary>
+        /// Stops the workers once they have run the chores already scheduled, and joins them; a chore still running
+        /// is waited for. Destroyed from one of its own chores, the scheduler joins the other workers, and the
+        /// calling one exits when the chore returns.
+        /// </summary>
+        _PPLXIMP ~work_stealing_scheduler();
+
+        _PPLXIMP virtual void schedule( TaskProc proc, _In_ void* param);
+
+    private:
+        std::unique_ptr<work_stealing_state> m_state;
+
+        work_stealing_scheduler(const work_stealing_scheduler&);
+        work_stealing_scheduler& operator=(const work_stealing_scheduler&);
+    };
+
 } // namespace details
 
 /// <summary>
@@ -313,9 +346,10 @@ typedef scoped_lock<pplx::reader_writer_lock> scoped_rw_lock;
 typedef pplx::reader_writer_lock::scoped_lock_read scoped_read_lock;
 
 /// <summary>
-/// Default scheduler type
+/// Default scheduler type. details::linux_scheduler, which runs chores on the shared thread pool, can be put in
+/// place instead with set_ambient_scheduler.
 /// </summary>
-typedef details::linux_scheduler default_scheduler_t;
+typedef details::work_stealing_scheduler default_scheduler_t;
 
 /// <summary>
 /// Terminate the process due to unhandled exception
@@ -75,6 +75,7 @@ namespace Concurrency { namespace streams {
             basic_producer_consumer_buffer(size_t alloc_size) 
                 : streambuf_state_manager<_CharType>(std::ios_base::out | std::ios_base::in),
                 m_alloc_size(alloc_size),
+                m_reserved(0),
                 m_allocBlock(nullptr),
                 m_total(0), m_total_read(0), m_total_written(0),
                 m_synced(0)
@@ -155,7 +156,7 @@ namespace Concurrency { namespace streams {
                 // easier book keeping
 
                 _PPLX_ASSERT(!m_allocBlock);
-                m_allocBlock = std::make_shared<_block>(count);
+                m_allocBlock = std::make_shared<_block>(count, true);
                 return m_allocBlock->wbegin();
             }
 
@@ -213,6 +214,42 @@ namespace Concurrency { namespace streams {
                 update_read_head(count);
             }
 
+            /// <summary>
+            /// Sizes the next block allocated by a write to hold at least count characters, so that data
+            /// of a known length is kept contiguous.
+            /// </summary>
+            /// <param name="count">The number of characters expected to be written.</param>
+            void reserve(size_t count)
+            {
+                pplx::scoped_critical_section l(m_lock);
+                m_reserved = count;
+            }
+
+            /// <summary>
+            /// Moves the unread data out of the buffer without copying it, if the write head is closed
+            /// and the data is held in a single block.
+            /// </summary>
+            /// <param name="data">Receives the data.</param>
+            /// <returns><c>true</c> if the data was moved out and the buffer is now empty, <c>false</c> otherwise.</returns>
+            bool try_take(std::vector<_CharType> &data)
+            {
+                pplx::scoped_critical_section l(m_lock);
+
+                if (this->can_write() || m_blocks.size() != 1 || m_blocks.front()->m_read != 0 || m_blocks.front()->m_raw)
+                {
+                    return false;
+                }
+
+                auto block = m_blocks.front();
+                const size_t count = block->rd_chars_left();
+                data = std::move(block->m_storage);
+                block->m_data = nullptr;
+                block->m_size = block->m_pos = block->m_read = 0;
+
+                update_read_head(count);
+                return true;
+            }
+
         protected:        
 
             virtual pplx::task<bool> _sync()
@@ -358,8 +395,9 @@ namespace Concurrency { namespace streams {
                 // Allocate a new block if necessary
                 if ( m_blocks.empty() || m_blocks.back()->wr_chars_left() < count )
                 {
-                    SafeSize alloc = m_alloc_size.Max(count);
-                    m_blocks.push_back(std::make_shared<_block>((size_t)alloc));
+                    SafeSize alloc = m_alloc_size.Max(count).Max(m_reserved);
+                    m_blocks.push_back(std::make_shared<_block>((size_t)alloc, false));
+                    m_reserved = 0;
                 }
 
                 // The block at the back is always the write head
@@ -399,14 +437,23 @@ namespace Concurrency { namespace streams {
             class _block
             {
             public:
-                _block(size_t size)
-                    : m_read(0), m_pos(0), m_size(size), m_data(new _CharType[size]) 
-                {
-                }
-
-                ~_block()
+                // A block filled through write() keeps its data in a vector, so that try_take can move it
+                // out. The vector is reserved rather than sized, and write() appends to it, so the block is
+                // never zero filled first. A block handed out by alloc() is written to directly, and uses
+                // a plain array instead.
+                _block(size_t size, bool written_directly)
+                    : m_read(0), m_pos(0), m_size(size), m_data(nullptr)
                 {
-                    delete [] m_data;
+                    if (written_directly)
+                    {
+                        m_raw.reset(new _CharType[size]);
+                        m_data = m_raw.get();
+                    }
+                    else
+                    {
+                        m_storage.reserve(size);
+                        m_data = m_storage.data();
+                    }
                 }
 
                 // Read head
@@ -418,7 +465,10 @@ namespace Concurrency { namespace streams {
                 // Allocation size (of m_data)
                 size_t m_size;
 
-                // The data store
+                // The data store: m_storage holds the characters written so far, within a capacity of
+                // m_size, unless the block was handed out by alloc(), in which case m_raw holds them.
+                std::vector<_CharType> m_storage;
+                std::unique_ptr<_CharType[]> m_raw;
                 _CharType * m_data;
 
                 // Pointer to the read head
@@ -465,12 +515,20 @@ namespace Concurrency { namespace streams {
 
                     const _CharType * srcEnd = src + countWritten;
 
+                    if (!m_raw)
+                    {
+                        // Stays within the reserved capacity, so m_data remains valid.
+                        m_storage.insert(m_storage.end(), src, srcEnd);
+                    }
+                    else
+                    {
 #ifdef _MS_WINDOWS
-                    // Avoid warning C4996: Use checked iterators under SECURE_SCL
-                    std::copy(src, srcEnd, stdext::checked_array_iterator<_CharType *>(wbegin(), static_cast<size_t>(avail)));
+                        // Avoid warning C4996: Use checked iterators under SECURE_SCL
+                        std::copy(src, srcEnd, stdext::checked_array_iterator<_CharType *>(wbegin(), static_cast<size_t>(avail)));
 #else
-                    std::copy(src, srcEnd, wbegin());
+                        std::copy(src, srcEnd, wbegin());
 #endif // _MS_WINDOWS
+                    }
 
                     update_write_head(countWritten);
                     return countWritten;
@@ -627,6 +685,9 @@ namespace Concurrency { namespace streams {
             // Default block size
             SafeSize m_alloc_size;
 
+            // Minimum size of the next block allocated by a write, set by reserve
+            size_t m_reserved;
+
             // The producer-consumer buffer is intended to be used concurrently by a reader
             // and a writer, who are not coordinating their accesses to the buffer (coordination
             // being what the buffer is for in the first place). Thus, we have to protect
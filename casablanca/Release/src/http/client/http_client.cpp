@@ -24,6 +24,14 @@
 ****/
 #include "stdafx.h"
 #include "http_helpers.h"
+#include "http_access_log.h"
+#include "filestream.h"
+#if !defined(_MS_WINDOWS) || (_MSC_VER >= 1700)
+#include <chrono>
+#endif
+#include <cmath>
+#include <deque>
+#include <random>
 
 #ifdef _MS_WINDOWS
 #if !defined(__cplusplus_winrt)
@@ -45,6 +53,10 @@ using namespace concurrency;
 #include <boost/asio.hpp>
 #include <boost/bind.hpp>
 #include <threadpool.h>
+#include "http2_helpers.h"
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <cerrno>
 #endif
 
 #ifdef _MS_WINDOWS
@@ -117,8 +129,201 @@ static void parse_headers_string(_Inout_z_ utf16char *headersStr, http_headers &
 
 class _http_client_communicator;
 
+// A process-wide free list of memory blocks of one size. Objects allocated for every request take
+// their memory from it, and give it back, instead of going to the heap each time.
+template<size_t Size>
+class _block_free_list
+{
+public:
+
+    static void *allocate()
+    {
+        {
+            auto &free_list = instance();
+            pplx::scoped_critical_section l(free_list.m_lock);
+            if (!free_list.m_blocks.empty())
+            {
+                void *block = free_list.m_blocks.back();
+                free_list.m_blocks.pop_back();
+                return block;
+            }
+        }
+        return ::operator new(Size);
+    }
+
+    static void deallocate(void *block)
+    {
+        {
+            auto &free_list = instance();
+            pplx::scoped_critical_section l(free_list.m_lock);
+            if (free_list.m_blocks.size() < max_free_blocks)
+            {
+                free_list.m_blocks.push_back(block);
+                return;
+            }
+        }
+        ::operator delete(block);
+    }
+
+private:
+
+    // Enough to cover the requests in flight on a busy client without holding on to a burst forever.
+    static const size_t max_free_blocks = 1024;
+
+    struct state
+    {
+        pplx::critical_section m_lock;
+        std::vector<void *> m_blocks;
+    };
+
+    // Created by the first thread to need it and published with a compare and exchange; function-local
+    // statics are not initialized thread-safely by every compiler the library supports. A thread that
+    // loses the race drops its own. Never destroyed, so that objects released during static destruction
+    // still find it.
+    static typename pplx::atomic_pointer<state>::type s_state;
+
+    static state &instance()
+    {
+        state *current = s_state;
+        if (current == nullptr)
+        {
+            state *created = new state();
+            current = pplx::atomic_compare_exchange(s_state, created, static_cast<state *>(nullptr));
+            if (current == nullptr)
+            {
+                current = created;
+            }
+            else
+            {
+                delete created;
+            }
+        }
+        return *current;
+    }
+};
+
+// Zero initialized before any code runs.
+template<size_t Size>
+typename pplx::atomic_pointer<typename _block_free_list<Size>::state>::type _block_free_list<Size>::s_state;
+
+// Allocator taking single objects from a _block_free_list; used with std::allocate_shared so that the
+// object and its control block are recycled together.
+template<typename T>
+class _recycling_allocator
+{
+public:
+    typedef T value_type;
+
+    _recycling_allocator() {}
+
+    template<typename U>
+    _recycling_allocator(const _recycling_allocator<U> &) {}
+
+    T *allocate(size_t n)
+    {
+        return static_cast<T *>(n == 1 ? _block_free_list<sizeof(T)>::allocate() : ::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T *p, size_t n)
+    {
+        if (n == 1)
+        {
+            _block_free_list<sizeof(T)>::deallocate(p);
+        }
+        else
+        {
+            ::operator delete(p);
+        }
+    }
+
+    template<typename U>
+    bool operator==(const _recycling_allocator<U> &) const { return true; }
+
+    template<typename U>
+    bool operator!=(const _recycling_allocator<U> &) const { return false; }
+};
+
+// Intrusive multi-producer, single-consumer queue used to hold requests when the client
+// guarantees ordering. Producers only ever perform a single atomic exchange, and the consumer
+// never takes a lock. The algorithm is the one described by Dmitry Vyukov: the queue always
+// contains a stub node, so push and pop never contend on the same pointer.
+class _ordered_request_queue
+{
+public:
+
+    struct node
+    {
+        node() : m_next_queued(nullptr) {}
+
+        pplx::atomic_pointer<node>::type m_next_queued;
+    };
+
+    _ordered_request_queue() : m_head(&m_stub), m_tail(&m_stub)
+    {
+    }
+
+    // May be called concurrently from any number of threads.
+    void push(node *item)
+    {
+        item->m_next_queued = nullptr;
+        node *prev = pplx::atomic_exchange(m_head, item);
+        prev->m_next_queued = item;
+    }
+
+    // Must only be called by one thread at a time. Returns nullptr if the queue is empty, or if
+    // a producer is part-way through linking in the next node.
+    node *pop()
+    {
+        node *tail = m_tail;
+        node *next = tail->m_next_queued;
+
+        if (tail == &m_stub)
+        {
+            if (next == nullptr)
+            {
+                return nullptr;
+            }
+            m_tail = next;
+            tail = next;
+            next = next->m_next_queued;
+        }
+
+        if (next != nullptr)
+        {
+            m_tail = next;
+            return tail;
+        }
+
+        node *head = m_head;
+        if (tail != head)
+        {
+            return nullptr;
+        }
+
+        // The tail is the last node; put the stub back behind it so it can be handed out.
+        push(&m_stub);
+
+        next = tail->m_next_queued;
+        if (next != nullptr)
+        {
+            m_tail = next;
+            return tail;
+        }
+        return nullptr;
+    }
+
+private:
+
+    _ordered_request_queue(const _ordered_request_queue &);
+    _ordered_request_queue &operator=(const _ordered_request_queue &);
+
+    node m_stub;
+    pplx::atomic_pointer<node>::type m_head;
+    node *m_tail;
+};
+
 // Request context encapsulating everything necessary for creating and responding to a request.
-class request_context
+class request_context : public _ordered_request_queue::node
 {
 public:
 
@@ -134,11 +339,18 @@ public:
         m_request.set_body(Concurrency::streams::istream());
 
         m_received_hdrs = true;
+        m_headers_time = utility::details::steady_clock_microseconds();
         m_response.set_error_code(error_code);
 
         if(m_response.error_code() == 0)
         {
-        m_request_completion.set(m_response);
+            // Have a body of known length land in one block, which extract_vector() can then move out.
+            size_t content_length = 0;
+            if (m_request.method() != methods::HEAD && m_response.headers().match(header_ids::content_length, content_length))
+            {
+                m_response._get_impl()->_reserve_body(content_length);
+            }
+            m_request_completion.set(m_response);
         }
 #ifdef _MS_WINDOWS
         else
@@ -161,6 +373,14 @@ public:
         m_response.set_error_code(0);
         m_response._get_impl()->_complete(body_size);
 
+#if !defined(_MS_WINDOWS) || (_MSC_VER >= 1700)
+        if (access_log::enabled())
+        {
+            access_log::record(access_log_source::client, m_request, m_response.status_code(), m_headers_time - m_start_time,
+                utility::details::steady_clock_microseconds() - m_start_time, m_request_size, body_size, access_log_failure::none);
+        }
+#endif
+
         finish();
 
         delete this;
@@ -208,6 +428,15 @@ public:
             m_response._get_impl()->_complete(0);
         }
 
+#if !defined(_MS_WINDOWS) || (_MSC_VER >= 1700)
+        if (access_log::enabled())
+        {
+            const uint64_t total_time = utility::details::steady_clock_microseconds() - m_start_time;
+            access_log::record(access_log_source::client, m_request, m_received_hdrs ? m_response.status_code() : 0,
+                m_received_hdrs ? m_headers_time - m_start_time : total_time, total_time, m_request_size, 0, access_log_failure::error);
+        }
+#endif
+
         finish();
 
         delete this;
@@ -233,6 +462,54 @@ public:
         return outstream.streambuf();
     }
 
+    // True if the response body goes to the sink chosen by the request instead of a stream.
+    bool _has_body_sink() const
+    {
+        return m_response._get_impl()->_has_body_sink();
+    }
+
+    // Hands received body data to the sink; false if the digest function threw.
+    bool _sink_body(const uint8_t *data, size_t size)
+    {
+        try
+        {
+            m_response._get_impl()->_sink_body(data, size);
+            return true;
+        }
+        catch (...)
+        {
+            return false;
+        }
+    }
+
+    // True if the response body is handed to a callback that paces the reading.
+    bool _has_body_callback() const
+    {
+        return _has_body_sink() && m_response._get_impl()->_body_mode() == response_body_mode::callback;
+    }
+
+    // Hands received body data to the callback. The data must stay valid until the task completes.
+    pplx::task<void> _deliver_body(const uint8_t *data, size_t size)
+    {
+        try
+        {
+            return m_response._get_impl()->_deliver_body(data, size);
+        }
+        catch (...)
+        {
+            return pplx::task_from_exception<void>(std::current_exception());
+        }
+    }
+
+    // Closes the response stream, if the body is being written to one.
+    void _close_writebuffer()
+    {
+        if (!_has_body_sink())
+        {
+            _get_writebuffer().close(std::ios_base::out).get();
+        }
+    }
+
     // request/response pair.
     http_request m_request;
     http_response m_response;
@@ -241,6 +518,12 @@ public:
 
     bool m_received_hdrs;
 
+    // For the access log: when the request started and its response headers arrived, in
+    // utility::details::steady_clock_microseconds, and the size of its body.
+    uint64_t m_start_time;
+    uint64_t m_headers_time;
+    size_t m_request_size;
+
     // task completion event to signal request is completed.
     pplx::task_completion_event<http_response> m_request_completion;
 
@@ -254,12 +537,19 @@ protected:
     }
 
     request_context(std::shared_ptr<_http_client_communicator> client, http_request &request)
-        : m_http_client(client), m_request(request), m_total_response_size(0), m_received_hdrs(false)
+        : m_http_client(client), m_request(request),
+          m_response(std::allocate_shared<http::details::_http_response>(_recycling_allocator<http::details::_http_response>())),
+          m_total_response_size(0), m_received_hdrs(false),
+          m_start_time(utility::details::steady_clock_microseconds()), m_headers_time(m_start_time), m_request_size(0)
     {
+        request.headers().match(header_names::content_length, m_request_size);
+
         auto responseImpl = m_response._get_impl();
 
         // Copy the user specified output stream over to the response
         responseImpl->set_outstream(request._get_impl()->_response_stream());
+        responseImpl->_set_body_sink(request._get_impl()->response_body_mode(), request._get_impl()->response_body_digest());
+        responseImpl->_set_body_callback(request._get_impl()->response_body_callback());
 
         // Prepare for receiving data from the network. Ideally, this should be done after
         // we receive the headers and determine that there is a response body. We will do it here
@@ -274,13 +564,23 @@ protected:
 // Interface used by client implementations. Concrete implementations are responsible for
 // sending HTTP requests and receiving the responses.
 //
-class _http_client_communicator
+class _http_client_communicator : public std::enable_shared_from_this<_http_client_communicator>
 {
 public:
 
     // Destructor to clean up any held resources.
     virtual ~_http_client_communicator() {}
 
+    // Establishes up to the given number of connections ahead of traffic, to be used by the next
+    // requests. Implementations without a connection pool have nothing to do.
+    virtual pplx::task<void> prewarm(size_t connections)
+    {
+        UNREFERENCED_PARAMETER(connections);
+        pplx::task_completion_event<void> done;
+        done.set();
+        return pplx::create_task(done);
+    }
+
     // Asychronously send a HTTP request and process the response.
     void async_send_request(request_context *request)
     {
@@ -289,32 +589,26 @@ public:
             // Send to call block to be processed.
             push_request(request);
         }
-        else
+        else if(m_client_config.max_connections() == 0 || acquire_connection(request))
         {
-            // Schedule a task to start sending.
-            pplx::create_task([this, request]
-            {
-                open_and_send_request(request);
-            });
+            schedule_send(request);
         }
     }
 
     void finish_request()
     {
-        pplx::scoped_critical_section l(m_open_lock);
-
-        --m_scheduled;
-
-        if( !m_requests_queue.empty())
+        if(m_client_config.guarantee_order())
         {
-            request_context *request = m_requests_queue.front();
-            m_requests_queue.pop();
-
-            // Schedule a task to start sending.
-            pplx::create_task([this, request]
+            // If more requests arrived while this one was in flight, the next one is sent
+            // right away on this thread.
+            if (pplx::atomic_decrement(m_scheduled) > 0)
             {
-                open_and_send_request(request);
-            });
+                drain_requests();
+            }
+        }
+        else if(m_client_config.max_connections() != 0)
+        {
+            release_connection();
         }
     }
 
@@ -325,7 +619,7 @@ public:
 
 protected:
     _http_client_communicator(const http::uri &address, const http_client_config& client_config)
-        : m_uri(address), m_client_config(client_config), m_opened(false), m_scheduled(0)
+        : m_uri(address), m_client_config(client_config), m_opened(false), m_scheduled(0), m_pending_sends(0), m_active_connections(0)
     {
     }
 
@@ -338,6 +632,21 @@ protected:
     // URI to connect to.
     const http::uri m_uri;
 
+    // Opens the client the first time it is needed.
+    void ensure_opened()
+    {
+        if( !m_opened )
+        {
+            pplx::scoped_critical_section l(m_open_lock);
+
+            if ( !m_opened )
+            {
+                open();
+                m_opened = true;
+            }
+        }
+    }
+
 private:
 
     http_client_config m_client_config;
@@ -349,44 +658,159 @@ private:
     // Wraps opening the client around sending a request.
     void open_and_send_request(request_context *request)
     {
-        // First see if client needs to be opened.
-        if( !m_opened )
+        ensure_opened();
+        send_request(request);
+    }
+
+    void schedule_send(request_context *request)
+    {
+        // Schedule a task to start sending.
+        pplx::create_task([this, request]
         {
-            pplx::scoped_critical_section l(m_open_lock);
+            try
+            {
+                open_and_send_request(request);
+            }
+            catch (...)
+            {
+                request->report_exception(std::current_exception());
+            }
+        });
+    }
 
-            if ( !m_opened )
+    // Takes a connection for the request if one is free, otherwise holds the request back.
+    bool acquire_connection(request_context *request)
+    {
+        pplx::scoped_critical_section l(m_connections_lock);
+        if (m_active_connections < m_client_config.max_connections())
+        {
+            ++m_active_connections;
+            return true;
+        }
+        const size_t level = static_cast<size_t>(request->m_request.priority());
+        m_waiting[level].push_back(std::make_pair(request, utility::details::steady_clock_microseconds()));
+        return false;
+    }
+
+    // Hands the connection of a finished request to the waiting request that comes first.
+    void release_connection()
+    {
+        request_context *next = nullptr;
+        {
+            pplx::scoped_critical_section l(m_connections_lock);
+            next = next_waiting_request();
+            if (next == nullptr)
             {
-                open();
-                m_opened = true;
+                --m_active_connections;
             }
         }
+        if (next != nullptr)
+        {
+            schedule_send(next);
+        }
+    }
 
-        send_request(request);
+    // Picks the oldest request of the highest priority class, where every second spent waiting
+    // counts as one class more.
+    request_context *next_waiting_request()
+    {
+        const uint64_t now = utility::details::steady_clock_microseconds();
+        size_t chosen = priority_levels;
+        double chosen_rank = 0;
+        for (size_t level = priority_levels; level-- > 0;)
+        {
+            if (m_waiting[level].empty())
+            {
+                continue;
+            }
+            const uint64_t queued = m_waiting[level].front().second;
+            const uint64_t waited = now > queued ? now - queued : 0;
+            const double rank = static_cast<double>(level) + static_cast<double>(waited) / 1000000.0;
+            if (chosen == priority_levels || rank > chosen_rank)
+            {
+                chosen = level;
+                chosen_rank = rank;
+            }
+        }
+        if (chosen == priority_levels)
+        {
+            return nullptr;
+        }
+        request_context *request = m_waiting[chosen].front().first;
+        m_waiting[chosen].pop_front();
+        return request;
     }
 
     void push_request(_In_opt_ request_context *request)
     {
         if (request == nullptr) return;
 
-        pplx::scoped_critical_section l(m_open_lock);
+        m_requests_queue.push(request);
 
-        if(++m_scheduled == 1)
+        if (pplx::atomic_increment(m_scheduled) == 1)
         {
-            // Schedule a task to start sending.
-            pplx::create_task([this, request]() -> void
+            // Nothing is in flight: schedule a task to start sending.
+            pplx::create_task([this]() -> void
             {
-                open_and_send_request(request);
+                drain_requests();
             });
         }
-        else
+    }
+
+    // Sends queued requests, one for each call. Only a single thread runs the loop at any time;
+    // calls made while it is running (including re-entrant ones, when a request completes
+    // synchronously) just add to the number of sends owed, which the running loop picks up.
+    void drain_requests()
+    {
+        if (pplx::atomic_increment(m_pending_sends) != 1)
+        {
+            return;
+        }
+
+        do
+        {
+            request_context *request = next_request();
+            try
+            {
+                open_and_send_request(request);
+            }
+            catch (...)
+            {
+                request->report_exception(std::current_exception());
+            }
+        }
+        while (pplx::atomic_decrement(m_pending_sends) != 0);
+    }
+
+    request_context *next_request()
+    {
+        // The request being waited for has already been counted in m_scheduled,
+        // so it is at most a producer's link away.
+        _ordered_request_queue::node *item;
+        while ((item = m_requests_queue.pop()) == nullptr)
         {
-            m_requests_queue.push(request);
+            pplx::platform::YieldExecution();
         }
+        return static_cast<request_context *>(item);
     }
 
     // Queue used to guarantee ordering of requests, when appliable.
-    std::queue<request_context *> m_requests_queue;
-    int                           m_scheduled;
+    _ordered_request_queue m_requests_queue;
+
+    // Number of ordered requests pushed but not yet finished.
+    pplx::atomic_long m_scheduled;
+
+    // Number of queued requests the drain loop still has to send.
+    pplx::atomic_long m_pending_sends;
+
+    // Number of request_priority classes.
+    static const size_t priority_levels = 3;
+
+    // Requests held back by the connection limit, per priority class, with the time they were queued
+    // in utility::details::steady_clock_microseconds.
+    pplx::critical_section m_connections_lock;
+    size_t m_active_connections;
+    std::deque<std::pair<request_context *, uint64_t>> m_waiting[priority_levels];
 };
 
 inline void request_context::finish()
@@ -1942,44 +2366,195 @@ private:
 
 using boost::asio::ip::tcp;
 
-class linux_client;
-struct client;
+// Requests are sent over a generic stream socket, so the same code path serves both TCP and
+// Unix domain socket ('unix://') connections.
+typedef boost::asio::generic::stream_protocol::socket stream_socket;
 
-class linux_request_context : public request_context
+#ifndef TCP_FASTOPEN_CONNECT
+#define TCP_FASTOPEN_CONNECT 30
+#endif
+
+typedef integer_socket_option<IPPROTO_TCP, TCP_KEEPIDLE> tcp_keep_alive_idle;
+typedef integer_socket_option<IPPROTO_TCP, TCP_KEEPINTVL> tcp_keep_alive_interval;
+typedef integer_socket_option<IPPROTO_TCP, TCP_KEEPCNT> tcp_keep_alive_count;
+typedef integer_socket_option<IPPROTO_TCP, TCP_QUICKACK> tcp_quick_ack;
+typedef integer_socket_option<IPPROTO_TCP, TCP_FASTOPEN_CONNECT> tcp_fast_open_connect;
+
+// Applies the socket options that have to be in place before connecting: the buffer sizes, since the
+// TCP window scale is negotiated on the SYN, and TCP Fast Open. The socket must already be open.
+// Options the system does not support are ignored.
+template <typename Socket>
+static void apply_connect_options(Socket &socket, const socket_options &options, bool tcp)
 {
-public:
-    static request_context * create_request_context(std::shared_ptr<_http_client_communicator> &client, http_request &request)
+    boost::system::error_code ignore;
+    if (options.send_buffer_size() > 0)
     {
-        return new linux_request_context(client, request);
+        socket.set_option(boost::asio::socket_base::send_buffer_size(options.send_buffer_size()), ignore);
     }
-
-    void report_error(const utility::string_t &scope, boost::system::error_code ec)
+    if (options.receive_buffer_size() > 0)
     {
-        request_context::report_error(0x8000000 | ec.value(), scope);
+        socket.set_option(boost::asio::socket_base::receive_buffer_size(options.receive_buffer_size()), ignore);
     }
+    if (tcp && options.fast_open())
+    {
+        socket.set_option(tcp_fast_open_connect(1), ignore);
+    }
+}
 
-    std::unique_ptr<tcp::socket> m_socket;
-    uri m_what;
-    size_t m_known_size;
-    size_t m_current_size;
-    bool m_needChunked;
-    boost::asio::streambuf m_request_buf;
-    boost::asio::streambuf m_response_buf;
-    std::unique_ptr<boost::asio::deadline_timer> m_timer;
+// Applies the socket options of a connected socket, ahead of the first write.
+template <typename Socket>
+static void apply_connected_options(Socket &socket, const socket_options &options, bool tcp)
+{
+    if (!tcp)
+    {
+        return;
+    }
 
-    ~linux_request_context()
+    boost::system::error_code ignore;
+    if (options.no_delay())
     {
-        if (m_timer)
+        socket.set_option(tcp::no_delay(true), ignore);
+    }
+    if (options.keep_alive())
+    {
+        socket.set_option(boost::asio::socket_base::keep_alive(true), ignore);
+        if (options.keep_alive_idle().count() > 0)
         {
-            m_timer->cancel();
-            m_timer.reset();
+            socket.set_option(tcp_keep_alive_idle(static_cast<int>(options.keep_alive_idle().count())), ignore);
         }
-
-        if (m_socket)
+        if (options.keep_alive_interval().count() > 0)
         {
-            boost::system::error_code ignore;
-            m_socket->shutdown(tcp::socket::shutdown_both, ignore);
-            m_socket->close();
+            socket.set_option(tcp_keep_alive_interval(static_cast<int>(options.keep_alive_interval().count())), ignore);
+        }
+        if (options.keep_alive_count() > 0)
+        {
+            socket.set_option(tcp_keep_alive_count(options.keep_alive_count()), ignore);
+        }
+    }
+    if (options.quick_ack())
+    {
+        socket.set_option(tcp_quick_ack(1), ignore);
+    }
+}
+
+class linux_client;
+struct client;
+
+// The socket buffers of a request. The client keeps them between requests, so that the capacity
+// they grew to is reused rather than allocated again for every request.
+struct linux_request_buffers
+{
+    boost::asio::streambuf m_request_buf;
+    boost::asio::streambuf m_response_buf;
+};
+
+class request_buffer_pool
+{
+public:
+
+    std::unique_ptr<linux_request_buffers> take()
+    {
+        {
+            pplx::scoped_critical_section l(m_lock);
+            if (!m_free.empty())
+            {
+                auto buffers = std::move(m_free.back());
+                m_free.pop_back();
+                return buffers;
+            }
+        }
+        return std::unique_ptr<linux_request_buffers>(new linux_request_buffers());
+    }
+
+    void give_back(std::unique_ptr<linux_request_buffers> buffers)
+    {
+        buffers->m_request_buf.consume(buffers->m_request_buf.size());
+        buffers->m_response_buf.consume(buffers->m_response_buf.size());
+
+        pplx::scoped_critical_section l(m_lock);
+        if (m_free.size() < max_free_buffers)
+        {
+            m_free.push_back(std::move(buffers));
+        }
+    }
+
+private:
+
+    static const size_t max_free_buffers = 256;
+
+    pplx::critical_section m_lock;
+    std::vector<std::unique_ptr<linux_request_buffers>> m_free;
+};
+
+class linux_request_context : public request_context
+{
+public:
+    static request_context * create_request_context(std::shared_ptr<_http_client_communicator> &client, http_request &request)
+    {
+        return new linux_request_context(client, request);
+    }
+
+    // Contexts are created and destroyed for every request; their memory is recycled.
+    static void *operator new(size_t size)
+    {
+        return size == sizeof(linux_request_context) ? _block_free_list<sizeof(linux_request_context)>::allocate() : ::operator new(size);
+    }
+
+    static void operator delete(void *p, size_t size)
+    {
+        if (size == sizeof(linux_request_context))
+        {
+            _block_free_list<sizeof(linux_request_context)>::deallocate(p);
+        }
+        else
+        {
+            ::operator delete(p);
+        }
+    }
+
+    // Takes socket buffers from the pool of the client that sends the request; they go back when the request is done.
+    void attach_buffers(request_buffer_pool &pool)
+    {
+        if (!m_buffers)
+        {
+            m_buffers = pool.take();
+            m_buffer_pool = &pool;
+        }
+    }
+
+    boost::asio::streambuf &request_buf() { return m_buffers->m_request_buf; }
+    boost::asio::streambuf &response_buf() { return m_buffers->m_response_buf; }
+
+    void report_error(const utility::string_t &scope, boost::system::error_code ec)
+    {
+        request_context::report_error(0x8000000 | ec.value(), scope);
+    }
+
+    std::unique_ptr<stream_socket> m_socket;
+    uri m_what;
+    size_t m_known_size;
+    size_t m_current_size;
+    bool m_needChunked;
+    std::unique_ptr<boost::asio::deadline_timer> m_timer;
+
+    ~linux_request_context()
+    {
+        if (m_buffers)
+        {
+            m_buffer_pool->give_back(std::move(m_buffers));
+        }
+
+        if (m_timer)
+        {
+            m_timer->cancel();
+            m_timer.reset();
+        }
+
+        if (m_socket)
+        {
+            boost::system::error_code ignore;
+            m_socket->shutdown(stream_socket::shutdown_both, ignore);
+            m_socket->close();
             m_socket.reset();
         }
     }
@@ -2002,199 +2577,628 @@ private:
         , m_known_size(0)
         , m_needChunked(false)
         , m_current_size(0)
+        , m_buffer_pool(nullptr)
     {
     }
+
+    std::unique_ptr<linux_request_buffers> m_buffers;
+
+    // Owned by the client, which the request keeps alive through m_http_client.
+    request_buffer_pool *m_buffer_pool;
 };
 
 
+// Serializes the head of a request (request line, Host and the header fields) straight into the
+// socket output buffer. The exact size is computed first, so the head is written with a single
+// prepare/commit and without building any intermediate strings.
+class request_head_writer
+{
+public:
+    request_head_writer(const http::method &method, const http::uri &what, const http_headers &headers)
+        : m_method(method), m_what(what), m_headers(headers), m_port_length(0)
+    {
+        // Only non-default ports are written to the Host header.
+        int port = what.port();
+        if (port != 0 && port != 80)
+        {
+            char digits[sizeof(m_port)];
+            size_t count = 0;
+            for (; port > 0 && count < sizeof(digits); port /= 10)
+            {
+                digits[count++] = static_cast<char>('0' + port % 10);
+            }
+            while (count > 0)
+            {
+                m_port[m_port_length++] = digits[--count];
+            }
+        }
+    }
+
+    size_t size() const
+    {
+        size_t size = m_method.size() + 1 + target_size() + sizeof(" HTTP/1.1\r\n") - 1;
+        size += sizeof("Host: ") - 1 + m_what.host().size() + crlf_size;
+        if (m_port_length != 0)
+        {
+            size += 1 + m_port_length;
+        }
+        for (auto iter = m_headers.begin(); iter != m_headers.end(); ++iter)
+        {
+            size += iter->first.size() + 1 + iter->second.size() + crlf_size;
+        }
+        size += sizeof("Connection: close\r\n") - 1 + crlf_size;
+        return size;
+    }
+
+    void write(boost::asio::streambuf &buf) const
+    {
+        const size_t head_size = size();
+        char *begin = boost::asio::buffer_cast<char *>(buf.prepare(head_size));
+        char *out = begin;
+
+        out = append(out, m_method);
+        *out++ = ' ';
+        out = write_target(out);
+        out = append(out, " HTTP/1.1\r\n");
+
+        out = append(out, "Host: ");
+        out = append(out, m_what.host());
+        if (m_port_length != 0)
+        {
+            *out++ = ':';
+            out = std::copy(m_port, m_port + m_port_length, out);
+        }
+        out = append(out, "\r\n");
+
+        for (auto iter = m_headers.begin(); iter != m_headers.end(); ++iter)
+        {
+            out = append(out, iter->first);
+            *out++ = ':';
+            out = append(out, iter->second);
+            out = append(out, "\r\n");
+        }
+
+        out = append(out, "Connection: close\r\n"); // so we can just read to EOF
+        out = append(out, "\r\n");
+
+        _PPLX_ASSERT(static_cast<size_t>(out - begin) == head_size);
+        buf.commit(head_size);
+    }
+
+private:
+    static const size_t crlf_size = 2;
+
+    // The request target is the resource part of the URI: path, query and fragment.
+    size_t target_size() const
+    {
+        size_t size = m_what.path().empty() ? 1 : m_what.path().size();
+        if (!m_what.query().empty())
+        {
+            size += 1 + m_what.query().size();
+        }
+        if (!m_what.fragment().empty())
+        {
+            size += 1 + m_what.fragment().size();
+        }
+        return size;
+    }
+
+    char *write_target(char *out) const
+    {
+        if (m_what.path().empty())
+        {
+            *out++ = '/';
+        }
+        else
+        {
+            out = append(out, m_what.path());
+        }
+        if (!m_what.query().empty())
+        {
+            *out++ = '?';
+            out = append(out, m_what.query());
+        }
+        if (!m_what.fragment().empty())
+        {
+            *out++ = '#';
+            out = append(out, m_what.fragment());
+        }
+        return out;
+    }
+
+    static char *append(char *out, const std::string &str)
+    {
+        return std::copy(str.begin(), str.end(), out);
+    }
+
+    template <size_t _Size>
+    static char *append(char *out, const char (&literal)[_Size])
+    {
+        return std::copy(literal, literal + _Size - 1, out);
+    }
+
+    const http::method &m_method;
+    const http::uri &m_what;
+    const http_headers &m_headers;
+    char m_port[8];
+    size_t m_port_length;
+};
+
 struct client
 {
-    client(boost::asio::io_service& io_service)
+    client(boost::asio::io_service& io_service, const std::string &local_path, const socket_options &options)
         : m_resolver(io_service)
-        , m_io_service(io_service) {}
+        , m_io_service(io_service)
+        , m_local_path(local_path)
+        , m_options(options)
+        , m_prewarm_target(0)
+        , m_refilling(0) {}
     
     void send_request(linux_request_context* ctx, int timeout)
     {
-        auto what = ctx->m_what;
-        ctx->m_socket.reset(new tcp::socket(m_io_service));
-                
-        auto resource = what.resource().to_string();
-        if (resource == "") resource = "/";
+        ctx->attach_buffers(m_buffer_pool);
 
-        auto method = ctx->m_request.method();
+        const auto &what = ctx->m_what;
+        ctx->m_socket.reset(new stream_socket(m_io_service));
+
+        const auto &method = ctx->m_request.method();
         // stop injection of headers via method
         // resource should be ok, since it's been encoded
         // and host won't resolve
         if (std::find(method.begin(), method.end(), '\r') != method.end())
             throw std::runtime_error("invalid method string");
 
-        auto host = what.host();
-        std::ostream request_stream(&ctx->m_request_buf);
-
-        request_stream << method << " "
-            << resource << " "
-            << "HTTP/1.1" << CRLF
-            << "Host: " << host;
-        
-        if (what.port() != 0 && what.port() != 80)
-            request_stream << ":" << what.port();
-
-        request_stream << CRLF;
+        const auto &host = what.host();
 
         // Check user specified transfer-encoding
         std::string transferencoding;
-        if (ctx->m_request.headers().match(header_names::transfer_encoding, transferencoding) && transferencoding == "chunked")
+        if (ctx->m_request.headers().match(header_ids::transfer_encoding, transferencoding) && transferencoding == "chunked")
         {
             ctx->m_needChunked = true;
         }
 
         // Stream without content length is the signal of requiring transcoding.
-        if (!ctx->m_request.headers().match(header_names::content_length, ctx->m_known_size))
+        if (!ctx->m_request.headers().match(header_ids::content_length, ctx->m_known_size))
         {
             if (ctx->m_request.body())
             {
                 ctx->m_needChunked = true;
-                ctx->m_request.headers()[header_names::transfer_encoding] = U("chunked");
+                ctx->m_request.headers()[header_ids::transfer_encoding] = U("chunked");
             }
             else
             {
-                ctx->m_request.headers()[header_names::content_length] = U("0");
+                ctx->m_request.headers()[header_ids::content_length] = U("0");
             }
         }
 
-        request_stream << flatten_http_headers(ctx->m_request.headers());
-
-        request_stream << "Connection: close" << CRLF; // so we can just read to EOF
-        request_stream << CRLF;
-
-        tcp::resolver::query query(host, utility::conversions::print_string(what.port() == 0 ? 80 : what.port()));
+        request_head_writer head(method, what, ctx->m_request.headers());
+        head.write(ctx->request_buf());
 
         ctx->m_timer.reset(new boost::asio::deadline_timer(m_io_service));
         ctx->m_timer->expires_from_now(boost::posix_time::milliseconds(timeout));
         ctx->m_timer->async_wait(boost::bind(&linux_request_context::cancel, ctx, boost::asio::placeholders::error));
 
-        m_resolver.async_resolve(query, boost::bind(&client::handle_resolve, this, boost::asio::placeholders::error, boost::asio::placeholders::iterator, ctx));
-    }
-
-private:
-    boost::asio::io_service& m_io_service;
-    tcp::resolver m_resolver;
-
-    void handle_resolve(const boost::system::error_code& ec, tcp::resolver::iterator endpoints, linux_request_context* ctx)
-    {
-        if (ec)
+        if (take_idle_socket(ctx))
         {
-            ctx->report_error("Error resolving address", ec);
+            handle_connect(boost::system::error_code(), tcp::resolver::iterator(), ctx);
+            return;
         }
-        else
+
+        if (!m_local_path.empty())
         {
-            auto endpoint = *endpoints;
-            ctx->m_socket->async_connect(endpoint, boost::bind(&client::handle_connect, this, boost::asio::placeholders::error, ++endpoints, ctx));
+            // Unix domain socket: there is nothing to resolve, and only a single endpoint to try.
+            connect(boost::asio::local::stream_protocol::endpoint(m_local_path), tcp::resolver::iterator(), ctx);
+            return;
         }
+
+        tcp::resolver::query query(host, utility::conversions::print_string(what.port() == 0 ? 80 : what.port()));
+        m_resolver.async_resolve(query, boost::bind(&client::handle_resolve, this, boost::asio::placeholders::error, boost::asio::placeholders::iterator, ctx));
     }
 
-    void handle_connect(const boost::system::error_code& ec, tcp::resolver::iterator endpoints, linux_request_context* ctx)
+    // Connects to the address ahead of traffic and parks the connections in the idle pool, where
+    // send_request picks them up. Since requests are sent with 'Connection: close', each one serves
+    // a single request; take_idle_socket connects a replacement for every connection it hands out, so
+    // the pool stays warm under traffic. The owner is kept alive until all the connection attempts are over.
+    pplx::task<void> prewarm(size_t connections, const http::uri &address, const std::shared_ptr<void> &owner)
     {
-        if (!ec)
         {
-            boost::asio::async_write(*ctx->m_socket, ctx->m_request_buf, boost::bind(&client::handle_write_request, this, boost::asio::placeholders::error, ctx));
+            // Connections beyond the pool's room would only be closed again.
+            pplx::scoped_critical_section l(m_idle_lock);
+            expire_idle_sockets();
+            const size_t room = m_idle.size() < max_idle_connections ? max_idle_connections - m_idle.size() : 0;
+            connections = std::min(connections, room);
+            m_prewarm_target = std::max(m_prewarm_target, m_idle.size() + connections);
         }
-        else if (endpoints == tcp::resolver::iterator())
+
+        auto state = std::make_shared<prewarm_state>(connections, owner);
+        if (connections == 0)
         {
-            ctx->report_error("Failed to connect to any resolved endpoint", ec);
+            state->m_done.set();
+            return pplx::create_task(state->m_done);
+        }
+
+        if (!m_local_path.empty())
+        {
+            for (size_t i = 0; i < connections; ++i)
+            {
+                prewarm_connect(state, boost::asio::local::stream_protocol::endpoint(m_local_path), tcp::resolver::iterator());
+            }
         }
         else
         {
-            boost::system::error_code ignore;
-            ctx->m_socket->shutdown(tcp::socket::shutdown_both, ignore);
-            ctx->m_socket->close();
-            ctx->m_socket.reset(new tcp::socket(m_io_service));
-            auto endpoint = *endpoints;
-            ctx->m_socket->async_connect(endpoint, boost::bind(&client::handle_connect, this, boost::asio::placeholders::error, ++endpoints, ctx));
+            tcp::resolver::query query(address.host(), utility::conversions::print_string(address.port() == 0 ? 80 : address.port()));
+            m_resolver.async_resolve(query, boost::bind(&client::handle_prewarm_resolve, this, boost::asio::placeholders::error, boost::asio::placeholders::iterator, state));
         }
+        return pplx::create_task(state->m_done);
     }
 
-    void handle_write_chunked_body(const boost::system::error_code& ec, linux_request_context* ctx)
+private:
+    boost::asio::io_service& m_io_service;
+
+    // Socket buffers of finished requests, for the next ones.
+    request_buffer_pool m_buffer_pool;
+    tcp::resolver m_resolver;
+
+    // Path of the Unix domain socket to connect to, empty when requests go over TCP.
+    const std::string m_local_path;
+    const socket_options m_options;
+
+    // Bounds of the idle pool: how many connections it keeps, and for how long.
+    static const size_t max_idle_connections = 64;
+    static std::chrono::seconds idle_timeout() { return std::chrono::seconds(30); }
+
+    struct idle_socket
     {
-        if (ec)
-            return handle_write_body(ec, ctx);
-        auto readbuf = ctx->_get_readbuffer();
-        uint8_t *buf = boost::asio::buffer_cast<uint8_t *>(ctx->m_request_buf.prepare(CHUNK_SIZE + http::details::chunked_encoding::additional_encoding_space));
-        readbuf.getn(buf + http::details::chunked_encoding::data_offset, CHUNK_SIZE).then([=](size_t readSize) {
-            size_t offset = http::details::chunked_encoding::add_chunked_delimiters(buf, CHUNK_SIZE+http::details::chunked_encoding::additional_encoding_space, readSize);
-            ctx->m_request_buf.commit(readSize + http::details::chunked_encoding::additional_encoding_space);
-            ctx->m_request_buf.consume(offset);
-            ctx->m_current_size += readSize;
-            boost::asio::async_write(*ctx->m_socket, ctx->m_request_buf,
-                    boost::bind(readSize != 0 ? &client::handle_write_chunked_body : &client::handle_write_body, this, boost::asio::placeholders::error, ctx));
-        });
-    }
+        std::unique_ptr<stream_socket> m_socket;
+        std::chrono::steady_clock::time_point m_parked;
+    };
 
-    void handle_write_large_body(const boost::system::error_code& ec, linux_request_context* ctx)
+    // Connections established ahead of traffic, oldest first.
+    pplx::critical_section m_idle_lock;
+    std::deque<idle_socket> m_idle;
+
+    // How many connections prewarm keeps parked, counting the replacements being connected, and where the
+    // last of them connected to; zero until prewarm is called. Guarded by m_idle_lock.
+    size_t m_prewarm_target;
+    size_t m_refilling;
+    boost::asio::generic::stream_protocol::endpoint m_prewarm_endpoint;
+
+    struct prewarm_state
     {
-        if (ec || ctx->m_current_size >= ctx->m_known_size)
-        {
-            return handle_write_body(ec, ctx);
-        }
+        prewarm_state(size_t connections, const std::shared_ptr<void> &owner)
+            : m_remaining(connections), m_connected(0), m_refill(false), m_owner(owner) {}
+
+        pplx::critical_section m_lock;
+        size_t m_remaining;
+        size_t m_connected;
+        bool m_refill; // replacing a connection handed out, rather than started by prewarm
+        boost::system::error_code m_error;
+        pplx::task_completion_event<void> m_done;
+        std::shared_ptr<void> m_owner;
+    };
+
+    struct prewarm_connection
+    {
+        prewarm_connection(const std::shared_ptr<prewarm_state> &state, boost::asio::io_service &io_service)
+            : m_state(state), m_socket(new stream_socket(io_service)) {}
 
-        auto readbuf = ctx->_get_readbuffer();
-        size_t readSize = std::min(CHUNK_SIZE, ctx->m_known_size - ctx->m_current_size);
-        
-        readbuf.getn(boost::asio::buffer_cast<uint8_t *>(ctx->m_request_buf.prepare(readSize)), readSize).then([=](size_t actualSize) {
-            ctx->m_current_size += actualSize;
-            ctx->m_request_buf.commit(actualSize);
-            boost::asio::async_write(*ctx->m_socket, ctx->m_request_buf,
-                    boost::bind(&client::handle_write_large_body, this, boost::asio::placeholders::error, ctx));
-        });
-    }
+        std::shared_ptr<prewarm_state> m_state;
+        std::unique_ptr<stream_socket> m_socket;
+    };
 
-    void handle_write_request(const boost::system::error_code& ec, linux_request_context* ctx)
+    // Hands a parked connection to the request, skipping the ones the server has closed meanwhile, and
+    // starts connecting replacements, up to the prewarm target.
+    bool take_idle_socket(linux_request_context* ctx)
     {
-        if (!ec)
+        bool taken = false;
+        size_t refills = 0;
+        boost::asio::generic::stream_protocol::endpoint endpoint;
         {
-            ctx->m_current_size = 0;
+            pplx::scoped_critical_section l(m_idle_lock);
+            expire_idle_sockets();
+            while (!m_idle.empty() && !taken)
+            {
+                std::unique_ptr<stream_socket> socket(std::move(m_idle.front().m_socket));
+                m_idle.pop_front();
+                if (is_idle_socket_usable(*socket))
+                {
+                    ctx->m_socket = std::move(socket);
+                    taken = true;
+                }
+            }
 
-            if (ctx->m_needChunked)
-                handle_write_chunked_body(ec, ctx);
-            else
-                handle_write_large_body(ec, ctx);
+            if (taken && m_prewarm_endpoint != endpoint && m_idle.size() + m_refilling < m_prewarm_target)
+            {
+                refills = m_prewarm_target - m_idle.size() - m_refilling;
+                m_refilling += refills;
+                endpoint = m_prewarm_endpoint;
+            }
         }
-        else
+
+        // Outside the lock, which a connection attempt failing right away takes again.
+        for (size_t i = 0; i < refills; ++i)
         {
-            ctx->report_error("Failed to write request headers", ec);
+            auto state = std::make_shared<prewarm_state>(1, ctx->m_http_client);
+            state->m_refill = true;
+            prewarm_connect(state, endpoint, tcp::resolver::iterator());
         }
+        return taken;
     }
 
-    void handle_write_body(const boost::system::error_code& ec, linux_request_context* ctx)
+    // Parks a connection, unless the pool is full. Expects m_idle_lock to be held.
+    void park_idle_socket(std::unique_ptr<stream_socket> socket)
     {
-        if (!ec)
-        {
-            // Read until the end of entire headers
-            boost::asio::async_read_until(*ctx->m_socket, ctx->m_response_buf, CRLF+CRLF,
-                boost::bind(&client::handle_status_line, this, boost::asio::placeholders::error, ctx));
-        }
-        else
+        expire_idle_sockets();
+        if (m_idle.size() < max_idle_connections)
         {
-            ctx->report_error("Failed to write request body", ec);
+            idle_socket idle;
+            idle.m_socket = std::move(socket);
+            idle.m_parked = std::chrono::steady_clock::now();
+            m_idle.push_back(std::move(idle));
         }
     }
 
-    void handle_status_line(const boost::system::error_code& ec, linux_request_context* ctx)
+    // Closes the connections that have been parked for longer than the idle timeout. Expects m_idle_lock
+    // to be held.
+    void expire_idle_sockets()
     {
-        if (!ec)
+        const auto expired = std::chrono::steady_clock::now() - idle_timeout();
+        while (!m_idle.empty() && m_idle.front().m_parked < expired)
         {
-            std::istream response_stream(&ctx->m_response_buf);
-            std::string http_version;
-            response_stream >> http_version;
-            status_code status_code;
-            response_stream >> status_code;
-
-            std::string status_message;
-            std::getline(response_stream, status_message);
+            m_idle.pop_front();
+        }
+    }
 
-            ctx->m_response.set_status_code(status_code);
+    // A parked connection is usable as long as the server has neither closed it nor sent anything on it.
+    static bool is_idle_socket_usable(stream_socket &socket)
+    {
+        char c;
+        const ssize_t read = ::recv(socket.native_handle(), &c, 1, MSG_PEEK | MSG_DONTWAIT);
+        return read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+    }
 
-            trim_whitespace(status_message);
+    void handle_prewarm_resolve(const boost::system::error_code& ec, tcp::resolver::iterator endpoints, const std::shared_ptr<prewarm_state> &state)
+    {
+        const size_t connections = state->m_remaining;
+        for (size_t i = 0; i < connections; ++i)
+        {
+            if (ec)
+            {
+                finish_prewarm(state, ec);
+            }
+            else
+            {
+                tcp::resolver::iterator next = endpoints;
+                tcp::endpoint endpoint = *next;
+                prewarm_connect(state, endpoint, ++next);
+            }
+        }
+    }
+
+    void prewarm_connect(const std::shared_ptr<prewarm_state> &state, const boost::asio::generic::stream_protocol::endpoint &endpoint, tcp::resolver::iterator next)
+    {
+        prewarm_connect(std::make_shared<prewarm_connection>(state, m_io_service), endpoint, next);
+    }
+
+    void prewarm_connect(const std::shared_ptr<prewarm_connection> &conn, const boost::asio::generic::stream_protocol::endpoint &endpoint, tcp::resolver::iterator next)
+    {
+        boost::system::error_code ec;
+        conn->m_socket->open(endpoint.protocol(), ec);
+        if (ec)
+        {
+            finish_prewarm(conn->m_state, ec);
+            return;
+        }
+        apply_connect_options(*conn->m_socket, m_options, is_tcp());
+        conn->m_socket->async_connect(endpoint, boost::bind(&client::handle_prewarm_connect, this, boost::asio::placeholders::error, next, conn));
+    }
+
+    void handle_prewarm_connect(const boost::system::error_code& ec, tcp::resolver::iterator endpoints, const std::shared_ptr<prewarm_connection> &conn)
+    {
+        if (!ec)
+        {
+            apply_connected_options(*conn->m_socket, m_options, is_tcp());
+            {
+                pplx::scoped_critical_section l(m_idle_lock);
+                boost::system::error_code ignore;
+                const auto endpoint = conn->m_socket->remote_endpoint(ignore);
+                if (!ignore)
+                {
+                    m_prewarm_endpoint = endpoint;
+                }
+                park_idle_socket(std::move(conn->m_socket));
+            }
+            finish_prewarm(conn->m_state, ec);
+        }
+        else if (endpoints == tcp::resolver::iterator())
+        {
+            finish_prewarm(conn->m_state, ec);
+        }
+        else
+        {
+            boost::system::error_code ignore;
+            conn->m_socket->close(ignore);
+            tcp::endpoint endpoint = *endpoints;
+            prewarm_connect(conn, endpoint, ++endpoints);
+        }
+    }
+
+    // The prewarm task completes once every connection attempt is over, and fails only if none succeeded.
+    // A replacement that failed is not retried; the next connection handed out tries again.
+    void finish_prewarm(const std::shared_ptr<prewarm_state> &state, const boost::system::error_code& ec)
+    {
+        if (state->m_refill)
+        {
+            pplx::scoped_critical_section l(m_idle_lock);
+            --m_refilling;
+        }
+
+        pplx::scoped_critical_section l(state->m_lock);
+        if (ec)
+        {
+            state->m_error = ec;
+        }
+        else
+        {
+            ++state->m_connected;
+        }
+
+        if (--state->m_remaining == 0)
+        {
+            if (state->m_connected == 0)
+            {
+                state->m_done.set_exception(http_exception(0x8000000 | state->m_error.value(), U("Failed to prewarm connections")));
+            }
+            else
+            {
+                state->m_done.set();
+            }
+        }
+    }
+
+    bool is_tcp() const
+    {
+        return m_local_path.empty();
+    }
+
+    // Opens the socket for the endpoint's protocol, so the options that must precede the connection
+    // can be set, and starts connecting.
+    void connect(const boost::asio::generic::stream_protocol::endpoint &endpoint, tcp::resolver::iterator next, linux_request_context* ctx)
+    {
+        boost::system::error_code ec;
+        ctx->m_socket->open(endpoint.protocol(), ec);
+        if (ec)
+        {
+            ctx->report_error("Failed to open socket", ec);
+            return;
+        }
+        apply_connect_options(*ctx->m_socket, m_options, is_tcp());
+        ctx->m_socket->async_connect(endpoint, boost::bind(&client::handle_connect, this, boost::asio::placeholders::error, next, ctx));
+    }
+
+    void handle_resolve(const boost::system::error_code& ec, tcp::resolver::iterator endpoints, linux_request_context* ctx)
+    {
+        if (ec)
+        {
+            ctx->report_error("Error resolving address", ec);
+        }
+        else
+        {
+            tcp::endpoint endpoint = *endpoints;
+            connect(endpoint, ++endpoints, ctx);
+        }
+    }
+
+    void handle_connect(const boost::system::error_code& ec, tcp::resolver::iterator endpoints, linux_request_context* ctx)
+    {
+        if (!ec)
+        {
+            apply_connected_options(*ctx->m_socket, m_options, is_tcp());
+            boost::asio::async_write(*ctx->m_socket, ctx->request_buf(), boost::bind(&client::handle_write_request, this, boost::asio::placeholders::error, ctx));
+        }
+        else if (endpoints == tcp::resolver::iterator())
+        {
+            ctx->report_error("Failed to connect to any resolved endpoint", ec);
+        }
+        else
+        {
+            boost::system::error_code ignore;
+            ctx->m_socket->shutdown(stream_socket::shutdown_both, ignore);
+            ctx->m_socket->close();
+            ctx->m_socket.reset(new stream_socket(m_io_service));
+            tcp::endpoint endpoint = *endpoints;
+            connect(endpoint, ++endpoints, ctx);
+        }
+    }
+
+    void handle_write_chunked_body(const boost::system::error_code& ec, linux_request_context* ctx)
+    {
+        if (ec)
+            return handle_write_body(ec, ctx);
+        auto readbuf = ctx->_get_readbuffer();
+        uint8_t *buf = boost::asio::buffer_cast<uint8_t *>(ctx->request_buf().prepare(CHUNK_SIZE + http::details::chunked_encoding::additional_encoding_space));
+        readbuf.getn(buf + http::details::chunked_encoding::data_offset, CHUNK_SIZE).then([=](size_t readSize) {
+            size_t offset = http::details::chunked_encoding::add_chunked_delimiters(buf, CHUNK_SIZE+http::details::chunked_encoding::additional_encoding_space, readSize);
+            ctx->request_buf().commit(readSize + http::details::chunked_encoding::additional_encoding_space);
+            ctx->request_buf().consume(offset);
+            ctx->m_current_size += readSize;
+            boost::asio::async_write(*ctx->m_socket, ctx->request_buf(),
+                    boost::bind(readSize != 0 ? &client::handle_write_chunked_body : &client::handle_write_body, this, boost::asio::placeholders::error, ctx));
+        });
+    }
+
+    void handle_write_large_body(const boost::system::error_code& ec, linux_request_context* ctx)
+    {
+        if (ec || ctx->m_current_size >= ctx->m_known_size)
+        {
+            return handle_write_body(ec, ctx);
+        }
+
+        auto readbuf = ctx->_get_readbuffer();
+        size_t readSize = std::min(CHUNK_SIZE, ctx->m_known_size - ctx->m_current_size);
+        
+        readbuf.getn(boost::asio::buffer_cast<uint8_t *>(ctx->request_buf().prepare(readSize)), readSize).then([=](size_t actualSize) {
+            ctx->m_current_size += actualSize;
+            ctx->request_buf().commit(actualSize);
+            boost::asio::async_write(*ctx->m_socket, ctx->request_buf(),
+                    boost::bind(&client::handle_write_large_body, this, boost::asio::placeholders::error, ctx));
+        });
+    }
+
+    void handle_write_request(const boost::system::error_code& ec, linux_request_context* ctx)
+    {
+        if (!ec)
+        {
+            ctx->m_current_size = 0;
+
+            if (ctx->m_needChunked)
+                handle_write_chunked_body(ec, ctx);
+            else
+                handle_write_large_body(ec, ctx);
+        }
+        else
+        {
+            ctx->report_error("Failed to write request headers", ec);
+        }
+    }
+
+    void handle_write_body(const boost::system::error_code& ec, linux_request_context* ctx)
+    {
+        if (!ec)
+        {
+            // TCP_QUICKACK does not stick, so turn delayed acknowledgments off again for the response.
+            if (m_options.quick_ack() && is_tcp())
+            {
+                boost::system::error_code ignore;
+                ctx->m_socket->set_option(tcp_quick_ack(true), ignore);
+            }
+
+            // Read until the end of entire headers
+            boost::asio::async_read_until(*ctx->m_socket, ctx->response_buf(), CRLF+CRLF,
+                boost::bind(&client::handle_status_line, this, boost::asio::placeholders::error, ctx));
+        }
+        else
+        {
+            ctx->report_error("Failed to write request body", ec);
+        }
+    }
+
+    void handle_status_line(const boost::system::error_code& ec, linux_request_context* ctx)
+    {
+        if (!ec)
+        {
+            std::istream response_stream(&ctx->response_buf());
+            std::string http_version;
+            response_stream >> http_version;
+            status_code status_code;
+            response_stream >> status_code;
+
+            std::string status_message;
+            std::getline(response_stream, status_message);
+
+            ctx->m_response.set_status_code(status_code);
+
+            trim_whitespace(status_message);
             ctx->m_response.set_reason_phrase(status_message);
 
             if (!response_stream || http_version.substr(0, 5) != "HTTP/")
@@ -2214,7 +3218,7 @@ private:
     void read_headers(linux_request_context* ctx)
     {
         ctx->m_needChunked = false;
-        std::istream response_stream(&ctx->m_response_buf);
+        std::istream response_stream(&ctx->response_buf());
         std::string header;
         while (std::getline(response_stream, header) && header != "\r")
         {
@@ -2235,7 +3239,7 @@ private:
         ctx->complete_headers();
 
         ctx->m_known_size = 0;
-        ctx->m_response.headers().match(header_names::content_length, ctx->m_known_size);
+        ctx->m_response.headers().match(header_ids::content_length, ctx->m_known_size);
         // note: need to check for 'chunked' here as well, azure storage sends both
         // transfer-encoding:chunked and content-length:0 (although HTTP says not to)
         if (ctx->m_request.method() == U("HEAD") || (!ctx->m_needChunked && ctx->m_known_size == 0))
@@ -2247,10 +3251,9 @@ private:
         {
             ctx->m_current_size = 0;
             if (!ctx->m_needChunked)
-                async_read_until_buffersize(std::min(ctx->m_known_size, CHUNK_SIZE),
-                    boost::bind(&client::handle_read_content, this, boost::asio::placeholders::error, ctx), ctx);
+                async_read_content(ctx);
             else
-                boost::asio::async_read_until(*ctx->m_socket, ctx->m_response_buf, CRLF,
+                boost::asio::async_read_until(*ctx->m_socket, ctx->response_buf(), CRLF,
                     boost::bind(&client::handle_chunk_header, this, boost::asio::placeholders::error, ctx));
         }
     }
@@ -2258,20 +3261,38 @@ private:
     template <typename ReadHandler>
     void async_read_until_buffersize(size_t size, ReadHandler handler, linux_request_context* ctx)
     {
-        if (ctx->m_response_buf.size() >= size)
-            boost::asio::async_read(*ctx->m_socket, ctx->m_response_buf, boost::asio::transfer_at_least(0), handler);
+        if (ctx->response_buf().size() >= size)
+            boost::asio::async_read(*ctx->m_socket, ctx->response_buf(), boost::asio::transfer_at_least(0), handler);
         else
-            boost::asio::async_read(*ctx->m_socket, ctx->m_response_buf, boost::asio::transfer_at_least(size - ctx->m_response_buf.size()), handler);
+            boost::asio::async_read(*ctx->m_socket, ctx->response_buf(), boost::asio::transfer_at_least(size - ctx->response_buf().size()), handler);
+    }
+
+    // Reads more of a body of known length. A body callback gets whatever has arrived straight away;
+    // otherwise reads gather up to a chunk.
+    void async_read_content(linux_request_context* ctx)
+    {
+        const size_t remaining = ctx->m_known_size - ctx->m_current_size;
+        async_read_until_buffersize(std::min(ctx->_has_body_callback() ? size_t(1) : CHUNK_SIZE, remaining),
+            boost::bind(&client::handle_read_content, this, boost::asio::placeholders::error, ctx), ctx);
     }
 
     void handle_chunk_header(const boost::system::error_code& ec, linux_request_context* ctx)
     {
         if (!ec)
         {
-            std::istream response_stream(&ctx->m_response_buf);
+            std::istream response_stream(&ctx->response_buf());
             std::string line;
             std::getline(response_stream, line);
 
+            // A body callback is handed a chunk's data as it arrives, which leaves the CRLF after the data
+            // to be read here, as an empty line.
+            if (ctx->_has_body_callback() && (line.empty() || line == "\r"))
+            {
+                boost::asio::async_read_until(*ctx->m_socket, ctx->response_buf(), CRLF,
+                    boost::bind(&client::handle_chunk_header, this, boost::asio::placeholders::error, ctx));
+                return;
+            }
+
             std::istringstream octetLine(line);    
             int octets = 0;
             octetLine >> std::hex >> octets;
@@ -2280,6 +3301,9 @@ private:
             {
                 ctx->report_error("Invalid chunked response header", boost::system::error_code());
             }
+            else if (octets > 0 && ctx->_has_body_callback())
+                async_read_until_buffersize(1,
+                    boost::bind(&client::handle_chunk_data, this, boost::asio::placeholders::error, static_cast<size_t>(octets), ctx), ctx);
             else
                 async_read_until_buffersize(octets + CRLF.size(), // +2 for crlf
                     boost::bind(&client::handle_chunk, this, boost::asio::placeholders::error, octets, ctx), ctx);
@@ -2297,16 +3321,27 @@ private:
             ctx->m_current_size += to_read;
             if (to_read == 0)
             {
-                ctx->m_response_buf.consume(CRLF.size());
-                ctx->_get_writebuffer().close(std::ios_base::out).get();
+                ctx->response_buf().consume(CRLF.size());
+                ctx->_close_writebuffer();
                 ctx->complete_request(ctx->m_current_size);
             }
+            else if (ctx->_has_body_sink())
+            {
+                if (!ctx->_sink_body(boost::asio::buffer_cast<const uint8_t *>(ctx->response_buf().data()), to_read))
+                {
+                    ctx->report_error("Failed to consume response body", boost::system::error_code());
+                    return;
+                }
+                ctx->response_buf().consume(to_read + CRLF.size()); // consume crlf
+                boost::asio::async_read_until(*ctx->m_socket, ctx->response_buf(), CRLF,
+                    boost::bind(&client::handle_chunk_header, this, boost::asio::placeholders::error, ctx));
+            }
             else
             {
                 auto writeBuffer = ctx->_get_writebuffer();
-                writeBuffer.putn(boost::asio::buffer_cast<const uint8_t *>(ctx->m_response_buf.data()), to_read).then([=](size_t) {
-                    ctx->m_response_buf.consume(to_read + CRLF.size()); // consume crlf
-                    boost::asio::async_read_until(*ctx->m_socket, ctx->m_response_buf, CRLF,
+                writeBuffer.putn(boost::asio::buffer_cast<const uint8_t *>(ctx->response_buf().data()), to_read).then([=](size_t) {
+                    ctx->response_buf().consume(to_read + CRLF.size()); // consume crlf
+                    boost::asio::async_read_until(*ctx->m_socket, ctx->response_buf(), CRLF,
                         boost::bind(&client::handle_chunk_header, this, boost::asio::placeholders::error, ctx));
                 });
             }
@@ -2317,25 +3352,87 @@ private:
         }
     }
 
-    void handle_read_content(const boost::system::error_code& ec, linux_request_context* ctx)
+    // Hands a body callback the part of a chunk's data that has arrived, remaining being what is left of the chunk.
+    void handle_chunk_data(const boost::system::error_code& ec, size_t remaining, linux_request_context* ctx)
     {
-        auto writeBuffer = ctx->_get_writebuffer();
+        if (ec)
+        {
+            ctx->report_error("Failed to read chunked response part", ec);
+            return;
+        }
+
+        const size_t size = std::min(ctx->response_buf().size(), remaining);
+        ctx->_deliver_body(boost::asio::buffer_cast<const uint8_t *>(ctx->response_buf().data()), size).then([=](pplx::task<void> op) {
+            try
+            {
+                op.get();
+            }
+            catch (...)
+            {
+                ctx->report_error("Failed to consume response body", boost::system::error_code());
+                return;
+            }
+            ctx->m_current_size += size;
+            ctx->response_buf().consume(size);
+            if (remaining > size)
+                async_read_until_buffersize(1,
+                    boost::bind(&client::handle_chunk_data, this, boost::asio::placeholders::error, remaining - size, ctx), ctx);
+            else
+                boost::asio::async_read_until(*ctx->m_socket, ctx->response_buf(), CRLF,
+                    boost::bind(&client::handle_chunk_header, this, boost::asio::placeholders::error, ctx));
+        });
+    }
 
+    void handle_read_content(const boost::system::error_code& ec, linux_request_context* ctx)
+    {
         if (ec)
             ctx->report_error("Failed to read response body", ec);
+        else if (ctx->m_current_size < ctx->m_known_size && ctx->_has_body_callback())
+        {
+            const size_t size = std::min(ctx->response_buf().size(), ctx->m_known_size - ctx->m_current_size);
+            ctx->_deliver_body(boost::asio::buffer_cast<const uint8_t *>(ctx->response_buf().data()), size).then([=](pplx::task<void> op) {
+                try
+                {
+                    op.get();
+                }
+                catch (...)
+                {
+                    ctx->report_error("Failed to consume response body", boost::system::error_code());
+                    return;
+                }
+                ctx->m_current_size += size;
+                ctx->response_buf().consume(size);
+                async_read_content(ctx);
+            });
+        }
+        else if (ctx->m_current_size < ctx->m_known_size && ctx->_has_body_sink())
+        {
+            // Nothing to wait for: the data goes straight from the socket buffer to the sink.
+            const size_t size = std::min(ctx->response_buf().size(), ctx->m_known_size - ctx->m_current_size);
+            if (!ctx->_sink_body(boost::asio::buffer_cast<const uint8_t *>(ctx->response_buf().data()), size))
+            {
+                ctx->report_error("Failed to consume response body", boost::system::error_code());
+                return;
+            }
+            ctx->m_current_size += size;
+            ctx->response_buf().consume(size);
+            async_read_until_buffersize(std::min(CHUNK_SIZE, ctx->m_known_size - ctx->m_current_size),
+                    boost::bind(&client::handle_read_content, this, boost::asio::placeholders::error, ctx), ctx);
+        }
         else if (ctx->m_current_size < ctx->m_known_size)
         {
+            auto writeBuffer = ctx->_get_writebuffer();
             // more data need to be read
-            writeBuffer.putn(boost::asio::buffer_cast<const uint8_t *>(ctx->m_response_buf.data()), std::min(ctx->m_response_buf.size(), ctx->m_known_size - ctx->m_current_size)).then([=](size_t writtenSize) {
+            writeBuffer.putn(boost::asio::buffer_cast<const uint8_t *>(ctx->response_buf().data()), std::min(ctx->response_buf().size(), ctx->m_known_size - ctx->m_current_size)).then([=](size_t writtenSize) {
                 ctx->m_current_size += writtenSize;
-                ctx->m_response_buf.consume(writtenSize);
+                ctx->response_buf().consume(writtenSize);
                 async_read_until_buffersize(std::min(CHUNK_SIZE, ctx->m_known_size - ctx->m_current_size),
                         boost::bind(&client::handle_read_content, this, boost::asio::placeholders::error, ctx), ctx);
             });
         }
         else
         {
-            writeBuffer.close(std::ios_base::out).get();
+            ctx->_close_writebuffer();
             ctx->complete_request(ctx->m_current_size);
         }
     }
@@ -2346,22 +3443,40 @@ private:
     std::unique_ptr<client> m_client;
     http::uri m_address;
 
+    // The URI request paths are appended to. For 'unix://' addresses the path names the socket,
+    // so requests are made relative to the root of 'localhost' instead.
+    http::uri m_request_base;
+
+    static bool is_local(const http::uri &address)
+    {
+        return address.scheme() == U("unix");
+    }
+
 public:
     linux_client(const http::uri &address, const http_client_config& client_config) 
         : _http_client_communicator(address, client_config)
-        , m_address(address) {}
+        , m_address(address)
+        , m_request_base(is_local(address) ? http::uri(U("http://localhost/")) : address) {}
 
     unsigned long open()
     {
-        m_client.reset(new client(crossplat::threadpool::shared_instance().service()));
+        m_client.reset(new client(crossplat::threadpool::shared_instance().service(),
+            is_local(m_address) ? http::uri::decode(m_address.path()) : std::string(),
+            client_config().socket_options()));
         return 0;
     }
 
+    pplx::task<void> prewarm(size_t connections)
+    {
+        ensure_opened();
+        return m_client->prewarm(connections, m_request_base, shared_from_this());
+    }
+
     void send_request(request_context* request_ctx)
     {
         auto linux_ctx = static_cast<linux_request_context*>(request_ctx);
 
-        auto encoded_resource = uri_builder(m_address).append(linux_ctx->m_request.relative_uri()).to_uri();
+        auto encoded_resource = uri_builder(m_request_base).append(linux_ctx->m_request.relative_uri()).to_uri();
 
         linux_ctx->m_what = encoded_resource;
 
@@ -2373,68 +3488,1712 @@ public:
         m_client->send_request(linux_ctx, secs * 1000);
     }
 };
-#endif
 
-} // namespace details
+// Size of the receive windows we advertise, for the connection and for each stream.
+static const uint32_t http2_local_window_size = 1024 * 1024;
 
-// Helper function to check to make sure the uri is valid.
-static void verify_uri(const uri &uri)
+class linux_http2_client;
+
+// State of a single request/response exchange on an HTTP/2 connection.
+struct http2_stream
 {
-    // Somethings like proper URI schema are verified by the URI class.
-    // We only need to check certain things specific to HTTP.
-    if( uri.scheme() != U("http") && uri.scheme() != U("https") )
+    http2_stream(linux_request_context *ctx, uint32_t id, int timeout, int64_t send_window)
+        : m_ctx(ctx), m_id(id), m_timeout(timeout), m_send_window(send_window), m_recv_consumed(0), m_recv_buffered(0),
+          m_delivering(false), m_end_received(false), m_body_remaining(0), m_known_length(false), m_body_offset(0), m_body_length(0),
+          m_reading_body(false), m_body_done(false), m_request_sent(false), m_headers_received(false), m_closed(false)
     {
-        throw std::invalid_argument("URI scheme must be 'http' or 'https'");
     }
 
-    if(uri.host().empty())
-    {
-        throw std::invalid_argument("URI must contain a hostname.");
-    }
-}
+    linux_request_context *m_ctx;
+    uint32_t m_id;
+    int m_timeout;
+
+    // Flow control: what we may still send, and what we have consumed without updating the peer.
+    int64_t m_send_window;
+    size_t m_recv_consumed;
+
+    // Response DATA received but not yet handed to the response, each payload with the length of the frame it
+    // came in; and the total of those lengths. The stream window is only given back as payloads are handed
+    // over, one at a time, so a slow consumer holds back this stream's sender and no other.
+    std::deque<std::pair<std::vector<uint8_t>, uint32_t>> m_recv_pending;
+    size_t m_recv_buffered;
+    bool m_delivering;
+    bool m_end_received;
+
+    // Request body, read in chunks and sent as DATA frames as the windows allow.
+    concurrency::streams::streambuf<uint8_t> m_body;
+    size_t m_body_remaining;
+    bool m_known_length;
+    std::vector<uint8_t> m_body_buffer;
+    size_t m_body_offset;
+    size_t m_body_length;
+    bool m_reading_body;
+    bool m_body_done;
+    bool m_request_sent;
+
+    bool m_headers_received;
+    bool m_closed;
+};
 
-class http_network_handler : public http_pipeline_stage
+// HTTP/2 connection (RFC 7540) over cleartext TCP with prior knowledge: the connection preface is sent
+// straight away, without an HTTP/1.1 Upgrade. Requests are multiplexed as concurrent streams, and all
+// connection state is only touched on the connection's strand.
+class http2_connection : public std::enable_shared_from_this<http2_connection>
 {
 public:
-
-    http_network_handler(const uri &base_uri, const http_client_config& client_config) :
-#if defined(__cplusplus_winrt)
-        m_http_client_impl(std::make_shared<details::winrt_client>(base_uri, client_config))
-#elif defined(WIN32)
-        m_http_client_impl(std::make_shared<details::winhttp_client>(base_uri, client_config))
-#else // LINUX
-        m_http_client_impl(std::make_shared<details::linux_client>(base_uri, client_config))
-#endif
+    http2_connection(boost::asio::io_service &io_service, const http::uri &address, const socket_options &options)
+        : m_io_service(io_service)
+        , m_strand(io_service)
+        , m_socket(io_service)
+        , m_resolver(io_service)
+        , m_address(address)
+        , m_options(options)
+        , m_state(state_idle)
+        , m_usable(true)
+        , m_next_stream_id(1)
+        , m_send_window(http2::default_initial_window_size)
+        , m_peer_initial_window(http2::default_initial_window_size)
+        , m_peer_max_frame_size(http2::default_max_frame_size)
+        , m_peer_max_streams(http2::initial_max_concurrent_streams)
+        , m_settings_received(false)
+        , m_refused_in_a_row(0)
+        , m_recv_consumed(0)
+        , m_writing(false)
+        , m_continuation_stream(0)
+        , m_header_end_stream(false)
     {
     }
 
-    virtual pplx::task<http_response> propagate(http_request request)
+    // Whether new requests may still be started on this connection.
+    bool usable() const
     {
+        return m_usable;
+    }
 
-#if defined(__cplusplus_winrt)
-        details::request_context * context = details::winrt_request_context::create_request_context(m_http_client_impl, request);
-#elif defined(WIN32)
-        details::request_context * context = details::winhttp_request_context::create_request_context(m_http_client_impl, request);
-#else // LINUX
-        details::request_context * context = details::linux_request_context::create_request_context(m_http_client_impl, request);
-#endif
+    // Starts a request on this connection. May be called from any thread.
+    void submit(linux_request_context *ctx, int timeout)
+    {
+        auto self = shared_from_this();
+        m_strand.post([self, ctx, timeout]() { self->start_request(ctx, timeout); });
+    }
 
-        // Use a task to externally signal the final result and completion of the task.
-        auto result_task = pplx::create_task(context->m_request_completion);
+    // Connects ahead of traffic. The task completes once the connection is open.
+    pplx::task<void> prewarm()
+    {
+        pplx::task_completion_event<void> opened;
+        auto self = shared_from_this();
+        m_strand.post([self, opened]()
+        {
+            if (self->m_state == state_open)
+            {
+                opened.set();
+                return;
+            }
+            if (self->m_state == state_closed)
+            {
+                opened.set_exception(http_exception(U("Connection closed before it was opened")));
+                return;
+            }
+            if (self->m_state == state_idle)
+            {
+                self->connect();
+            }
+            self->m_open_waiters.push_back(opened);
+        });
+        return pplx::create_task(opened);
+    }
+
+    // Stops new requests and closes the connection once the active ones have finished.
+    void shutdown()
+    {
+        m_usable = false;
+        auto self = shared_from_this();
+        m_strand.post([self]()
+        {
+            if (self->m_streams.empty())
+            {
+                self->close_connection(http2::error_codes::no_error);
+            }
+        });
+    }
+
+private:
+    typedef std::map<uint32_t, std::shared_ptr<http2_stream>> stream_map;
+
+    enum connection_state { state_idle, state_connecting, state_open, state_closed };
+
+    //
+    // Starting streams.
+    //
+
+    void start_request(linux_request_context *ctx, int timeout)
+    {
+        if (m_state == state_closed || !m_usable)
+        {
+            resubmit(ctx, timeout);
+            return;
+        }
+        if (m_state == state_idle)
+        {
+            connect();
+        }
+        if (m_streams.size() >= m_peer_max_streams)
+        {
+            m_waiting.push_back(std::make_pair(ctx, timeout));
+            return;
+        }
+        open_stream(ctx, timeout);
+    }
+
+    void start_waiting()
+    {
+        while (!m_waiting.empty() && m_streams.size() < m_peer_max_streams && m_state != state_closed)
+        {
+            auto next = m_waiting.front();
+            m_waiting.pop_front();
+            start_request(next.first, next.second);
+        }
+    }
+
+    // Hands a request that never got a stream here to another connection.
+    static void resubmit(linux_request_context *ctx, int timeout);
+
+    void open_stream(linux_request_context *ctx, int timeout)
+    {
+        const uint32_t id = m_next_stream_id;
+        if (id > 0x7fffffff)
+        {
+            // Out of stream ids; the client will open a new connection.
+            m_usable = false;
+            resubmit(ctx, timeout);
+            return;
+        }
+        m_next_stream_id += 2;
+
+        auto stream = std::make_shared<http2_stream>(ctx, id, timeout, m_peer_initial_window);
+        auto &request = ctx->m_request;
+        if (request.body())
+        {
+            stream->m_body = ctx->_get_readbuffer();
+            stream->m_known_length = request.headers().match(header_ids::content_length, stream->m_body_remaining);
+        }
+        const bool has_body = request.body() && !(stream->m_known_length && stream->m_body_remaining == 0);
+        if (!has_body)
+        {
+            stream->m_body_done = true;
+            stream->m_request_sent = true;
+        }
+        m_streams[id] = stream;
+
+        std::vector<uint8_t> block;
+        m_encoder.encode(request_fields(ctx), block);
+        write_header_block(id, block, !has_body);
+
+        ctx->m_timer.reset(new boost::asio::deadline_timer(m_io_service));
+        ctx->m_timer->expires_from_now(boost::posix_time::milliseconds(timeout));
+        ctx->m_timer->async_wait(m_strand.wrap(boost::bind(&http2_connection::handle_stream_timeout, shared_from_this(), boost::asio::placeholders::error, id)));
+
+        if (has_body)
+        {
+            read_body(stream);
+        }
+    }
+
+    // Builds the request's header list: pseudo-headers first, then the regular fields in lower case,
+    // leaving out those specific to HTTP/1.1 connections.
+    static std::vector<http2::header_field> request_fields(linux_request_context *ctx)
+    {
+        const auto &what = ctx->m_what;
+        const auto &headers = ctx->m_request.headers();
+
+        std::string authority;
+        if (!headers.match(header_ids::host, authority))
+        {
+            authority = what.host();
+            if (what.port() != 0 && what.port() != 80)
+            {
+                authority += ":" + utility::conversions::print_string(what.port());
+            }
+        }
+        std::string path = what.path().empty() ? std::string("/") : what.path();
+        if (!what.query().empty())
+        {
+            path += "?" + what.query();
+        }
+
+        std::vector<http2::header_field> fields;
+        fields.reserve(headers.size() + 4);
+        fields.push_back(http2::header_field(":method", ctx->m_request.method()));
+        fields.push_back(http2::header_field(":scheme", "http"));
+        fields.push_back(http2::header_field(":authority", authority));
+        fields.push_back(http2::header_field(":path", path));
+
+        for (auto iter = headers.begin(); iter != headers.end(); ++iter)
+        {
+            std::string name = iter->first;
+            std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+            if (name == "connection" || name == "keep-alive" || name == "proxy-connection"
+                || name == "transfer-encoding" || name == "upgrade" || name == "host"
+                || (name == "te" && iter->second != "trailers"))
+            {
+                continue;
+            }
+            fields.push_back(http2::header_field(std::move(name), iter->second));
+        }
+        return fields;
+    }
+
+    // Sends a header block as a HEADERS frame, followed by CONTINUATION frames if it does not fit.
+    void write_header_block(uint32_t id, const std::vector<uint8_t> &block, bool end_stream)
+    {
+        size_t offset = 0;
+        uint8_t type = http2::frame_types::headers;
+        do
+        {
+            const size_t length = std::min(block.size() - offset, static_cast<size_t>(m_peer_max_frame_size));
+            uint8_t flags = 0;
+            if (type == http2::frame_types::headers && end_stream)
+            {
+                flags |= http2::frame_flags::end_stream;
+            }
+            if (offset + length == block.size())
+            {
+                flags |= http2::frame_flags::end_headers;
+            }
+            write_frame(type, flags, id, block.empty() ? nullptr : &block[offset], length);
+            offset += length;
+            type = http2::frame_types::continuation;
+        }
+        while (offset < block.size());
+    }
+
+    //
+    // Request bodies.
+    //
+
+    void read_body(const std::shared_ptr<http2_stream> &stream)
+    {
+        size_t to_read = CHUNK_SIZE;
+        if (stream->m_known_length)
+        {
+            to_read = std::min(to_read, stream->m_body_remaining);
+        }
+        stream->m_body_buffer.resize(std::max(to_read, static_cast<size_t>(1)));
+        stream->m_reading_body = true;
+
+        auto self = shared_from_this();
+        stream->m_body.getn(&stream->m_body_buffer[0], to_read).then([self, stream](pplx::task<size_t> op)
+        {
+            size_t read = 0;
+            bool failed = false;
+            try
+            {
+                read = op.get();
+            }
+            catch (...)
+            {
+                failed = true;
+            }
+            self->m_strand.post([self, stream, read, failed]() { self->handle_body_read(stream, read, failed); });
+        });
+    }
+
+    void handle_body_read(const std::shared_ptr<http2_stream> &stream, size_t read, bool failed)
+    {
+        stream->m_reading_body = false;
+        if (stream->m_closed)
+        {
+            return;
+        }
+        if (failed)
+        {
+            reset_stream(stream, http2::error_codes::cancel, "Failed to read request body", boost::system::error_code());
+            return;
+        }
+
+        stream->m_body_offset = 0;
+        stream->m_body_length = read;
+        if (stream->m_known_length)
+        {
+            stream->m_body_remaining -= std::min(read, stream->m_body_remaining);
+        }
+        if (read == 0 || (stream->m_known_length && stream->m_body_remaining == 0))
+        {
+            stream->m_body_done = true;
+        }
+        stream->m_ctx->m_current_size += read;
+        send_body(stream);
+    }
+
+    // Sends as much of the buffered body as the flow control windows allow.
+    void send_body(const std::shared_ptr<http2_stream> &stream)
+    {
+        while (stream->m_body_offset < stream->m_body_length)
+        {
+            const int64_t window = std::min(stream->m_send_window, m_send_window);
+            if (window <= 0)
+            {
+                // Blocked until the peer sends a WINDOW_UPDATE or changes its settings.
+                return;
+            }
+            const size_t length = static_cast<size_t>(std::min(static_cast<int64_t>(std::min(stream->m_body_length - stream->m_body_offset, static_cast<size_t>(m_peer_max_frame_size))), window));
+            const bool last = stream->m_body_done && stream->m_body_offset + length == stream->m_body_length;
+
+            write_frame(http2::frame_types::data, last ? http2::frame_flags::end_stream : 0, stream->m_id, &stream->m_body_buffer[stream->m_body_offset], length);
+            stream->m_body_offset += length;
+            stream->m_send_window -= length;
+            m_send_window -= length;
+            if (last)
+            {
+                stream->m_request_sent = true;
+            }
+        }
+
+        if (stream->m_body_done)
+        {
+            if (!stream->m_request_sent)
+            {
+                // The body ended on a chunk boundary.
+                write_frame(http2::frame_types::data, http2::frame_flags::end_stream, stream->m_id, nullptr, 0);
+                stream->m_request_sent = true;
+            }
+        }
+        else
+        {
+            read_body(stream);
+        }
+    }
+
+    void resume_senders()
+    {
+        for (auto iter = m_streams.begin(); iter != m_streams.end(); ++iter)
+        {
+            const auto &stream = iter->second;
+            if (!stream->m_reading_body && stream->m_body_offset < stream->m_body_length)
+            {
+                send_body(stream);
+            }
+        }
+    }
+
+    //
+    // Writing.
+    //
+
+    void write_frame(uint8_t type, uint8_t flags, uint32_t stream_id, const uint8_t *payload, size_t length)
+    {
+        const size_t offset = m_write_pending.size();
+        m_write_pending.resize(offset + http2::frame_header_size);
+        http2::frame_header(static_cast<uint32_t>(length), type, flags, stream_id).write(&m_write_pending[offset]);
+        if (length != 0)
+        {
+            m_write_pending.insert(m_write_pending.end(), payload, payload + length);
+        }
+        flush();
+    }
+
+    void write_rst_stream(uint32_t id, uint32_t error_code)
+    {
+        std::vector<uint8_t> payload;
+        http2::append_uint32(payload, error_code);
+        write_frame(http2::frame_types::rst_stream, 0, id, &payload[0], payload.size());
+    }
+
+    void write_window_update(uint32_t id, uint32_t increment)
+    {
+        std::vector<uint8_t> payload;
+        http2::append_uint32(payload, increment);
+        write_frame(http2::frame_types::window_update, 0, id, &payload[0], payload.size());
+    }
+
+    // Frames are collected while a write is in flight and sent together when it completes.
+    void flush()
+    {
+        if (m_writing || m_write_pending.empty() || m_state != state_open)
+        {
+            return;
+        }
+        m_writing = true;
+        m_write_buffer.swap(m_write_pending);
+        m_write_pending.clear();
+        boost::asio::async_write(m_socket, boost::asio::buffer(m_write_buffer),
+            m_strand.wrap(boost::bind(&http2_connection::handle_write, shared_from_this(), boost::asio::placeholders::error)));
+    }
+
+    void handle_write(const boost::system::error_code& ec)
+    {
+        m_writing = false;
+        m_write_buffer.clear();
+        if (ec)
+        {
+            fail_connection("Failed to write to HTTP/2 connection", ec);
+        }
+        else
+        {
+            flush();
+        }
+    }
+
+    //
+    // Connecting.
+    //
+
+    void connect()
+    {
+        m_state = state_connecting;
+
+        // The preface, our settings and the connection window update go out ahead of everything else.
+        m_write_pending.assign(http2::connection_preface, http2::connection_preface + http2::connection_preface_size);
+        std::vector<uint8_t> settings;
+        append_setting(settings, http2::settings_ids::enable_push, 0);
+        append_setting(settings, http2::settings_ids::initial_window_size, http2_local_window_size);
+        write_frame(http2::frame_types::settings, 0, 0, &settings[0], settings.size());
+        write_window_update(0, http2_local_window_size - http2::default_initial_window_size);
+
+        const int port = m_address.port() == 0 ? 80 : m_address.port();
+        tcp::resolver::query query(m_address.host(), utility::conversions::print_string(port));
+        m_resolver.async_resolve(query, m_strand.wrap(boost::bind(&http2_connection::handle_resolve, shared_from_this(), boost::asio::placeholders::error, boost::asio::placeholders::iterator)));
+    }
+
+    static void append_setting(std::vector<uint8_t> &out, uint16_t id, uint32_t value)
+    {
+        out.push_back(static_cast<uint8_t>(id >> 8));
+        out.push_back(static_cast<uint8_t>(id));
+        http2::append_uint32(out, value);
+    }
+
+    void handle_resolve(const boost::system::error_code& ec, tcp::resolver::iterator endpoints)
+    {
+        if (ec)
+        {
+            fail_connection("Error resolving address", ec);
+        }
+        else
+        {
+            start_connect(endpoints);
+        }
+    }
+
+    void start_connect(tcp::resolver::iterator endpoints)
+    {
+        tcp::endpoint endpoint = *endpoints;
+        boost::system::error_code ec;
+        m_socket.open(endpoint.protocol(), ec);
+        if (ec)
+        {
+            fail_connection("Failed to open socket", ec);
+            return;
+        }
+        apply_connect_options(m_socket, m_options, true);
+        m_socket.async_connect(endpoint, m_strand.wrap(boost::bind(&http2_connection::handle_connect, shared_from_this(), boost::asio::placeholders::error, ++endpoints)));
+    }
+
+    void handle_connect(const boost::system::error_code& ec, tcp::resolver::iterator endpoints)
+    {
+        if (m_state == state_closed)
+        {
+            return;
+        }
+        if (!ec)
+        {
+            m_state = state_open;
+            apply_connected_options(m_socket, m_options, true);
+            for (auto iter = m_open_waiters.begin(); iter != m_open_waiters.end(); ++iter)
+            {
+                iter->set();
+            }
+            m_open_waiters.clear();
+            flush();
+            read_frame_header();
+        }
+        else if (endpoints == tcp::resolver::iterator())
+        {
+            fail_connection("Failed to connect to any resolved endpoint", ec);
+        }
+        else
+        {
+            boost::system::error_code ignore;
+            m_socket.close(ignore);
+            start_connect(endpoints);
+        }
+    }
+
+    //
+    // Reading.
+    //
+
+    void read_frame_header()
+    {
+        boost::asio::async_read(m_socket, boost::asio::buffer(m_read_header, http2::frame_header_size),
+            m_strand.wrap(boost::bind(&http2_connection::handle_frame_header, shared_from_this(), boost::asio::placeholders::error)));
+    }
+
+    void handle_frame_header(const boost::system::error_code& ec)
+    {
+        if (ec)
+        {
+            fail_connection("Failed to read from HTTP/2 connection", ec);
+            return;
+        }
+
+        m_frame = http2::frame_header::read(m_read_header);
+        if (m_frame.length > http2::default_max_frame_size)
+        {
+            protocol_error(http2::error_codes::frame_size_error, "Received an oversized HTTP/2 frame");
+            return;
+        }
+        m_read_payload.resize(m_frame.length);
+        if (m_frame.length == 0)
+        {
+            handle_frame_payload(ec);
+        }
+        else
+        {
+            boost::asio::async_read(m_socket, boost::asio::buffer(m_read_payload),
+                m_strand.wrap(boost::bind(&http2_connection::handle_frame_payload, shared_from_this(), boost::asio::placeholders::error)));
+        }
+    }
+
+    void handle_frame_payload(const boost::system::error_code& ec)
+    {
+        if (ec)
+        {
+            fail_connection("Failed to read from HTTP/2 connection", ec);
+            return;
+        }
+
+        // Nothing but the rest of a header block may come between HEADERS and its last CONTINUATION.
+        if (m_continuation_stream != 0 && (m_frame.type != http2::frame_types::continuation || m_frame.stream_id != m_continuation_stream))
+        {
+            protocol_error(http2::error_codes::protocol_error, "Expected an HTTP/2 CONTINUATION frame");
+            return;
+        }
+
+        switch (m_frame.type)
+        {
+        case http2::frame_types::data:
+            handle_data();
+            break;
+        case http2::frame_types::headers:
+            handle_headers();
+            break;
+        case http2::frame_types::continuation:
+            handle_continuation();
+            break;
+        case http2::frame_types::rst_stream:
+            handle_rst_stream();
+            break;
+        case http2::frame_types::settings:
+            handle_settings();
+            break;
+        case http2::frame_types::push_promise:
+            // We disable push in our settings.
+            protocol_error(http2::error_codes::protocol_error, "Received an HTTP/2 PUSH_PROMISE with push disabled");
+            break;
+        case http2::frame_types::ping:
+            handle_ping();
+            break;
+        case http2::frame_types::goaway:
+            handle_goaway();
+            break;
+        case http2::frame_types::window_update:
+            handle_window_update();
+            break;
+        default:
+            // PRIORITY and unknown frame types are ignored.
+            break;
+        }
+
+        if (m_state == state_open)
+        {
+            read_frame_header();
+        }
+    }
+
+    // Strips padding (and priority fields, for HEADERS) off the current frame's payload.
+    bool frame_content(size_t &offset, size_t &length)
+    {
+        offset = 0;
+        length = m_read_payload.size();
+        size_t padding = 0;
+        if (m_frame.flags & http2::frame_flags::padded)
+        {
+            if (length < 1)
+            {
+                return false;
+            }
+            padding = m_read_payload[0];
+            offset = 1;
+        }
+        if (m_frame.type == http2::frame_types::headers && (m_frame.flags & http2::frame_flags::priority))
+        {
+            offset += 5;
+        }
+        if (offset + padding > length)
+        {
+            return false;
+        }
+        length -= offset + padding;
+        return true;
+    }
+
+    std::shared_ptr<http2_stream> find_stream(uint32_t id) const
+    {
+        auto iter = m_streams.find(id);
+        return iter == m_streams.end() ? std::shared_ptr<http2_stream>() : iter->second;
+    }
+
+    void handle_data()
+    {
+        size_t offset, length;
+        if (m_frame.stream_id == 0 || !frame_content(offset, length))
+        {
+            protocol_error(http2::error_codes::protocol_error, "Invalid HTTP/2 DATA frame");
+            return;
+        }
+
+        // The connection window is given back as frames arrive, whatever becomes of them, so that
+        // the other streams keep going while one stream's body is consumed slowly.
+        const uint32_t frame_length = m_frame.length;
+        consume_connection_window(frame_length);
+
+        auto stream = find_stream(m_frame.stream_id);
+        if (!stream)
+        {
+            return;
+        }
+        if (!stream->m_headers_received)
+        {
+            reset_stream(stream, http2::error_codes::protocol_error, "Received HTTP/2 DATA before the response headers", boost::system::error_code());
+            return;
+        }
+        if (stream->m_recv_buffered + stream->m_recv_consumed + frame_length > http2_local_window_size)
+        {
+            reset_stream(stream, http2::error_codes::flow_control_error, "HTTP/2 server exceeded the stream window", boost::system::error_code());
+            return;
+        }
+
+        if (length == 0)
+        {
+            consume_stream_window(stream.get(), frame_length);
+        }
+        else
+        {
+            std::vector<uint8_t> payload;
+            if (offset == 0 && length == m_read_payload.size())
+            {
+                payload.swap(m_read_payload);
+            }
+            else
+            {
+                payload.assign(m_read_payload.begin() + offset, m_read_payload.begin() + offset + length);
+            }
+            stream->m_recv_pending.push_back(std::make_pair(std::move(payload), frame_length));
+            stream->m_recv_buffered += frame_length;
+        }
+        if (m_frame.flags & http2::frame_flags::end_stream)
+        {
+            stream->m_end_received = true;
+        }
+        deliver_data(stream);
+    }
+
+    // Hands the stream's oldest pending DATA payload to the response, unless one is being handed over
+    // already, and completes the stream once all are and END_STREAM has arrived.
+    void deliver_data(const std::shared_ptr<http2_stream> &stream)
+    {
+        if (stream->m_delivering || stream->m_closed)
+        {
+            return;
+        }
+        if (stream->m_recv_pending.empty())
+        {
+            if (stream->m_end_received)
+            {
+                complete_stream(stream);
+            }
+            return;
+        }
+
+        auto payload = std::make_shared<std::vector<uint8_t>>(std::move(stream->m_recv_pending.front().first));
+        const uint32_t frame_length = stream->m_recv_pending.front().second;
+        stream->m_recv_pending.pop_front();
+        stream->m_delivering = true;
+
+        auto self = shared_from_this();
+        if (stream->m_ctx->_has_body_sink())
+        {
+            const bool failed = !stream->m_ctx->_sink_body(&(*payload)[0], payload->size());
+            handle_data_delivered(stream, frame_length, payload->size(), failed);
+            return;
+        }
+
+        auto delivered = [self, stream, payload, frame_length](bool failed)
+        {
+            self->m_strand.post([self, stream, payload, frame_length, failed]()
+            {
+                self->handle_data_delivered(stream, frame_length, payload->size(), failed);
+            });
+        };
+        if (stream->m_ctx->_has_body_callback())
+        {
+            stream->m_ctx->_deliver_body(&(*payload)[0], payload->size()).then([delivered](pplx::task<void> op)
+            {
+                bool failed = false;
+                try
+                {
+                    op.get();
+                }
+                catch (...)
+                {
+                    failed = true;
+                }
+                delivered(failed);
+            });
+        }
+        else
+        {
+            auto writebuf = stream->m_ctx->_get_writebuffer();
+            writebuf.putn(&(*payload)[0], payload->size()).then([delivered](pplx::task<size_t> op)
+            {
+                bool failed = false;
+                try
+                {
+                    op.get();
+                }
+                catch (...)
+                {
+                    failed = true;
+                }
+                delivered(failed);
+            });
+        }
+    }
+
+    void handle_data_delivered(const std::shared_ptr<http2_stream> &stream, uint32_t frame_length, size_t length, bool failed)
+    {
+        stream->m_delivering = false;
+        stream->m_recv_buffered -= frame_length;
+        if (stream->m_closed)
+        {
+            return;
+        }
+        if (failed)
+        {
+            reset_stream(stream, http2::error_codes::cancel, "Failed to write response body", boost::system::error_code());
+            return;
+        }
+
+        consume_stream_window(stream.get(), frame_length);
+        stream->m_ctx->m_current_size += length;
+        deliver_data(stream);
+    }
+
+    // Gives received DATA back to the peer's connection window once half of ours has been used.
+    void consume_connection_window(uint32_t length)
+    {
+        m_recv_consumed += length;
+        if (m_recv_consumed >= http2_local_window_size / 2)
+        {
+            write_window_update(0, static_cast<uint32_t>(m_recv_consumed));
+            m_recv_consumed = 0;
+        }
+    }
+
+    // Gives DATA handed to the response back to the peer's stream window once half of ours has been used.
+    void consume_stream_window(http2_stream *stream, uint32_t length)
+    {
+        stream->m_recv_consumed += length;
+        if (stream->m_recv_consumed >= http2_local_window_size / 2)
+        {
+            write_window_update(stream->m_id, static_cast<uint32_t>(stream->m_recv_consumed));
+            stream->m_recv_consumed = 0;
+        }
+    }
+
+    void handle_headers()
+    {
+        size_t offset, length;
+        if (m_frame.stream_id == 0 || !frame_content(offset, length))
+        {
+            protocol_error(http2::error_codes::protocol_error, "Invalid HTTP/2 HEADERS frame");
+            return;
+        }
+        m_header_block.assign(m_read_payload.begin() + offset, m_read_payload.begin() + offset + length);
+        m_header_end_stream = (m_frame.flags & http2::frame_flags::end_stream) != 0;
+        if (m_frame.flags & http2::frame_flags::end_headers)
+        {
+            handle_header_block(m_frame.stream_id);
+        }
+        else
+        {
+            m_continuation_stream = m_frame.stream_id;
+        }
+    }
+
+    void handle_continuation()
+    {
+        if (m_continuation_stream == 0)
+        {
+            protocol_error(http2::error_codes::protocol_error, "Unexpected HTTP/2 CONTINUATION frame");
+            return;
+        }
+        m_header_block.insert(m_header_block.end(), m_read_payload.begin(), m_read_payload.end());
+        if (m_frame.flags & http2::frame_flags::end_headers)
+        {
+            const uint32_t id = m_continuation_stream;
+            m_continuation_stream = 0;
+            handle_header_block(id);
+        }
+    }
+
+    void handle_header_block(uint32_t id)
+    {
+        // Blocks are always decoded, even for streams we no longer track, to keep the tables in step.
+        std::vector<http2::header_field> fields;
+        if (!m_decoder.decode(m_header_block.empty() ? nullptr : &m_header_block[0], m_header_block.size(), fields))
+        {
+            protocol_error(http2::error_codes::compression_error, "Invalid HTTP/2 header block");
+            return;
+        }
+        m_header_block.clear();
+
+        auto stream = find_stream(id);
+        if (!stream)
+        {
+            return;
+        }
+
+        if (stream->m_headers_received)
+        {
+            // Trailers. Only a closing block is allowed; the stream completes once its DATA is delivered.
+            if (!m_header_end_stream)
+            {
+                reset_stream(stream, http2::error_codes::protocol_error, "Received HTTP/2 trailers without END_STREAM", boost::system::error_code());
+            }
+            else
+            {
+                stream->m_end_received = true;
+                deliver_data(stream);
+            }
+            return;
+        }
+
+        status_code status = 0;
+        bool has_status = false;
+        for (auto iter = fields.begin(); iter != fields.end(); ++iter)
+        {
+            if (iter->first == ":status")
+            {
+                has_status = http::bind(iter->second, status);
+            }
+        }
+        if (!has_status)
+        {
+            reset_stream(stream, http2::error_codes::protocol_error, "Invalid HTTP/2 response status", boost::system::error_code());
+            return;
+        }
+        if (status >= 100 && status < 200)
+        {
+            // Informational responses are skipped; the final one follows.
+            return;
+        }
+
+        auto ctx = stream->m_ctx;
+        ctx->m_response.set_status_code(status);
+        for (auto iter = fields.begin(); iter != fields.end(); ++iter)
+        {
+            if (!iter->first.empty() && iter->first[0] != ':')
+            {
+                ctx->m_response.headers().add(iter->first, iter->second);
+            }
+        }
+        stream->m_headers_received = true;
+        m_refused_in_a_row = 0;
+        ctx->m_current_size = 0;
+        ctx->complete_headers();
+
+        if (m_header_end_stream)
+        {
+            complete_stream(stream);
+        }
+    }
+
+    void handle_rst_stream()
+    {
+        if (m_frame.stream_id == 0 || m_frame.length != 4)
+        {
+            protocol_error(http2::error_codes::frame_size_error, "Invalid HTTP/2 RST_STREAM frame");
+            return;
+        }
+        auto stream = find_stream(m_frame.stream_id);
+        if (stream)
+        {
+            const uint32_t error_code = http2::read_uint32(&m_read_payload[0]);
+            close_stream(stream);
+            if (error_code == http2::error_codes::refused_stream && !stream->m_body && m_refused_in_a_row < max_refused_in_a_row)
+            {
+                // The server did not act on the stream, so the request is safe to send again. It has fewer
+                // streams to spare than it advertised; wait for one of the open ones to finish first.
+                ++m_refused_in_a_row;
+                if (!m_streams.empty())
+                {
+                    m_peer_max_streams = std::min(m_peer_max_streams, static_cast<uint32_t>(m_streams.size()));
+                }
+                if (m_usable)
+                {
+                    m_waiting.push_front(std::make_pair(stream->m_ctx, stream->m_timeout));
+                }
+                else
+                {
+                    resubmit(stream->m_ctx, stream->m_timeout);
+                }
+            }
+            else
+            {
+                stream->m_ctx->request_context::report_error(0x8000000 | error_code, U("HTTP/2 stream reset by server"));
+            }
+            finish_stream();
+        }
+    }
+
+    void handle_settings()
+    {
+        if (m_frame.stream_id != 0 || m_frame.length % 6 != 0 || ((m_frame.flags & http2::frame_flags::ack) && m_frame.length != 0))
+        {
+            protocol_error(http2::error_codes::frame_size_error, "Invalid HTTP/2 SETTINGS frame");
+            return;
+        }
+        if (m_frame.flags & http2::frame_flags::ack)
+        {
+            return;
+        }
+        if (!m_settings_received)
+        {
+            // Without a limit in the server's first SETTINGS, there is none.
+            m_settings_received = true;
+            m_peer_max_streams = std::numeric_limits<uint32_t>::max();
+        }
+
+        for (size_t offset = 0; offset < m_read_payload.size(); offset += 6)
+        {
+            const uint16_t id = static_cast<uint16_t>((m_read_payload[offset] << 8) | m_read_payload[offset + 1]);
+            const uint32_t value = http2::read_uint32(&m_read_payload[offset + 2]);
+            switch (id)
+            {
+            case http2::settings_ids::header_table_size:
+                m_encoder.set_max_table_size(value);
+                break;
+            case http2::settings_ids::max_concurrent_streams:
+                m_peer_max_streams = value;
+                break;
+            case http2::settings_ids::initial_window_size:
+                {
+                    if (value > http2::max_window_size)
+                    {
+                        protocol_error(http2::error_codes::flow_control_error, "Invalid HTTP/2 initial window size");
+                        return;
+                    }
+                    // The change applies to the windows of all open streams.
+                    const int64_t delta = static_cast<int64_t>(value) - static_cast<int64_t>(m_peer_initial_window);
+                    for (auto iter = m_streams.begin(); iter != m_streams.end(); ++iter)
+                    {
+                        iter->second->m_send_window += delta;
+                    }
+                    m_peer_initial_window = value;
+                }
+                break;
+            case http2::settings_ids::max_frame_size:
+                if (value < http2::default_max_frame_size || value > http2::max_allowed_frame_size)
+                {
+                    protocol_error(http2::error_codes::protocol_error, "Invalid HTTP/2 max frame size");
+                    return;
+                }
+                m_peer_max_frame_size = value;
+                break;
+            default:
+                break;
+            }
+        }
+
+        write_frame(http2::frame_types::settings, http2::frame_flags::ack, 0, nullptr, 0);
+        resume_senders();
+        start_waiting();
+    }
+
+    void handle_ping()
+    {
+        if (m_frame.stream_id != 0 || m_frame.length != 8)
+        {
+            protocol_error(http2::error_codes::frame_size_error, "Invalid HTTP/2 PING frame");
+            return;
+        }
+        if (!(m_frame.flags & http2::frame_flags::ack))
+        {
+            write_frame(http2::frame_types::ping, http2::frame_flags::ack, 0, &m_read_payload[0], m_read_payload.size());
+        }
+    }
+
+    void handle_goaway()
+    {
+        if (m_frame.stream_id != 0 || m_frame.length < 8)
+        {
+            protocol_error(http2::error_codes::frame_size_error, "Invalid HTTP/2 GOAWAY frame");
+            return;
+        }
+        m_usable = false;
+
+        // Streams above the last one the server processed were never acted on, so they are safe to send again.
+        const uint32_t last_stream_id = http2::read_uint32(&m_read_payload[0]) & 0x7fffffff;
+        std::vector<std::shared_ptr<http2_stream>> unprocessed;
+        for (auto iter = m_streams.upper_bound(last_stream_id); iter != m_streams.end(); ++iter)
+        {
+            unprocessed.push_back(iter->second);
+        }
+        for (auto iter = unprocessed.begin(); iter != unprocessed.end(); ++iter)
+        {
+            close_stream(*iter);
+            if ((*iter)->m_body)
+            {
+                // Part of the body may have been consumed already.
+                (*iter)->m_ctx->report_error(U("HTTP/2 connection closed by server"), boost::system::error_code());
+            }
+            else
+            {
+                resubmit((*iter)->m_ctx, (*iter)->m_timeout);
+            }
+        }
+        resubmit_waiting();
+
+        if (m_streams.empty())
+        {
+            close_connection(http2::error_codes::no_error);
+        }
+    }
+
+    void handle_window_update()
+    {
+        if (m_frame.length != 4)
+        {
+            protocol_error(http2::error_codes::frame_size_error, "Invalid HTTP/2 WINDOW_UPDATE frame");
+            return;
+        }
+        const uint32_t increment = http2::read_uint32(&m_read_payload[0]) & 0x7fffffff;
+        if (m_frame.stream_id == 0)
+        {
+            if (increment == 0 || m_send_window + increment > http2::max_window_size)
+            {
+                protocol_error(http2::error_codes::flow_control_error, "Invalid HTTP/2 connection window update");
+                return;
+            }
+            m_send_window += increment;
+        }
+        else
+        {
+            auto stream = find_stream(m_frame.stream_id);
+            if (!stream)
+            {
+                return;
+            }
+            if (increment == 0 || stream->m_send_window + increment > http2::max_window_size)
+            {
+                reset_stream(stream, http2::error_codes::flow_control_error, "Invalid HTTP/2 stream window update", boost::system::error_code());
+                return;
+            }
+            stream->m_send_window += increment;
+        }
+        resume_senders();
+    }
+
+    //
+    // Closing streams and the connection.
+    //
+
+    void close_stream(const std::shared_ptr<http2_stream> &stream)
+    {
+        stream->m_closed = true;
+        m_streams.erase(stream->m_id);
+    }
+
+    void complete_stream(const std::shared_ptr<http2_stream> &stream)
+    {
+        if (!stream->m_request_sent)
+        {
+            // The server answered before reading all of the body; it does not need the rest.
+            write_rst_stream(stream->m_id, http2::error_codes::no_error);
+        }
+        close_stream(stream);
+
+        auto ctx = stream->m_ctx;
+        ctx->_close_writebuffer();
+        ctx->complete_request(ctx->m_current_size);
+
+        finish_stream();
+    }
+
+    void reset_stream(const std::shared_ptr<http2_stream> &stream, uint32_t error_code, const utility::string_t &message, const boost::system::error_code &ec)
+    {
+        write_rst_stream(stream->m_id, error_code);
+        close_stream(stream);
+        stream->m_ctx->report_error(message, ec);
+        finish_stream();
+    }
+
+    void finish_stream()
+    {
+        if (!m_usable && m_streams.empty())
+        {
+            close_connection(http2::error_codes::no_error);
+        }
+        else
+        {
+            start_waiting();
+        }
+    }
+
+    void handle_stream_timeout(const boost::system::error_code& ec, uint32_t id)
+    {
+        if (ec)
+        {
+            return;
+        }
+        auto stream = find_stream(id);
+        if (stream)
+        {
+            reset_stream(stream, http2::error_codes::cancel, "Request timed out", boost::asio::error::timed_out);
+        }
+    }
+
+    void resubmit_waiting()
+    {
+        std::deque<std::pair<linux_request_context *, int>> waiting;
+        waiting.swap(m_waiting);
+        for (auto iter = waiting.begin(); iter != waiting.end(); ++iter)
+        {
+            resubmit(iter->first, iter->second);
+        }
+    }
+
+    // Connection errors: tell the server with GOAWAY and fail everything on the connection.
+    void protocol_error(uint32_t error_code, const utility::string_t &message)
+    {
+        fail_connection(message, boost::system::error_code(), error_code);
+    }
+
+    void fail_connection(const utility::string_t &message, const boost::system::error_code &ec, uint32_t error_code = http2::error_codes::no_error)
+    {
+        if (m_state == state_closed)
+        {
+            return;
+        }
+        m_usable = false;
+
+        stream_map streams;
+        streams.swap(m_streams);
+        for (auto iter = streams.begin(); iter != streams.end(); ++iter)
+        {
+            iter->second->m_closed = true;
+            iter->second->m_ctx->report_error(message, ec);
+        }
+
+        // Requests that never got a stream do not depend on this connection.
+        resubmit_waiting();
+        close_connection(error_code);
+    }
+
+    void close_connection(uint32_t error_code)
+    {
+        if (m_state == state_closed)
+        {
+            return;
+        }
+
+        // Say goodbye if the socket is free; a write in flight will be cut short anyway.
+        boost::system::error_code ignore;
+        if (m_state == state_open && !m_writing)
+        {
+            std::vector<uint8_t> goaway(http2::frame_header_size);
+            http2::frame_header(8, http2::frame_types::goaway, 0, 0).write(&goaway[0]);
+            http2::append_uint32(goaway, 0);
+            http2::append_uint32(goaway, error_code);
+            boost::asio::write(m_socket, boost::asio::buffer(goaway), ignore);
+        }
+        m_state = state_closed;
+        m_usable = false;
+
+        for (auto iter = m_open_waiters.begin(); iter != m_open_waiters.end(); ++iter)
+        {
+            iter->set_exception(http_exception(U("Connection closed before it was opened")));
+        }
+        m_open_waiters.clear();
+
+        m_resolver.cancel();
+        m_socket.shutdown(tcp::socket::shutdown_both, ignore);
+        m_socket.close(ignore);
+    }
+
+    boost::asio::io_service &m_io_service;
+    boost::asio::io_service::strand m_strand;
+    tcp::socket m_socket;
+    tcp::resolver m_resolver;
+    http::uri m_address;
+    const socket_options m_options;
+
+    connection_state m_state;
+    std::atomic<bool> m_usable;
+
+    // Prewarm calls waiting for the connection to open.
+    std::vector<pplx::task_completion_event<void>> m_open_waiters;
+
+    stream_map m_streams;
+    std::deque<std::pair<linux_request_context *, int>> m_waiting;
+    uint32_t m_next_stream_id;
+
+    // Peer settings and our send window for the connection.
+    int64_t m_send_window;
+    uint32_t m_peer_initial_window;
+    uint32_t m_peer_max_frame_size;
+    uint32_t m_peer_max_streams;
+    bool m_settings_received;
+
+    // Streams refused by the server since it last answered one. Past the limit, a refused request fails.
+    static const int max_refused_in_a_row = 8;
+    int m_refused_in_a_row;
+
+    // Received DATA not yet returned to the peer's connection window.
+    size_t m_recv_consumed;
+
+    http2::hpack_encoder m_encoder;
+    http2::hpack_decoder m_decoder;
+
+    // Outgoing frames: m_write_buffer is being written, m_write_pending collects the next batch.
+    std::vector<uint8_t> m_write_buffer;
+    std::vector<uint8_t> m_write_pending;
+    bool m_writing;
+
+    // The frame being read.
+    uint8_t m_read_header[http2::frame_header_size];
+    http2::frame_header m_frame;
+    std::vector<uint8_t> m_read_payload;
+
+    // Header block being assembled from HEADERS and CONTINUATION frames.
+    std::vector<uint8_t> m_header_block;
+    uint32_t m_continuation_stream;
+    bool m_header_end_stream;
+};
+
+// HTTP/2 client: sends every request as a stream on a shared connection, opening a new connection
+// when the current one is closed or has been told to go away.
+class linux_http2_client : public _http_client_communicator
+{
+public:
+    linux_http2_client(const http::uri &address, const http_client_config& client_config)
+        : _http_client_communicator(address, client_config)
+        , m_address(address) {}
+
+    ~linux_http2_client()
+    {
+        if (m_connection)
+        {
+            m_connection->shutdown();
+        }
+    }
+
+    unsigned long open()
+    {
+        return 0;
+    }
+
+    void send_request(request_context* request_ctx)
+    {
+        auto linux_ctx = static_cast<linux_request_context*>(request_ctx);
+
+        linux_ctx->m_what = uri_builder(m_address).append(linux_ctx->m_request.relative_uri()).to_uri();
+
+        int secs = static_cast<int>(client_config().timeout().count());
+        connection()->submit(linux_ctx, secs * 1000);
+    }
+
+    void resubmit(linux_request_context *ctx, int timeout)
+    {
+        connection()->submit(ctx, timeout);
+    }
+
+    // All requests share a single connection, so there is only ever one to open.
+    pplx::task<void> prewarm(size_t connections)
+    {
+        if (connections == 0)
+        {
+            return _http_client_communicator::prewarm(connections);
+        }
+        return connection()->prewarm();
+    }
+
+private:
+    std::shared_ptr<http2_connection> connection()
+    {
+        pplx::scoped_critical_section l(m_connection_lock);
+        if (!m_connection || !m_connection->usable())
+        {
+            m_connection = std::make_shared<http2_connection>(crossplat::threadpool::shared_instance().service(), m_address, client_config().socket_options());
+        }
+        return m_connection;
+    }
+
+    http::uri m_address;
+    pplx::critical_section m_connection_lock;
+    std::shared_ptr<http2_connection> m_connection;
+};
+
+void http2_connection::resubmit(linux_request_context *ctx, int timeout)
+{
+    static_cast<linux_http2_client *>(ctx->m_http_client.get())->resubmit(ctx, timeout);
+}
+#endif
+
+} // namespace details
+
+// Helper function to check to make sure the uri is valid.
+static void verify_uri(const uri &uri)
+{
+    // Somethings like proper URI schema are verified by the URI class.
+    // We only need to check certain things specific to HTTP.
+#if !defined(_MS_WINDOWS)
+    // Unix domain sockets are named by the path alone, e.g. unix:///var/run/agent.sock.
+    if( uri.scheme() == U("unix") )
+    {
+        if(!uri.host().empty() || uri.path().empty() || uri.path() == U("/"))
+        {
+            throw std::invalid_argument("URI must be of the form 'unix:///path/to/socket'.");
+        }
+        return;
+    }
+#endif
+
+    if( uri.scheme() != U("http") && uri.scheme() != U("https") )
+    {
+        throw std::invalid_argument("URI scheme must be 'http' or 'https'");
+    }
+
+    if(uri.host().empty())
+    {
+        throw std::invalid_argument("URI must contain a hostname.");
+    }
+}
+
+// Helper function to check the uris of a client balancing over several backends.
+static const std::vector<uri> &verify_uris(const std::vector<uri> &uris)
+{
+    if(uris.empty())
+    {
+        throw std::invalid_argument("At least one URI must be given.");
+    }
+    std::for_each(uris.begin(), uris.end(), verify_uri);
+    return uris;
+}
+
+// Spreads requests over the client implementations of several equivalent base URIs. Each request
+// goes to the better of two backends picked at random, judged by their outstanding requests and
+// observed latency ("power of two choices"). Backends that keep failing are left out for a while.
+// Times are in utility::details::steady_clock_microseconds.
+class http_backend_balancer
+{
+public:
+
+    struct backend
+    {
+        backend(std::shared_ptr<details::_http_client_communicator> client)
+            : m_client(std::move(client)), m_outstanding(0), m_latency(0), m_sampled(0), m_consecutive_failures(0), m_ejected_until(0) {}
+
+        std::shared_ptr<details::_http_client_communicator> m_client;
+
+        // The fields below are guarded by the balancer's lock.
+        long m_outstanding;
+        // Moving average of the time to response headers, in microseconds; 0 until the first response.
+        double m_latency;
+        // When m_latency last took a sample.
+        uint64_t m_sampled;
+        int m_consecutive_failures;
+        uint64_t m_ejected_until;
+
+        // The latency average, drawn toward the average of the pool for as long as it takes no samples.
+        // Otherwise a backend that had a bad spell would lose every comparison, and so never get another
+        // request to show it is over.
+        double latency(uint64_t now, double pool_latency) const
+        {
+            if (m_latency == 0 || pool_latency == 0 || now <= m_sampled)
+            {
+                return m_latency;
+            }
+            const double idle_seconds = static_cast<double>(now - m_sampled) / 1000000.0;
+            return pool_latency + (m_latency - pool_latency) * std::exp(-idle_seconds / latency_decay_seconds);
+        }
+
+        // Expected cost of sending one more request here. Backends without a measurement yet cost
+        // nothing, so each one gets tried early on.
+        double cost(uint64_t now, double pool_latency) const
+        {
+            return latency(now, pool_latency) * static_cast<double>(m_outstanding + 1);
+        }
+    };
+
+    http_backend_balancer(std::vector<std::shared_ptr<details::_http_client_communicator>> clients)
+        : m_random(static_cast<unsigned int>(utility::details::steady_clock_microseconds()))
+    {
+        for (auto iter = clients.begin(); iter != clients.end(); ++iter)
+        {
+            m_backends.push_back(std::make_shared<backend>(*iter));
+        }
+    }
+
+    const std::vector<std::shared_ptr<backend>>& backends() const
+    {
+        return m_backends;
+    }
+
+    // Picks the backend for the next request and counts the request as outstanding there.
+    std::shared_ptr<backend> choose()
+    {
+        pplx::scoped_critical_section l(m_lock);
+
+        const uint64_t now = utility::details::steady_clock_microseconds();
+        const double average = pool_latency();
+        m_candidates.clear();
+        for (size_t i = 0; i < m_backends.size(); ++i)
+        {
+            if (m_backends[i]->m_ejected_until <= now)
+            {
+                m_candidates.push_back(i);
+            }
+        }
+        if (m_candidates.empty())
+        {
+            // Everything is ejected; better to keep trying than to fail every request.
+            for (size_t i = 0; i < m_backends.size(); ++i)
+            {
+                m_candidates.push_back(i);
+            }
+        }
+
+        const size_t count = m_candidates.size();
+        const size_t first = m_random() % count;
+        std::shared_ptr<backend> chosen = m_backends[m_candidates[first]];
+        if (count > 1)
+        {
+            // Draw the second one from the remaining candidates, so the two always differ.
+            size_t second = m_random() % (count - 1);
+            if (second >= first)
+            {
+                ++second;
+            }
+            const auto &other = m_backends[m_candidates[second]];
+            if (other->cost(now, average) < chosen->cost(now, average))
+            {
+                chosen = other;
+            }
+        }
+
+        ++chosen->m_outstanding;
+        return chosen;
+    }
+
+    // Records the outcome of a request sent to the backend at the given time.
+    void record(backend &target, uint64_t start, bool succeeded)
+    {
+        const uint64_t now = utility::details::steady_clock_microseconds();
+        const double latency = static_cast<double>(now - start);
+
+        // A failure counts as a slow response, so that a failing backend loses the comparisons.
+        const double sample = succeeded ? latency : std::max(latency, failure_latency);
+
+        pplx::scoped_critical_section l(m_lock);
+        --target.m_outstanding;
+        const double current = target.latency(now, pool_latency());
+        target.m_latency = current == 0 ? sample : current + latency_weight * (sample - current);
+        target.m_sampled = now;
+        if (succeeded)
+        {
+            target.m_consecutive_failures = 0;
+        }
+        else if (++target.m_consecutive_failures >= max_consecutive_failures)
+        {
+            target.m_consecutive_failures = 0;
+            target.m_ejected_until = now + static_cast<uint64_t>(ejection_seconds) * 1000000;
+        }
+    }
+
+private:
+
+    // The average latency of the backends that have one. Must be called under the lock.
+    double pool_latency() const
+    {
+        double total = 0;
+        int measured = 0;
+        for (auto iter = m_backends.begin(); iter != m_backends.end(); ++iter)
+        {
+            if ((*iter)->m_latency != 0)
+            {
+                total += (*iter)->m_latency;
+                ++measured;
+            }
+        }
+        return measured == 0 ? 0 : total / static_cast<double>(measured);
+    }
+
+    // Weight of the newest sample in the latency average.
+    static const double latency_weight;
+
+    // Latency recorded for a failed request, in microseconds.
+    static const double failure_latency;
+
+    // Time, in seconds, for the distance of an idle backend's latency from the pool average to shrink by a factor e.
+    static const double latency_decay_seconds;
+
+    // Consecutive failures after which a backend is ejected, and for how long.
+    static const int max_consecutive_failures = 5;
+    static const int ejection_seconds = 10;
+
+    std::vector<std::shared_ptr<backend>> m_backends;
+
+    pplx::critical_section m_lock;
+    std::minstd_rand m_random;
+    // Scratch space for choose, to avoid an allocation per request.
+    std::vector<size_t> m_candidates;
+};
+
+const double http_backend_balancer::latency_weight = 0.2;
+const double http_backend_balancer::failure_latency = 1000000.0;
+const double http_backend_balancer::latency_decay_seconds = 5.0;
+
+class http_network_handler : public http_pipeline_stage
+{
+public:
+
+    http_network_handler(const uri &base_uri, const http_client_config& client_config) :
+        m_http_client_impl(create_client(base_uri, client_config))
+    {
+    }
+
+    http_network_handler(const std::vector<uri> &base_uris, const http_client_config& client_config) :
+        m_http_client_impl(create_client(base_uris[0], client_config))
+    {
+        if (base_uris.size() > 1)
+        {
+            std::vector<std::shared_ptr<details::_http_client_communicator>> clients;
+            clients.push_back(m_http_client_impl);
+            for (auto iter = base_uris.begin() + 1; iter != base_uris.end(); ++iter)
+            {
+                clients.push_back(create_client(*iter, client_config));
+            }
+            m_balancer = std::make_shared<http_backend_balancer>(std::move(clients));
+        }
+    }
+
+    virtual pplx::task<http_response> propagate(http_request request)
+    {
+        if (!m_balancer)
+        {
+            return send(m_http_client_impl, request);
+        }
+
+        auto balancer = m_balancer;
+        auto target = balancer->choose();
+        const uint64_t start = utility::details::steady_clock_microseconds();
+        return send(target->m_client, request).then([balancer, target, start](pplx::task<http_response> result) -> http_response
+        {
+            try
+            {
+                http_response response = result.get();
+                balancer->record(*target, start, response.status_code() < status_codes::InternalError);
+                return response;
+            }
+            catch (...)
+            {
+                balancer->record(*target, start, false);
+                throw;
+            }
+        });
+    }
+
+    // The client implementation of the first base URI; all of them share the same configuration.
+    const std::shared_ptr<details::_http_client_communicator>& http_client_impl() const
+    {
+        return m_http_client_impl;
+    }
+
+    // Prewarms every backend. Fails only if no connection could be established to any of them.
+    pplx::task<void> prewarm(size_t connections)
+    {
+        if (!m_balancer)
+        {
+            return m_http_client_impl->prewarm(connections);
+        }
+
+        std::vector<pplx::task<bool>> attempts;
+        const auto &backends = m_balancer->backends();
+        for (auto iter = backends.begin(); iter != backends.end(); ++iter)
+        {
+            attempts.push_back((*iter)->m_client->prewarm(connections).then([](pplx::task<void> attempt) -> bool
+            {
+                try
+                {
+                    attempt.get();
+                    return true;
+                }
+                catch (...)
+                {
+                    return false;
+                }
+            }));
+        }
+        return pplx::when_all(attempts.begin(), attempts.end()).then([](std::vector<bool> results)
+        {
+            if (std::find(results.begin(), results.end(), true) == results.end())
+            {
+                throw http_exception(U("Failed to prewarm connections"));
+            }
+        });
+    }
+
+private:
+    std::shared_ptr<details::_http_client_communicator> m_http_client_impl;
+
+    // Only set when the client was given several base URIs.
+    std::shared_ptr<http_backend_balancer> m_balancer;
+
+    static pplx::task<http_response> send(std::shared_ptr<details::_http_client_communicator> impl, http_request &request)
+    {
+#if defined(__cplusplus_winrt)
+        details::request_context * context = details::winrt_request_context::create_request_context(impl, request);
+#elif defined(WIN32)
+        details::request_context * context = details::winhttp_request_context::create_request_context(impl, request);
+#else // LINUX
+        details::request_context * context = details::linux_request_context::create_request_context(impl, request);
+#endif
+
+        // Use a task to externally signal the final result and completion of the task.
+        auto result_task = pplx::create_task(context->m_request_completion);
 
         // Asynchronously send the response with the HTTP client implementation.
-        m_http_client_impl->async_send_request(context);
+        impl->async_send_request(context);
 
         return result_task;
     }
 
-    const std::shared_ptr<details::_http_client_communicator>& http_client_impl() const
+    static std::shared_ptr<details::_http_client_communicator> create_client(const uri &base_uri, const http_client_config& client_config)
     {
-        return m_http_client_impl;
+#if defined(__cplusplus_winrt)
+        return std::make_shared<details::winrt_client>(base_uri, client_config);
+#elif defined(WIN32)
+        return std::make_shared<details::winhttp_client>(base_uri, client_config);
+#else // LINUX
+        if (client_config.use_http2() && base_uri.scheme() == U("http"))
+        {
+            return std::make_shared<details::linux_http2_client>(base_uri, client_config);
+        }
+        return std::make_shared<details::linux_client>(base_uri, client_config);
+#endif
     }
-
-private:
-    std::shared_ptr<details::_http_client_communicator> m_http_client_impl;
 };
 
 http_client::http_client(const uri &base_uri) : 
@@ -2449,6 +5208,16 @@ http_client::http_client(const uri &base_uri, const http_client_config& client_c
     verify_uri(base_uri);
 }
 
+http_client::http_client(const std::vector<uri> &base_uris) : 
+    http_pipeline(std::make_shared<http_network_handler>(verify_uris(base_uris), http_client_config()))
+{
+}
+
+http_client::http_client(const std::vector<uri> &base_uris, const http_client_config& client_config) : 
+    http_pipeline(std::make_shared<http_network_handler>(verify_uris(base_uris), client_config))
+{
+}
+
 http_client::http_client(const http_client &&other) : 
     http_pipeline(std::move(other))
 {
@@ -2468,11 +5237,554 @@ pplx::task<http_response> http_client::request(http_request request)
     return propagate(request);
 }
 
+pplx::task<void> http_client::prewarm(size_t connections)
+{
+    http_network_handler* ph = static_cast<http_network_handler*>(last_stage().get());
+    return ph->prewarm(connections);
+}
+
 const http_client_config& http_client::client_config() const
 {
     http_network_handler* ph = static_cast<http_network_handler*>(last_stage().get());
     return ph->http_client_impl()->client_config();
 }
 
+namespace details
+{
+
+// Shared between the limiter and the continuations of the requests it lets through, which may
+// outlive it.
+struct concurrency_limiter_state : std::enable_shared_from_this<concurrency_limiter_state>
+{
+    struct queued_request
+    {
+        queued_request(http_request request, std::shared_ptr<http_pipeline_stage> next)
+            : m_request(std::move(request)), m_next(std::move(next)) {}
+
+        http_request m_request;
+        std::shared_ptr<http_pipeline_stage> m_next;
+        pplx::task_completion_event<http_response> m_response;
+    };
+
+    concurrency_limiter_state(adaptive_concurrency_limiter::algorithm alg, size_t initial_limit, size_t min_limit, size_t max_limit, size_t max_queued)
+        : m_algorithm(alg)
+        , m_min_limit(static_cast<double>(std::max<size_t>(min_limit, 1)))
+        , m_max_limit(static_cast<double>(std::max(max_limit, std::max<size_t>(min_limit, 1))))
+        , m_max_queued(max_queued)
+        , m_limit(std::min(std::max(static_cast<double>(initial_limit), m_min_limit), m_max_limit))
+        , m_in_flight(0)
+        , m_long_rtt(0)
+    {
+    }
+
+    pplx::task<http_response> admit(http_request request, std::shared_ptr<http_pipeline_stage> next)
+    {
+        {
+            pplx::scoped_critical_section l(m_lock);
+            if (m_in_flight >= current_limit())
+            {
+                pplx::task_completion_event<http_response> response;
+                if (m_queue.size() < m_max_queued)
+                {
+                    m_queue.push_back(queued_request(std::move(request), std::move(next)));
+                    response = m_queue.back().m_response;
+                }
+                else
+                {
+                    response.set_exception(http_exception(U("Too many requests in flight")));
+                }
+                return pplx::create_task(response);
+            }
+            ++m_in_flight;
+        }
+        return send(std::move(request), std::move(next));
+    }
+
+    // Sends a request holding a slot, and gives the slot up once the response headers are in.
+    pplx::task<http_response> send(http_request request, std::shared_ptr<http_pipeline_stage> next)
+    {
+        auto self = shared_from_this();
+        const uint64_t start = utility::details::steady_clock_microseconds();
+        pplx::task<http_response> sent;
+        try
+        {
+            sent = next->propagate(std::move(request));
+        }
+        catch (...)
+        {
+            // The request never went out, so it tells nothing about the limit; just free its slot.
+            release();
+            return pplx::task_from_exception<http_response>(std::current_exception());
+        }
+        return sent.then([self, start](pplx::task<http_response> result) -> http_response
+        {
+            http_response response;
+            try
+            {
+                response = result.get();
+            }
+            catch (...)
+            {
+                self->complete(start, true);
+                throw;
+            }
+            // 429 Too Many Requests.
+            self->complete(start, response.status_code() == status_codes::ServiceUnavailable || response.status_code() == 429);
+            return response;
+        });
+    }
+
+    // Takes the request's slot back and adjusts the limit. start is the utility::details::steady_clock_microseconds
+    // the request was sent at.
+    void complete(uint64_t start, bool dropped)
+    {
+        const double rtt = static_cast<double>(utility::details::steady_clock_microseconds() - start);
+
+        std::vector<queued_request> ready;
+        {
+            pplx::scoped_critical_section l(m_lock);
+            const size_t in_flight = m_in_flight--;
+            if (dropped)
+            {
+                m_limit *= backoff_ratio;
+            }
+            else if (m_algorithm == adaptive_concurrency_limiter::aimd)
+            {
+                // Only grow while the limit is actually what holds requests back.
+                if (in_flight * 2 >= current_limit())
+                {
+                    m_limit += 1.0 / m_limit;
+                }
+            }
+            else
+            {
+                update_gradient(rtt, in_flight);
+            }
+            m_limit = std::min(std::max(m_limit, m_min_limit), m_max_limit);
+            take_ready(ready);
+        }
+        send_ready(ready);
+    }
+
+    // Gives a slot up without adjusting the limit.
+    void release()
+    {
+        std::vector<queued_request> ready;
+        {
+            pplx::scoped_critical_section l(m_lock);
+            --m_in_flight;
+            take_ready(ready);
+        }
+        send_ready(ready);
+    }
+
+    // Moves the queued requests the limit lets through to ready, taking their slots. Expects the lock to be held.
+    void take_ready(std::vector<queued_request> &ready)
+    {
+        while (!m_queue.empty() && m_in_flight < current_limit())
+        {
+            ++m_in_flight;
+            ready.push_back(std::move(m_queue.front()));
+            m_queue.pop_front();
+        }
+    }
+
+    void send_ready(std::vector<queued_request> &ready)
+    {
+        for (auto iter = ready.begin(); iter != ready.end(); ++iter)
+        {
+            auto response = iter->m_response;
+            send(std::move(iter->m_request), std::move(iter->m_next)).then([response](pplx::task<http_response> result)
+            {
+                try
+                {
+                    response.set(result.get());
+                }
+                catch (...)
+                {
+                    response.set_exception(std::current_exception());
+                }
+            });
+        }
+    }
+
+    // The limit follows the ratio between the long-term round trip time, which stands for the backend
+    // with no queue, and the current one, plus some headroom to detect when more capacity frees up.
+    void update_gradient(double rtt, size_t in_flight)
+    {
+        m_long_rtt = m_long_rtt == 0 ? rtt : m_long_rtt + long_rtt_weight * (rtt - m_long_rtt);
+
+        // After a sustained rise the long-term average would take too long to come back down.
+        if (m_long_rtt / rtt > 2.0)
+        {
+            m_long_rtt *= 0.95;
+        }
+
+        // Do not grow a limit that is not being used.
+        if (in_flight * 2 < current_limit())
+        {
+            return;
+        }
+
+        const double gradient = std::max(0.5, std::min(1.0, m_long_rtt / rtt));
+        const double target = m_limit * gradient + std::sqrt(m_limit);
+        m_limit = m_limit * (1.0 - smoothing) + target * smoothing;
+    }
+
+    size_t current_limit() const
+    {
+        return static_cast<size_t>(m_limit);
+    }
+
+    static const double backoff_ratio;
+    static const double long_rtt_weight;
+    static const double smoothing;
+
+    const adaptive_concurrency_limiter::algorithm m_algorithm;
+    const double m_min_limit;
+    const double m_max_limit;
+    const size_t m_max_queued;
+
+    // The fields below are guarded by the lock.
+    mutable pplx::critical_section m_lock;
+    double m_limit;
+    size_t m_in_flight;
+    // Moving average of the round trip time over many requests, in microseconds.
+    double m_long_rtt;
+    std::deque<queued_request> m_queue;
+};
+
+const double concurrency_limiter_state::backoff_ratio = 0.9;
+const double concurrency_limiter_state::long_rtt_weight = 2.0 / 601;
+const double concurrency_limiter_state::smoothing = 0.2;
+
+} // namespace details
+
+adaptive_concurrency_limiter::adaptive_concurrency_limiter(algorithm alg, size_t initial_limit, size_t min_limit, size_t max_limit, size_t max_queued)
+    : m_state(std::make_shared<details::concurrency_limiter_state>(alg, initial_limit, min_limit, max_limit, max_queued))
+{
+}
+
+size_t adaptive_concurrency_limiter::limit() const
+{
+    pplx::scoped_critical_section l(m_state->m_lock);
+    return m_state->current_limit();
+}
+
+size_t adaptive_concurrency_limiter::in_flight() const
+{
+    pplx::scoped_critical_section l(m_state->m_lock);
+    return m_state->m_in_flight;
+}
+
+pplx::task<http_response> adaptive_concurrency_limiter::propagate(http_request request)
+{
+    return m_state->admit(std::move(request), get_next_stage());
+}
+
+namespace details
+{
+
+// A capture file starts with this, followed by the records of the exchanges. A record is its size as a 32-bit
+// integer, then the exchange: the offset and duration in microseconds as 64-bit integers, the status code as a
+// 16-bit integer, and the method, request URI, request headers, request body, reason phrase, response headers and
+// response body. Strings and bodies are their size as a 32-bit integer followed by their bytes, strings in UTF-8;
+// headers are their count as a 32-bit integer followed by each name and value. Integers are little-endian.
+static const char traffic_capture_magic[8] = { 'H', 'T', 'T', 'P', 'C', 'A', 'P', '1' };
+
+static void append_integer(std::vector<unsigned char> &record, uint64_t value, size_t size)
+{
+    for (size_t i = 0; i < size; ++i)
+    {
+        record.push_back(static_cast<unsigned char>(value >> (8 * i)));
+    }
+}
+
+static void append_bytes(std::vector<unsigned char> &record, const unsigned char *data, size_t size)
+{
+    append_integer(record, size, 4);
+    record.insert(record.end(), data, data + size);
+}
+
+static void append_string(std::vector<unsigned char> &record, const utility::string_t &value)
+{
+    auto utf8 = utility::conversions::to_utf8string(value);
+    append_bytes(record, reinterpret_cast<const unsigned char *>(utf8.data()), utf8.size());
+}
+
+static void append_headers(std::vector<unsigned char> &record, const http_headers &headers)
+{
+    append_integer(record, headers.size(), 4);
+    for (auto it = headers.begin(); it != headers.end(); ++it)
+    {
+        append_string(record, it->first);
+        append_string(record, it->second);
+    }
+}
+
+// Reads the fields of capture records, throwing if one runs past the end of the file.
+class capture_reader
+{
+public:
+    capture_reader(const std::vector<unsigned char> &data) : m_data(data), m_pos(0) { }
+
+    bool at_end() const { return m_pos == m_data.size(); }
+
+    uint64_t read_integer(size_t size)
+    {
+        check(size);
+        uint64_t value = 0;
+        for (size_t i = 0; i < size; ++i)
+        {
+            value |= static_cast<uint64_t>(m_data[m_pos++]) << (8 * i);
+        }
+        return value;
+    }
+
+    std::vector<unsigned char> read_bytes()
+    {
+        const size_t size = static_cast<size_t>(read_integer(4));
+        check(size);
+        std::vector<unsigned char> bytes(m_data.begin() + m_pos, m_data.begin() + m_pos + size);
+        m_pos += size;
+        return bytes;
+    }
+
+    utility::string_t read_string()
+    {
+        auto bytes = read_bytes();
+        return utility::conversions::to_string_t(std::string(bytes.begin(), bytes.end()));
+    }
+
+    void read_headers(http_headers &headers)
+    {
+        for (auto count = read_integer(4); count > 0; --count)
+        {
+            auto name = read_string();
+            headers.add(name, read_string());
+        }
+    }
+
+    void check(size_t size) const
+    {
+        if (m_data.size() - m_pos < size)
+        {
+            throw std::runtime_error("Traffic capture is truncated");
+        }
+    }
+
+private:
+    const std::vector<unsigned char> &m_data;
+    size_t m_pos;
+};
+
+// Shared between the recorder and the exchanges in flight, which may outlive it.
+struct traffic_recorder_state
+{
+    traffic_recorder_state(const utility::string_t &file_name)
+        : m_file(concurrency::streams::file_buffer<uint8_t>::open(file_name, std::ios::out | std::ios::trunc).get()),
+          m_start(utility::details::steady_clock_microseconds()),
+          m_captured(0)
+    {
+        m_writes = m_file.putn(reinterpret_cast<const uint8_t *>(traffic_capture_magic), sizeof(traffic_capture_magic)).then([](size_t) { });
+    }
+
+    // Writes the record of a completed exchange after those already queued. sent is the
+    // utility::details::steady_clock_microseconds the request was sent at.
+    void capture(http_request request, const std::vector<unsigned char> &request_body, uint64_t sent,
+        const http_response *response, const std::vector<unsigned char> &response_body)
+    {
+        auto record = std::make_shared<std::vector<unsigned char>>();
+        append_integer(*record, 0, 4);
+        append_integer(*record, sent - m_start, 8);
+        append_integer(*record, utility::details::steady_clock_microseconds() - sent, 8);
+        append_integer(*record, response != nullptr ? response->status_code() : 0, 2);
+        append_string(*record, request.method());
+        append_string(*record, request.request_uri().to_string());
+        append_headers(*record, request.headers());
+        append_bytes(*record, request_body.empty() ? nullptr : &request_body[0], request_body.size());
+        append_string(*record, response != nullptr ? response->reason_phrase() : utility::string_t());
+        append_headers(*record, response != nullptr ? response->headers() : http_headers());
+        append_bytes(*record, response_body.empty() ? nullptr : &response_body[0], response_body.size());
+
+        const size_t size = record->size() - 4;
+        for (size_t i = 0; i < 4; ++i)
+        {
+            (*record)[i] = static_cast<unsigned char>(size >> (8 * i));
+        }
+
+        pplx::scoped_critical_section l(m_lock);
+        auto file = m_file;
+        m_writes = m_writes.then([file, record](pplx::task<void> previous)
+        {
+            try
+            {
+                previous.wait();
+            }
+            catch (...)
+            {
+                // A failed write only loses its own record.
+            }
+            auto out = file;
+            return out.putn(&(*record)[0], record->size()).then([record](size_t) { });
+        });
+        pplx::atomic_increment(m_captured);
+    }
+
+    void close()
+    {
+        pplx::task<void> writes;
+        {
+            pplx::scoped_critical_section l(m_lock);
+            writes = m_writes;
+        }
+        try
+        {
+            writes.wait();
+        }
+        catch (...)
+        {
+        }
+        m_file.close().wait();
+    }
+
+    concurrency::streams::streambuf<uint8_t> m_file;
+    const uint64_t m_start;
+    pplx::atomic_size_t m_captured;
+
+    // Guards the chain of writes.
+    pplx::critical_section m_lock;
+    pplx::task<void> m_writes;
+};
+
+} // namespace details
+
+traffic_recorder::traffic_recorder(const utility::string_t &file_name)
+    : m_state(std::make_shared<details::traffic_recorder_state>(file_name))
+{
+}
+
+traffic_recorder::~traffic_recorder()
+{
+    m_state->close();
+}
+
+size_t traffic_recorder::captured() const
+{
+    return m_state->m_captured;
+}
+
+pplx::task<http_response> traffic_recorder::propagate(http_request request)
+{
+    auto state = m_state;
+    auto next = get_next_stage();
+
+    // Read the request body whole, and send the copy on in its place.
+    auto request_body = std::make_shared<std::vector<unsigned char>>();
+    pplx::task<void> body_read = pplx::task_from_result();
+    if (request.body())
+    {
+        auto buffer = std::make_shared<concurrency::streams::container_buffer<std::vector<unsigned char>>>();
+        body_read = request.body().read_to_end(*buffer).then([request, buffer, request_body](size_t) mutable
+        {
+            *request_body = std::move(buffer->collection());
+            auto content_type = request.headers().content_type();
+            request.set_body(concurrency::streams::bytestream::open_istream(*request_body), request_body->size(), content_type);
+        });
+    }
+
+    return body_read.then([=]()
+    {
+        const uint64_t sent = utility::details::steady_clock_microseconds();
+        return next->propagate(request).then([=](pplx::task<http_response> response_task) -> pplx::task<http_response>
+        {
+            http_response response;
+            try
+            {
+                response = response_task.get();
+            }
+            catch (...)
+            {
+                state->capture(request, *request_body, sent, nullptr, std::vector<unsigned char>());
+                throw;
+            }
+
+            auto request_impl = request._get_impl();
+            if (request_impl->_response_stream() || request_impl->response_body_mode() != response_body_mode::buffer)
+            {
+                // The body is not kept: capture the exchange once it has been received.
+                response.content_ready().then([=](pplx::task<http_response> ready)
+                {
+                    try
+                    {
+                        ready.wait();
+                    }
+                    catch (...)
+                    {
+                    }
+                    state->capture(request, *request_body, sent, &response, std::vector<unsigned char>());
+                });
+                return pplx::task_from_result(response);
+            }
+
+            return response.extract_vector().then([=](std::vector<unsigned char> body) mutable
+            {
+                state->capture(request, *request_body, sent, &response, body);
+
+                // Put the body back for the caller to read.
+                auto content_type = response.headers().content_type();
+                auto length = body.size();
+                response.set_body(concurrency::streams::bytestream::open_istream(std::move(body)), length, content_type);
+                return response;
+            });
+        });
+    });
+}
+
+std::vector<captured_exchange> read_traffic_capture(const utility::string_t &file_name)
+{
+    concurrency::streams::container_buffer<std::vector<unsigned char>> buffer;
+    {
+        concurrency::streams::istream file = concurrency::streams::file_stream<uint8_t>::open_istream(file_name).get();
+        file.read_to_end(buffer).get();
+        file.close().wait();
+    }
+    const auto &data = buffer.collection();
+
+    if (data.size() < sizeof(details::traffic_capture_magic)
+        || !std::equal(details::traffic_capture_magic, details::traffic_capture_magic + sizeof(details::traffic_capture_magic), data.begin()))
+    {
+        throw std::runtime_error("Not a traffic capture");
+    }
+
+    std::vector<captured_exchange> exchanges;
+    details::capture_reader reader(data);
+    reader.read_integer(sizeof(details::traffic_capture_magic));
+    while (!reader.at_end())
+    {
+        reader.read_integer(4);
+
+        captured_exchange exchange;
+        exchange.offset = reader.read_integer(8);
+        exchange.duration = reader.read_integer(8);
+        exchange.status_code = static_cast<http::status_code>(reader.read_integer(2));
+        exchange.method = reader.read_string();
+        exchange.request_uri = reader.read_string();
+        reader.read_headers(exchange.request_headers);
+        exchange.request_body = reader.read_bytes();
+        exchange.reason_phrase = reader.read_string();
+        reader.read_headers(exchange.response_headers);
+        exchange.response_body = reader.read_bytes();
+        exchanges.push_back(std::move(exchange));
+    }
+
+    // Records are written as exchanges complete; put them back in the order they were sent.
+    std::stable_sort(exchanges.begin(), exchanges.end(), [](const captured_exchange &left, const captured_exchange &right)
+    {
+        return left.offset < right.offset;
+    });
+    return exchanges;
+}
+
 } // namespace client
 }} // namespace casablanca::http
@@ -0,0 +1,629 @@
+/***
+* ==++==
+*
+* Copyright (c) Microsoft Corporation. All rights reserved.
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* ==--==
+* =+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+
+*
+* http2_helpers.cpp - Implementation Details of the HTTP/2 transport
+*
+* HTTP/2 frame headers and HPACK header compression.
+*
+* =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+****/
+
+#include "stdafx.h"
+#include "http2_helpers.h"
+
+namespace web { namespace http
+{
+namespace details
+{
+namespace http2
+{
+
+void frame_header::write(uint8_t *out) const
+{
+    out[0] = static_cast<uint8_t>(length >> 16);
+    out[1] = static_cast<uint8_t>(length >> 8);
+    out[2] = static_cast<uint8_t>(length);
+    out[3] = type;
+    out[4] = flags;
+    out[5] = static_cast<uint8_t>((stream_id >> 24) & 0x7f);
+    out[6] = static_cast<uint8_t>(stream_id >> 16);
+    out[7] = static_cast<uint8_t>(stream_id >> 8);
+    out[8] = static_cast<uint8_t>(stream_id);
+}
+
+frame_header frame_header::read(const uint8_t *in)
+{
+    frame_header header;
+    header.length = (static_cast<uint32_t>(in[0]) << 16) | (static_cast<uint32_t>(in[1]) << 8) | in[2];
+    header.type = in[3];
+    header.flags = in[4];
+    header.stream_id = read_uint32(in + 5) & 0x7fffffff;
+    return header;
+}
+
+void append_uint32(std::vector<uint8_t> &out, uint32_t value)
+{
+    out.push_back(static_cast<uint8_t>(value >> 24));
+    out.push_back(static_cast<uint8_t>(value >> 16));
+    out.push_back(static_cast<uint8_t>(value >> 8));
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+uint32_t read_uint32(const uint8_t *in)
+{
+    return (static_cast<uint32_t>(in[0]) << 24) | (static_cast<uint32_t>(in[1]) << 16) | (static_cast<uint32_t>(in[2]) << 8) | in[3];
+}
+
+//
+// Huffman coding.
+//
+// The code in RFC 7541 appendix B is canonical, with the symbols of each length in ascending order,
+// so the code lengths are all that is needed to rebuild both the codes and the decoding tables.
+//
+
+static const int huffman_symbol_count = 257;
+static const int huffman_eos = 256;
+static const int huffman_max_length = 30;
+
+static const uint8_t s_huffman_lengths[huffman_symbol_count] =
+{
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+    6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+    30
+};
+
+static struct huffman_tables
+{
+    huffman_tables()
+    {
+        int count_by_length[huffman_max_length + 1] = { 0 };
+        for (int symbol = 0; symbol < huffman_symbol_count; ++symbol)
+        {
+            ++count_by_length[s_huffman_lengths[symbol]];
+        }
+
+        // Symbols ordered by code, and where each length starts in that order.
+        int next_index = 0;
+        for (int length = 0; length <= huffman_max_length; ++length)
+        {
+            first_index[length] = next_index;
+            count[length] = count_by_length[length];
+            next_index += count_by_length[length];
+        }
+        int fill[huffman_max_length + 1];
+        std::copy(first_index, first_index + huffman_max_length + 1, fill);
+        for (int symbol = 0; symbol < huffman_symbol_count; ++symbol)
+        {
+            sorted_symbols[fill[s_huffman_lengths[symbol]]++] = static_cast<uint16_t>(symbol);
+        }
+
+        // Assign the canonical codes.
+        uint32_t code = 0;
+        int previous_length = 0;
+        for (int i = 0; i < huffman_symbol_count; ++i)
+        {
+            const int symbol = sorted_symbols[i];
+            const int length = s_huffman_lengths[symbol];
+            if (i != 0)
+            {
+                code = (code + 1) << (length - previous_length);
+            }
+            else
+            {
+                code = 0;
+            }
+            if (i == first_index[length])
+            {
+                first_code[length] = code;
+            }
+            codes[symbol] = code;
+            previous_length = length;
+        }
+    }
+
+    uint32_t codes[huffman_symbol_count];
+    uint16_t sorted_symbols[huffman_symbol_count];
+    uint32_t first_code[huffman_max_length + 1];
+    int first_index[huffman_max_length + 1];
+    int count[huffman_max_length + 1];
+} s_huffman;
+
+size_t huffman_encoded_size(const std::string &str)
+{
+    size_t bits = 0;
+    for (auto iter = str.begin(); iter != str.end(); ++iter)
+    {
+        bits += s_huffman_lengths[static_cast<uint8_t>(*iter)];
+    }
+    return (bits + 7) / 8;
+}
+
+void huffman_encode(const std::string &str, std::vector<uint8_t> &out)
+{
+    uint64_t pending = 0;
+    int pending_bits = 0;
+    for (auto iter = str.begin(); iter != str.end(); ++iter)
+    {
+        const uint8_t symbol = static_cast<uint8_t>(*iter);
+        pending = (pending << s_huffman_lengths[symbol]) | s_huffman.codes[symbol];
+        pending_bits += s_huffman_lengths[symbol];
+        while (pending_bits >= 8)
+        {
+            pending_bits -= 8;
+            out.push_back(static_cast<uint8_t>(pending >> pending_bits));
+        }
+    }
+
+    // Pad the last octet with the most significant bits of EOS, which are all ones.
+    if (pending_bits > 0)
+    {
+        const int padding = 8 - pending_bits;
+        out.push_back(static_cast<uint8_t>((pending << padding) | ((1u << padding) - 1)));
+    }
+}
+
+bool huffman_decode(const uint8_t *data, size_t size, std::string &out)
+{
+    uint32_t code = 0;
+    int length = 0;
+    for (size_t i = 0; i < size; ++i)
+    {
+        for (int bit = 7; bit >= 0; --bit)
+        {
+            code = (code << 1) | ((data[i] >> bit) & 1);
+            ++length;
+
+            if (s_huffman.count[length] != 0 && code - s_huffman.first_code[length] < static_cast<uint32_t>(s_huffman.count[length]))
+            {
+                const int symbol = s_huffman.sorted_symbols[s_huffman.first_index[length] + (code - s_huffman.first_code[length])];
+                if (symbol == huffman_eos)
+                {
+                    return false;
+                }
+                out.push_back(static_cast<char>(symbol));
+                code = 0;
+                length = 0;
+            }
+            else if (length == huffman_max_length)
+            {
+                return false;
+            }
+        }
+    }
+
+    // What is left must be padding: fewer than eight bits, all ones.
+    return length < 8 && code == (1u << length) - 1;
+}
+
+//
+// Tables.
+//
+
+static const header_field s_static_table[hpack_table::static_table_size] =
+{
+    header_field(":authority", ""),
+    header_field(":method", "GET"),
+    header_field(":method", "POST"),
+    header_field(":path", "/"),
+    header_field(":path", "/index.html"),
+    header_field(":scheme", "http"),
+    header_field(":scheme", "https"),
+    header_field(":status", "200"),
+    header_field(":status", "204"),
+    header_field(":status", "206"),
+    header_field(":status", "304"),
+    header_field(":status", "400"),
+    header_field(":status", "404"),
+    header_field(":status", "500"),
+    header_field("accept-charset", ""),
+    header_field("accept-encoding", "gzip, deflate"),
+    header_field("accept-language", ""),
+    header_field("accept-ranges", ""),
+    header_field("accept", ""),
+    header_field("access-control-allow-origin", ""),
+    header_field("age", ""),
+    header_field("allow", ""),
+    header_field("authorization", ""),
+    header_field("cache-control", ""),
+    header_field("content-disposition", ""),
+    header_field("content-encoding", ""),
+    header_field("content-language", ""),
+    header_field("content-length", ""),
+    header_field("content-location", ""),
+    header_field("content-range", ""),
+    header_field("content-type", ""),
+    header_field("cookie", ""),
+    header_field("date", ""),
+    header_field("etag", ""),
+    header_field("expect", ""),
+    header_field("expires", ""),
+    header_field("from", ""),
+    header_field("host", ""),
+    header_field("if-match", ""),
+    header_field("if-modified-since", ""),
+    header_field("if-none-match", ""),
+    header_field("if-range", ""),
+    header_field("if-unmodified-since", ""),
+    header_field("last-modified", ""),
+    header_field("link", ""),
+    header_field("location", ""),
+    header_field("max-forwards", ""),
+    header_field("proxy-authenticate", ""),
+    header_field("proxy-authorization", ""),
+    header_field("range", ""),
+    header_field("referer", ""),
+    header_field("refresh", ""),
+    header_field("retry-after", ""),
+    header_field("server", ""),
+    header_field("set-cookie", ""),
+    header_field("strict-transport-security", ""),
+    header_field("transfer-encoding", ""),
+    header_field("user-agent", ""),
+    header_field("vary", ""),
+    header_field("via", ""),
+    header_field("www-authenticate", "")
+};
+
+static size_t entry_size(const header_field &field)
+{
+    return field.first.size() + field.second.size() + hpack_table::entry_overhead;
+}
+
+const header_field *hpack_table::get(size_t index) const
+{
+    if (index == 0)
+    {
+        return nullptr;
+    }
+    if (index <= static_table_size)
+    {
+        return &s_static_table[index - 1];
+    }
+    index -= static_table_size + 1;
+    if (index < m_entries.size())
+    {
+        return &m_entries[index];
+    }
+    return nullptr;
+}
+
+size_t hpack_table::find(const std::string &name, const std::string &value, bool &name_only) const
+{
+    size_t name_index = 0;
+    for (size_t i = 0; i < static_table_size; ++i)
+    {
+        if (s_static_table[i].first == name)
+        {
+            if (s_static_table[i].second == value)
+            {
+                name_only = false;
+                return i + 1;
+            }
+            if (name_index == 0)
+            {
+                name_index = i + 1;
+            }
+        }
+    }
+    for (size_t i = 0; i < m_entries.size(); ++i)
+    {
+        if (m_entries[i].first == name)
+        {
+            if (m_entries[i].second == value)
+            {
+                name_only = false;
+                return static_table_size + 1 + i;
+            }
+            if (name_index == 0)
+            {
+                name_index = static_table_size + 1 + i;
+            }
+        }
+    }
+    name_only = name_index != 0;
+    return name_index;
+}
+
+void hpack_table::add(const header_field &field)
+{
+    const size_t size = entry_size(field);
+
+    // An entry larger than the whole table empties it and is not added.
+    if (size > m_max_size)
+    {
+        evict(0);
+        return;
+    }
+    evict(m_max_size - size);
+    m_entries.push_front(field);
+    m_size += size;
+}
+
+void hpack_table::set_max_size(size_t max_size)
+{
+    m_max_size = max_size;
+    evict(max_size);
+}
+
+void hpack_table::evict(size_t max_size)
+{
+    while (m_size > max_size && !m_entries.empty())
+    {
+        m_size -= entry_size(m_entries.back());
+        m_entries.pop_back();
+    }
+}
+
+//
+// Primitive representations.
+//
+
+void hpack_encode_integer(size_t value, int prefix_bits, uint8_t first_byte, std::vector<uint8_t> &out)
+{
+    const size_t max_prefix = (static_cast<size_t>(1) << prefix_bits) - 1;
+    if (value < max_prefix)
+    {
+        out.push_back(static_cast<uint8_t>(first_byte | value));
+        return;
+    }
+    out.push_back(static_cast<uint8_t>(first_byte | max_prefix));
+    value -= max_prefix;
+    while (value >= 0x80)
+    {
+        out.push_back(static_cast<uint8_t>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+bool hpack_decode_integer(const uint8_t *data, size_t size, size_t &pos, int prefix_bits, size_t &value)
+{
+    if (pos >= size)
+    {
+        return false;
+    }
+    const size_t max_prefix = (static_cast<size_t>(1) << prefix_bits) - 1;
+    value = data[pos++] & max_prefix;
+    if (value < max_prefix)
+    {
+        return true;
+    }
+
+    // Limit continuation octets so the value always fits in 32 bits.
+    for (int shift = 0; shift <= 21; shift += 7)
+    {
+        if (pos >= size)
+        {
+            return false;
+        }
+        const uint8_t octet = data[pos++];
+        value += static_cast<size_t>(octet & 0x7f) << shift;
+        if ((octet & 0x80) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void encode_string(const std::string &str, std::vector<uint8_t> &out)
+{
+    const size_t huffman_size = huffman_encoded_size(str);
+    if (huffman_size < str.size())
+    {
+        hpack_encode_integer(huffman_size, 7, 0x80, out);
+        huffman_encode(str, out);
+    }
+    else
+    {
+        hpack_encode_integer(str.size(), 7, 0x00, out);
+        out.insert(out.end(), str.begin(), str.end());
+    }
+}
+
+static bool decode_string(const uint8_t *data, size_t size, size_t &pos, std::string &str)
+{
+    if (pos >= size)
+    {
+        return false;
+    }
+    const bool huffman = (data[pos] & 0x80) != 0;
+    size_t length;
+    if (!hpack_decode_integer(data, size, pos, 7, length) || length > size - pos)
+    {
+        return false;
+    }
+    if (huffman)
+    {
+        if (!huffman_decode(data + pos, length, str))
+        {
+            return false;
+        }
+    }
+    else
+    {
+        str.assign(reinterpret_cast<const char *>(data + pos), length);
+    }
+    pos += length;
+    return true;
+}
+
+// Fields that should never be added to a compression table, so their values cannot be
+// recovered by probing the compression state.
+static bool is_sensitive(const header_field &field)
+{
+    return field.first == "authorization"
+        || field.first == "proxy-authorization"
+        || (field.first == "cookie" && field.second.size() < 20);
+}
+
+//
+// Encoder.
+//
+
+void hpack_encoder::set_max_table_size(size_t max_size)
+{
+    // We never use more than the default, even if the peer allows it.
+    const size_t new_size = std::min(max_size, static_cast<size_t>(default_header_table_size));
+    if (new_size != m_table.max_size())
+    {
+        m_table.set_max_size(new_size);
+        m_pending_size_update = true;
+    }
+}
+
+void hpack_encoder::encode(const std::vector<header_field> &fields, std::vector<uint8_t> &block)
+{
+    if (m_pending_size_update)
+    {
+        hpack_encode_integer(m_table.max_size(), 5, 0x20, block);
+        m_pending_size_update = false;
+    }
+
+    for (auto iter = fields.begin(); iter != fields.end(); ++iter)
+    {
+        bool name_only = false;
+        const size_t index = m_table.find(iter->first, iter->second, name_only);
+
+        if (index != 0 && !name_only)
+        {
+            // Indexed header field.
+            hpack_encode_integer(index, 7, 0x80, block);
+            continue;
+        }
+
+        const bool sensitive = is_sensitive(*iter);
+        const bool indexed = !sensitive && entry_size(*iter) <= m_table.max_size();
+        if (indexed)
+        {
+            // Literal with incremental indexing.
+            hpack_encode_integer(index, 6, 0x40, block);
+        }
+        else
+        {
+            // Literal never indexed, or without indexing for fields too large to keep.
+            hpack_encode_integer(index, 4, sensitive ? 0x10 : 0x00, block);
+        }
+        if (index == 0)
+        {
+            encode_string(iter->first, block);
+        }
+        encode_string(iter->second, block);
+
+        if (indexed)
+        {
+            m_table.add(*iter);
+        }
+    }
+}
+
+//
+// Decoder.
+//
+
+bool hpack_decoder::decode(const uint8_t *data, size_t size, std::vector<header_field> &fields)
+{
+    size_t pos = 0;
+    bool seen_field = false;
+    while (pos < size)
+    {
+        const uint8_t octet = data[pos];
+        size_t index;
+
+        if (octet & 0x80)
+        {
+            // Indexed header field.
+            if (!hpack_decode_integer(data, size, pos, 7, index))
+            {
+                return false;
+            }
+            const header_field *field = m_table.get(index);
+            if (field == nullptr)
+            {
+                return false;
+            }
+            fields.push_back(*field);
+            seen_field = true;
+            continue;
+        }
+
+        if ((octet & 0xe0) == 0x20)
+        {
+            // Dynamic table size update, only allowed at the start of a block.
+            size_t max_size;
+            if (seen_field || !hpack_decode_integer(data, size, pos, 5, max_size) || max_size > m_max_table_size)
+            {
+                return false;
+            }
+            m_table.set_max_size(max_size);
+            continue;
+        }
+
+        // Literal header field, with incremental indexing (6 bit prefix), without indexing or never indexed (4 bit prefix).
+        const bool indexed = (octet & 0xc0) == 0x40;
+        if (!hpack_decode_integer(data, size, pos, indexed ? 6 : 4, index))
+        {
+            return false;
+        }
+
+        header_field field;
+        if (index != 0)
+        {
+            const header_field *name = m_table.get(index);
+            if (name == nullptr)
+            {
+                return false;
+            }
+            field.first = name->first;
+        }
+        else if (!decode_string(data, size, pos, field.first))
+        {
+            return false;
+        }
+        if (!decode_string(data, size, pos, field.second))
+        {
+            return false;
+        }
+
+        if (indexed)
+        {
+            m_table.add(field);
+        }
+        fields.push_back(std::move(field));
+        seen_field = true;
+    }
+    return true;
+}
+
+} // namespace http2
+} // namespace details
+}} // namespace web::http
@@ -0,0 +1,357 @@
+/***
+* ==++==
+*
+* Copyright (c) Microsoft Corporation. All rights reserved.
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* ==--==
+* =+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+
+*
+* http_access_log.cpp
+*
+* HTTP Library: binary access log of the exchanges completed by http_client and http_listener
+*
+* =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+****/
+
+#include "stdafx.h"
+#include "http_access_log.h"
+
+#if !defined(_MS_WINDOWS) || (_MSC_VER >= 1700)
+
+#include "filestream.h"
+#include <condition_variable>
+#include <mutex>
+#include <type_traits>
+
+#if defined(_MSC_VER)
+#define _ACCESS_LOG_THREAD_LOCAL __declspec(thread)
+#else
+#include <pthread.h>
+#define _ACCESS_LOG_THREAD_LOCAL __thread
+#endif
+
+namespace web { namespace http
+{
+
+namespace
+{
+
+// A single producer, single consumer ring of entries: the thread that owns it records, the flusher drains.
+// The indices only grow; an index is masked to find its slot.
+struct access_log_ring
+{
+    access_log_ring(size_t capacity)
+        : m_entries(capacity), m_mask(capacity - 1), m_head(0), m_recording(false), m_tail(0), m_free(false), m_next(nullptr)
+    {
+    }
+
+    std::vector<access_log_entry> m_entries;
+    const size_t m_mask;
+    char m_pad0[64];
+    std::atomic<size_t> m_head;     // next slot to record into, written by the owning thread
+    std::atomic<bool> m_recording;  // set by the owning thread while it records, for stopping to wait on
+    char m_pad1[64];
+    std::atomic<size_t> m_tail;     // next slot to drain, written by the flusher
+    char m_pad2[64];
+    std::atomic<bool> m_free;       // set when the owning thread exits, until another thread takes the ring
+    access_log_ring *m_next;        // the ring created before this one
+};
+
+// Every ring created, newest first. Rings are only ever added; those of threads that exited are reused.
+std::atomic<access_log_ring *> s_rings(nullptr);
+_ACCESS_LOG_THREAD_LOCAL access_log_ring *s_thread_ring = nullptr;
+
+// Frees the ring of an exiting thread for the next thread that records. Entries still in it are drained as usual.
+#if defined(_MSC_VER)
+void WINAPI release_thread_ring(void *ring)
+#else
+void release_thread_ring(void *ring)
+#endif
+{
+    if (ring != nullptr)
+    {
+        static_cast<access_log_ring *>(ring)->m_free.store(true, std::memory_order_release);
+    }
+}
+
+// The thread-local slot whose destructor runs release_thread_ring as a thread that has a ring exits.
+#if defined(_MSC_VER)
+DWORD create_ring_key()
+{
+    return FlsAlloc(release_thread_ring);
+}
+
+void set_ring_key(DWORD key, access_log_ring *ring)
+{
+    FlsSetValue(key, ring);
+}
+
+DWORD s_ring_key = create_ring_key();
+#else
+pthread_key_t create_ring_key()
+{
+    pthread_key_t key;
+    pthread_key_create(&key, release_thread_ring);
+    return key;
+}
+
+void set_ring_key(pthread_key_t key, access_log_ring *ring)
+{
+    pthread_setspecific(key, ring);
+}
+
+pthread_key_t s_ring_key = create_ring_key();
+#endif
+
+std::atomic<bool> s_enabled(false);
+std::atomic<size_t> s_dropped(0);
+std::atomic<size_t> s_ring_entries(4096);
+
+// Guards starting and stopping, and the flusher's wait.
+std::mutex s_lock;
+std::condition_variable s_stopping;
+bool s_stop = false;
+std::thread s_flusher;
+
+size_t round_up_to_power_of_2(size_t value)
+{
+    size_t result = 1;
+    while (result < value)
+        result <<= 1;
+    return result;
+}
+
+// Takes the ring of a thread that exited, if there is one.
+access_log_ring *take_free_ring()
+{
+    for (auto ring = s_rings.load(); ring != nullptr; ring = ring->m_next)
+    {
+        bool expected = true;
+        if (ring->m_free.load(std::memory_order_relaxed) && ring->m_free.compare_exchange_strong(expected, false))
+        {
+            return ring;
+        }
+    }
+    return nullptr;
+}
+
+access_log_ring *thread_ring()
+{
+    if (s_thread_ring == nullptr)
+    {
+        access_log_ring *ring = take_free_ring();
+        if (ring == nullptr)
+        {
+            ring = new access_log_ring(s_ring_entries);
+            access_log_ring *head = s_rings.load();
+            do
+            {
+                ring->m_next = head;
+            } while (!s_rings.compare_exchange_weak(head, ring));
+        }
+        s_thread_ring = ring;
+        set_ring_key(s_ring_key, ring);
+    }
+    return s_thread_ring;
+}
+
+// Moves the recorded entries of every ring to the end of the batch.
+void drain(std::vector<access_log_entry> &batch)
+{
+    for (auto ring = s_rings.load(); ring != nullptr; ring = ring->m_next)
+    {
+        const size_t head = ring->m_head.load(std::memory_order_acquire);
+        size_t tail = ring->m_tail.load(std::memory_order_relaxed);
+        for (; tail != head; ++tail)
+        {
+            batch.push_back(ring->m_entries[tail & ring->m_mask]);
+        }
+        ring->m_tail.store(tail, std::memory_order_release);
+    }
+}
+
+void write_batch(concurrency::streams::streambuf<uint8_t> &file, std::vector<access_log_entry> &batch)
+{
+    if (!batch.empty())
+    {
+        file.putn(reinterpret_cast<const uint8_t *>(&batch[0]), batch.size() * sizeof(access_log_entry)).wait();
+        file.sync().wait();
+        batch.clear();
+    }
+}
+
+void flush_until_stopped(concurrency::streams::streambuf<uint8_t> file, std::chrono::milliseconds flush_interval)
+{
+    std::vector<access_log_entry> batch;
+    std::unique_lock<std::mutex> lock(s_lock);
+    while (!s_stop)
+    {
+        s_stopping.wait_for(lock, flush_interval);
+
+        lock.unlock();
+        drain(batch);
+        write_batch(file, batch);
+        lock.lock();
+    }
+
+    // Nothing is recorded any more; write what is left.
+    lock.unlock();
+    drain(batch);
+    write_batch(file, batch);
+    file.close().wait();
+}
+
+} // namespace
+
+void access_log::start(const utility::string_t &file_name, std::chrono::milliseconds flush_interval, size_t ring_entries)
+{
+    std::lock_guard<std::mutex> lock(s_lock);
+    if (s_enabled)
+    {
+        throw std::invalid_argument("The access log is already started");
+    }
+
+    auto file = concurrency::streams::file_buffer<uint8_t>::open(file_name, std::ios::out | std::ios::app).get();
+    s_ring_entries = round_up_to_power_of_2(std::max<size_t>(ring_entries, 2));
+    s_stop = false;
+    s_flusher = std::thread(flush_until_stopped, file, flush_interval);
+    s_enabled = true;
+}
+
+void access_log::stop()
+{
+    std::thread flusher;
+    {
+        std::lock_guard<std::mutex> lock(s_lock);
+        if (!s_enabled)
+        {
+            return;
+        }
+        s_enabled = false;
+
+        // A thread that saw the log enabled may still be recording; its entry must be in before the final drain.
+        for (auto ring = s_rings.load(); ring != nullptr; ring = ring->m_next)
+        {
+            while (ring->m_recording.load())
+            {
+                std::this_thread::yield();
+            }
+        }
+
+        s_stop = true;
+        flusher = std::move(s_flusher);
+    }
+    s_stopping.notify_one();
+    flusher.join();
+}
+
+bool access_log::enabled()
+{
+    return s_enabled.load(std::memory_order_relaxed);
+}
+
+void access_log::record(const access_log_entry &entry)
+{
+    if (!enabled())
+    {
+        return;
+    }
+
+    // Either stop sees the flag and waits for the entry, or this sees the log stopped.
+    access_log_ring *ring = thread_ring();
+    ring->m_recording.store(true);
+    if (s_enabled.load())
+    {
+        const size_t head = ring->m_head.load(std::memory_order_relaxed);
+        if (head - ring->m_tail.load(std::memory_order_acquire) > ring->m_mask)
+        {
+            ++s_dropped;
+        }
+        else
+        {
+            ring->m_entries[head & ring->m_mask] = entry;
+            ring->m_head.store(head + 1, std::memory_order_release);
+        }
+    }
+    ring->m_recording.store(false, std::memory_order_release);
+}
+
+void access_log::record(access_log_source::source source, const http_request &request, status_code status,
+    uint64_t headers_time, uint64_t total_time, uint64_t request_size, uint64_t response_size,
+    access_log_failure::kind failed)
+{
+    if (!enabled())
+    {
+        return;
+    }
+
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+    const auto started = std::chrono::system_clock::now() - microseconds(total_time);
+
+    access_log_entry entry = {};
+    entry.start_time = static_cast<uint64_t>(duration_cast<microseconds>(started.time_since_epoch()).count());
+    entry.uri_hash = hash_uri(request.request_uri());
+    entry.request_size = request_size;
+    entry.response_size = response_size;
+    entry.headers_time = static_cast<uint32_t>(headers_time);
+    entry.total_time = static_cast<uint32_t>(total_time);
+    entry.status_code = status;
+    entry.source = static_cast<uint8_t>(source);
+    entry.method = method_code(request.method());
+    entry.failed = static_cast<uint8_t>(failed);
+    record(entry);
+}
+
+size_t access_log::dropped()
+{
+    return s_dropped;
+}
+
+uint64_t access_log::hash_uri(const uri &request_uri)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    auto add = [&hash](const utility::string_t &text)
+    {
+        for (auto it = text.begin(); it != text.end(); ++it)
+        {
+            hash ^= static_cast<uint64_t>(static_cast<std::make_unsigned<utility::char_t>::type>(*it));
+            hash *= 1099511628211ULL;
+        }
+    };
+
+    add(request_uri.path());
+    if (!request_uri.query().empty())
+    {
+        add(U("?"));
+        add(request_uri.query());
+    }
+    return hash;
+}
+
+uint8_t access_log::method_code(const method &request_method)
+{
+    static const method *codes[] = { &methods::GET, &methods::POST, &methods::PUT, &methods::DEL, &methods::HEAD,
+        &methods::OPTIONS, &methods::TRCE, &methods::CONNECT, &methods::MERGE, &methods::PATCH };
+
+    for (uint8_t i = 0; i < sizeof(codes) / sizeof(codes[0]); ++i)
+    {
+        if (*codes[i] == request_method)
+            return i + 1;
+    }
+    return 0;
+}
+
+}} // namespace web::http
+
+#endif // !defined(_MS_WINDOWS) || (_MSC_VER >= 1700)
@@ -40,60 +40,177 @@ namespace web { namespace http
 
 static utility::string_t _g_emptyString;
 
+// Names of the well known headers, indexed by header_ids::id. Both tables are constant initialized, so
+// looking a header up by id is safe from the constructors of other translation units' statics.
+static const utility::char_t * const _g_knownHeaderNames[header_ids::_count] =
+{
+    U(""),
+#define _HEADER_NAMES
+#define DAT(a,b) b,
+#include "http_constants.dat"
+#undef _HEADER_NAMES
+#undef DAT
+};
+
+// details::_hash_header_name of each of the names above, computed ahead of time.
+static const uint32_t _g_knownHeaderHashes[header_ids::_count] =
+{
+    0x811c9dc5u, // (unknown)
+    0x08247e29u, // Accept
+    0xda645c68u, // Accept-Charset
+    0xc9715a99u, // Accept-Encoding
+    0x75f67716u, // Accept-Language
+    0x6625cf66u, // Accept-Ranges
+    0x2c41499cu, // Age
+    0xaeb1a832u, // Allow
+    0x913657beu, // Authorization
+    0x50c8a4cdu, // Cache-Control
+    0x38b99ed9u, // Connection
+    0x03e2ed88u, // Content-Encoding
+    0x017d1113u, // Content-Language
+    0x4df9451du, // Content-Length
+    0x893b4c2eu, // Content-Location
+    0xbb31d46bu, // Content-MD5
+    0xd3ecfa4au, // Content-Range
+    0xfcf70995u, // Content-Type
+    0xd472dc59u, // Date
+    0x06c857c0u, // ETag
+    0x96da6b58u, // Expect
+    0x3e8ec783u, // Expires
+    0x95cd8075u, // From
+    0xaffea56fu, // Host
+    0xd67076eau, // If-Match
+    0x83e879a9u, // If-Modified-Since
+    0x972b6177u, // If-None-Match
+    0x8b887e3eu, // If-Range
+    0xe230478au, // If-Unmodified-Since
+    0xc0575a6bu, // Last-Modified
+    0x0bf5a9a6u, // Location
+    0x6cd905d6u, // Max-Forwards
+    0x19fa4625u, // Pragma
+    0xa17edaefu, // Proxy-Authenticate
+    0xa01f18bbu, // Proxy-Authorization
+    0xfadc0cd2u, // Range
+    0xec9af966u, // Referer
+    0xc6da1376u, // Retry-After
+    0x40ac3dd2u, // Server
+    0x3c453eb2u, // TE
+    0x816fede0u, // Trailer
+    0xddb4744cu, // Transfer-Encoding
+    0xdc97cc77u, // Upgrade
+    0x24259beeu, // User-Agent
+    0x40abde45u, // Vary
+    0x69122c13u, // Via
+    0x792112efu, // Warning
+    0x2e7bcf02u, // WWW-Authenticate
+};
+
+const utility::char_t * details::_known_header_name(header_ids::id id)
+{
+    return _g_knownHeaderNames[id];
+}
+
+uint32_t details::_known_header_hash(header_ids::id id)
+{
+    return _g_knownHeaderHashes[id];
+}
+
 utility::string_t http_headers::content_type() const
 {
     utility::string_t result;
-    match(http::header_names::content_type, result);
+    match(header_ids::content_type, result);
     return result;
 }
 
 void http_headers::set_content_type(utility::string_t type)
 {
-    add(http::header_names::content_type, std::move(type));
+    add(header_ids::content_type, std::move(type));
 }
 
 utility::string_t http_headers::cache_control() const
 {
     utility::string_t result;
-    match(http::header_names::cache_control, result);
+    match(header_ids::cache_control, result);
     return result;
 }
 
 void http_headers::set_cache_control(utility::string_t control)
 {
-    add(http::header_names::cache_control, std::move(control));
+    add(header_ids::cache_control, std::move(control));
 }
 
 utility::string_t http_headers::date() const
 {
     utility::string_t result;
-    match(http::header_names::date, result);
+    match(header_ids::date, result);
     return result;
 }
 
 void http_headers::set_date(const utility::datetime& date)
 {
-    add(http::header_names::date, date.to_string(utility::datetime::RFC_1123));
+    add(header_ids::date, date.to_string(utility::datetime::RFC_1123));
 }
 
 size_t http_headers::content_length() const
 {
     size_t length = 0;
-    match(http::header_names::content_length, length);
+    match(header_ids::content_length, length);
     return length;
 }
 
 void http_headers::set_content_length(size_t length)
 {
-    add(http::header_names::content_length, length);
+    add(header_ids::content_length, length);
 }
 
 static const utility::char_t * stream_was_set_explicitly = U("A stream was set on the message and extraction is not possible");
 static const utility::char_t * textual_content_type_missing = U("Content-Type must be textual to extract a string.");
 static const utility::char_t * unsupported_charset = U("Charset must be iso-8859-1, utf-8, utf-16, utf-16le, or utf-16be to be extracted.");
 
+// Body buffers of known length are presized up to this size, and grow a block at a time past it. The length
+// comes from the peer, so it does not get to decide how much is allocated before any of the body arrives.
+static const size_t max_reserved_body_size = 1024 * 1024;
+
+// The buffer _prepare_to_receive_data created for the body, if the message has one.
+static std::shared_ptr<streams::details::basic_producer_consumer_buffer<uint8_t>> body_buffer(const concurrency::streams::istream &instream)
+{
+    if (!instream)
+    {
+        return nullptr;
+    }
+    return std::dynamic_pointer_cast<streams::details::basic_producer_consumer_buffer<uint8_t>>(instream.streambuf().get_base());
+}
+
+// Reads all available data from a buffer into a collection. Data held in one contiguous block, such as a
+// presized body, is copied straight out of the block.
+template<typename Collection>
+static void read_body(concurrency::streams::streambuf<uint8_t> buf, Collection &body)
+{
+    const size_t size = buf.in_avail();
+    if (size == 0)
+    {
+        return;
+    }
+
+    uint8_t *ptr = nullptr;
+    size_t count = 0;
+    if (buf.acquire(ptr, count) && ptr != nullptr)
+    {
+        if (count == size)
+        {
+            body.assign(ptr, ptr + count);
+            buf.release(ptr, count);
+            return;
+        }
+        buf.release(ptr, 0);
+    }
+
+    body.resize(size);
+    buf.getn((uint8_t*)&body[0], body.size()).get(); // There is no risk of blocking.
+}
+
 http_msg_base::http_msg_base() 
-    : m_headers()
+    : m_headers(), m_body_mode(response_body_mode::buffer), m_received_body_size(0)
 {
 }
 
@@ -102,6 +219,14 @@ http_msg_base::http_msg_base()
 /// </summary>
 void http_msg_base::_prepare_to_receive_data()
 {
+#if !defined(_MS_WINDOWS)
+    // The body goes to a sink instead; there is nothing to read it back from.
+    if (_has_body_sink())
+    {
+        return;
+    }
+#endif
+
     // See if the user specified an outstream
     if (!outstream())
     {
@@ -121,6 +246,15 @@ void http_msg_base::_prepare_to_receive_data()
     // or media (like file) that the user can read from...
 }
 
+void http_msg_base::_reserve_body(size_t content_length)
+{
+    auto buffer = body_buffer(instream());
+    if (buffer)
+    {
+        buffer->reserve(std::min(content_length, max_reserved_body_size));
+    }
+}
+
 /// <summary>
 ///     Determine the content length
 /// </summary>
@@ -141,8 +275,8 @@ size_t http_msg_base::_get_content_length()
         size_t content_length = 0;
         utility::string_t transfer_encoding;
 
-        bool has_cnt_length = headers().match(header_names::content_length, content_length);
-        bool has_xfr_encode = headers().match(header_names::transfer_encoding, transfer_encoding);
+        bool has_cnt_length = headers().match(header_ids::content_length, content_length);
+        bool has_xfr_encode = headers().match(header_ids::transfer_encoding, transfer_encoding);
 
         if (has_xfr_encode)
         {
@@ -156,7 +290,7 @@ size_t http_msg_base::_get_content_length()
 
         // Neither is set. Assume transfer-encoding for now (until we have the ability to determine
         // the length of the stream).
-        headers().add(header_names::transfer_encoding, U("chunked"));
+        headers().add(header_ids::transfer_encoding, U("chunked"));
         return std::numeric_limits<size_t>::max();
     }
 
@@ -228,8 +362,7 @@ utility::string_t details::http_msg_base::_extract_string()
 #endif
     {
         std::string body;
-        body.resize((std::string::size_type)buf_r.in_avail());
-        buf_r.getn((uint8_t*)&body[0], body.size()).get(); // There is no risk of blocking.
+        read_body(buf_r, body);
         return to_string_t(usascii_to_utf16(body));
     }
 
@@ -241,8 +374,7 @@ utility::string_t details::http_msg_base::_extract_string()
 #endif
     {
         std::string body;
-        body.resize((std::string::size_type)buf_r.in_avail());
-        buf_r.getn((uint8_t*)&body[0], body.size()).get(); // There is no risk of blocking.
+        read_body(buf_r, body);
         return to_string_t(latin1_to_utf16(body));
     }
 
@@ -254,8 +386,7 @@ utility::string_t details::http_msg_base::_extract_string()
 #endif
     {
         std::string body;
-        body.resize((std::string::size_type)buf_r.in_avail());
-        buf_r.getn((uint8_t*)&body[0], body.size()).get(); // There is no risk of blocking.
+        read_body(buf_r, body);
         return to_string_t(body);
     }
 
@@ -266,8 +397,8 @@ utility::string_t details::http_msg_base::_extract_string()
     else if(boost::iequals(charset, charset_utf16))
 #endif
     {
-        std::vector<uint8_t> body((std::vector<uint8_t>::size_type)buf_r.in_avail());
-        buf_r.getn((uint8_t*)&body[0], body.size()).get(); // There is no risk of blocking.
+        std::vector<uint8_t> body;
+        read_body(buf_r, body);
         return to_string_t(convert_utf16_to_utf16(body));
     }
 
@@ -291,8 +422,8 @@ utility::string_t details::http_msg_base::_extract_string()
     else if(boost::iequals(charset, charset_utf16be))
 #endif
     {
-        std::vector<uint8_t> body((std::vector<uint8_t>::size_type)buf_r.in_avail());
-        buf_r.getn((uint8_t*)&body[0], body.size()).get(); // There is no risk of blocking.
+        std::vector<uint8_t> body;
+        read_body(buf_r, body);
         return to_string_t(convert_utf16be_to_utf16le(body, false));
     }
     
@@ -342,8 +473,7 @@ json::value details::http_msg_base::_extract_json()
 #endif
     {
         std::string body;
-        body.resize(buf_r.in_avail());
-        buf_r.getn((uint8_t*)&body[0], body.size()).get(); // There is no risk of blocking.
+        read_body(buf_r, body);
         return json::value::parse(to_string_t(latin1_to_utf16(body)));
     }
 
@@ -355,8 +485,7 @@ json::value details::http_msg_base::_extract_json()
 #endif
     {
         std::string body;
-        body.resize(buf_r.in_avail());
-        buf_r.getn((uint8_t*)&body[0], body.size()).get(); // There is no risk of blocking.
+        read_body(buf_r, body);
         return json::value::parse(to_string_t(body));
     }
 
@@ -367,8 +496,8 @@ json::value details::http_msg_base::_extract_json()
     else if(boost::iequals(charset, charset_utf16))
 #endif
     {
-        std::vector<uint8_t> body((std::vector<uint8_t>::size_type)buf_r.in_avail());
-        buf_r.getn((uint8_t*)&body[0], body.size()).get(); // There is no risk of blocking.
+        std::vector<uint8_t> body;
+        read_body(buf_r, body);
         return json::value::parse(to_string_t(convert_utf16_to_utf16(body)));
     }
 
@@ -392,8 +521,8 @@ json::value details::http_msg_base::_extract_json()
     else if(boost::iequals(charset, charset_utf16be))
 #endif
     {
-        std::vector<uint8_t> body((std::vector<uint8_t>::size_type)buf_r.in_avail());
-        buf_r.getn((uint8_t*)&body[0], body.size()).get(); // There is no risk of blocking.
+        std::vector<uint8_t> body;
+        read_body(buf_r, body);
         return json::value::parse(to_string_t(convert_utf16be_to_utf16le(body, false)));
     }
     
@@ -411,16 +540,15 @@ std::vector<uint8_t> details::http_msg_base::_extract_vector()
     }
 
     std::vector<uint8_t> body;
-    auto buf_r = instream().streambuf();	
-	size_t size = buf_r.in_avail();
 
-    body.resize((std::vector<uint8_t>::size_type)buf_r.in_avail());
-	if (size > 0)
-	{
-		body.resize(size);
-		buf_r.getn((uint8_t*)&body[0], body.size()).get(); // There is no risk of blocking.
-	}
+    // A body received into a single block is moved out rather than copied.
+    auto buffer = body_buffer(instream());
+    if (buffer && buffer->try_take(body))
+    {
+        return body;
+    }
 
+    read_body(instream().streambuf(), body);
     return body;
 }
 
@@ -523,7 +651,7 @@ static utility::string_t http_headers_body_to_string(const http_headers &headers
     buffer << CRLF;
 
     utility::string_t content_type;
-    if(headers.match(http::header_names::content_type, content_type))
+    if(headers.match(header_ids::content_type, content_type))
     {
         buffer << convert_body_to_string_t(content_type, instream);
     }
@@ -539,9 +667,9 @@ utility::string_t details::http_msg_base::to_string() const
 static void set_content_type_if_not_present(http::http_headers &headers, utility::string_t content_type)
 {
     utility::string_t temp;
-    if(!headers.match(http::header_names::content_type, temp))
+    if(!headers.match(header_ids::content_type, temp))
     {
-        headers.add(http::header_names::content_type, std::move(content_type));
+        headers.add(header_ids::content_type, std::move(content_type));
     }
 }
 
@@ -553,7 +681,7 @@ void details::http_msg_base::set_body(streams::istream instream, utility::string
 
 void details::http_msg_base::set_body(streams::istream instream, size_t contentLength, utility::string_t contentType)
 {
-    headers().add(http::header_names::content_length, contentLength);
+    headers().add(header_ids::content_length, contentLength);
     set_body(instream, std::move(contentType));
     m_data_available.set(contentLength);
 }
@@ -561,14 +689,18 @@ void details::http_msg_base::set_body(streams::istream instream, size_t contentL
 details::_http_request::_http_request()
   : m_initiated_response(0), 
     m_server_context(), 
-    m_listener_path(U(""))
+    m_listener_path(U("")),
+    m_priority(request_priority::normal),
+    m_response_body_mode(http::response_body_mode::buffer)
 {
 }
 
 details::_http_request::_http_request(std::shared_ptr<http::details::_http_server_context> server_context)
   : m_initiated_response(0), 
     m_server_context(std::move(server_context)),
-    m_listener_path(U(""))
+    m_listener_path(U("")),
+    m_priority(request_priority::normal),
+    m_response_body_mode(http::response_body_mode::buffer)
 {
 }
 
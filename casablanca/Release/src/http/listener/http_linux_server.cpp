@@ -0,0 +1,1485 @@
+/***
+* ==++==
+*
+* Copyright (c) Microsoft Corporation. All rights reserved. 
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+* http://www.apache.org/licenses/LICENSE-2.0
+* 
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* ==--==
+* =+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+
+*/
+#include "stdafx.h"
+#include "http_helpers.h"
+#include "http_server_api.h"
+#include "http_server.h"
+#include "http_linux_server.h"
+#include "http_access_log.h"
+#include "producerconsumerstream.h"
+#include "filestream.h"
+#include <pthread.h>
+#include <sched.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#define CRLF std::string("\r\n")
+
+using boost::asio::ip::tcp;
+using namespace boost::asio;
+
+namespace web
+{
+namespace http
+{
+
+namespace listener
+{
+
+    const size_t ChunkSize = 4 * 1024;
+
+    // The most sent with sendfile before going back to the shard's io_service, so one large file does not
+    // hold up the other connections on the shard's thread.
+    const size_t SendfileChunkSize = 1024 * 1024;
+
+namespace details
+{
+
+typedef http::details::integer_socket_option<SOL_SOCKET, SO_REUSEPORT> reuse_port;
+
+// Parses the digits of a Range bound. Returns false for an empty value or one that does not fit a size_t.
+static bool parse_range_bound(const std::string& digits, size_t& value)
+{
+    if (digits.empty())
+        return false;
+
+    value = 0;
+    for (auto it = digits.begin(); it != digits.end(); ++it)
+    {
+        const size_t digit = static_cast<size_t>(*it - '0');
+        if (value > (std::numeric_limits<size_t>::max() - digit) / 10)
+            return false;
+        value = value * 10 + digit;
+    }
+    return true;
+}
+
+// Parses a Range header holding a single byte range ("bytes=first-last", "bytes=first-" or "bytes=-suffix")
+// against a body of the given size. Returns false for anything else, which is then ignored and the whole
+// body sent, as is a bound too large to represent. A range starting past the end is returned with satisfiable
+// set to false.
+static bool parse_byte_range(const std::string& value, size_t size, size_t& first, size_t& last, bool& satisfiable)
+{
+    const std::string prefix = "bytes=";
+    if (!boost::istarts_with(value, prefix) || value.find(',') != std::string::npos)
+        return false;
+
+    auto spec = value.substr(prefix.size());
+    http::details::trim_whitespace(spec);
+    auto dash = spec.find('-');
+    if (dash == std::string::npos)
+        return false;
+
+    auto first_part = spec.substr(0, dash);
+    auto last_part = spec.substr(dash + 1);
+    if (first_part.find_first_not_of("0123456789") != std::string::npos || last_part.find_first_not_of("0123456789") != std::string::npos)
+        return false;
+
+    if (first_part.empty())
+    {
+        // suffix range: the last n bytes
+        size_t suffix;
+        if (!parse_range_bound(last_part, suffix))
+            return false;
+        satisfiable = suffix > 0 && size > 0;
+        first = size - std::min(suffix, size);
+        last = size - 1;
+        return true;
+    }
+
+    if (!parse_range_bound(first_part, first))
+        return false;
+    last = size - 1;
+    if (!last_part.empty())
+    {
+        size_t requested_last;
+        if (!parse_range_bound(last_part, requested_last) || requested_last < first)
+            return false;
+        last = std::min(requested_last, last);
+    }
+    satisfiable = first < size;
+    return true;
+}
+
+// Checks an If-None-Match header against an entity tag, comparing weakly as RFC 2616 asks for GET.
+static bool etag_matches(const std::string& if_none_match, const std::string& etag)
+{
+    auto strip_weak = [](std::string tag) -> std::string
+    {
+        http::details::trim_whitespace(tag);
+        return boost::starts_with(tag, "W/") ? tag.substr(2) : tag;
+    };
+
+    std::istringstream tags(if_none_match);
+    std::string tag;
+    while (std::getline(tags, tag, ','))
+    {
+        tag = strip_weak(tag);
+        if (tag == "*" || tag == strip_weak(etag))
+            return true;
+    }
+    return false;
+}
+
+// Converts a file time to a datetime, which counts 100ns ticks from 1601.
+static utility::datetime file_time_to_datetime(time_t time)
+{
+    return utility::datetime() + (static_cast<utility::datetime::interval_type>(time) + 11644473600ULL) * 10000000ULL;
+}
+
+// Compresses a response body a piece at a time, in gzip or zlib (HTTP "deflate") format.
+class response_compressor
+{
+public:
+    response_compressor(bool gzip, int level)
+    : m_input(ChunkSize)
+    , m_finishing(false)
+    , m_flush(false)
+    , m_output_full(false)
+    , m_finished(false)
+    {
+        memset(&m_stream, 0, sizeof(m_stream));
+        // 15 window bits gives the zlib format; adding 16 gives gzip.
+        if (deflateInit2(&m_stream, level, Z_DEFLATED, gzip ? 31 : 15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        {
+            throw std::bad_alloc();
+        }
+    }
+
+    ~response_compressor()
+    {
+        deflateEnd(&m_stream);
+    }
+
+    // The buffer the next piece of the body is read into.
+    uint8_t* input_buffer() { return m_input.data(); }
+
+    // True when all input given has been compressed and the output drained, so more input is wanted.
+    bool needs_input() const { return !m_finishing && m_stream.avail_in == 0 && !m_output_full; }
+
+    // Hands over the bytes read into the input buffer; none marks the end of the body. A short read means
+    // the body is produced slowly, so what was compressed so far is flushed rather than held back.
+    void set_input(size_t size)
+    {
+        m_stream.next_in = m_input.data();
+        m_stream.avail_in = static_cast<uInt>(size);
+        m_finishing = size == 0;
+        m_flush = size < m_input.size();
+    }
+
+    // Compresses into out and returns the number of bytes produced.
+    size_t compress(uint8_t* out, size_t size)
+    {
+        m_stream.next_out = out;
+        m_stream.avail_out = static_cast<uInt>(size);
+        int result = deflate(&m_stream, m_finishing ? Z_FINISH : (m_flush ? Z_SYNC_FLUSH : Z_NO_FLUSH));
+        if (result == Z_STREAM_END)
+        {
+            m_finished = true;
+        }
+        else if (result != Z_OK && result != Z_BUF_ERROR)
+        {
+            throw std::runtime_error("error compressing the response body");
+        }
+        m_output_full = m_stream.avail_out == 0;
+        return size - m_stream.avail_out;
+    }
+
+    bool finished() const { return m_finished; }
+
+private:
+    z_stream m_stream;
+    std::vector<uint8_t> m_input;
+    bool m_finishing;
+    bool m_flush;
+    bool m_output_full;
+    bool m_finished;
+};
+
+// Picks the content coding to compress a response with from an Accept-Encoding header: gzip or deflate,
+// whichever has the higher quality value, gzip on a tie. Returns an empty string if neither is acceptable.
+static utility::string_t choose_content_coding(const utility::string_t& accept_encoding)
+{
+    double gzip = -1, deflate = -1, any = -1;
+    std::istringstream codings(accept_encoding);
+    utility::string_t coding;
+    while (std::getline(codings, coding, ','))
+    {
+        double quality = 1;
+        auto semicolon = coding.find(';');
+        if (semicolon != utility::string_t::npos)
+        {
+            auto parameter = coding.substr(semicolon + 1);
+            http::details::trim_whitespace(parameter);
+            if (boost::istarts_with(parameter, U("q=")))
+            {
+                quality = atof(parameter.c_str() + 2);
+            }
+            coding.erase(semicolon);
+        }
+        http::details::trim_whitespace(coding);
+
+        if (boost::iequals(coding, U("gzip")) || boost::iequals(coding, U("x-gzip"))) gzip = quality;
+        else if (boost::iequals(coding, U("deflate"))) deflate = quality;
+        else if (coding == U("*")) any = quality;
+    }
+
+    if (gzip < 0) gzip = any;
+    if (deflate < 0) deflate = any;
+    if (gzip <= 0 && deflate <= 0)
+        return utility::string_t();
+    return gzip >= deflate ? U("gzip") : U("deflate");
+}
+
+bool queue_time_shedder::admit(clock::duration waited, clock::time_point now)
+{
+    bool shed = m_budget > clock::duration::zero() && waited > m_budget;
+
+    if (m_target > clock::duration::zero())
+    {
+        pplx::scoped_critical_section lock(m_lock);
+        if (now >= m_interval_end)
+        {
+            if (m_interval_end != clock::time_point())
+            {
+                m_standing_queue = m_min_wait > m_target;
+            }
+            m_min_wait = clock::duration::max();
+            m_interval_end = now + m_interval;
+        }
+        m_min_wait = std::min(m_min_wait, waited);
+        shed = shed || (m_standing_queue && waited > 2 * m_target);
+    }
+
+    if (shed)
+    {
+        ++m_shed;
+    }
+    return !shed;
+}
+
+void shard_scheduler::schedule(pplx::TaskProc proc, void* param)
+{
+    pplx::scoped_critical_section lock(m_lock);
+    if (m_p_service != nullptr)
+    {
+        m_p_service->post(boost::bind(proc, param));
+    }
+    else
+    {
+        crossplat::threadpool::shared_instance().service().post(boost::bind(proc, param));
+    }
+}
+
+void shard_scheduler::detach()
+{
+    pplx::scoped_critical_section lock(m_lock);
+    m_p_service = nullptr;
+}
+
+// The shard whose thread is the current one, if any.
+static __thread acceptor_shard* s_current_shard = nullptr;
+
+// Handed out to the thread-per-core shards of every listener in the process, so that the shards of
+// different listeners do not all land on the first cores.
+static std::atomic<size_t> s_next_core(0);
+
+// Pins a shard's thread to the next of the cores the process is allowed to run on.
+static void pin_to_next_core(std::thread& thread)
+{
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+    {
+        throw http_exception(errno, "Error: could not get the cores the process may run on");
+    }
+
+    int skip = static_cast<int>(s_next_core++ % static_cast<size_t>(CPU_COUNT(&allowed)));
+    int core = 0;
+    for (; core < CPU_SETSIZE; ++core)
+    {
+        if (CPU_ISSET(core, &allowed) && skip-- == 0)
+        {
+            break;
+        }
+    }
+
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(core, &cpus);
+    const int result = pthread_setaffinity_np(thread.native_handle(), sizeof(cpus), &cpus);
+    if (result != 0)
+    {
+        throw http_exception(result, "Error: could not pin an acceptor thread to a core");
+    }
+}
+
+void acceptor_shard::start(const tcp::endpoint& endpoint)
+{
+    m_acceptor.open(endpoint.protocol());
+    m_acceptor.set_option(tcp::acceptor::reuse_address(true));
+    m_acceptor.set_option(reuse_port(1));
+    m_acceptor.bind(endpoint);
+    m_acceptor.listen();
+
+    if (m_p_parent->m_p_server->thread_per_core())
+    {
+        m_scheduler = std::make_shared<shard_scheduler>(m_service);
+    }
+
+    accept();
+    m_thread = std::thread([this]() { run(); });
+
+    if (m_scheduler)
+    {
+        try
+        {
+            pin_to_next_core(m_thread);
+        }
+        catch (...)
+        {
+            stop_accepting();
+            stop();
+            throw;
+        }
+    }
+}
+
+void acceptor_shard::run()
+{
+    s_current_shard = this;
+    if (m_scheduler)
+    {
+        pplx::set_thread_scheduler(m_scheduler);
+    }
+
+    m_service.run();
+
+    if (m_scheduler)
+    {
+        pplx::set_thread_scheduler(nullptr);
+    }
+    s_current_shard = nullptr;
+}
+
+void acceptor_shard::accept()
+{
+    auto socket = new tcp::socket(m_service);
+    m_acceptor.async_accept(*socket, boost::bind(&acceptor_shard::on_accept, this, socket, placeholders::error));
+}
+
+void acceptor_shard::on_accept(tcp::socket* socket, const boost::system::error_code& ec)
+{
+    if (ec)
+    {
+        delete socket;
+        if (ec == boost::asio::error::operation_aborted || !m_acceptor.is_open())
+        {
+            return;
+        }
+    }
+    else
+    {
+        m_p_parent->add_connection(std::unique_ptr<tcp::socket>(socket), m_service);
+    }
+
+    // A failed accept, such as one for running out of file descriptors, does not stop the listener.
+    accept();
+}
+
+void acceptor_shard::stop_accepting()
+{
+    if (!m_thread.joinable() || s_current_shard == this)
+    {
+        boost::system::error_code ignore;
+        m_acceptor.close(ignore);
+        return;
+    }
+
+    // The acceptor is only touched from the shard's thread once that runs.
+    pplx::notification_event closed;
+    m_service.post([this, &closed]()
+    {
+        boost::system::error_code ignore;
+        m_acceptor.close(ignore);
+        closed.set();
+    });
+    closed.wait();
+}
+
+void acceptor_shard::stop()
+{
+    if (m_thread.joinable())
+    {
+        // Tasks scheduled from now on might find the thread gone.
+        if (m_scheduler)
+        {
+            m_scheduler->detach();
+        }
+        m_work.reset();
+        m_thread.join();
+    }
+}
+
+void hostport_listener::start()
+{
+    // resolve the endpoint address
+    tcp::resolver resolver(crossplat::threadpool::shared_instance().service());
+    tcp::resolver::query query(m_host, m_port);
+    tcp::endpoint endpoint = *resolver.resolve(query);
+
+    try
+    {
+        for (size_t i = 0; i < m_p_server->acceptor_threads(); ++i)
+        {
+            std::unique_ptr<acceptor_shard> shard(new acceptor_shard(this, i));
+            shard->start(endpoint);
+
+            // With port 0 the first shard picks the port; the others share it.
+            endpoint = shard->local_endpoint();
+            m_shards.push_back(std::move(shard));
+        }
+    }
+    catch (...)
+    {
+        stop();
+        throw;
+    }
+}
+
+void hostport_listener::add_connection(std::unique_ptr<tcp::socket> socket, io_service& service)
+{
+    pplx::scoped_lock<pplx::recursive_lock> lock(m_connections_lock);
+    m_connections.insert(new connection(std::move(socket), service, m_p_server, this));
+    m_all_connections_complete.reset();
+}
+
+connection::connection(std::unique_ptr<tcp::socket> socket, io_service& service, http_linux_server* server, hostport_listener* parent)
+: m_socket(std::move(socket))
+, m_service(service)
+, m_request_buf()
+, m_response_buf()
+, m_idle_timer(service)
+, m_p_server(server)
+, m_p_parent(parent)
+, m_arrival(0)
+, m_response_start(0)
+, m_close(false)
+, m_chunked(false)
+, m_file_handle(-1)
+, m_handler_failed(false)
+, m_refs(1)
+{
+    start_request_response();
+}
+
+connection::~connection()
+{
+}
+
+void connection::close()
+{
+    m_close = true;
+    auto sock = m_socket.get();
+    if (sock != nullptr)
+    {
+        boost::system::error_code ec;
+        sock->cancel(ec);
+        sock->shutdown(tcp::socket::shutdown_both, ec);
+        sock->close();
+    }
+    m_request._reply_if_not_already(status_codes::InternalError);
+}
+
+void connection::start_request_response()
+{
+    m_read_size = 0; m_read = 0;
+    m_handler_failed = false;
+
+    // The buffer is not cleared: it may already hold the next pipelined request, in which case the
+    // read below completes without touching the socket.
+    ++m_refs;
+    m_idle_timer.expires_from_now(m_p_server->keep_alive_timeout());
+    m_idle_timer.async_wait(boost::bind(&connection::handle_idle_timeout, this, placeholders::error));
+
+    async_read_until(*m_socket, m_request_buf, CRLF + CRLF, boost::bind(&connection::handle_http_line, this, placeholders::error));
+}
+
+void connection::handle_idle_timeout(const boost::system::error_code& ec)
+{
+    // A read that completed just as the timer expired has already moved the expiry time on.
+    if (!ec && m_idle_timer.expires_at() <= steady_timer::clock_type::now())
+    {
+        // The client kept the connection open without sending a request; abort the pending read.
+        m_close = true;
+        boost::system::error_code ignore;
+        m_socket->cancel(ignore);
+    }
+
+    if (--m_refs == 0)
+        delete this;
+}
+
+void connection::handle_http_line(const boost::system::error_code& ec)
+{
+    m_idle_timer.expires_at(steady_timer::time_point::max());
+    m_request = http_request::_create_request(std::unique_ptr<http::details::_http_server_context>(new linux_request_context()));
+    if (ec)
+    {
+        // client closed connection, or it stayed idle for too long
+        if (ec == boost::asio::error::eof || ec == boost::asio::error::operation_aborted)
+        {
+            finish_request_response();
+        }
+        else
+        {
+            m_request.reply(status_codes::InternalError);
+            do_response();
+        }
+    }
+    else
+    {
+        m_arrival = utility::details::steady_clock_microseconds();
+
+        // read http status line
+
+        std::istream request_stream(&m_request_buf);
+        std::skipws(request_stream);
+
+        std::string http_verb;
+        request_stream >> http_verb;
+
+        if (boost::iequals(http_verb, http::methods::GET))          http_verb = http::methods::GET;
+        else if (boost::iequals(http_verb, http::methods::POST))    http_verb = http::methods::POST;
+        else if (boost::iequals(http_verb, http::methods::PUT))     http_verb = http::methods::PUT;
+        else if (boost::iequals(http_verb, http::methods::DEL))     http_verb = http::methods::DEL;
+        else if (boost::iequals(http_verb, http::methods::HEAD))    http_verb = http::methods::HEAD;
+        else if (boost::iequals(http_verb, http::methods::TRCE))    http_verb = http::methods::TRCE;
+        else if (boost::iequals(http_verb, http::methods::CONNECT)) http_verb = http::methods::CONNECT;
+        else if (boost::iequals(http_verb, http::methods::OPTIONS)) http_verb = http::methods::OPTIONS;
+        m_request.set_method(http_verb);
+
+        std::string http_path_and_version;
+        std::getline(request_stream, http_path_and_version);
+        const size_t VersionPortionSize = sizeof(" HTTP/1.1\r") - 1;
+
+        // Get the host part of the address. This is a bit of a hack, like the Windows one...
+        std::string host_part = "http://" + m_p_parent->m_host + ":" + m_p_parent->m_port;
+        uri request_uri = uri::encode_uri(host_part);
+        // Get the path - remove the version portion and prefix space
+        request_uri = uri_builder(request_uri).append(http_path_and_version.substr(1, http_path_and_version.size() - VersionPortionSize - 1)).to_uri();
+        m_request.set_request_uri(request_uri);
+
+        // Get the version
+        std::string http_version = http_path_and_version.substr(http_path_and_version.size() - VersionPortionSize + 1, VersionPortionSize - 2);
+
+        handle_headers(http_version == "HTTP/1.0");
+    }
+}
+
+void connection::handle_headers(bool http_1_0)
+{
+    std::istream request_stream(&m_request_buf);
+    std::string header;
+    while (std::getline(request_stream, header) && header != "\r")
+    {
+        auto colon = header.find(':');
+        if (colon != std::string::npos)
+        {
+            auto name = header.substr(0, colon);
+            auto value = header.substr(colon+1, header.length() - (colon+1)); // also exclude '\r'
+            http::details::trim_whitespace(name);
+            http::details::trim_whitespace(value);
+
+            auto& currentValue = m_request.headers()[name];
+            if (currentValue.empty() || boost::iequals(name, U("content-length"))) // (content-length is already set)
+            {
+                currentValue = value;
+            }
+            else currentValue += U(", ") + value;
+        }
+        else
+        {
+            m_request.reply(status_codes::BadRequest);
+            do_response();
+            return;
+        }
+    }
+
+    m_chunked = false;
+    utility::string_t name;
+    // An HTTP/1.1 connection persists unless the client asks to close it; an HTTP/1.0 one only if
+    // the client asks to keep it alive.
+    m_close = http_1_0;
+    if (m_request.headers().match(U("connection"), name))
+    {
+        if (boost::iequals(name, U("close")))
+        {
+            m_close = true;
+        }
+        else if (boost::iequals(name, U("keep-alive")))
+        {
+            m_close = false;
+        }
+    }
+
+    if (m_request.headers().match(U("transfer-encoding"), name))
+    {
+        // This is not quite right. See details in TFS#549211
+        if (!boost::iequals(name, U("identity")))
+        {
+            m_chunked = true;
+        }
+    }
+
+    Concurrency::streams::producer_consumer_buffer<uint8_t> buf;
+    m_request._get_impl()->set_instream(buf.create_istream());
+    m_request._get_impl()->set_outstream(buf.create_ostream());
+    if (m_chunked)
+    {
+        boost::asio::async_read_until(*m_socket, m_request_buf, CRLF, boost::bind(&connection::handle_chunked_header, this, placeholders::error));
+        dispatch_request_to_listener();
+        return;
+    }
+
+    if (!m_request.headers().match(U("content-length"), m_read_size))
+        m_read_size = 0;
+
+        if (m_read_size == 0)
+        {
+            request_data_avail( 0);
+        }
+        else // need to read the sent data
+        {
+            m_read = 0;
+            async_read_until_buffersize(std::min(ChunkSize, m_read_size), boost::bind(&connection::handle_body, this, placeholders::error));
+        }
+
+        dispatch_request_to_listener();
+    }
+
+void connection::handle_chunked_header(const boost::system::error_code& ec)
+{
+    if (!ec)
+    {
+        std::istream is(&m_request_buf);
+        int len;
+        is >> std::hex >> len;
+        m_request_buf.consume(CRLF.size());
+        m_read += len;
+        if (len == 0)
+            // The last chunk is followed by optional trailers and an empty line, which must be
+            // consumed so that a pipelined request after it starts at the front of the buffer.
+            boost::asio::async_read_until(*m_socket, m_request_buf, CRLF,
+                boost::bind(&connection::handle_chunked_trailer, this, placeholders::error, m_read));
+        else
+            async_read_until_buffersize(len + 2, boost::bind(&connection::handle_chunked_body, this, boost::asio::placeholders::error, len));
+    }
+    else
+    {
+        m_request._reply_if_not_already(status_codes::BadRequest);
+    }
+}
+
+void connection::handle_chunked_trailer(const boost::system::error_code& ec, size_t size)
+{
+    if (!ec)
+    {
+        std::istream is(&m_request_buf);
+        std::string trailer;
+        std::getline(is, trailer);
+        if (trailer != "\r")
+        {
+            // Trailers are not passed on to the request.
+            boost::asio::async_read_until(*m_socket, m_request_buf, CRLF,
+                boost::bind(&connection::handle_chunked_trailer, this, placeholders::error, size));
+        }
+        else
+        {
+            request_data_avail(size);
+        }
+    }
+    else
+    {
+        m_request._reply_if_not_already(status_codes::BadRequest);
+    }
+}
+
+void connection::handle_chunked_body(const boost::system::error_code& ec, int toWrite)
+{
+    if (!ec)
+    {
+        auto writebuf = m_request._get_impl()->outstream().streambuf();
+        writebuf.putn(buffer_cast<const uint8_t *>(m_request_buf.data()), toWrite).then([=](size_t) {
+            m_request_buf.consume(2 + toWrite);
+
+            boost::asio::async_read_until(*m_socket, m_request_buf, CRLF, 
+                    boost::bind(&connection::handle_chunked_header, this, placeholders::error));
+        });
+    }
+    else
+    {
+        m_request._reply_if_not_already(status_codes::BadRequest);
+    }
+}
+
+void connection::handle_body(const boost::system::error_code& ec)
+{
+    // read body
+    if (ec)
+    {
+        m_request._reply_if_not_already(status_codes::BadRequest);
+    }
+    else if (m_read < m_read_size)  // there is more to read
+    {
+        auto writebuf = m_request._get_impl()->outstream().streambuf();
+        writebuf.putn(boost::asio::buffer_cast<const uint8_t*>(m_request_buf.data()), std::min(m_request_buf.size(), m_read_size - m_read)).then([=](size_t writtenSize) {
+            m_read += writtenSize;
+            m_request_buf.consume(writtenSize);
+            async_read_until_buffersize(std::min(ChunkSize, m_read_size - m_read), boost::bind(&connection::handle_body, this, placeholders::error));
+        });
+    }
+    else  // have read request body
+    {
+        request_data_avail(m_read);
+    }
+}
+
+
+template <typename ReadHandler>
+void connection::async_read_until_buffersize(size_t size, ReadHandler handler)
+{
+    auto bufsize = m_request_buf.size();
+    if (bufsize >= size)
+        boost::asio::async_read(*m_socket, m_request_buf, transfer_at_least(0), handler);
+    else
+        boost::asio::async_read(*m_socket, m_request_buf, transfer_at_least(size - bufsize), handler);
+}
+
+void connection::dispatch_request_to_listener()
+{
+    // locate the listener:
+    http_listener_interface* pListener = nullptr;
+    {
+        auto path_segments = uri::split_path(uri::decode(m_request.relative_uri().path()));
+        for (auto i = static_cast<long>(path_segments.size()); i >= 0; --i)
+        {
+            std::string path = "";
+            for (size_t j = 0; j < static_cast<size_t>(i); ++j)
+            {
+                path += "/" + path_segments[j];
+            }
+            path += "/";
+
+            pplx::scoped_read_lock lock(m_p_parent->m_listeners_lock);
+            auto it = m_p_parent->m_listeners.find(path);
+            if (it != m_p_parent->m_listeners.end())
+            {
+                pListener = it->second;
+                break;
+            }
+        }
+    }
+
+    if (pListener == nullptr)
+    {
+        m_request.reply(status_codes::NotFound);
+        do_response();
+    }
+    else
+    {
+        m_request._set_listener_path(pListener->uri().path());
+        do_response();
+
+        // The handler runs on the thread pool, off the shard's thread, or in thread-per-core mode back on
+        // the shard's thread once it is free. The time the request waits there is its queue time; a request
+        // that waited too long is answered 503 unhandled.
+        auto request = m_request;
+        auto arrival = m_arrival;
+        pplx::create_task([this, request, arrival, pListener]()
+        {
+            const auto waited = std::chrono::microseconds(utility::details::steady_clock_microseconds() - arrival);
+            if (!m_p_server->m_shedder.admit(waited, details::queue_time_shedder::clock::now()))
+            {
+                http_request shed = request;
+                shed._reply_if_not_already(status_codes::ServiceUnavailable);
+            }
+            else
+            {
+                invoke_listener(pListener, request);
+            }
+
+            if (--m_refs == 0)
+                delete this;
+        });
+        return;
+    }
+
+    if (--m_refs == 0)
+        delete this;
+}
+
+void connection::invoke_listener(http_listener_interface* pListener, http_request request)
+{
+    // Look up the lock for the http_listener.
+    pplx::reader_writer_lock *pListenerLock;
+    {
+        pplx::reader_writer_lock::scoped_lock_read lock(m_p_server->m_listeners_lock);
+
+        // It is possible the listener could have unregistered.
+        if(m_p_server->m_registered_listeners.find(pListener) == m_p_server->m_registered_listeners.end())
+        {
+            request.reply(status_codes::NotFound);
+            return;
+        }
+        pListenerLock = m_p_server->m_registered_listeners[pListener].get();
+
+        // We need to acquire the listener's lock before releasing the registered listeners lock.
+        // But we don't need to hold the registered listeners lock when calling into the user's code.
+        pListenerLock->lock_read();
+    }
+
+    try
+    {
+        pListener->handle_request(request);
+        pListenerLock->unlock();
+    } 
+    catch(...)
+    {
+        // An exception thrown out of the handler is answered with a 500, and flagged in the access log.
+        pListenerLock->unlock();
+        m_handler_failed = true;
+        request._reply_if_not_already(status_codes::InternalError);
+    }
+}
+
+void connection::request_data_avail(size_t size)
+{
+    // closing writing data
+    m_request._get_impl()->_complete(size);
+}
+
+void connection::do_response()
+{
+    ++m_refs;
+    pplx::task<http_response> response_task = m_request.get_response();
+
+    response_task.then(
+        [=](pplx::task<http::http_response> r_task)
+        {
+            http::http_response response;
+            try
+            {
+                response = r_task.get();
+            }
+            catch(...)
+            {
+                m_handler_failed = true;
+                response = http::http_response(status_codes::InternalError);
+            }
+            // before sending response, the full incoming message need to be processed.
+            m_request.content_ready().then([=](pplx::task<http::http_request>) {
+                try
+                {
+                    async_process_response(response);
+                }
+                catch(...)
+                {
+                    // Nothing observes this task: an exception escaping it would terminate the process.
+                    m_handler_failed = true;
+                    async_process_response(http::http_response(status_codes::InternalError));
+                }
+            });
+        });
+}
+
+void connection::async_process_response(http_response response)
+{
+    m_response_buf.consume(m_response_buf.size()); // clear the buffer
+    std::ostream os(&m_response_buf);
+    m_response_start = utility::details::steady_clock_microseconds();
+
+    m_chunked = false;
+    m_write = m_write_size = 0;
+
+    // May change the status code, so it goes before the status line.
+    prepare_file_response(response);
+    prepare_compressed_response(response);
+
+    os << "HTTP/1.1 " << response.status_code() << " " 
+        << response.reason_phrase()
+        << CRLF;
+
+    std::string transferencoding;
+    if (response.headers().match(header_names::transfer_encoding, transferencoding) && transferencoding == "chunked")
+    {
+        m_chunked  = true;
+    }
+    if (!response.headers().match(header_names::content_length, m_write_size) && response.body())
+    {
+        m_chunked = true;
+        response.headers()[header_names::transfer_encoding] = U("chunked");
+    }
+    if (m_request.method() == methods::HEAD)
+    {
+        // The headers describe the body a GET would get, but none follows them.
+        m_chunked = false;
+        m_write_size = 0;
+    }
+
+    for (auto it = response.headers().begin();
+            it != response.headers().end(); ++it)
+    {
+        // check if the responder has requested we close the connection
+        if (boost::iequals(it->first, U("connection"))) {
+            if (boost::iequals(it->second, U("close")))
+            {
+                m_close = true;
+            }
+        }
+        os << it->first << ": "
+           << it->second << CRLF;
+    }
+    os << CRLF;
+
+    boost::asio::async_write(*m_socket, m_response_buf, boost::bind(&connection::handle_headers_written, this, response, placeholders::error));
+}
+
+
+// Sets the response up to send a body backed by a file with sendfile, instead of copying it through
+// m_response_buf. Answers conditional GETs from the file's modification time and a single byte Range
+// from the file's size.
+void connection::prepare_file_response(http_response response)
+{
+    m_file_handle = -1;
+
+    auto body = response.body();
+    if (!body)
+        return;
+    auto file = std::dynamic_pointer_cast<Concurrency::streams::details::basic_file_buffer<uint8_t>>(body.streambuf().get_base());
+    if (!file)
+        return;
+
+    struct stat info;
+    int handle = file->_native_handle();
+    auto position = body.tell();
+    if (handle == -1 || position == static_cast<decltype(position)>(-1) || fstat(handle, &info) != 0 || !S_ISREG(info.st_mode))
+        return;
+
+    size_t size = static_cast<size_t>(info.st_size);
+    size_t start = std::min(static_cast<size_t>(position), size);
+    size_t end = size;
+    size_t length;
+    if (response.headers().match(header_names::content_length, length))
+        end = std::min(end, start + length);
+
+    auto& headers = response.headers();
+    const bool whole_file = start == 0 && end == size;
+    const bool is_get = m_request.method() == methods::GET || m_request.method() == methods::HEAD;
+    if (whole_file && is_get && response.status_code() == status_codes::OK)
+    {
+        auto last_modified = file_time_to_datetime(info.st_mtime);
+        if (!headers.has(header_names::last_modified))
+            headers[header_names::last_modified] = last_modified.to_string();
+        if (!headers.has(header_names::etag))
+        {
+            std::ostringstream etag;
+            etag << "\"" << std::hex << info.st_size << "-" << info.st_mtime << "\"";
+            headers[header_names::etag] = etag.str();
+        }
+        headers[header_names::accept_ranges] = U("bytes");
+
+        auto& request_headers = m_request.headers();
+        utility::string_t value;
+        bool not_modified = false;
+        if (request_headers.match(header_names::if_none_match, value))
+        {
+            not_modified = etag_matches(value, headers[header_names::etag]);
+        }
+        else if (request_headers.match(header_names::if_modified_since, value))
+        {
+            auto since = utility::datetime::from_string(value);
+            not_modified = since.to_interval() != 0 && last_modified.to_interval() <= since.to_interval();
+        }
+
+        if (not_modified)
+        {
+            response.set_status_code(status_codes::NotModified);
+            headers[header_names::content_length] = U("0");
+            return;
+        }
+
+        // A Range under an If-Range that no longer matches the file gets the whole file.
+        if (request_headers.match(header_names::range, value) &&
+            (!request_headers.has(header_names::if_range) ||
+             request_headers[header_names::if_range] == headers[header_names::etag] ||
+             request_headers[header_names::if_range] == headers[header_names::last_modified]))
+        {
+            size_t first, last;
+            bool satisfiable;
+            if (parse_byte_range(value, size, first, last, satisfiable))
+            {
+                std::ostringstream range;
+                if (!satisfiable)
+                {
+                    range << "bytes */" << size;
+                    response.set_status_code(status_codes::RangeNotSatisfiable);
+                    headers[header_names::content_range] = range.str();
+                    headers[header_names::content_length] = U("0");
+                    return;
+                }
+
+                range << "bytes " << first << "-" << last << "/" << size;
+                response.set_status_code(status_codes::PartialContent);
+                headers[header_names::content_range] = range.str();
+                start = first;
+                end = last + 1;
+            }
+        }
+    }
+
+    headers.set_content_length(end - start);
+    headers.remove(header_names::transfer_encoding);
+    if (m_request.method() != methods::HEAD)
+    {
+        m_file_handle = handle;
+        m_file_offset = start;
+        m_file_end = end;
+    }
+}
+
+// Decides whether to compress the response body and, if so, sets up the headers and the compressor.
+void connection::prepare_compressed_response(http_response response)
+{
+    m_compressor.reset();
+
+    const int level = m_p_server->compression_level();
+    auto status = response.status_code();
+    if (level == 0 || m_file_handle != -1 || !response.body() || m_request.method() == methods::HEAD ||
+        status < 200 || status == status_codes::NoContent || status == status_codes::NotModified || status == status_codes::PartialContent)
+    {
+        return;
+    }
+
+    auto& headers = response.headers();
+    utility::string_t content_type, charset, value;
+    http::details::parse_content_type_and_charset(headers.content_type(), content_type, charset);
+    if (headers.has(header_names::content_encoding) || !http::details::is_content_type_textual(content_type))
+        return;
+
+    size_t length;
+    if (headers.match(header_names::content_length, length) && length < m_p_server->compression_min_size())
+        return;
+
+    // The body sent now depends on Accept-Encoding, whichever way it goes.
+    if (headers.match(header_names::vary, value) && !value.empty())
+        headers[header_names::vary] = value + U(", ") + header_names::accept_encoding;
+    else
+        headers[header_names::vary] = header_names::accept_encoding;
+
+    if (!m_request.headers().match(header_names::accept_encoding, value))
+        return;
+    auto coding = choose_content_coding(value);
+    if (coding.empty())
+        return;
+
+    m_compressor.reset(new response_compressor(coding == U("gzip"), level));
+    headers[header_names::content_encoding] = coding;
+    headers.remove(header_names::content_length);
+    headers[header_names::transfer_encoding] = U("chunked");
+}
+
+void connection::handle_write_chunked_response(http_response response, const boost::system::error_code& ec)
+{
+    if (ec)
+        return handle_response_written(response, ec);
+
+    auto readbuf = response._get_impl()->instream().streambuf();
+    auto membuf = m_response_buf.prepare(ChunkSize + http::details::chunked_encoding::additional_encoding_space);
+
+    readbuf.getn(buffer_cast<uint8_t *>(membuf) + http::details::chunked_encoding::data_offset, ChunkSize).then([=](size_t actualSize) {
+        size_t offset = http::details::chunked_encoding::add_chunked_delimiters(buffer_cast<uint8_t *>(membuf), ChunkSize+http::details::chunked_encoding::additional_encoding_space, actualSize);
+        m_write += actualSize;
+        m_response_buf.commit(actualSize + http::details::chunked_encoding::additional_encoding_space);
+        m_response_buf.consume(offset);
+        boost::asio::async_write(*m_socket, m_response_buf,
+            boost::bind(actualSize == 0 ? &connection::handle_response_written : &connection::handle_write_chunked_response, this, response, placeholders::error));
+    });
+}
+
+
+void connection::handle_write_file_response(http_response response, const boost::system::error_code& ec)
+{
+    if (ec)
+        return handle_response_written(response, ec);
+
+    boost::system::error_code error;
+    m_socket->native_non_blocking(true, error);
+    while (!error && m_file_offset < m_file_end)
+    {
+        off_t offset = static_cast<off_t>(m_file_offset);
+        auto sent = ::sendfile(m_socket->native_handle(), m_file_handle, &offset, std::min(SendfileChunkSize, m_file_end - m_file_offset));
+        if (sent > 0)
+        {
+            m_file_offset = static_cast<size_t>(offset);
+            m_write += static_cast<size_t>(sent);
+            if (m_file_offset < m_file_end)
+            {
+                // Let the shard's other connections run before the next chunk.
+                m_service.post(boost::bind(&connection::handle_write_file_response, this, response, boost::system::error_code()));
+                return;
+            }
+        }
+        else if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            // The socket is full; continue once it can take more.
+            m_socket->async_write_some(null_buffers(), boost::bind(&connection::handle_write_file_response, this, response, placeholders::error));
+            return;
+        }
+        else if (sent == 0)
+        {
+            // The file is shorter than the length already sent in the headers.
+            error = boost::asio::error::eof;
+        }
+        else if (errno != EINTR)
+        {
+            error = boost::system::error_code(errno, boost::system::system_category());
+        }
+    }
+
+    if (!error)
+    {
+        // Leave the stream where a read of the body would have.
+        response.body().seek(m_file_end);
+    }
+    m_file_handle = -1;
+    handle_response_written(response, error);
+}
+
+void connection::handle_write_compressed_response(http_response response, const boost::system::error_code& ec)
+{
+    if (ec)
+        return handle_response_written(response, ec);
+
+    if (!m_compressor->needs_input())
+        return write_compressed_chunk(response);
+
+    auto readbuf = response._get_impl()->instream().streambuf();
+    readbuf.getn(m_compressor->input_buffer(), ChunkSize).then([=](size_t actualSize) {
+        m_compressor->set_input(actualSize);
+        write_compressed_chunk(response);
+    });
+}
+
+void connection::write_compressed_chunk(http_response response)
+{
+    auto membuf = m_response_buf.prepare(ChunkSize + http::details::chunked_encoding::additional_encoding_space);
+    auto data = buffer_cast<uint8_t *>(membuf);
+
+    size_t produced;
+    try
+    {
+        produced = m_compressor->compress(data + http::details::chunked_encoding::data_offset, ChunkSize);
+    }
+    catch (const std::exception&)
+    {
+        return handle_response_written(response, boost::asio::error::invalid_argument);
+    }
+
+    if (produced == 0 && !m_compressor->finished())
+    {
+        // zlib is holding on to what it has; give it more of the body.
+        return handle_write_compressed_response(response, boost::system::error_code());
+    }
+
+    // Once the compressed stream has ended, an empty chunk ends the body.
+    size_t offset = http::details::chunked_encoding::add_chunked_delimiters(data, ChunkSize + http::details::chunked_encoding::additional_encoding_space, produced);
+    m_write += produced;
+    m_response_buf.commit(produced + http::details::chunked_encoding::additional_encoding_space);
+    m_response_buf.consume(offset);
+    boost::asio::async_write(*m_socket, m_response_buf,
+        boost::bind(produced == 0 ? &connection::handle_response_written : &connection::handle_write_compressed_response, this, response, placeholders::error));
+}
+
+void connection::handle_write_large_response(http_response response, const boost::system::error_code& ec)
+{
+    if (ec || m_write == m_write_size)
+        return handle_response_written(response, ec);
+
+    auto readbuf = response._get_impl()->instream().streambuf();
+    size_t readBytes = std::min(ChunkSize, m_write_size - m_write);
+    readbuf.getn(buffer_cast<uint8_t *>(m_response_buf.prepare(readBytes)), readBytes).then([=](size_t actualSize) {
+        m_write += actualSize;
+        m_response_buf.commit(actualSize);
+        boost::asio::async_write(*m_socket, m_response_buf, boost::bind(&connection::handle_write_large_response, this, response, placeholders::error));
+    });
+}
+
+void connection::handle_headers_written(http_response response, const boost::system::error_code& ec)
+{
+    if (ec)
+    {
+        auto * context = static_cast<linux_request_context*>(response._get_server_context());
+        context->m_response_completed.set_exception(std::runtime_error("error writing headers"));
+        finish_request_response();
+    }
+    else
+    {
+        if (m_request.method() == methods::HEAD)
+            handle_response_written(response, ec);
+        else if (m_file_handle != -1)
+            handle_write_file_response(response, ec);
+        else if (m_compressor)
+            handle_write_compressed_response(response, ec);
+        else if (m_chunked)
+            handle_write_chunked_response(response, ec);
+        else
+            handle_write_large_response(response, ec);
+    }
+}
+
+void connection::handle_response_written(http_response response, const boost::system::error_code& ec)
+{
+    if (access_log::enabled())
+    {
+        const uint64_t total_time = utility::details::steady_clock_microseconds() - m_arrival;
+        const uint64_t headers_time = m_response_start - m_arrival;
+
+        // m_write counts the body bytes written, as they went on the wire.
+        access_log::record(access_log_source::listener, m_request, response.status_code(), headers_time, total_time,
+            m_read, m_write, ec ? access_log_failure::error : m_handler_failed ? access_log_failure::handler_exception : access_log_failure::none);
+    }
+
+    auto * context = static_cast<linux_request_context*>(response._get_server_context());
+    if (ec)
+    {
+        //printf("-> boost::system::error_code %d in handle_response_written\n", ec.value());
+        context->m_response_completed.set_exception(std::runtime_error("error writing response"));
+        finish_request_response();
+    }
+    else
+    {
+        context->m_response_completed.set();
+        if (!m_close)
+        {
+            start_request_response();
+        }
+        else
+        {
+            finish_request_response();
+        }
+    }
+}
+
+void connection::finish_request_response()
+{
+    // kill the connection
+    {
+        pplx::scoped_lock<pplx::recursive_lock> lock(m_p_parent->m_connections_lock);
+        m_p_parent->m_connections.erase(this);
+        if (m_p_parent->m_connections.size() == 0)
+            m_p_parent->m_all_connections_complete.set();
+    }
+
+    close();
+    if (--m_refs == 0)
+    delete this;
+}
+
+void hostport_listener::stop()
+{
+    for (auto it = m_shards.begin(); it != m_shards.end(); ++it)
+    {
+        (*it)->stop_accepting();
+    }
+
+    // halt existing connections
+    {
+        pplx::scoped_lock<pplx::recursive_lock> lock(m_connections_lock);
+        for (auto it = m_connections.begin(); it != m_connections.end(); ++it)
+        {
+            (*it)->close();
+        }
+    }
+
+    // Stopped from one of its own shards, say by a handler closing its listener in thread-per-core mode,
+    // the connection being handled cannot finish, nor the shard's thread be joined, until this returns.
+    // The shards are then stopped from the thread pool instead, each once its connections are gone;
+    // the destructor still waits for all the connections.
+    if (s_current_shard != nullptr && s_current_shard->m_p_parent == this)
+    {
+        auto shards = std::make_shared<std::vector<std::unique_ptr<acceptor_shard>>>(std::move(m_shards));
+        m_shards.clear();
+        crossplat::threadpool::shared_instance().service().post([shards]() { shards->clear(); });
+        return;
+    }
+
+    m_all_connections_complete.wait();
+
+    m_shards.clear();
+}
+
+void hostport_listener::add_listener(const std::string& path, http_listener_interface* listener)
+{
+    pplx::scoped_read_lock lock(m_listeners_lock);
+
+    if (!m_listeners.insert(std::map<std::string,http_listener_interface*>::value_type(path, listener)).second)
+        throw std::invalid_argument("Error: http_listener is already registered for this path");
+}
+
+void hostport_listener::remove_listener(const std::string& path, http_listener_interface*)
+{
+    pplx::scoped_read_lock lock(m_listeners_lock);
+
+    if (m_listeners.erase(path) != 1)
+        throw std::invalid_argument("Error: no http_listener found for this path");
+
+}
+
+}
+
+unsigned long http_linux_server::start()
+{
+    pplx::reader_writer_lock::scoped_lock_read lock(m_listeners_lock);
+
+    auto it = m_listeners.begin();
+    try
+    {
+        for (; it != m_listeners.end(); ++it)
+        {
+            it->second->start();
+        }
+    }
+    catch (...)
+    {
+        --it;
+        while (it != m_listeners.begin())
+        {
+            it->second->stop();
+            --it;
+        }
+        it->second->stop();
+    }
+
+    m_started = true;
+    return 0;
+}
+
+unsigned long http_linux_server::stop()
+{
+    pplx::reader_writer_lock::scoped_lock_read lock(m_listeners_lock);
+
+    m_started = false;
+
+    for (auto it = m_listeners.begin(); it != m_listeners.end(); ++it)
+    {
+        it->second->stop();
+    }
+    return 0;
+}
+
+std::pair<std::string,std::string> canonical_parts(const http::uri& uri)
+{
+    auto host = uri.host();
+    auto port = uri.port();
+    std::ostringstream endpoint;
+    endpoint << uri::decode(host) << ":" << port;
+
+    auto path = uri::decode(uri.path());
+
+    if (path.size() > 1 && path[path.size()-1] != '/')
+    {
+        path += "/"; // ensure the end slash is present
+    }
+
+    return std::make_pair(endpoint.str(), path);
+}
+
+unsigned long http_linux_server::register_listener(http_listener_interface* listener)
+{
+    auto parts = canonical_parts(listener->uri());
+    auto hostport = parts.first;
+    auto path = parts.second;
+
+    {
+        pplx::scoped_read_lock lock(m_listeners_lock);
+        if (m_registered_listeners.find(listener) != m_registered_listeners.end())
+            throw std::invalid_argument("listener already registered");
+
+        m_registered_listeners[listener] = std::unique_ptr<pplx::reader_writer_lock>(new pplx::reader_writer_lock());
+
+        auto found_hostport_listener = m_listeners.find(hostport);
+        if (found_hostport_listener == m_listeners.end())
+        {
+            found_hostport_listener = m_listeners.insert(
+                std::make_pair(hostport, std::unique_ptr<details::hostport_listener>(new details::hostport_listener(this, hostport)))).first;
+
+            if (m_started)
+                found_hostport_listener->second->start();
+        }
+
+        found_hostport_listener->second->add_listener(path, listener);
+    }
+
+    return 0;
+}
+
+unsigned long http_linux_server::unregister_listener(http_listener_interface* listener)
+{
+    auto parts = canonical_parts(listener->uri());
+    auto hostport = parts.first;
+    auto path = parts.second;
+    // First remove listener registration.
+    std::unique_ptr<pplx::reader_writer_lock> pListenerLock;
+    {
+        pplx::scoped_read_lock lock(m_listeners_lock);
+        {
+            auto hostport_listeners = m_listeners.find(hostport);
+            if (hostport_listeners == m_listeners.end())
+            {
+                throw std::invalid_argument("Error: no listener registered for that host");
+            }
+
+            hostport_listeners->second->remove_listener(path, listener);
+
+        }
+        pListenerLock = std::move(m_registered_listeners[listener]);
+        m_registered_listeners[listener] = nullptr;
+        m_registered_listeners.erase(listener);
+    }
+
+    // Then take the listener write lock to make sure there are no calls into the listener's
+    // request handler.
+    {
+        pplx::scoped_read_lock lock(*pListenerLock);
+    }
+
+    return 0;
+}
+
+pplx::task<void> http_linux_server::respond(http::http_response response)
+{
+    details::linux_request_context * p_context = static_cast<details::linux_request_context*>(response._get_server_context());
+    return pplx::create_task(p_context->m_response_completed);
+}
+
+}
+}
+}
+
@@ -102,6 +102,31 @@ pplx::task<http_response> http_listener::handle_request(http_request msg)
 
 pplx::task<http_response> http_listener::dispatch_request(http_request msg)
 {
+    if(!m_router.empty())
+    {
+        // Routes match the path as received, after the listener's own path, with no decoding or copying.
+        const utility::string_t &path = msg._get_impl()->request_uri().path();
+        const utility::string_t &base = m_uri.path();
+        size_t prefix = base.size();
+        if(prefix > 0 && base[prefix - 1] == U('/'))
+        {
+            --prefix;
+        }
+        if(prefix > path.size() || path.compare(0, prefix, base, 0, prefix) != 0 || (prefix < path.size() && path[prefix] != U('/')))
+        {
+            prefix = 0;
+        }
+
+        static const utility::char_t root[] = U("/");
+        bool dispatched = prefix < path.size() ?
+            m_router.dispatch(msg, path.data() + prefix, path.size() - prefix) :
+            m_router.dispatch(msg, root, 1);
+        if(dispatched)
+        {
+            return msg.get_response();
+        }
+    }
+
     // Specific method handler takes priority over general.
     const method &mtd = msg.method();
     if(m_supported_methods.count(mtd))
@@ -104,10 +104,4 @@ pplx::task<void> details::_http_request::reply(http_response response)
     return _reply_impl(response);
 }
 
-#define _METHODS
-#define DAT(a,b) const method methods::a = b;
-#include "http_constants.dat"
-#undef _METHODS
-#undef DAT
-
 }} // namespace web::http
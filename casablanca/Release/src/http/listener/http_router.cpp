@@ -0,0 +1,362 @@
+/***
+* ==++==
+*
+* Copyright (c) Microsoft Corporation. All rights reserved.
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* ==--==
+* =+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+
+*
+* http_router.cpp
+*
+* HTTP Library: request routing for http_listener, on a radix tree of path patterns
+*
+* =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+****/
+
+#include "stdafx.h"
+#include "http_router.h"
+
+namespace web { namespace http
+{
+namespace listener
+{
+
+bool route_params::find(const utility::string_t &name, size_t &index) const
+{
+    if (m_names == nullptr)
+        return false;
+
+    for (index = 0; index < m_count && index < m_names->size(); ++index)
+    {
+        if ((*m_names)[index] == name)
+            return true;
+    }
+    return false;
+}
+
+bool route_params::has(const utility::string_t &name) const
+{
+    size_t index;
+    return find(name, index);
+}
+
+utility::string_t route_params::get(const utility::string_t &name) const
+{
+    return uri::decode(raw(name));
+}
+
+utility::string_t route_params::raw(const utility::string_t &name) const
+{
+    size_t index;
+    if (!find(name, index))
+        return utility::string_t();
+    return utility::string_t(m_values[index], m_lengths[index]);
+}
+
+/// <summary>
+/// A node of the radix tree. The edge into a literal node is its prefix; a parameter node matches one path
+/// segment and a catch-all node the rest of the path, and neither has a prefix.
+/// </summary>
+struct http_router::node
+{
+    utility::string_t prefix;
+    utility::string_t first_chars;                  // first character of each literal child's prefix, in order
+    std::vector<std::unique_ptr<node>> children;    // literal children
+    std::unique_ptr<node> param;                    // child matching a {name} segment
+    std::unique_ptr<node> catch_all;                // child matching a {*name} rest of the path
+
+    // The route ending at this node, if any.
+    std::vector<std::pair<http::method, handler>> handlers;
+    std::vector<utility::string_t> names;           // the route's parameter names, in path order
+
+    // Walks the literal edges for text from this node, splitting an edge where the text leaves it,
+    // and returns the node the text ends at.
+    node *insert_literal(utility::string_t text)
+    {
+        node *current = this;
+        while (!text.empty())
+        {
+            auto pos = current->first_chars.find(text[0]);
+            if (pos == utility::string_t::npos)
+            {
+                std::unique_ptr<node> child(new node());
+                child->prefix = std::move(text);
+                current->first_chars.push_back(child->prefix[0]);
+                current->children.push_back(std::move(child));
+                return current->children.back().get();
+            }
+
+            node *child = current->children[pos].get();
+            size_t common = 0;
+            while (common < child->prefix.size() && common < text.size() && child->prefix[common] == text[common])
+                ++common;
+
+            if (common < child->prefix.size())
+            {
+                // The text leaves the edge part way: split it at the divergence.
+                std::unique_ptr<node> middle(new node());
+                middle->prefix = child->prefix.substr(0, common);
+                child->prefix.erase(0, common);
+                middle->first_chars.push_back(child->prefix[0]);
+                middle->children.push_back(std::move(current->children[pos]));
+                current->children[pos] = std::move(middle);
+                child = current->children[pos].get();
+            }
+
+            text.erase(0, common);
+            current = child;
+        }
+        return current;
+    }
+
+    // Matches the rest of a path from this node, trying literal children first, then a parameter, then a
+    // catch-all. Returns the node of the route that handles the method; path_match receives the first node whose
+    // route matches the path whatever the method.
+    const node *match(const http::method &method, const utility::char_t *path, const utility::char_t *end,
+        route_params &params, const node *&path_match) const
+    {
+        if (path == end && !handlers.empty())
+        {
+            if (path_match == nullptr)
+                path_match = this;
+            if (has_method(method))
+                return this;
+        }
+
+        if (path != end)
+        {
+            auto pos = first_chars.find(*path);
+            if (pos != utility::string_t::npos)
+            {
+                const node *child = children[pos].get();
+                const size_t length = child->prefix.size();
+                if (static_cast<size_t>(end - path) >= length && child->prefix.compare(0, length, path, length) == 0)
+                {
+                    auto found = child->match(method, path + length, end, params, path_match);
+                    if (found != nullptr)
+                        return found;
+                }
+            }
+
+            if (param && *path != U('/') && params.m_count < route_params::max_params)
+            {
+                auto segment_end = path;
+                while (segment_end != end && *segment_end != U('/'))
+                    ++segment_end;
+
+                const size_t index = params.m_count++;
+                params.m_values[index] = path;
+                params.m_lengths[index] = segment_end - path;
+                auto found = param->match(method, segment_end, end, params, path_match);
+                if (found != nullptr)
+                    return found;
+                --params.m_count;
+            }
+        }
+
+        if (catch_all && !catch_all->handlers.empty() && params.m_count < route_params::max_params)
+        {
+            if (path_match == nullptr)
+                path_match = catch_all.get();
+            if (catch_all->has_method(method))
+            {
+                const size_t index = params.m_count++;
+                params.m_values[index] = path;
+                params.m_lengths[index] = end - path;
+                return catch_all.get();
+            }
+        }
+
+        return nullptr;
+    }
+
+    bool has_method(const http::method &method) const
+    {
+        for (auto it = handlers.begin(); it != handlers.end(); ++it)
+        {
+            if (it->first == method)
+                return true;
+        }
+        return false;
+    }
+
+    const handler *find_handler(const http::method &method) const
+    {
+        for (auto it = handlers.begin(); it != handlers.end(); ++it)
+        {
+            if (it->first == method)
+                return &it->second;
+        }
+        return nullptr;
+    }
+};
+
+http_router::http_router() : m_root(new node()), m_routes(0)
+{
+}
+
+http_router::~http_router()
+{
+}
+
+http_router::http_router(http_router &&other) : m_root(std::move(other.m_root)), m_routes(other.m_routes)
+{
+    other.m_root.reset(new node());
+    other.m_routes = 0;
+}
+
+http_router &http_router::operator=(http_router &&other)
+{
+    if (this != &other)
+    {
+        m_root = std::move(other.m_root);
+        m_routes = other.m_routes;
+        other.m_root.reset(new node());
+        other.m_routes = 0;
+    }
+    return *this;
+}
+
+http_router &http_router::add(const http::method &method, const utility::string_t &pattern, handler route_handler)
+{
+    return add(std::vector<http::method>(1, method), pattern, std::move(route_handler));
+}
+
+http_router &http_router::add(const std::vector<http::method> &methods, const utility::string_t &pattern, handler route_handler)
+{
+    if (pattern.empty() || pattern[0] != U('/'))
+    {
+        throw std::invalid_argument("Route pattern must start with '/'");
+    }
+    if (methods.empty())
+    {
+        throw std::invalid_argument("Route must handle at least one method");
+    }
+
+    node *current = m_root.get();
+    std::vector<utility::string_t> names;
+    size_t pos = 0;
+    while (pos < pattern.size())
+    {
+        auto open = pattern.find(U('{'), pos);
+        current = current->insert_literal(pattern.substr(pos, open == utility::string_t::npos ? utility::string_t::npos : open - pos));
+        if (open == utility::string_t::npos)
+            break;
+
+        auto close = pattern.find(U('}'), open);
+        if (close == utility::string_t::npos || close == open + 1)
+        {
+            throw std::invalid_argument("Route pattern has an unterminated or empty parameter");
+        }
+        if (pattern[open - 1] != U('/') || (close + 1 < pattern.size() && pattern[close + 1] != U('/')))
+        {
+            throw std::invalid_argument("Route parameters must be whole path segments");
+        }
+        if (names.size() == route_params::max_params)
+        {
+            throw std::invalid_argument("Route pattern has too many parameters");
+        }
+
+        auto name = pattern.substr(open + 1, close - open - 1);
+        std::unique_ptr<node> *child;
+        if (name[0] == U('*'))
+        {
+            if (close + 1 != pattern.size())
+            {
+                throw std::invalid_argument("A {*name} parameter must end the route pattern");
+            }
+            name.erase(0, 1);
+            child = &current->catch_all;
+        }
+        else
+        {
+            child = &current->param;
+        }
+        if (!*child)
+        {
+            child->reset(new node());
+        }
+        names.push_back(std::move(name));
+        current = child->get();
+        pos = close + 1;
+    }
+
+    for (auto it = methods.begin(); it != methods.end(); ++it)
+    {
+        if (current->has_method(*it))
+        {
+            throw std::invalid_argument("A handler for this method and route pattern is already registered");
+        }
+    }
+    if (!current->handlers.empty() && current->names != names)
+    {
+        throw std::invalid_argument("Routes with the same path must name their parameters alike");
+    }
+
+    for (auto it = methods.begin(); it != methods.end(); ++it)
+    {
+        current->handlers.push_back(std::make_pair(*it, route_handler));
+    }
+    current->names = std::move(names);
+    ++m_routes;
+    return *this;
+}
+
+const http_router::handler *http_router::find(const http::method &method, const utility::char_t *path, size_t length, route_params &params) const
+{
+    const node *path_match = nullptr;
+    params.m_count = 0;
+    auto found = m_root->match(method, path, path + length, params, path_match);
+    if (found == nullptr)
+    {
+        params.m_count = 0;
+        return nullptr;
+    }
+
+    params.m_names = &found->names;
+    return found->find_handler(method);
+}
+
+bool http_router::dispatch(http_request request, const utility::char_t *path, size_t length) const
+{
+    route_params params;
+    const node *path_match = nullptr;
+    auto found = m_root->match(request.method(), path, path + length, params, path_match);
+    if (found != nullptr)
+    {
+        params.m_names = &found->names;
+        (*found->find_handler(request.method()))(request, params);
+        return true;
+    }
+
+    if (path_match == nullptr)
+    {
+        return false;
+    }
+
+    // The path names a resource, just not with this method.
+    utility::string_t allowed;
+    for (auto it = path_match->handlers.begin(); it != path_match->handlers.end(); ++it)
+    {
+        if (!allowed.empty())
+            allowed += U(", ");
+        allowed += it->first;
+    }
+    http_response response(status_codes::MethodNotAllowed);
+    response.headers().add(header_names::allow, allowed);
+    request.reply(response);
+    return true;
+}
+
+} // namespace listener
+}} // namespace web::http
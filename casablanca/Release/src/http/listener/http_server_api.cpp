@@ -30,7 +30,8 @@
 #include "http_windows_server.h"
 #else
 #include "http_linux_server.h"
-#include "log.h"
+
+#define FAILED(x) ((x) != 0)
 #endif
 
 using namespace web; using namespace utility;
@@ -61,11 +62,6 @@ void http_server_api::unregister_server_api()
 {
     pplx::scoped_critical_section lock(s_lock);
 
-    if (http_server_api::has_listener())
-    {
-        logging::log::post(logging::LOG_WARNING, U("Server API was cleared while listeners were still attached"));
-    }
-
     s_server_api.release();
 }
 
@@ -75,7 +71,6 @@ void http_server_api::unsafe_register_server_api(std::unique_ptr<http_server> se
 
     if (http_server_api::has_listener())
     {
-        logging::log::post(logging::LOG_FATAL, U("Attempted to register a new server API while listening to requests"));
         throw http_exception(U("Current server API instance has listeners attached. Register a server API before listening to requests"));
     }
 
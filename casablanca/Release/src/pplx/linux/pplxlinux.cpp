@@ -27,6 +27,8 @@
 #include "pplx.h"
 #include <threadpool.h>
 #include "sys/syscall.h"
+#include <algorithm>
+#include <thread>
 
 #ifdef _MS_WINDOWS
 #error "ERROR: This file should only be included in non-windows Build"
@@ -55,6 +57,419 @@ namespace details {
         crossplat::threadpool::shared_instance().schedule(boost::bind(proc, param));
     }
 
+    // A Chase-Lev deque of chores (Le, Pop, Cohen and Zappa Nardelli, "Correct and Efficient Work-Stealing for
+    // Weak Memory Models"). Only its owner pushes and takes, at the bottom; any thread steals, at the top.
+    class chore_deque
+    {
+    public:
+        chore_deque() : m_top(0), m_bottom(0), m_array(new ring(64))
+        {
+        }
+
+        ~chore_deque()
+        {
+            delete m_array.load(std::memory_order_relaxed);
+            for (auto it = m_retired.begin(); it != m_retired.end(); ++it)
+                delete *it;
+        }
+
+        void push(TaskProc proc, void* param)
+        {
+            const long long b = m_bottom.load(std::memory_order_relaxed);
+            const long long t = m_top.load(std::memory_order_acquire);
+            ring* a = m_array.load(std::memory_order_relaxed);
+            if (b - t > static_cast<long long>(a->m_mask))
+            {
+                a = grow(a, t, b);
+            }
+            a->put(b, proc, param);
+            std::atomic_thread_fence(std::memory_order_release);
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+        }
+
+        bool take(TaskProc& proc, void*& param)
+        {
+            const long long b = m_bottom.load(std::memory_order_relaxed) - 1;
+            ring* a = m_array.load(std::memory_order_relaxed);
+            m_bottom.store(b, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            long long t = m_top.load(std::memory_order_relaxed);
+
+            bool taken = false;
+            if (t <= b)
+            {
+                a->get(b, proc, param);
+                taken = true;
+                if (t == b)
+                {
+                    // The last chore: a thief may be after it too.
+                    taken = m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+                    m_bottom.store(b + 1, std::memory_order_relaxed);
+                }
+            }
+            else
+            {
+                m_bottom.store(b + 1, std::memory_order_relaxed);
+            }
+            return taken;
+        }
+
+        bool steal(TaskProc& proc, void*& param)
+        {
+            long long t = m_top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            const long long b = m_bottom.load(std::memory_order_acquire);
+            if (t >= b)
+            {
+                return false;
+            }
+
+            ring* a = m_array.load(std::memory_order_acquire);
+            a->get(t, proc, param);
+            return m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+        }
+
+        bool empty() const
+        {
+            return m_bottom.load(std::memory_order_seq_cst) <= m_top.load(std::memory_order_seq_cst);
+        }
+
+    private:
+        // The slots are atomics so that a thief reading a slot the owner is reusing is no data race; the thief's
+        // compare and exchange on the top then fails, and it drops what it read.
+        struct ring
+        {
+            ring(size_t size) : m_mask(size - 1), m_procs(new std::atomic<TaskProc>[size]), m_params(new std::atomic<void*>[size])
+            {
+            }
+
+            void put(long long i, TaskProc proc, void* param)
+            {
+                m_procs[i & m_mask].store(proc, std::memory_order_relaxed);
+                m_params[i & m_mask].store(param, std::memory_order_relaxed);
+            }
+
+            void get(long long i, TaskProc& proc, void*& param) const
+            {
+                proc = m_procs[i & m_mask].load(std::memory_order_relaxed);
+                param = m_params[i & m_mask].load(std::memory_order_relaxed);
+            }
+
+            const size_t m_mask;
+            std::unique_ptr<std::atomic<TaskProc>[]> m_procs;
+            std::unique_ptr<std::atomic<void*>[]> m_params;
+        };
+
+        // Doubles the ring. Thieves may still be reading the old one, so it is kept until the deque goes away.
+        ring* grow(ring* a, long long t, long long b)
+        {
+            ring* bigger = new ring(2 * (a->m_mask + 1));
+            for (long long i = t; i < b; ++i)
+            {
+                TaskProc proc;
+                void* param;
+                a->get(i, proc, param);
+                bigger->put(i, proc, param);
+            }
+            m_retired.push_back(a);
+            m_array.store(bigger, std::memory_order_release);
+            return bigger;
+        }
+
+        std::atomic<long long> m_top;
+        char m_pad[64];
+        std::atomic<long long> m_bottom;
+        std::atomic<ring*> m_array;
+        std::vector<ring*> m_retired;
+    };
+
+    // Chores scheduled from threads that are not workers. Producers push onto a lock-free stack; a worker takes
+    // the whole stack at once, which leaves no ABA problem, and moves the chores to its own deque.
+    class injection_stack
+    {
+    public:
+        struct node
+        {
+            TaskProc m_proc;
+            void* m_param;
+            node* m_next;
+        };
+
+        injection_stack() : m_head(nullptr)
+        {
+        }
+
+        ~injection_stack()
+        {
+            delete_all(m_head.load(std::memory_order_relaxed));
+        }
+
+        void push(TaskProc proc, void* param)
+        {
+            node* n = new node;
+            n->m_proc = proc;
+            n->m_param = param;
+            n->m_next = m_head.load(std::memory_order_relaxed);
+            while (!m_head.compare_exchange_weak(n->m_next, n, std::memory_order_release, std::memory_order_relaxed))
+            {
+            }
+        }
+
+        // The chores pushed so far, newest first.
+        node* take_all()
+        {
+            if (m_head.load(std::memory_order_relaxed) == nullptr)
+            {
+                return nullptr;
+            }
+            return m_head.exchange(nullptr, std::memory_order_acquire);
+        }
+
+        bool empty() const
+        {
+            return m_head.load(std::memory_order_seq_cst) == nullptr;
+        }
+
+        static void delete_all(node* n)
+        {
+            while (n != nullptr)
+            {
+                node* next = n->m_next;
+                delete n;
+                n = next;
+            }
+        }
+
+    private:
+        std::atomic<node*> m_head;
+    };
+
+    struct work_stealing_state
+    {
+        struct worker
+        {
+            worker(work_stealing_state* state, unsigned int seed) : m_state(state), m_random(seed | 1)
+            {
+            }
+
+            // xorshift; good enough to pick victims.
+            unsigned int next_random()
+            {
+                m_random ^= m_random << 13;
+                m_random ^= m_random >> 17;
+                m_random ^= m_random << 5;
+                return m_random;
+            }
+
+            work_stealing_state* m_state;
+            chore_deque m_deque;
+            unsigned int m_random;
+            std::thread m_thread;
+        };
+
+        // The worker running on the calling thread, if it is one.
+        static __thread worker* s_current;
+
+        // How many times an idle worker looks for chores before it sleeps.
+        static const int spins = 64;
+
+        work_stealing_state(size_t threads) : m_sleepers(0), m_stopping(false)
+        {
+            for (size_t i = 0; i < threads; ++i)
+            {
+                m_workers.push_back(std::unique_ptr<worker>(new worker(this, static_cast<unsigned int>(i) * 2654435761u)));
+            }
+            for (size_t i = 0; i < threads; ++i)
+            {
+                worker* w = m_workers[i].get();
+                w->m_thread = std::thread([this, w]() { run(w); });
+            }
+        }
+
+        // Lets the workers run the chores left and joins them. When stopping from a worker, that worker's thread
+        // is detached instead; it leaves its loop, without touching the state again, once its chore returns.
+        void stop()
+        {
+            worker* self = s_current != nullptr && s_current->m_state == this ? s_current : nullptr;
+            {
+                std::lock_guard<std::mutex> lock(m_lock);
+                m_stopping = true;
+                m_wake.notify_all();
+            }
+
+            for (auto it = m_workers.begin(); it != m_workers.end(); ++it)
+            {
+                if (it->get() != self)
+                    (*it)->m_thread.join();
+            }
+            if (self != nullptr)
+            {
+                self->m_thread.detach();
+                s_current = nullptr;
+            }
+        }
+
+        void schedule(TaskProc proc, void* param)
+        {
+            worker* w = s_current;
+            if (w == nullptr || w->m_state != this)
+            {
+                m_injected.push(proc, param);
+            }
+            else
+            {
+                w->m_deque.push(proc, param);
+            }
+            wake(1);
+        }
+
+        // Pairs with the fence in sleep: either the sleeper sees the chores, or this sees the sleeper.
+        void wake(size_t chores)
+        {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (m_sleepers.load(std::memory_order_relaxed) > 0)
+            {
+                std::lock_guard<std::mutex> lock(m_lock);
+                if (chores > 1)
+                    m_wake.notify_all();
+                else
+                    m_wake.notify_one();
+            }
+        }
+
+        void run(worker* w)
+        {
+            s_current = w;
+            int idle = 0;
+            while (true)
+            {
+                TaskProc proc;
+                void* param;
+                if (find(w, proc, param))
+                {
+                    idle = 0;
+                    proc(param);
+
+                    // The chore destroyed the scheduler, and w with it.
+                    if (s_current != w)
+                        return;
+                }
+                else if (++idle < spins)
+                {
+                    std::this_thread::yield();
+                }
+                else
+                {
+                    idle = 0;
+                    if (!sleep())
+                        break;
+                }
+            }
+            s_current = nullptr;
+        }
+
+        // Looks for a chore: the worker's newest, then the oldest injected one, then one stolen.
+        bool find(worker* w, TaskProc& proc, void*& param)
+        {
+            if (w->m_deque.take(proc, param))
+            {
+                return true;
+            }
+
+            // The injected chores come newest first. All but the oldest go to the worker's deque, pushed so that it
+            // takes them oldest first and thieves the newest; the oldest is run now.
+            injection_stack::node* n = m_injected.take_all();
+            if (n != nullptr)
+            {
+                size_t moved = 0;
+                for (; n->m_next != nullptr; ++moved)
+                {
+                    injection_stack::node* next = n->m_next;
+                    w->m_deque.push(n->m_proc, n->m_param);
+                    delete n;
+                    n = next;
+                }
+                proc = n->m_proc;
+                param = n->m_param;
+                delete n;
+                if (moved != 0)
+                    wake(moved);
+                return true;
+            }
+
+            const size_t count = m_workers.size();
+            size_t victim = w->next_random() % count;
+            for (size_t i = 0; i < count; ++i, victim = (victim + 1) % count)
+            {
+                worker* v = m_workers[victim].get();
+                if (v != w && v->m_deque.steal(proc, param))
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // Waits until there may be chores; false once the scheduler is stopping and none are left.
+        bool sleep()
+        {
+            std::unique_lock<std::mutex> lock(m_lock);
+            m_sleepers.fetch_add(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            bool idle;
+            while ((idle = m_injected.empty() && all_empty()) && !m_stopping)
+            {
+                m_wake.wait(lock);
+            }
+            m_sleepers.fetch_sub(1, std::memory_order_relaxed);
+            return !idle;
+        }
+
+        bool all_empty() const
+        {
+            for (auto it = m_workers.begin(); it != m_workers.end(); ++it)
+            {
+                if (!(*it)->m_deque.empty())
+                    return false;
+            }
+            return true;
+        }
+
+        std::vector<std::unique_ptr<worker>> m_workers;
+        std::atomic<int> m_sleepers;
+        injection_stack m_injected;
+
+        // Guards the fields below; sleeping workers wait on m_wake under it.
+        std::mutex m_lock;
+        std::condition_variable m_wake;
+        bool m_stopping;
+    };
+
+    __thread work_stealing_state::worker* work_stealing_state::s_current = nullptr;
+
+    // Chores may block on one another, so even a machine with few cores gets a few workers.
+    static const size_t min_default_workers = 4;
+
+    static size_t default_workers()
+    {
+        return std::max<size_t>(min_default_workers, std::thread::hardware_concurrency());
+    }
+
+    work_stealing_scheduler::work_stealing_scheduler(size_t threads)
+        : m_state(new work_stealing_state(threads == 0 ? default_workers() : threads))
+    {
+    }
+
+    work_stealing_scheduler::~work_stealing_scheduler()
+    {
+        m_state->stop();
+    }
+
+    void work_stealing_scheduler::schedule(TaskProc proc, void* param)
+    {
+        m_state->schedule(proc, param);
+    }
+
     class linux_timer
     {
         struct callback_finisher
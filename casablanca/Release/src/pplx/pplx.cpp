@@ -43,11 +43,28 @@ _PPLXIMP unsigned int __cdecl _GetNextAsyncId()
 } // namespace details
 #endif
 
+// Destroyed with the other statics at process exit, which stops the default scheduler's workers; see
+// ~work_stealing_scheduler.
 static std::shared_ptr<pplx::scheduler> _M_Scheduler;
 static pplx::details::_Spin_lock _M_SpinLock;
 
+#if defined(_MSC_VER)
+#define _PPLX_THREAD_LOCAL __declspec(thread)
+#else
+#define _PPLX_THREAD_LOCAL __thread
+#endif
+
+// The scheduler set for the calling thread, if any. Thread-local storage only holds plain data, so the
+// shared_ptr lives on the heap.
+static _PPLX_THREAD_LOCAL std::shared_ptr<pplx::scheduler> *_M_ThreadScheduler = nullptr;
+
 _PPLXIMP std::shared_ptr<pplx::scheduler> __cdecl get_ambient_scheduler()
 {
+    if (_M_ThreadScheduler != nullptr)
+    {
+        return *_M_ThreadScheduler;
+    }
+
     if ( !_M_Scheduler)
     {
         ::pplx::details::_Scoped_spin_lock _Lock(_M_SpinLock);
@@ -72,4 +89,10 @@ _PPLXIMP void __cdecl set_ambient_scheduler(std::shared_ptr<pplx::scheduler> _Sc
     _M_Scheduler = _Scheduler;
 }
 
+_PPLXIMP void __cdecl set_thread_scheduler(std::shared_ptr<pplx::scheduler> _Scheduler)
+{
+    delete _M_ThreadScheduler;
+    _M_ThreadScheduler = _Scheduler ? new std::shared_ptr<pplx::scheduler>(std::move(_Scheduler)) : nullptr;
+}
+
 } // namespace pplx
@@ -738,3 +738,19 @@ size_t _seekwrpos_fsb(Concurrency::streams::details::_file_info *info, size_t po
     fInfo->m_wrpos = pos;
     return fInfo->m_wrpos;
 }
+
+/// <summary>
+/// Get the file descriptor of a file stream.
+/// </summary>
+/// <param name="info">The file info record of the file</param>
+/// <returns>The file descriptor, or -1 if the file is closed</returns>
+int _get_fsb_handle(Concurrency::streams::details::_file_info *info)
+{
+    if ( info == nullptr ) return -1;
+
+    _file_info_impl *fInfo = (_file_info_impl *)info;
+
+    pplx::scoped_recursive_lock lock(info->m_lock);
+
+    return fInfo->m_handle;
+}
@@ -492,6 +492,24 @@ datetime __cdecl datetime::utc_now()
 #endif
 }
 
+uint64_t __cdecl details::steady_clock_microseconds()
+{
+#ifdef _MS_WINDOWS
+    LARGE_INTEGER count, frequency;
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&frequency);
+
+    // Split in whole seconds and the rest, so the multiplication does not overflow.
+    const uint64_t seconds = static_cast<uint64_t>(count.QuadPart / frequency.QuadPart);
+    const uint64_t rest = static_cast<uint64_t>(count.QuadPart % frequency.QuadPart);
+    return seconds * 1000000 + rest * 1000000 / static_cast<uint64_t>(frequency.QuadPart);
+#else //LINUX
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return static_cast<uint64_t>(time.tv_sec) * 1000000 + static_cast<uint64_t>(time.tv_nsec) / 1000;
+#endif
+}
+
 /// <summary>
 /// Returns a string representation of the datetime. The string is formatted based on RFC 1123 or ISO 8601
 /// </summary>
@@ -26,6 +26,12 @@
 #include "stdafx.h"
 #include <fstream>
 
+#ifndef _MS_WINDOWS
+#include <boost/asio.hpp>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
 using namespace web::http;
 using namespace web::http::client;
 
@@ -33,6 +39,72 @@ using namespace tests::functional::http::utilities;
 
 namespace tests { namespace functional { namespace http { namespace client {
 
+#if !defined(_MS_WINDOWS)
+// Minimal HTTP/1.1 server on a Unix domain socket. Each response echoes the request target and Host header.
+class local_socket_server
+{
+public:
+    local_socket_server(const std::string &path)
+        : m_path(path)
+    {
+        ::unlink(m_path.c_str());
+        m_acceptor.reset(new boost::asio::local::stream_protocol::acceptor(m_service, boost::asio::local::stream_protocol::endpoint(m_path)));
+        m_thread = std::thread([this]() { run(); });
+    }
+
+    ~local_socket_server()
+    {
+        // Wake the server thread up from a blocking accept.
+        ::shutdown(m_acceptor->native_handle(), SHUT_RDWR);
+        m_thread.join();
+        m_acceptor.reset();
+        ::unlink(m_path.c_str());
+    }
+
+private:
+    void run()
+    {
+        for (;;)
+        {
+            boost::asio::local::stream_protocol::socket socket(m_service);
+            boost::system::error_code ec;
+            m_acceptor->accept(socket, ec);
+            if (ec)
+            {
+                return;
+            }
+
+            boost::asio::streambuf buf;
+            boost::asio::read_until(socket, buf, "\r\n\r\n", ec);
+            if (ec)
+            {
+                continue;
+            }
+
+            std::istream request(&buf);
+            std::string method, target, line, host;
+            request >> method >> target;
+            while (std::getline(request, line) && line != "\r")
+            {
+                if (line.compare(0, 6, "Host: ") == 0)
+                {
+                    host = line.substr(6, line.size() - 7);
+                }
+            }
+
+            std::string body = target + " " + host;
+            std::string response = "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: " + utility::conversions::print_string(body.size()) + "\r\n\r\n" + body;
+            boost::asio::write(socket, boost::asio::buffer(response), ec);
+        }
+    }
+
+    std::string m_path;
+    boost::asio::io_service m_service;
+    std::unique_ptr<boost::asio::local::stream_protocol::acceptor> m_acceptor;
+    std::thread m_thread;
+};
+#endif
+
 SUITE(client_construction)
 {
 
@@ -97,8 +169,94 @@ TEST_FIXTURE(uri_address, client_construction_error_cases)
     // empty host.
     address = uri(U("http://:34567/"));
     verify_client_invalid_argument(address);
+
+    // no base uris.
+    try
+    {
+        http_client client((std::vector<uri>()));
+        VERIFY_IS_TRUE(false);
+    } catch(std::invalid_argument &)
+    {
+        // expected
+    }
+
+#if !defined(_MS_WINDOWS)
+    // Unix domain sockets are named by path only.
+    verify_client_invalid_argument(uri(U("unix://localhost/tmp/socket")));
+    verify_client_invalid_argument(uri(U("unix:///")));
+#endif
+}
+
+#if !defined(_MS_WINDOWS)
+TEST_FIXTURE(uri_address, unix_domain_socket)
+{
+    const std::string path = "/tmp/casablanca_client_construction.sock";
+    local_socket_server server(path);
+
+    // The base URI names the socket, the request paths are sent as is.
+    http_client client(uri(U("unix://") + path));
+    VERIFY_ARE_EQUAL(U("/ localhost"), client.request(methods::GET).get().extract_string().get());
+    for (int i = 0; i < 10; ++i)
+    {
+        http_response response = client.request(methods::GET, U("/v1/items?id=") + utility::conversions::print_string(i)).get();
+        VERIFY_ARE_EQUAL(status_codes::OK, response.status_code());
+        VERIFY_ARE_EQUAL(U("/v1/items?id=") + utility::conversions::print_string(i) + U(" localhost"), response.extract_string().get());
+    }
+}
+
+TEST_FIXTURE(uri_address, unix_domain_socket_missing)
+{
+    http_client client(uri(U("unix:///tmp/casablanca_no_such_socket.sock")));
+    VERIFY_THROWS(client.request(methods::GET).get(), http_exception);
 }
 
+TEST_FIXTURE(uri_address, multiple_base_uris)
+{
+    local_socket_server server1("/tmp/casablanca_client_construction1.sock");
+    local_socket_server server2("/tmp/casablanca_client_construction2.sock");
+
+    std::vector<uri> base_uris;
+    base_uris.push_back(uri(U("unix:///tmp/casablanca_client_construction1.sock")));
+    base_uris.push_back(uri(U("unix:///tmp/casablanca_client_construction2.sock")));
+    http_client client(base_uris);
+
+    std::vector<pplx::task<http_response>> responses;
+    for (int i = 0; i < 20; ++i)
+    {
+        responses.push_back(client.request(methods::GET, U("/items")));
+    }
+    for (size_t i = 0; i < responses.size(); ++i)
+    {
+        VERIFY_ARE_EQUAL(U("/items localhost"), responses[i].get().extract_string().get());
+    }
+}
+
+TEST_FIXTURE(uri_address, multiple_base_uris_failing_backend)
+{
+    local_socket_server server("/tmp/casablanca_client_construction.sock");
+
+    std::vector<uri> base_uris;
+    base_uris.push_back(uri(U("unix:///tmp/casablanca_no_such_socket.sock")));
+    base_uris.push_back(uri(U("unix:///tmp/casablanca_client_construction.sock")));
+    http_client client(base_uris);
+
+    // Failures steer the requests away from the missing backend.
+    int failures = 0;
+    for (int i = 0; i < 20; ++i)
+    {
+        try
+        {
+            VERIFY_ARE_EQUAL(status_codes::OK, client.request(methods::GET).get().status_code());
+        }
+        catch (const http_exception &)
+        {
+            ++failures;
+        }
+    }
+    VERIFY_IS_TRUE(failures <= 1);
+}
+#endif
+
 TEST_FIXTURE(uri_address, move_not_init)
 {
     test_http_server::scoped_server scoped(m_uri);
@@ -142,6 +300,32 @@ TEST_FIXTURE(uri_address, get_client_config)
     VERIFY_ARE_EQUAL(config2.timeout().count(), timeout.count());
 }
 
+// Verify that requests still go through with every socket option set
+TEST_FIXTURE(uri_address, socket_options)
+{
+    test_http_server::scoped_server scoped(m_uri);
+
+    socket_options options;
+    options.set_no_delay(true);
+    options.set_send_buffer_size(256 * 1024);
+    options.set_receive_buffer_size(256 * 1024);
+    options.set_keep_alive(true);
+    options.set_keep_alive_idle(utility::seconds(30));
+    options.set_keep_alive_interval(utility::seconds(5));
+    options.set_keep_alive_count(3);
+    options.set_quick_ack(true);
+    options.set_fast_open(true);
+
+    http_client_config config;
+    config.set_socket_options(options);
+    http_client client(m_uri, config);
+    VERIFY_IS_TRUE(client.client_config().socket_options().no_delay());
+    VERIFY_ARE_EQUAL(256 * 1024, client.client_config().socket_options().receive_buffer_size());
+
+    test_connection(scoped.server(), &client, U("/"));
+    test_connection(scoped.server(), &client, U("/path"));
+}
+
 } // SUITE(client_construction)
 
 }}}}
\ No newline at end of file
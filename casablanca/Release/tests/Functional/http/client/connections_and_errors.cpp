@@ -86,6 +86,61 @@ TEST_FIXTURE(uri_address, pending_requests_after_client)
     pending_requests_after_client_impl(m_uri, false);
 }
 
+// Tests requests sent over connections established ahead of time.
+TEST_FIXTURE(uri_address, prewarm_connections)
+{
+    test_http_server::scoped_server scoped(m_uri);
+    http_client client(m_uri);
+    client.prewarm(3).wait();
+
+    // More requests than prewarmed connections, so some go out on new ones.
+    for(int i = 0; i < 5; ++i)
+    {
+        auto response = client.request(methods::GET);
+        scoped.server()->next_request().then([&](test_request *request)
+        {
+            http_asserts::assert_test_request_equals(request, methods::GET, U("/"));
+            VERIFY_ARE_EQUAL(0u, request->reply(status_codes::OK));
+        });
+        http_asserts::assert_response_equals(response.get(), status_codes::OK);
+    }
+}
+
+#if !defined(_MS_WINDOWS)
+TEST_FIXTURE(uri_address, prewarm_connections_are_reused)
+{
+    // The pass-through emulator counts the connections made to the server.
+    test_http_server::scoped_server scoped(m_uri, network_conditions());
+    http_client client(m_uri);
+    client.prewarm(2).wait();
+
+    for(int i = 0; i < 3; ++i)
+    {
+        auto response = client.request(methods::GET);
+        scoped.server()->next_request().then([&](test_request *request)
+        {
+            VERIFY_ARE_EQUAL(0u, request->reply(status_codes::OK));
+        });
+        http_asserts::assert_response_equals(response.get(), status_codes::OK);
+    }
+
+    // Each request goes out on a parked connection, which is replaced in the background to keep two
+    // parked; a request finding both replacements still connecting connects itself instead of replacing.
+    // Either way the two prewarmed connections and three more are made.
+    for(int i = 0; i < 500 && scoped.server()->connections() < 5u; ++i)
+    {
+        tests::common::utilities::os_utilities::sleep(10);
+    }
+    VERIFY_ARE_EQUAL(5u, scoped.server()->connections());
+}
+#endif
+
+TEST_FIXTURE(uri_address, prewarm_server_doesnt_exist)
+{
+    http_client client(m_uri);
+    VERIFY_THROWS(client.prewarm(2).wait(), http_exception);
+}
+
 TEST_FIXTURE(uri_address, server_doesnt_exist,
              "Ignore:Linux", "627642")
 {
@@ -207,6 +262,61 @@ TEST_FIXTURE(uri_address, stream_timeout)
 }
 #endif
 
+#if !defined(_MS_WINDOWS)
+TEST_FIXTURE(uri_address, emulated_latency_and_bandwidth)
+{
+    network_conditions conditions;
+    conditions.latency = std::chrono::milliseconds(100);
+    conditions.bandwidth = 100 * 1024;
+    conditions.max_write = 7;
+    test_http_server::scoped_server scoped(m_uri, conditions);
+    test_http_server * p_server = scoped.server();
+    http_client client(m_uri);
+
+    const std::string body(20 * 1024, 'a');
+    p_server->next_request().then([&](test_request *p_request)
+    {
+        VERIFY_ARE_EQUAL(0u, p_request->reply(200, U("OK"), std::map<utility::string_t, utility::string_t>(), body));
+    });
+
+    // The request and the response each take the latency, and the body a fifth of a second more.
+    auto start = std::chrono::steady_clock::now();
+    http_response response = client.request(methods::GET).get();
+    VERIFY_ARE_EQUAL(body.size(), response.extract_vector().get().size());
+    VERIFY_IS_TRUE(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(350));
+}
+
+TEST_FIXTURE(uri_address, emulated_latency_times_out)
+{
+    network_conditions conditions;
+    conditions.latency = std::chrono::milliseconds(1500);
+    conditions.jitter = std::chrono::milliseconds(500);
+    test_http_server::scoped_server scoped(m_uri, conditions);
+    http_client_config config;
+    config.set_timeout(utility::seconds(1));
+    http_client client(m_uri, config);
+
+    VERIFY_THROWS_HTTP_ERROR_CODE(client.request(methods::GET).get(), std::errc::timed_out);
+}
+
+TEST_FIXTURE(uri_address, emulated_connection_reset)
+{
+    network_conditions conditions;
+    conditions.reset_after = 10;
+    test_http_server::scoped_server scoped(m_uri, conditions);
+    test_http_server * p_server = scoped.server();
+    http_client client(m_uri);
+
+    p_server->next_request().then([](test_request *p_request)
+    {
+        p_request->reply(200);
+    });
+
+    // The connection is reset part way through the status line.
+    VERIFY_THROWS(client.request(methods::GET).get(), http_exception);
+}
+#endif
+
 } // SUITE(connections_and_errors)
 
 }}}}
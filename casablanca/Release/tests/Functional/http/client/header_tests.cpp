@@ -307,6 +307,73 @@ TEST_FIXTURE(uri_address, date_header)
     VERIFY_ARE_EQUAL(value.to_string(), foundValue);
 }
 
+TEST_FIXTURE(uri_address, header_ids_match_names)
+{
+    http_headers headers;
+    headers.add(header_ids::content_type, U("text/plain"));
+    VERIFY_IS_TRUE(headers.has(header_names::content_type));
+    VERIFY_IS_TRUE(headers.has(U("CONTENT-TYPE")));
+    VERIFY_ARE_EQUAL(U("text/plain"), headers[header_ids::content_type]);
+
+    headers[U("content-type")] = U("application/json");
+    VERIFY_ARE_EQUAL(1u, headers.size());
+    utility::string_t foundValue;
+    VERIFY_IS_TRUE(headers.match(header_ids::content_type, foundValue));
+    VERIFY_ARE_EQUAL(U("application/json"), foundValue);
+
+    headers.remove(header_ids::content_type);
+    VERIFY_IS_TRUE(headers.empty());
+    VERIFY_ARE_EQUAL(headers.end(), headers.find(header_ids::content_type));
+}
+
+TEST_FIXTURE(uri_address, known_header_tables)
+{
+    // The hashes are written out ahead of time; they must be those of the names, parallel to header_names.
+    const utility::string_t names[] =
+    {
+        utility::string_t(),
+#define _HEADER_NAMES
+#define DAT(a,b) b,
+#include "http_constants.dat"
+#undef _HEADER_NAMES
+#undef DAT
+    };
+    VERIFY_ARE_EQUAL(static_cast<size_t>(header_ids::_count), sizeof(names) / sizeof(names[0]));
+    for (int i = 0; i < header_ids::_count; ++i)
+    {
+        const header_ids::id id = static_cast<header_ids::id>(i);
+        VERIFY_ARE_EQUAL(names[i], utility::string_t(web::http::details::_known_header_name(id)));
+        VERIFY_ARE_EQUAL(web::http::details::_hash_header_name(names[i]), web::http::details::_known_header_hash(id));
+    }
+}
+
+TEST_FIXTURE(uri_address, many_headers)
+{
+    // More fields than fit in the inline storage.
+    http_headers h;
+    const size_t count = http_headers::inline_capacity * 3;
+    for (size_t i = 0; i < count; ++i)
+    {
+        h.add(U("Key") + utility::conversions::print_string(i), i);
+    }
+    VERIFY_ARE_EQUAL(count, h.size());
+
+    // Removal keeps the remaining fields in insertion order.
+    h.remove(U("KEY0"));
+    VERIFY_ARE_EQUAL(count - 1, h.size());
+    VERIFY_ARE_EQUAL(U("Key1"), h.begin()->first);
+
+    http_headers copy(h);
+    http_headers moved(std::move(h));
+    http_asserts::assert_http_headers_equals(copy, moved);
+    for (size_t i = 1; i < count; ++i)
+    {
+        size_t value;
+        VERIFY_IS_TRUE(moved.match(U("key") + utility::conversions::print_string(i), value));
+        VERIFY_ARE_EQUAL(i, value);
+    }
+}
+
 } // SUITE(header_tests)
 
 }}}}
\ No newline at end of file
@@ -0,0 +1,472 @@
+/***
+* ==++==
+*
+* Copyright (c) Microsoft Corporation. All rights reserved.
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* ==--==
+* =+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+
+*
+* http2_tests.cpp
+*
+* Tests cases for HPACK and the HTTP/2 client transport.
+*
+* =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+****/
+
+#include "stdafx.h"
+#include "http2_helpers.h"
+
+#ifndef _MS_WINDOWS
+#include <boost/asio.hpp>
+#endif
+
+using namespace web::http;
+using namespace web::http::client;
+using namespace web::http::details::http2;
+
+namespace tests { namespace functional { namespace http { namespace client {
+
+static std::vector<uint8_t> from_hex(const std::string &hex)
+{
+    std::vector<uint8_t> bytes;
+    for (size_t i = 0; i + 1 < hex.size(); i += 2)
+    {
+        bytes.push_back(static_cast<uint8_t>(std::stoi(hex.substr(i, 2), nullptr, 16)));
+    }
+    return bytes;
+}
+
+#ifndef _MS_WINDOWS
+
+using boost::asio::ip::tcp;
+
+// Minimal h2c server on loopback for the transport tests. Every request is answered with its path
+// followed by the number of request body bytes received. Responses are held back until a given
+// number of requests have arrived, and then sent newest first, so a client that does not
+// multiplex its requests would never finish. The first requests can be refused with REFUSED_STREAM.
+class h2c_test_server
+{
+public:
+    h2c_test_server(unsigned short port, size_t hold_until, size_t refuse = 0)
+        : m_acceptor(m_service, tcp::endpoint(boost::asio::ip::address_v4::loopback(), port)),
+          m_hold_until(hold_until),
+          m_refuse(refuse),
+          m_connections(0)
+    {
+        m_thread = std::thread([this]() { run(); });
+    }
+
+    ~h2c_test_server()
+    {
+        // Wake the server thread up from a blocking accept or read.
+        ::shutdown(m_acceptor.native_handle(), SHUT_RDWR);
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            if (m_socket)
+            {
+                ::shutdown(m_socket->native_handle(), SHUT_RDWR);
+            }
+        }
+        m_thread.join();
+    }
+
+    size_t connections() const
+    {
+        return m_connections;
+    }
+
+private:
+    struct request
+    {
+        request() : received(0) {}
+        std::string path;
+        size_t received;
+    };
+
+    void run()
+    {
+        for (;;)
+        {
+            auto socket = std::make_shared<tcp::socket>(m_service);
+            boost::system::error_code ec;
+            m_acceptor.accept(*socket, ec);
+            if (ec)
+            {
+                return;
+            }
+            ++m_connections;
+            {
+                std::lock_guard<std::mutex> lock(m_lock);
+                m_socket = socket;
+            }
+            try
+            {
+                serve(*socket);
+            }
+            catch (const boost::system::system_error &)
+            {
+            }
+        }
+    }
+
+    void write_frame(tcp::socket &socket, uint8_t type, uint8_t flags, uint32_t stream_id, const std::vector<uint8_t> &payload)
+    {
+        std::vector<uint8_t> frame(frame_header_size);
+        frame_header(static_cast<uint32_t>(payload.size()), type, flags, stream_id).write(&frame[0]);
+        frame.insert(frame.end(), payload.begin(), payload.end());
+        boost::asio::write(socket, boost::asio::buffer(frame));
+    }
+
+    void respond(tcp::socket &socket, uint32_t id, const request &req)
+    {
+        const std::string body = req.path + ":" + std::to_string(req.received);
+        std::vector<header_field> fields;
+        fields.push_back(header_field(":status", "200"));
+        fields.push_back(header_field("content-type", "text/plain"));
+        fields.push_back(header_field("content-length", std::to_string(body.size())));
+        std::vector<uint8_t> block;
+        m_encoder.encode(fields, block);
+        write_frame(socket, frame_types::headers, frame_flags::end_headers, id, block);
+        write_frame(socket, frame_types::data, frame_flags::end_stream, id, std::vector<uint8_t>(body.begin(), body.end()));
+    }
+
+    void serve(tcp::socket &socket)
+    {
+        std::vector<uint8_t> preface(connection_preface_size);
+        boost::asio::read(socket, boost::asio::buffer(preface));
+        VERIFY_IS_TRUE(std::equal(preface.begin(), preface.end(), connection_preface));
+        write_frame(socket, frame_types::settings, 0, 0, std::vector<uint8_t>());
+
+        hpack_decoder decoder;
+        std::map<uint32_t, request> requests;
+        std::vector<uint32_t> complete;
+        for (;;)
+        {
+            uint8_t header_bytes[frame_header_size];
+            boost::asio::read(socket, boost::asio::buffer(header_bytes));
+            const frame_header header = frame_header::read(header_bytes);
+            std::vector<uint8_t> payload(header.length);
+            if (header.length != 0)
+            {
+                boost::asio::read(socket, boost::asio::buffer(payload));
+            }
+
+            switch (header.type)
+            {
+            case frame_types::settings:
+                if (!(header.flags & frame_flags::ack))
+                {
+                    write_frame(socket, frame_types::settings, frame_flags::ack, 0, std::vector<uint8_t>());
+                }
+                break;
+            case frame_types::headers:
+                {
+                    VERIFY_IS_TRUE((header.flags & frame_flags::end_headers) != 0);
+                    std::vector<header_field> fields;
+                    VERIFY_IS_TRUE(decoder.decode(payload.empty() ? nullptr : &payload[0], payload.size(), fields));
+                    for (auto iter = fields.begin(); iter != fields.end(); ++iter)
+                    {
+                        if (iter->first == ":path")
+                        {
+                            requests[header.stream_id].path = iter->second;
+                        }
+                    }
+                }
+                break;
+            case frame_types::data:
+                requests[header.stream_id].received += payload.size();
+                if (!payload.empty())
+                {
+                    std::vector<uint8_t> increment;
+                    append_uint32(increment, header.length);
+                    write_frame(socket, frame_types::window_update, 0, 0, increment);
+                    write_frame(socket, frame_types::window_update, 0, header.stream_id, increment);
+                }
+                break;
+            case frame_types::goaway:
+                return;
+            default:
+                break;
+            }
+
+            if ((header.type == frame_types::headers || header.type == frame_types::data) && (header.flags & frame_flags::end_stream))
+            {
+                if (m_refuse > 0)
+                {
+                    --m_refuse;
+                    std::vector<uint8_t> error_code;
+                    append_uint32(error_code, error_codes::refused_stream);
+                    write_frame(socket, frame_types::rst_stream, 0, header.stream_id, error_code);
+                    continue;
+                }
+                complete.push_back(header.stream_id);
+                if (complete.size() >= m_hold_until)
+                {
+                    for (auto iter = complete.rbegin(); iter != complete.rend(); ++iter)
+                    {
+                        respond(socket, *iter, requests[*iter]);
+                    }
+                    complete.clear();
+                }
+            }
+        }
+    }
+
+    boost::asio::io_service m_service;
+    tcp::acceptor m_acceptor;
+    size_t m_hold_until;
+    size_t m_refuse;
+    std::atomic<size_t> m_connections;
+    std::mutex m_lock;
+    std::shared_ptr<tcp::socket> m_socket;
+    hpack_encoder m_encoder;
+    std::thread m_thread;
+};
+
+#endif
+
+SUITE(http2_tests)
+{
+
+// Request header blocks from RFC 7541 appendix C.4, which use Huffman coding and the dynamic table.
+TEST(hpack_decode_rfc_examples)
+{
+    hpack_decoder decoder;
+    std::vector<header_field> fields;
+
+    auto block = from_hex("828684418cf1e3c2e5f23a6ba0ab90f4ff");
+    VERIFY_IS_TRUE(decoder.decode(&block[0], block.size(), fields));
+    VERIFY_ARE_EQUAL(4u, fields.size());
+    VERIFY_ARE_EQUAL("GET", fields[0].second);
+    VERIFY_ARE_EQUAL(":authority", fields[3].first);
+    VERIFY_ARE_EQUAL("www.example.com", fields[3].second);
+    VERIFY_ARE_EQUAL(57u, decoder.table().size());
+
+    fields.clear();
+    block = from_hex("828684be5886a8eb10649cbf");
+    VERIFY_IS_TRUE(decoder.decode(&block[0], block.size(), fields));
+    VERIFY_ARE_EQUAL(5u, fields.size());
+    VERIFY_ARE_EQUAL("www.example.com", fields[3].second);
+    VERIFY_ARE_EQUAL("cache-control", fields[4].first);
+    VERIFY_ARE_EQUAL("no-cache", fields[4].second);
+    VERIFY_ARE_EQUAL(110u, decoder.table().size());
+
+    fields.clear();
+    block = from_hex("828785bf408825a849e95ba97d7f8925a849e95bb8e8b4bf");
+    VERIFY_IS_TRUE(decoder.decode(&block[0], block.size(), fields));
+    VERIFY_ARE_EQUAL(5u, fields.size());
+    VERIFY_ARE_EQUAL("https", fields[1].second);
+    VERIFY_ARE_EQUAL("/index.html", fields[2].second);
+    VERIFY_ARE_EQUAL("custom-key", fields[4].first);
+    VERIFY_ARE_EQUAL("custom-value", fields[4].second);
+    VERIFY_ARE_EQUAL(164u, decoder.table().size());
+}
+
+TEST(hpack_decode_invalid)
+{
+    hpack_decoder decoder;
+    std::vector<header_field> fields;
+
+    // Index 0, an index past the end of both tables, and a truncated literal.
+    const uint8_t zero_index[] = { 0x80 };
+    VERIFY_IS_FALSE(decoder.decode(zero_index, sizeof(zero_index), fields));
+    const uint8_t past_end[] = { 0xbf };
+    VERIFY_IS_FALSE(hpack_decoder().decode(past_end, sizeof(past_end), fields));
+    const uint8_t truncated[] = { 0x40, 0x0a, 'c', 'u' };
+    VERIFY_IS_FALSE(hpack_decoder().decode(truncated, sizeof(truncated), fields));
+}
+
+TEST(hpack_round_trip)
+{
+    hpack_encoder encoder;
+    hpack_decoder decoder;
+
+    std::vector<header_field> fields;
+    fields.push_back(header_field(":method", "POST"));
+    fields.push_back(header_field(":path", "/api/events?batch=1"));
+    fields.push_back(header_field("content-type", "application/json"));
+    fields.push_back(header_field("authorization", "Bearer token"));
+    fields.push_back(header_field("x-large", std::string(5000, 'x')));
+
+    std::vector<uint8_t> first, second;
+    encoder.encode(fields, first);
+    encoder.encode(fields, second);
+
+    // The repeated block refers to the dynamic table, except for the never indexed and oversized fields.
+    VERIFY_IS_TRUE(second.size() < first.size());
+
+    std::vector<header_field> decoded;
+    VERIFY_IS_TRUE(decoder.decode(&first[0], first.size(), decoded));
+    VERIFY_IS_TRUE(decoded == fields);
+    decoded.clear();
+    VERIFY_IS_TRUE(decoder.decode(&second[0], second.size(), decoded));
+    VERIFY_IS_TRUE(decoded == fields);
+}
+
+TEST(hpack_table_size_update)
+{
+    hpack_encoder encoder;
+    hpack_decoder decoder;
+
+    std::vector<header_field> fields;
+    fields.push_back(header_field("x-custom", "value"));
+
+    std::vector<uint8_t> first, second;
+    encoder.encode(fields, first);
+    encoder.set_max_table_size(0);
+    encoder.encode(fields, second);
+
+    // The second block starts with the size update, which empties the table.
+    std::vector<header_field> decoded;
+    VERIFY_IS_TRUE(decoder.decode(&first[0], first.size(), decoded));
+    VERIFY_ARE_EQUAL(1u, decoder.table().entry_count());
+    VERIFY_IS_TRUE(decoder.decode(&second[0], second.size(), decoded));
+    VERIFY_ARE_EQUAL(2u, decoded.size());
+    VERIFY_ARE_EQUAL(0u, decoder.table().entry_count());
+
+    // A size update after the first field is an error.
+    first.insert(first.end(), second.begin(), second.end());
+    VERIFY_IS_FALSE(hpack_decoder().decode(&first[0], first.size(), decoded));
+}
+
+TEST(huffman_round_trip)
+{
+    std::string all_octets;
+    for (int i = 0; i < 256; ++i)
+    {
+        all_octets.push_back(static_cast<char>(i));
+    }
+
+    std::vector<uint8_t> encoded;
+    huffman_encode(all_octets, encoded);
+    VERIFY_ARE_EQUAL(huffman_encoded_size(all_octets), encoded.size());
+
+    std::string decoded;
+    VERIFY_IS_TRUE(huffman_decode(&encoded[0], encoded.size(), decoded));
+    VERIFY_ARE_EQUAL(all_octets, decoded);
+
+    // Padding longer than seven bits is an error.
+    const uint8_t padding[] = { 0xff, 0xff };
+    decoded.clear();
+    VERIFY_IS_FALSE(huffman_decode(padding, sizeof(padding), decoded));
+}
+
+TEST(frame_header_round_trip)
+{
+    uint8_t bytes[frame_header_size];
+    frame_header(0x123456, frame_types::headers, frame_flags::end_headers | frame_flags::end_stream, 0x7fffffff).write(bytes);
+    const frame_header header = frame_header::read(bytes);
+    VERIFY_ARE_EQUAL(0x123456u, header.length);
+    VERIFY_ARE_EQUAL(frame_types::headers, header.type);
+    VERIFY_ARE_EQUAL(frame_flags::end_headers | frame_flags::end_stream, header.flags);
+    VERIFY_ARE_EQUAL(0x7fffffffu, header.stream_id);
+}
+
+#ifndef _MS_WINDOWS
+
+TEST_FIXTURE(uri_address, h2c_multiplexed_requests)
+{
+    const size_t num_requests = 10;
+    h2c_test_server server(static_cast<unsigned short>(m_uri.port()), num_requests);
+    {
+        http_client_config config;
+        config.set_use_http2(true);
+        http_client client(m_uri, config);
+
+        std::vector<pplx::task<http_response>> responses;
+        for (size_t i = 0; i < num_requests; ++i)
+        {
+            responses.push_back(client.request(methods::GET, U("/stream/") + utility::conversions::print_string(i)));
+        }
+        for (size_t i = 0; i < num_requests; ++i)
+        {
+            http_response response = responses[i].get();
+            VERIFY_ARE_EQUAL(status_codes::OK, response.status_code());
+            VERIFY_ARE_EQUAL(U("text/plain"), response.headers().content_type());
+            VERIFY_ARE_EQUAL(U("/stream/") + utility::conversions::print_string(i) + U(":0"), response.extract_string().get());
+        }
+    }
+    VERIFY_ARE_EQUAL(1u, server.connections());
+}
+
+TEST_FIXTURE(uri_address, h2c_flow_controlled_body)
+{
+    h2c_test_server server(static_cast<unsigned short>(m_uri.port()), 1);
+    {
+        http_client_config config;
+        config.set_use_http2(true);
+        http_client client(m_uri, config);
+
+        // Larger than the initial 64KB windows, so sending depends on the server's window updates.
+        const std::string body(300 * 1024, 'a');
+        http_response response = client.request(methods::PUT, U("/upload"), body).get();
+        VERIFY_ARE_EQUAL(status_codes::OK, response.status_code());
+        VERIFY_ARE_EQUAL(U("/upload:") + utility::conversions::print_string(body.size()), response.extract_string().get());
+    }
+    VERIFY_ARE_EQUAL(1u, server.connections());
+}
+
+TEST_FIXTURE(uri_address, h2c_slow_body_does_not_stall_other_streams)
+{
+    h2c_test_server server(static_cast<unsigned short>(m_uri.port()), 2);
+    {
+        http_client_config config;
+        config.set_use_http2(true);
+        http_client client(m_uri, config);
+
+        // The server answers /slow first; its body callback only finishes once /fast has been read whole,
+        // which needs the connection to go on reading frames while the callback holds its data.
+        pplx::task_completion_event<void> fast_done;
+        std::string slow_body;
+        http_request slow(methods::GET);
+        slow.set_request_uri(U("/slow"));
+        slow.set_response_body_callback([&slow_body, fast_done](const unsigned char *data, size_t size)
+        {
+            slow_body.append(reinterpret_cast<const char *>(data), size);
+            return pplx::create_task(fast_done);
+        });
+
+        auto fast_response = client.request(methods::GET, U("/fast"));
+        auto slow_response = client.request(slow);
+
+        VERIFY_ARE_EQUAL(U("/fast:0"), fast_response.get().extract_string().get());
+        fast_done.set();
+
+        http_response response = slow_response.get();
+        response.content_ready().wait();
+        VERIFY_ARE_EQUAL("/slow:0", slow_body);
+    }
+    VERIFY_ARE_EQUAL(1u, server.connections());
+}
+
+TEST_FIXTURE(uri_address, h2c_refused_stream_retried)
+{
+    h2c_test_server server(static_cast<unsigned short>(m_uri.port()), 1, 2);
+    {
+        http_client_config config;
+        config.set_use_http2(true);
+        http_client client(m_uri, config);
+
+        // The server acted on neither refused stream, so the client sends the request again on the same connection.
+        http_response response = client.request(methods::GET, U("/refused")).get();
+        VERIFY_ARE_EQUAL(status_codes::OK, response.status_code());
+        VERIFY_ARE_EQUAL(U("/refused:0"), response.extract_string().get());
+    }
+    VERIFY_ARE_EQUAL(1u, server.connections());
+}
+
+#endif
+
+} // SUITE(http2_tests)
+
+}}}}
@@ -0,0 +1,602 @@
+/***
+* ==++==
+*
+* Copyright (c) Microsoft Corporation. All rights reserved. 
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+* http://www.apache.org/licenses/LICENSE-2.0
+* 
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* ==--==
+* =+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+
+*
+* listener_tests.cpp
+*
+* Tests cases for the http_listener features: routing, acceptor shards, pipelining, keep-alive,
+* queue time shedding, compression, thread-per-core and the access log.
+*
+* =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+****/
+
+#include "stdafx.h"
+
+#ifndef __cplusplus_winrt
+#include "http_listener.h"
+#endif
+
+#if !defined(_MS_WINDOWS)
+#include "http_server_api.h"
+#include "http_linux_server.h"
+#include "http_access_log.h"
+#endif
+
+using namespace web; using namespace utility;
+using namespace utility::conversions;
+using namespace web::http;
+using namespace web::http::client;
+
+using namespace tests::common::utilities;
+using namespace tests::functional::http::utilities;
+
+namespace tests { namespace functional { namespace http { namespace client {
+
+SUITE(listener_tests)
+{
+
+#ifndef __cplusplus_winrt
+TEST_FIXTURE(uri_address, listener_routes)
+{
+    using namespace web::http::listener;
+
+    std::vector<method> file_methods;
+    file_methods.push_back(methods::GET);
+    file_methods.push_back(methods::PUT);
+
+    auto listener = http_listener::create(m_uri);
+    listener.route(methods::GET, U("/users/{id}"), [](http_request request, const route_params &params)
+    {
+        request.reply(status_codes::OK, U("user:") + params.get(U("id")));
+    })
+    .route(methods::GET, U("/users/me"), [](http_request request, const route_params &)
+    {
+        request.reply(status_codes::OK, U("me"));
+    })
+    .route(methods::POST, U("/users/{id}/posts/{post}"), [](http_request request, const route_params &params)
+    {
+        request.reply(status_codes::OK, params.get(U("id")) + U(",") + params.get(U("post")));
+    })
+    .route(file_methods, U("/files/{*path}"), [](http_request request, const route_params &params)
+    {
+        request.reply(status_codes::OK, params.raw(U("path")));
+    })
+    .support([](http_request request)
+    {
+        request.reply(status_codes::OK, U("fallback"));
+    });
+    VERIFY_ARE_EQUAL(0u, listener.open());
+
+    http_client client(m_uri);
+    VERIFY_ARE_EQUAL(U("user:42"), client.request(methods::GET, U("/users/42")).get().extract_string().get());
+    VERIFY_ARE_EQUAL(U("me"), client.request(methods::GET, U("/users/me")).get().extract_string().get());
+    VERIFY_ARE_EQUAL(U("user:a b"), client.request(methods::GET, U("/users/a%20b")).get().extract_string().get());
+    VERIFY_ARE_EQUAL(U("7,9"), client.request(methods::POST, U("/users/7/posts/9")).get().extract_string().get());
+    VERIFY_ARE_EQUAL(U("a/b/c"), client.request(methods::PUT, U("/files/a/b/c")).get().extract_string().get());
+    VERIFY_ARE_EQUAL(U("fallback"), client.request(methods::GET, U("/unrouted")).get().extract_string().get());
+
+    http_response response = client.request(methods::DEL, U("/users/42")).get();
+    VERIFY_ARE_EQUAL(status_codes::MethodNotAllowed, response.status_code());
+    VERIFY_ARE_EQUAL(U("GET"), response.headers()[header_names::allow]);
+
+    VERIFY_ARE_EQUAL(0u, listener.close());
+}
+
+TEST(router_patterns)
+{
+    using namespace web::http::listener;
+
+    http_router router;
+    auto noop = [](http_request, const route_params &) {};
+    VERIFY_THROWS(router.add(methods::GET, U("users"), noop), std::invalid_argument);
+    VERIFY_THROWS(router.add(methods::GET, U("/users/{id"), noop), std::invalid_argument);
+    VERIFY_THROWS(router.add(methods::GET, U("/users/x{id}"), noop), std::invalid_argument);
+    VERIFY_THROWS(router.add(methods::GET, U("/files/{*path}/more"), noop), std::invalid_argument);
+
+    router.add(methods::GET, U("/a/{x}/c"), noop).add(methods::GET, U("/a/b/{y}"), noop).add(methods::GET, U("/ab"), noop);
+    VERIFY_THROWS(router.add(methods::GET, U("/ab"), noop), std::invalid_argument);
+
+    route_params params;
+    const utility::string_t path = U("/a/b/c");
+    VERIFY_IS_NOT_NULL(router.find(methods::GET, path.data(), path.size(), params));
+    VERIFY_ARE_EQUAL(1u, params.size());
+    VERIFY_ARE_EQUAL(U("c"), params.get(U("y")));
+
+    const utility::string_t other = U("/a/z/c");
+    VERIFY_IS_NOT_NULL(router.find(methods::GET, other.data(), other.size(), params));
+    VERIFY_ARE_EQUAL(U("z"), params.get(U("x")));
+    VERIFY_IS_FALSE(params.has(U("y")));
+
+    const utility::string_t missing = U("/a/z/d");
+    VERIFY_IS_NULL(router.find(methods::GET, missing.data(), missing.size(), params));
+    VERIFY_IS_NULL(router.find(methods::PUT, path.data(), path.size(), params));
+}
+#endif
+
+#if !defined(_MS_WINDOWS)
+TEST_FIXTURE(uri_address, requests_over_acceptor_shards)
+{
+    using namespace web::http::listener;
+
+    // In thread-per-core mode a handler runs on the thread of the shard that accepted its connection.
+    http_linux_server* server = new http_linux_server(4);
+    server->set_thread_per_core(true);
+    http_server_api::register_server_api(std::unique_ptr<http_server>(server));
+    VERIFY_ARE_EQUAL(4u, server->acceptor_threads());
+
+    pplx::critical_section lock;
+    std::set<std::thread::id> shard_threads;
+    auto listener = http_listener::create(m_uri);
+    listener.support([&](http_request request)
+    {
+        {
+            pplx::scoped_critical_section l(lock);
+            shard_threads.insert(std::this_thread::get_id());
+        }
+        request.reply(status_codes::OK, request.relative_uri().path());
+    });
+    VERIFY_ARE_EQUAL(0u, listener.open());
+
+    {
+        // Every request is on a connection of its own, which the kernel hands to one of the shards.
+        std::vector<std::unique_ptr<http_client>> clients;
+        std::vector<pplx::task<http_response>> responses;
+        for(size_t i = 0; i < 40; ++i)
+        {
+            clients.push_back(std::unique_ptr<http_client>(new http_client(m_uri)));
+            responses.push_back(clients.back()->request(methods::GET, U("/") + to_string_t(std::to_string(i))));
+        }
+        for(size_t i = 0; i < responses.size(); ++i)
+        {
+            http_response rsp = responses[i].get();
+            VERIFY_ARE_EQUAL(status_codes::OK, rsp.status_code());
+            VERIFY_ARE_EQUAL(U("/") + to_string_t(std::to_string(i)), rsp.extract_string().get());
+        }
+    }
+
+    VERIFY_ARE_EQUAL(0u, listener.close());
+    http_server_api::unregister_server_api();
+
+    VERIFY_IS_TRUE(shard_threads.size() > 1);
+    VERIFY_IS_TRUE(shard_threads.size() <= 4);
+}
+
+TEST_FIXTURE(uri_address, pipelined_requests_on_one_connection)
+{
+    using namespace web::http::listener;
+    using boost::asio::ip::tcp;
+
+    auto listener = http_listener::create(m_uri);
+    listener.support([](http_request request)
+    {
+        request.reply(status_codes::OK, request.relative_uri().path());
+    });
+    VERIFY_ARE_EQUAL(0u, listener.open());
+
+    // Three requests in one write; the second has a chunked body, the last closes the connection.
+    boost::asio::io_service service;
+    tcp::socket socket(service);
+    boost::asio::connect(socket, tcp::resolver(service).resolve(tcp::resolver::query(m_uri.host(), std::to_string(m_uri.port()))));
+    const std::string requests =
+        "GET /first HTTP/1.1\r\nHost: localhost\r\n\r\n"
+        "POST /second HTTP/1.1\r\nHost: localhost\r\nTransfer-Encoding: chunked\r\n\r\n3\r\nabc\r\n0\r\n\r\n"
+        "GET /third HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+    boost::asio::write(socket, boost::asio::buffer(requests));
+
+    boost::asio::streambuf responses;
+    boost::system::error_code ec;
+    boost::asio::read(socket, responses, ec);
+    VERIFY_IS_TRUE(ec == boost::asio::error::eof);
+
+    const std::string text((std::istreambuf_iterator<char>(&responses)), std::istreambuf_iterator<char>());
+    const auto first = text.find("/first"), second = text.find("/second"), third = text.find("/third");
+    VERIFY_IS_TRUE(first != std::string::npos);
+    VERIFY_IS_TRUE(second != std::string::npos && second > first);
+    VERIFY_IS_TRUE(third != std::string::npos && third > second);
+
+    VERIFY_ARE_EQUAL(0u, listener.close());
+}
+
+TEST_FIXTURE(uri_address, idle_connection_is_closed)
+{
+    using namespace web::http::listener;
+    using boost::asio::ip::tcp;
+
+    http_linux_server* server = new http_linux_server(1);
+    server->set_keep_alive_timeout(utility::seconds(1));
+    http_server_api::register_server_api(std::unique_ptr<http_server>(server));
+
+    auto listener = http_listener::create(m_uri);
+    listener.support([](http_request request) { request.reply(status_codes::OK); });
+    VERIFY_ARE_EQUAL(0u, listener.open());
+
+    boost::asio::io_service service;
+    tcp::socket socket(service);
+    boost::asio::connect(socket, tcp::resolver(service).resolve(tcp::resolver::query(m_uri.host(), std::to_string(m_uri.port()))));
+
+    // Nothing is sent: the server closes the connection once the timeout passes.
+    const auto start = std::chrono::steady_clock::now();
+    char byte;
+    boost::system::error_code ec;
+    boost::asio::read(socket, boost::asio::buffer(&byte, 1), ec);
+    VERIFY_IS_TRUE(ec != boost::system::error_code());
+    VERIFY_IS_TRUE(std::chrono::steady_clock::now() - start < std::chrono::seconds(30));
+
+    VERIFY_ARE_EQUAL(0u, listener.close());
+    http_server_api::unregister_server_api();
+}
+
+TEST(queue_time_shedding)
+{
+    using web::http::listener::details::queue_time_shedder;
+    using std::chrono::milliseconds;
+
+    auto now = queue_time_shedder::clock::now();
+
+    // A budget sheds whatever waited longer than it.
+    {
+        queue_time_shedder shedder;
+        shedder.set_budget(milliseconds(50));
+        VERIFY_IS_TRUE(shedder.admit(milliseconds(10), now));
+        VERIFY_IS_FALSE(shedder.admit(milliseconds(60), now));
+        VERIFY_ARE_EQUAL(1u, shedder.shed_count());
+    }
+
+    // CoDel sheds once an interval has passed with every wait over the target, and stops after one without.
+    {
+        queue_time_shedder shedder;
+        shedder.set_target(milliseconds(5), milliseconds(100));
+        VERIFY_IS_TRUE(shedder.admit(milliseconds(20), now));
+        VERIFY_IS_TRUE(shedder.admit(milliseconds(30), now + milliseconds(50)));
+        VERIFY_IS_FALSE(shedder.admit(milliseconds(30), now + milliseconds(100)));
+        VERIFY_IS_TRUE(shedder.admit(milliseconds(8), now + milliseconds(110)));
+        VERIFY_IS_TRUE(shedder.admit(milliseconds(1), now + milliseconds(150)));
+        VERIFY_IS_TRUE(shedder.admit(milliseconds(30), now + milliseconds(200)));
+        VERIFY_ARE_EQUAL(1u, shedder.shed_count());
+    }
+}
+
+TEST_FIXTURE(uri_address, requests_within_queue_time_budget)
+{
+    using namespace web::http::listener;
+
+    http_linux_server* server = new http_linux_server();
+    server->set_queue_time_budget(std::chrono::milliseconds(10000));
+    http_server_api::register_server_api(std::unique_ptr<http_server>(server));
+
+    auto listener = http_listener::create(m_uri);
+    listener.support([](http_request request) { request.reply(status_codes::OK); });
+    VERIFY_ARE_EQUAL(0u, listener.open());
+
+    http_client client(m_uri);
+    for(size_t i = 0; i < 10; ++i)
+    {
+        VERIFY_ARE_EQUAL(status_codes::OK, client.request(methods::GET).get().status_code());
+    }
+    VERIFY_ARE_EQUAL(0u, server->shed_requests());
+
+    VERIFY_ARE_EQUAL(0u, listener.close());
+    http_server_api::unregister_server_api();
+}
+
+TEST_FIXTURE(uri_address, requests_over_queue_time_budget_are_shed)
+{
+    using namespace web::http::listener;
+    using boost::asio::ip::tcp;
+
+    http_linux_server* server = new http_linux_server(1);
+    server->set_queue_time_budget(std::chrono::milliseconds(50));
+    http_server_api::register_server_api(std::unique_ptr<http_server>(server));
+
+    auto listener = http_listener::create(m_uri);
+    listener.support([](http_request request) { request.reply(status_codes::OK); });
+    VERIFY_ARE_EQUAL(0u, listener.open());
+
+    // Fill every worker of the pool the handlers run on, and queue more chores behind them.
+    const size_t blockers = 1024;
+    pplx::notification_event release;
+    std::atomic<size_t> started(0);
+    std::vector<pplx::task<void>> blocked;
+    for(size_t i = 0; i < blockers; ++i)
+    {
+        blocked.push_back(pplx::create_task([&]()
+        {
+            ++started;
+            release.wait();
+        }));
+    }
+
+    // The request is read on the acceptor's thread, then its handler waits in the pool's queue.
+    boost::asio::io_service service;
+    tcp::socket socket(service);
+    boost::asio::connect(socket, tcp::resolver(service).resolve(tcp::resolver::query(m_uri.host(), std::to_string(m_uri.port()))));
+    const std::string request = "GET / HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+    boost::asio::write(socket, boost::asio::buffer(request));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    VERIFY_IS_TRUE(started < blockers);
+    release.set();
+    for(size_t i = 0; i < blocked.size(); ++i)
+    {
+        blocked[i].wait();
+    }
+
+    boost::asio::streambuf response;
+    boost::system::error_code ec;
+    boost::asio::read(socket, response, ec);
+    VERIFY_IS_TRUE(ec == boost::asio::error::eof);
+    const std::string text((std::istreambuf_iterator<char>(&response)), std::istreambuf_iterator<char>());
+    VERIFY_ARE_EQUAL(0u, text.find("HTTP/1.1 503 "));
+    VERIFY_ARE_EQUAL(1u, server->shed_requests());
+
+    // Once the pool is free again requests are handled.
+    http_client client(m_uri);
+    VERIFY_ARE_EQUAL(status_codes::OK, client.request(methods::GET).get().status_code());
+    VERIFY_ARE_EQUAL(1u, server->shed_requests());
+
+    VERIFY_ARE_EQUAL(0u, listener.close());
+    http_server_api::unregister_server_api();
+}
+
+TEST_FIXTURE(uri_address, compressed_responses)
+{
+    using namespace web::http::listener;
+
+    http_linux_server* server = new http_linux_server();
+    server->set_compression(6, 100);
+    http_server_api::register_server_api(std::unique_ptr<http_server>(server));
+
+    utility::string_t text;
+    for(size_t i = 0; i < 1000; ++i)
+    {
+        text += U("{\"key\": \"value\"}, ");
+    }
+    auto listener = http_listener::create(m_uri);
+    listener.support([text](http_request request)
+    {
+        auto path = request.relative_uri().path();
+        if(path == U("/small"))
+        {
+            request.reply(status_codes::OK, U("tiny"));
+        }
+        else if(path == U("/binary"))
+        {
+            http_response response(status_codes::OK);
+            response.set_body(std::vector<unsigned char>(text.begin(), text.end()));
+            request.reply(response);
+        }
+        else
+        {
+            request.reply(status_codes::OK, text, U("application/json"));
+        }
+    });
+    VERIFY_ARE_EQUAL(0u, listener.open());
+
+    http_client client(m_uri);
+    auto get = [&](const utility::string_t &path, const utility::string_t &accept_encoding) -> http_response
+    {
+        http_request msg(methods::GET);
+        msg.set_request_uri(path);
+        if(!accept_encoding.empty())
+            msg.headers().add(header_names::accept_encoding, accept_encoding);
+        http_response response = client.request(msg).get();
+        response.content_ready().wait();
+        return response;
+    };
+
+    // A textual body is compressed for a client that accepts it, and streamed chunked.
+    {
+        http_response response = get(U("/"), U("deflate;q=0.5, gzip"));
+        VERIFY_ARE_EQUAL(U("gzip"), response.headers()[header_names::content_encoding]);
+        VERIFY_ARE_EQUAL(U("Accept-Encoding"), response.headers()[header_names::vary]);
+        VERIFY_ARE_EQUAL(U("chunked"), response.headers()[header_names::transfer_encoding]);
+        auto body = response.extract_vector().get();
+        VERIFY_IS_TRUE(body.size() > 2 && body.size() < text.size() / 5);
+        VERIFY_ARE_EQUAL(0x1f, body[0]);
+        VERIFY_ARE_EQUAL(0x8b, body[1]);
+    }
+    {
+        http_response response = get(U("/"), U("deflate"));
+        VERIFY_ARE_EQUAL(U("deflate"), response.headers()[header_names::content_encoding]);
+    }
+
+    // Bodies that are not asked for compressed, too small, or not textual are sent as they are.
+    VERIFY_ARE_EQUAL(text, get(U("/"), U("")).extract_string().get());
+    VERIFY_ARE_EQUAL(text, get(U("/"), U("gzip;q=0")).extract_string().get());
+    VERIFY_IS_FALSE(get(U("/small"), U("gzip")).headers().has(header_names::content_encoding));
+    VERIFY_IS_FALSE(get(U("/binary"), U("gzip")).headers().has(header_names::content_encoding));
+
+    VERIFY_ARE_EQUAL(0u, listener.close());
+    http_server_api::unregister_server_api();
+}
+
+TEST_FIXTURE(uri_address, thread_per_core_handlers)
+{
+    using namespace web::http::listener;
+
+    http_linux_server* server = new http_linux_server(1);
+    server->set_thread_per_core(true);
+    http_server_api::register_server_api(std::unique_ptr<http_server>(server));
+
+    // With one shard, every handler and continuation runs on its one thread.
+    pplx::critical_section lock;
+    std::set<std::thread::id> threads;
+    auto listener = http_listener::create(m_uri);
+    listener.support([&](http_request request)
+    {
+        {
+            pplx::scoped_critical_section l(lock);
+            threads.insert(std::this_thread::get_id());
+        }
+        request.extract_string().then([&, request](utility::string_t body) mutable
+        {
+            {
+                pplx::scoped_critical_section l(lock);
+                threads.insert(std::this_thread::get_id());
+            }
+            request.reply(status_codes::OK, body);
+        });
+    });
+    VERIFY_ARE_EQUAL(0u, listener.open());
+
+    {
+        http_client client(m_uri);
+        std::vector<pplx::task<http_response>> responses;
+        for(size_t i = 0; i < 10; ++i)
+        {
+            responses.push_back(client.request(methods::POST, U(""), U("body") + to_string_t(std::to_string(i))));
+        }
+        for(size_t i = 0; i < responses.size(); ++i)
+        {
+            http_response rsp = responses[i].get();
+            VERIFY_ARE_EQUAL(status_codes::OK, rsp.status_code());
+            VERIFY_ARE_EQUAL(U("body") + to_string_t(std::to_string(i)), rsp.extract_string().get());
+        }
+    }
+
+    VERIFY_ARE_EQUAL(1u, threads.size());
+    VERIFY_IS_TRUE(threads.find(std::this_thread::get_id()) == threads.end());
+
+    VERIFY_ARE_EQUAL(0u, listener.close());
+    http_server_api::unregister_server_api();
+}
+
+TEST_FIXTURE(uri_address, thread_per_core_close_from_handler)
+{
+    using namespace web::http::listener;
+
+    http_linux_server* server = new http_linux_server(2);
+    server->set_thread_per_core(true);
+    http_server_api::register_server_api(std::unique_ptr<http_server>(server));
+
+    // The continuation runs on the shard's thread, which closing the listener must not wait on.
+    pplx::task_completion_event<unsigned long> closed;
+    auto listener = http_listener::create(m_uri);
+    listener.support([&](http_request request)
+    {
+        request.reply(status_codes::OK).then([&](pplx::task<void>)
+        {
+            closed.set(listener.close());
+        });
+    });
+    VERIFY_ARE_EQUAL(0u, listener.open());
+
+    http_client client(m_uri);
+    VERIFY_ARE_EQUAL(status_codes::OK, client.request(methods::GET).get().status_code());
+    VERIFY_ARE_EQUAL(0u, pplx::create_task(closed).get());
+    VERIFY_THROWS(client.request(methods::GET).get(), http_exception);
+
+    http_server_api::unregister_server_api();
+}
+
+TEST_FIXTURE(uri_address, access_log_records_exchanges)
+{
+    using namespace web::http::listener;
+
+    const std::string file_name = "access_log_records_exchanges.bin";
+    std::remove(file_name.c_str());
+
+    auto listener = http_listener::create(m_uri);
+    listener.support([](http_request request) { request.reply(status_codes::OK, U("hello")); });
+    VERIFY_ARE_EQUAL(0u, listener.open());
+
+    access_log::start(to_string_t(file_name), std::chrono::milliseconds(10));
+    VERIFY_IS_TRUE(access_log::enabled());
+    {
+        http_client client(m_uri);
+        for(size_t i = 0; i < 3; ++i)
+        {
+            VERIFY_ARE_EQUAL(status_codes::OK, client.request(methods::GET, U("/log?x=1")).get().status_code());
+        }
+    }
+    VERIFY_ARE_EQUAL(0u, listener.close());
+    access_log::stop();
+    VERIFY_IS_FALSE(access_log::enabled());
+
+    std::ifstream file(file_name, std::ios::binary);
+    std::vector<access_log_entry> entries;
+    access_log_entry entry;
+    while (file.read(reinterpret_cast<char *>(&entry), sizeof(entry)))
+    {
+        entries.push_back(entry);
+    }
+    VERIFY_ARE_EQUAL(6u, entries.size());
+
+    size_t client_entries = 0;
+    for (auto it = entries.begin(); it != entries.end(); ++it)
+    {
+        if (it->source == static_cast<uint8_t>(access_log_source::client))
+            ++client_entries;
+        VERIFY_ARE_EQUAL(status_codes::OK, it->status_code);
+        VERIFY_ARE_EQUAL(1, it->method);
+        VERIFY_ARE_EQUAL(5u, it->response_size);
+        VERIFY_ARE_EQUAL(0, it->failed);
+        VERIFY_IS_TRUE(it->headers_time <= it->total_time);
+        VERIFY_IS_TRUE(it->uri_hash == access_log::hash_uri(uri(U("/log?x=1"))));
+    }
+    VERIFY_ARE_EQUAL(3u, client_entries);
+    VERIFY_ARE_EQUAL(0u, access_log::dropped());
+
+    std::remove(file_name.c_str());
+}
+
+TEST_FIXTURE(uri_address, access_log_flags_handler_exceptions)
+{
+    using namespace web::http::listener;
+
+    const std::string file_name = "access_log_flags_handler_exceptions.bin";
+    std::remove(file_name.c_str());
+
+    auto listener = http_listener::create(m_uri);
+    listener.support([](http_request) { throw std::runtime_error("handler failed"); });
+    VERIFY_ARE_EQUAL(0u, listener.open());
+
+    access_log::start(to_string_t(file_name), std::chrono::milliseconds(10));
+    {
+        http_client client(m_uri);
+        VERIFY_ARE_EQUAL(status_codes::InternalError, client.request(methods::GET).get().status_code());
+    }
+    VERIFY_ARE_EQUAL(0u, listener.close());
+    access_log::stop();
+
+    std::ifstream file(file_name, std::ios::binary);
+    std::vector<access_log_entry> entries;
+    access_log_entry entry;
+    while (file.read(reinterpret_cast<char *>(&entry), sizeof(entry)))
+    {
+        entries.push_back(entry);
+    }
+    VERIFY_ARE_EQUAL(2u, entries.size());
+
+    // The client got a complete response; only the listener knows why it is a 500.
+    for (auto it = entries.begin(); it != entries.end(); ++it)
+    {
+        VERIFY_ARE_EQUAL(status_codes::InternalError, it->status_code);
+        if (it->source == static_cast<uint8_t>(access_log_source::listener))
+            VERIFY_ARE_EQUAL(access_log_failure::handler_exception, it->failed);
+        else
+            VERIFY_ARE_EQUAL(access_log_failure::none, it->failed);
+    }
+
+    std::remove(file_name.c_str());
+}
+
+#endif
+
+} // SUITE(listener_tests)
+
+}}}}
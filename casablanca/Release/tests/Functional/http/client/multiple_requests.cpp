@@ -186,6 +186,136 @@ TEST_FIXTURE(uri_address, responses_with_data)
     }
 }
 
+// Tests requests issued concurrently from several threads with ordering guaranteed.
+// Each thread's requests must reach the server in the order that thread sent them.
+TEST_FIXTURE(uri_address, ordered_requests_from_many_threads)
+{
+    test_http_server::scoped_server scoped(m_uri);
+    http_client_config config;
+    config.set_guarantee_order(true);
+    http_client client(m_uri, config);
+
+    const size_t num_threads = 4;
+    const size_t num_requests = 25;
+    const method method = methods::GET;
+    const web::http::status_code code = status_codes::OK;
+
+    auto request_path = [](size_t thread, size_t i)
+    {
+        return U("/") + print_string(thread) + U("/") + print_string(i);
+    };
+
+    // send requests
+    std::vector<pplx::task<std::vector<pplx::task<http_response>>>> senders;
+    for(size_t t = 0; t < num_threads; ++t)
+    {
+        senders.push_back(pplx::create_task([t, &client, &method, &request_path]()
+        {
+            std::vector<pplx::task<http_response>> responses;
+            for(size_t i = 0; i < num_requests; ++i)
+            {
+                responses.push_back(client.request(method, request_path(t, i)));
+            }
+            return responses;
+        }));
+    }
+
+    // response to requests, checking each thread's requests arrive in order.
+    std::vector<size_t> next_expected(num_threads, 0);
+    for(size_t i = 0; i < num_threads * num_requests; ++i)
+    {
+        test_request *request = scoped.server()->wait_for_request();
+        size_t t = 0;
+        for(; t < num_threads; ++t)
+        {
+            if(next_expected[t] < num_requests && request->m_path == request_path(t, next_expected[t]))
+            {
+                break;
+            }
+        }
+        VERIFY_IS_TRUE(t < num_threads);
+        if(t < num_threads)
+        {
+            ++next_expected[t];
+        }
+        VERIFY_ARE_EQUAL(0u, request->reply(code));
+    }
+
+    // wait for requests.
+    for(size_t t = 0; t < num_threads; ++t)
+    {
+        auto responses = senders[t].get();
+        for(size_t i = 0; i < num_requests; ++i)
+        {
+            http_asserts::assert_response_equals(responses[i].get(), code);
+        }
+    }
+}
+
+TEST_FIXTURE(uri_address, sequential_requests_recycle_state)
+{
+    test_http_server::scoped_server scoped(m_uri);
+    http_client client(m_uri);
+
+    // Request state is recycled between requests; bodies of varying size must not see
+    // what was left behind by the previous one.
+    std::string data_arrays[3];
+    initialize_data(data_arrays, 3);
+    data_arrays[1].resize(10);
+    data_arrays[2].append(data_arrays[0]);
+    std::map<utility::string_t, utility::string_t> headers;
+    headers[U("Content-Type")] = U("text/plain");
+
+    for(size_t i = 0; i < 30; ++i)
+    {
+        const std::string &body = data_arrays[i % 3];
+        auto response = client.request(methods::PUT, U(""), body);
+
+        test_request *request = scoped.server()->wait_for_request();
+        http_asserts::assert_test_request_equals(request, methods::PUT, U("/"), U("text/plain"), to_string_t(body));
+        VERIFY_ARE_EQUAL(0u, request->reply(status_codes::OK, U(""), headers, body));
+
+        http_response rsp = response.get();
+        VERIFY_ARE_EQUAL(to_string_t(body), rsp.extract_string().get());
+    }
+}
+
+TEST_FIXTURE(uri_address, requests_by_priority)
+{
+    test_http_server::scoped_server scoped(m_uri);
+    http_client_config config;
+    config.set_max_connections(1);
+    http_client client(m_uri, config);
+
+    auto requests = scoped.server()->next_requests(4);
+
+    // The first request takes the only connection, the others wait for it.
+    const utility::string_t paths[] = { U("/first"), U("/background"), U("/normal"), U("/interactive") };
+    const request_priority::level priorities[] = { request_priority::normal, request_priority::background, request_priority::normal, request_priority::interactive };
+    std::vector<pplx::task<http_response>> responses;
+    for(size_t i = 0; i < 4; ++i)
+    {
+        http_request msg(methods::GET);
+        msg.set_request_uri(paths[i]);
+        msg.set_priority(priorities[i]);
+        responses.push_back(client.request(msg));
+    }
+
+    // The waiting requests go out highest priority first.
+    const utility::string_t expected[] = { U("/first"), U("/interactive"), U("/normal"), U("/background") };
+    for(size_t i = 0; i < 4; ++i)
+    {
+        test_request *request = requests[i].get();
+        http_asserts::assert_test_request_equals(request, methods::GET, expected[i]);
+        VERIFY_ARE_EQUAL(0u, request->reply(status_codes::OK));
+    }
+
+    for(size_t i = 0; i < 4; ++i)
+    {
+        http_asserts::assert_response_equals(responses[i].get(), status_codes::OK);
+    }
+}
+
 } // SUITE(multiple_requests)
 
 }}}}
@@ -28,6 +28,7 @@
 using namespace web::http;
 using namespace web::http::client;
 
+using namespace tests::common::utilities;
 using namespace tests::functional::http::utilities;
 
 namespace tests { namespace functional { namespace http { namespace client {
@@ -232,6 +233,150 @@ TEST_FIXTURE(uri_address, http_short_circuit_no_count)
     VERIFY_ARE_EQUAL(0u, count);
 }
 
+TEST_FIXTURE(uri_address, concurrency_limiter_queues_and_rejects)
+{
+    pplx::critical_section lock;
+    std::vector<http_request> held;
+    auto hold_stage = 
+        [&](http_request request, std::shared_ptr<http_pipeline_stage> next_stage) -> pplx::task<http_response>
+        {
+            pplx::scoped_critical_section l(lock);
+            held.push_back(request);
+            return request.get_response();
+        };
+    auto held_count = [&]() -> size_t
+    {
+        pplx::scoped_critical_section l(lock);
+        return held.size();
+    };
+
+    // Two requests in flight, one waiting.
+    auto limiter = std::make_shared<adaptive_concurrency_limiter>(adaptive_concurrency_limiter::aimd, 2, 1, 10, 1);
+    http_client client(m_uri);
+    client.add_handler(limiter);
+    client.add_handler(hold_stage);
+
+    std::vector<pplx::task<http_response>> responses;
+    for(int i = 0; i < 3; ++i)
+    {
+        responses.push_back(client.request(methods::GET));
+    }
+    VERIFY_THROWS(client.request(methods::GET).get(), http_exception);
+    VERIFY_ARE_EQUAL(2u, held_count());
+    VERIFY_ARE_EQUAL(2u, limiter->in_flight());
+
+    // Answering one lets the queued request through.
+    held[0].reply(status_codes::OK);
+    http_asserts::assert_response_equals(responses[0].get(), status_codes::OK);
+    for(int i = 0; i < 100 && held_count() < 3; ++i)
+    {
+        os_utilities::sleep(10);
+    }
+    VERIFY_ARE_EQUAL(3u, held_count());
+
+    held[1].reply(status_codes::OK);
+    held[2].reply(status_codes::OK);
+    http_asserts::assert_response_equals(responses[1].get(), status_codes::OK);
+    http_asserts::assert_response_equals(responses[2].get(), status_codes::OK);
+    VERIFY_ARE_EQUAL(0u, limiter->in_flight());
+}
+
+TEST_FIXTURE(uri_address, concurrency_limiter_backs_off)
+{
+    auto reply_stage = 
+        [](http_request request, std::shared_ptr<http_pipeline_stage> next_stage) -> pplx::task<http_response>
+        {
+            request.reply(status_codes::ServiceUnavailable);
+            return request.get_response();
+        };
+
+    adaptive_concurrency_limiter::algorithm algorithms[] = { adaptive_concurrency_limiter::aimd, adaptive_concurrency_limiter::gradient };
+    for(int i = 0; i < 2; ++i)
+    {
+        auto limiter = std::make_shared<adaptive_concurrency_limiter>(algorithms[i], 10, 1, 10);
+        http_client client(m_uri);
+        client.add_handler(limiter);
+        client.add_handler(reply_stage);
+
+        for(int j = 0; j < 10; ++j)
+        {
+            http_asserts::assert_response_equals(client.request(methods::GET).get(), status_codes::ServiceUnavailable);
+        }
+        VERIFY_IS_TRUE(limiter->limit() < 10);
+    }
+}
+
+TEST_FIXTURE(uri_address, concurrency_limiter_releases_slot_on_throw)
+{
+    auto throw_stage = 
+        [](http_request request, std::shared_ptr<http_pipeline_stage> next_stage) -> pplx::task<http_response>
+        {
+            throw http_exception(U("stage failed"));
+        };
+
+    // A single slot: if the failed request kept it, the second one would queue forever.
+    auto limiter = std::make_shared<adaptive_concurrency_limiter>(adaptive_concurrency_limiter::aimd, 1, 1, 1);
+    http_client client(m_uri);
+    client.add_handler(limiter);
+    client.add_handler(throw_stage);
+
+    VERIFY_THROWS(client.request(methods::GET).get(), http_exception);
+    VERIFY_ARE_EQUAL(0u, limiter->in_flight());
+    VERIFY_THROWS(client.request(methods::GET).get(), http_exception);
+    VERIFY_ARE_EQUAL(0u, limiter->in_flight());
+}
+
+TEST_FIXTURE(uri_address, traffic_recorder_captures_exchanges)
+{
+    test_http_server::scoped_server scoped(m_uri);
+    test_http_server * p_server = scoped.server();
+    const utility::string_t file_name = U("traffic_recorder_captures_exchanges.cap");
+
+    {
+        auto recorder = std::make_shared<traffic_recorder>(file_name);
+        http_client client(m_uri);
+        client.add_handler(recorder);
+
+        p_server->next_request().then([](test_request *p_request)
+        {
+            http_asserts::assert_test_request_equals(p_request, methods::POST, U("/capture?a=1"), U("text/plain"), U("request body"));
+            std::map<utility::string_t, utility::string_t> headers;
+            headers[U("Content-Type")] = U("text/plain");
+            VERIFY_ARE_EQUAL(0u, p_request->reply(200, U("OK"), headers, "response body"));
+        });
+        http_response response = client.request(methods::POST, U("/capture?a=1"), U("request body")).get();
+        VERIFY_ARE_EQUAL(status_codes::OK, response.status_code());
+
+        // The caller still gets the body the recorder read.
+        VERIFY_ARE_EQUAL(U("response body"), response.extract_string().get());
+
+        p_server->next_request().then([](test_request *p_request)
+        {
+            VERIFY_ARE_EQUAL(0u, p_request->reply(404));
+        });
+        VERIFY_ARE_EQUAL(status_codes::NotFound, client.request(methods::GET, U("/missing")).get().status_code());
+        VERIFY_ARE_EQUAL(2u, recorder->captured());
+    }
+
+    auto exchanges = read_traffic_capture(file_name);
+    VERIFY_ARE_EQUAL(2u, exchanges.size());
+
+    VERIFY_ARE_EQUAL(methods::POST, exchanges[0].method);
+    VERIFY_ARE_EQUAL(U("/capture?a=1"), exchanges[0].request_uri);
+    VERIFY_ARE_EQUAL(U("text/plain"), exchanges[0].request_headers.content_type());
+    VERIFY_ARE_EQUAL("request body", std::string(exchanges[0].request_body.begin(), exchanges[0].request_body.end()));
+    VERIFY_ARE_EQUAL(status_codes::OK, exchanges[0].status_code);
+    VERIFY_ARE_EQUAL(U("OK"), exchanges[0].reason_phrase);
+    VERIFY_ARE_EQUAL("response body", std::string(exchanges[0].response_body.begin(), exchanges[0].response_body.end()));
+
+    VERIFY_ARE_EQUAL(methods::GET, exchanges[1].method);
+    VERIFY_ARE_EQUAL(status_codes::NotFound, exchanges[1].status_code);
+    VERIFY_IS_TRUE(exchanges[1].response_body.empty());
+    VERIFY_IS_TRUE(exchanges[0].offset <= exchanges[1].offset);
+
+    std::remove(utility::conversions::to_utf8string(file_name).c_str());
+}
+
 } // SUITE(pipeline_stage_tests)
 
 }}}}
\ No newline at end of file
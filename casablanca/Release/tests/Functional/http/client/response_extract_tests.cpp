@@ -333,6 +333,26 @@ TEST_FIXTURE(uri_address, extract_vector)
     VERIFY_ARE_EQUAL(vector_data, rsp.extract_vector().get());
 }
 
+TEST_FIXTURE(uri_address, extract_large_body)
+{
+    test_http_server::scoped_server scoped(m_uri);
+    http_client client(m_uri);
+
+    // Large enough to be read from the network in several parts, all of which land in the presized body.
+    std::string data;
+    for (size_t i = 0; i < 200000; ++i)
+    {
+        data.push_back('a' + (char)(i % 26));
+    }
+    const std::vector<unsigned char> vector_data(data.begin(), data.end());
+
+    http_response rsp = send_request_response(scoped.server(), &client, U("application/octet-stream"), data);
+    VERIFY_ARE_EQUAL(vector_data, rsp.extract_vector().get());
+
+    rsp = send_request_response(scoped.server(), &client, U("text/plain; charset=utf-8"), data);
+    VERIFY_ARE_EQUAL(to_string_t(data), rsp.extract_string().get());
+}
+
 TEST_FIXTURE(uri_address, set_stream_try_extract_vector)
 {
 	test_http_server::scoped_server scoped(m_uri);
@@ -33,6 +33,10 @@ using namespace Windows::Storage;
 #include "http_listener.h"
 #endif
 
+#if !defined(_MS_WINDOWS)
+#include <boost/asio.hpp>
+#endif
+
 using namespace web; 
 using namespace utility;
 using namespace concurrency;
@@ -281,6 +285,335 @@ TEST_FIXTURE(uri_address, get_resp_stream)
 
     VERIFY_ARE_EQUAL(0, listener.close());
 }
+
+TEST(response_body_mode_needs_function)
+{
+    http_request msg(methods::GET);
+    VERIFY_THROWS(msg.set_response_body_mode(response_body_mode::digest), std::invalid_argument);
+    VERIFY_THROWS(msg.set_response_body_mode(response_body_mode::callback), std::invalid_argument);
+    VERIFY_THROWS(msg.set_response_body_digest(nullptr), std::invalid_argument);
+    VERIFY_IS_TRUE(msg.response_body_mode() == response_body_mode::buffer);
+}
+
+#if !defined(_MS_WINDOWS)
+TEST_FIXTURE(uri_address, response_body_mode_count)
+{
+    http_client client(m_uri);
+    utility::string_t responseData(U("Hello world"));
+
+    auto listener = web::http::listener::http_listener::create(m_uri);
+    VERIFY_ARE_EQUAL(0u, listener.open());
+    listener.support([responseData](http_request request)
+    {
+        request.reply(status_codes::OK, responseData);
+    });
+
+    {
+        http_request msg(methods::GET);
+        msg.set_response_body_mode(response_body_mode::count);
+        VERIFY_IS_TRUE(msg.response_body_mode() == response_body_mode::count);
+
+        http_response rsp = client.request(msg).get().content_ready().get();
+        VERIFY_ARE_EQUAL(responseData.size(), rsp.received_body_size());
+        VERIFY_IS_FALSE((bool)rsp.body());
+    }
+
+    VERIFY_ARE_EQUAL(0u, listener.close());
+}
+
+TEST_FIXTURE(uri_address, response_body_mode_digest)
+{
+    http_client client(m_uri);
+    std::string responseData("Hello world");
+
+    auto listener = web::http::listener::http_listener::create(m_uri);
+    VERIFY_ARE_EQUAL(0u, listener.open());
+    listener.support([responseData](http_request request)
+    {
+        streams::producer_consumer_buffer<uint8_t> buf;
+        request.reply(200, buf.create_istream(), U("text/plain"));
+
+        VERIFY_ARE_EQUAL(buf.putn((const uint8_t *)responseData.data(), responseData.size()).get(), responseData.size());
+        VERIFY_IS_TRUE(buf.close(std::ios_base::out).get());
+    });
+
+    {
+        std::string digested;
+        http_request msg(methods::GET);
+        msg.set_response_body_digest([&digested](const unsigned char *data, size_t size)
+        {
+            digested.append(reinterpret_cast<const char *>(data), size);
+        });
+
+        http_response rsp = client.request(msg).get().content_ready().get();
+        VERIFY_ARE_EQUAL(responseData, digested);
+        VERIFY_ARE_EQUAL(responseData.size(), rsp.received_body_size());
+    }
+
+    VERIFY_ARE_EQUAL(0u, listener.close());
+}
+
+TEST_FIXTURE(uri_address, response_body_callback)
+{
+    http_client client(m_uri);
+    std::string responseData("Hello world");
+
+    auto listener = web::http::listener::http_listener::create(m_uri);
+    VERIFY_ARE_EQUAL(0u, listener.open());
+    listener.support([responseData](http_request request)
+    {
+        streams::producer_consumer_buffer<uint8_t> buf;
+        request.reply(200, buf.create_istream(), U("text/plain"));
+
+        VERIFY_ARE_EQUAL(buf.putn((const uint8_t *)responseData.data(), 5).get(), 5);
+        VERIFY_ARE_EQUAL(buf.putn((const uint8_t *)responseData.data() + 5, responseData.size() - 5).get(), responseData.size() - 5);
+        VERIFY_IS_TRUE(buf.close(std::ios_base::out).get());
+    });
+
+    {
+        std::string received;
+        http_request msg(methods::GET);
+        msg.set_response_body_callback([&received](const unsigned char *data, size_t size)
+        {
+            // Hold on to the block for a while; nothing more is read until the task completes.
+            std::string block(reinterpret_cast<const char *>(data), size);
+            return pplx::create_task([&received, block]()
+            {
+                received.append(block);
+            });
+        });
+        VERIFY_IS_TRUE(msg.response_body_mode() == response_body_mode::callback);
+
+        http_response rsp = client.request(msg).get();
+        VERIFY_ARE_EQUAL(status_codes::OK, rsp.status_code());
+        rsp.content_ready().wait();
+        VERIFY_ARE_EQUAL(responseData, received);
+        VERIFY_ARE_EQUAL(responseData.size(), rsp.received_body_size());
+    }
+
+    VERIFY_ARE_EQUAL(0u, listener.close());
+}
+
+TEST_FIXTURE(uri_address, response_body_callback_gets_data_as_it_arrives)
+{
+    http_client client(m_uri);
+    const std::string responseData("Hello world");
+
+    // The second part of the body is only sent once the callback has had the first, with a known length
+    // and then chunked.
+    pplx::notification_event first_part_received;
+    bool known_length = true;
+    auto listener = web::http::listener::http_listener::create(m_uri);
+    VERIFY_ARE_EQUAL(0u, listener.open());
+    listener.support([&](http_request request)
+    {
+        streams::producer_consumer_buffer<uint8_t> buf;
+        if (known_length)
+            request.reply(200, buf.create_istream(), responseData.size(), U("text/plain"));
+        else
+            request.reply(200, buf.create_istream(), U("text/plain"));
+
+        VERIFY_ARE_EQUAL(buf.putn((const uint8_t *)responseData.data(), 5).get(), 5);
+        buf.sync().wait();
+        VERIFY_ARE_EQUAL(0u, first_part_received.wait(30000));
+        VERIFY_ARE_EQUAL(buf.putn((const uint8_t *)responseData.data() + 5, responseData.size() - 5).get(), responseData.size() - 5);
+        VERIFY_IS_TRUE(buf.close(std::ios_base::out).get());
+    });
+
+    for (int i = 0; i < 2; ++i)
+    {
+        known_length = i == 0;
+        first_part_received.reset();
+
+        std::string received;
+        http_request msg(methods::GET);
+        msg.set_response_body_callback([&](const unsigned char *data, size_t size)
+        {
+            received.append(reinterpret_cast<const char *>(data), size);
+            if (received.size() >= 5)
+            {
+                first_part_received.set();
+            }
+            return pplx::task_from_result();
+        });
+
+        http_response rsp = client.request(msg).get();
+        VERIFY_ARE_EQUAL(status_codes::OK, rsp.status_code());
+        rsp.content_ready().wait();
+        VERIFY_ARE_EQUAL(responseData, received);
+    }
+
+    VERIFY_ARE_EQUAL(0u, listener.close());
+}
+
+TEST_FIXTURE(uri_address, response_body_callback_fails)
+{
+    http_client client(m_uri);
+
+    auto listener = web::http::listener::http_listener::create(m_uri);
+    VERIFY_ARE_EQUAL(0u, listener.open());
+    listener.support([](http_request request)
+    {
+        request.reply(status_codes::OK, U("Hello world"));
+    });
+
+    {
+        http_request msg(methods::GET);
+        msg.set_response_body_callback([](const unsigned char *, size_t)
+        {
+            return pplx::task_from_exception<void>(std::runtime_error("stop"));
+        });
+
+        VERIFY_THROWS(client.request(msg).get().content_ready().get(), http_exception);
+    }
+
+    VERIFY_ARE_EQUAL(0u, listener.close());
+}
+
+TEST_FIXTURE(uri_address, response_file_body_ranges)
+{
+    const std::string content = "0123456789abcdefghij";
+    {
+        auto ostream = OPENSTR_W<uint8_t>(U("response_file_body.txt")).get();
+        ostream.print(content).wait();
+        ostream.close().wait();
+    }
+
+    auto listener = web::http::listener::http_listener::create(m_uri);
+    VERIFY_ARE_EQUAL(0u, listener.open());
+    listener.support([](http_request request)
+    {
+        auto body = Concurrency::streams::file_stream<uint8_t>::open_istream(U("response_file_body.txt")).get();
+        request.reply(status_codes::OK, body);
+    });
+
+    http_client client(m_uri);
+    utility::string_t etag;
+    {
+        http_response response = client.request(methods::GET).get();
+        VERIFY_ARE_EQUAL(status_codes::OK, response.status_code());
+        VERIFY_ARE_EQUAL(content.size(), response.headers().content_length());
+        VERIFY_IS_TRUE(response.headers().match(header_names::etag, etag));
+        VERIFY_ARE_EQUAL(content, response.extract_string().get());
+    }
+    {
+        http_request msg(methods::GET);
+        msg.headers().add(header_names::range, U("bytes=5-9"));
+        http_response response = client.request(msg).get();
+        VERIFY_ARE_EQUAL(status_codes::PartialContent, response.status_code());
+        VERIFY_ARE_EQUAL(U("bytes 5-9/20"), response.headers()[header_names::content_range]);
+        VERIFY_ARE_EQUAL(content.substr(5, 5), response.extract_string().get());
+    }
+    {
+        http_request msg(methods::GET);
+        msg.headers().add(header_names::range, U("bytes=-3"));
+        http_response response = client.request(msg).get();
+        VERIFY_ARE_EQUAL(status_codes::PartialContent, response.status_code());
+        VERIFY_ARE_EQUAL(content.substr(17), response.extract_string().get());
+    }
+    {
+        http_request msg(methods::GET);
+        msg.headers().add(header_names::range, U("bytes=100-"));
+        http_response response = client.request(msg).get();
+        VERIFY_ARE_EQUAL(status_codes::RangeNotSatisfiable, response.status_code());
+        VERIFY_ARE_EQUAL(U("bytes */20"), response.headers()[header_names::content_range]);
+    }
+    {
+        http_request msg(methods::GET);
+        msg.headers().add(header_names::if_none_match, etag);
+        http_response response = client.request(msg).get();
+        VERIFY_ARE_EQUAL(status_codes::NotModified, response.status_code());
+        VERIFY_ARE_EQUAL(0u, response.headers().content_length());
+    }
+
+    VERIFY_ARE_EQUAL(0u, listener.close());
+}
+
+TEST_FIXTURE(uri_address, response_file_body_bad_ranges)
+{
+    const std::string content = "0123456789abcdefghij";
+    {
+        auto ostream = OPENSTR_W<uint8_t>(U("response_file_body_bad_ranges.txt")).get();
+        ostream.print(content).wait();
+        ostream.close().wait();
+    }
+
+    auto listener = web::http::listener::http_listener::create(m_uri);
+    VERIFY_ARE_EQUAL(0u, listener.open());
+    listener.support([](http_request request)
+    {
+        auto body = Concurrency::streams::file_stream<uint8_t>::open_istream(U("response_file_body_bad_ranges.txt")).get();
+        request.reply(status_codes::OK, body);
+    });
+
+    // Ranges that overflow or do not parse are ignored, and the whole file sent.
+    const utility::string_t ranges[] =
+    {
+        U("bytes=99999999999999999999999-"),
+        U("bytes=-99999999999999999999999"),
+        U("bytes=0-99999999999999999999999"),
+        U("bytes=abc"),
+        U("bytes=5-2"),
+        U("bytes=-"),
+        U("items=0-5")
+    };
+    http_client client(m_uri);
+    for (size_t i = 0; i < sizeof(ranges) / sizeof(ranges[0]); ++i)
+    {
+        http_request msg(methods::GET);
+        msg.headers().add(header_names::range, ranges[i]);
+        http_response response = client.request(msg).get();
+        VERIFY_ARE_EQUAL(status_codes::OK, response.status_code());
+        VERIFY_ARE_EQUAL(content, response.extract_string().get());
+    }
+
+    VERIFY_ARE_EQUAL(0u, listener.close());
+}
+
+TEST_FIXTURE(uri_address, response_file_body_head)
+{
+    const std::string content = "0123456789abcdefghij";
+    {
+        auto ostream = OPENSTR_W<uint8_t>(U("response_file_body_head.txt")).get();
+        ostream.print(content).wait();
+        ostream.close().wait();
+    }
+
+    auto listener = web::http::listener::http_listener::create(m_uri);
+    VERIFY_ARE_EQUAL(0u, listener.open());
+    listener.support([](http_request request)
+    {
+        auto body = Concurrency::streams::file_stream<uint8_t>::open_istream(U("response_file_body_head.txt")).get();
+        request.reply(status_codes::OK, body);
+    });
+
+    // http_client closes its connection after each request, so the HEAD and the GET are written on one
+    // socket: a body sent after the HEAD response would show up in front of the GET's response.
+    using boost::asio::ip::tcp;
+    boost::asio::io_service service;
+    tcp::socket socket(service);
+    boost::asio::connect(socket, tcp::resolver(service).resolve(tcp::resolver::query(m_uri.host(), std::to_string(m_uri.port()))));
+    const std::string requests =
+        "HEAD / HTTP/1.1\r\nHost: localhost\r\n\r\n"
+        "GET / HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+    boost::asio::write(socket, boost::asio::buffer(requests));
+
+    boost::asio::streambuf responses;
+    boost::system::error_code ec;
+    boost::asio::read(socket, responses, ec);
+    VERIFY_IS_TRUE(ec == boost::asio::error::eof);
+
+    const std::string text((std::istreambuf_iterator<char>(&responses)), std::istreambuf_iterator<char>());
+    VERIFY_ARE_EQUAL(0u, text.find("HTTP/1.1 200"));
+    VERIFY_IS_TRUE(text.find("Content-Length: 20\r\n") < text.find("\r\n\r\n"));
+    const auto head_end = text.find("\r\n\r\n") + 4;
+    VERIFY_ARE_EQUAL(head_end, text.find("HTTP/1.1 200", head_end));
+    VERIFY_ARE_EQUAL(text.size() - content.size(), text.rfind(content));
+    VERIFY_ARE_EQUAL(text.find(content), text.rfind(content));
+
+    VERIFY_ARE_EQUAL(0u, listener.close());
+}
+#endif
 #endif
 
 #pragma endregion
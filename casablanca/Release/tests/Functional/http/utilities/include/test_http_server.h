@@ -23,6 +23,7 @@
 
 #pragma once
 
+#include <chrono>
 #include <map>
 #include <sstream>
 
@@ -108,6 +109,35 @@ private:
         size_t data_length);
 };
 
+#if !defined(_MS_WINDOWS)
+/// <summary>
+/// Network conditions a test_http_server can emulate on the connections made to it. Each direction of a
+/// connection is shaped on its own; the defaults leave the traffic as it is.
+/// </summary>
+struct network_conditions
+{
+    network_conditions() : latency(0), jitter(0), bandwidth(0), max_write(0), reset_after(0), seed(1) {}
+
+    // Delay added to the data sent each way.
+    std::chrono::milliseconds latency;
+
+    // Most random delay added on top of the latency. The data sent each way stays in order.
+    std::chrono::milliseconds jitter;
+
+    // Bytes per second sent each way; 0 for no limit.
+    size_t bandwidth;
+
+    // Most bytes written to a socket at once, so that reads see partial messages; 0 for no limit.
+    size_t max_write;
+
+    // Bytes of response data after which the connection is reset; 0 to never reset.
+    size_t reset_after;
+
+    // Seed of the jitter, so that runs are repeatable.
+    unsigned int seed;
+};
+#endif
+
 /// <summary>
 /// Basic HTTP server for testing. Supports waiting and collecting together requests.
 ///
@@ -117,6 +147,10 @@ class test_http_server
 {
 public:
     TEST_UTILITY_API test_http_server(const web::http::uri &uri);
+#if !defined(_MS_WINDOWS)
+    // Serves through a proxy at the URI that emulates the network conditions.
+    TEST_UTILITY_API test_http_server(const web::http::uri &uri, const network_conditions &conditions);
+#endif
     TEST_UTILITY_API ~test_http_server();
 
     // APIs to open and close requests.
@@ -129,6 +163,11 @@ public:
     TEST_UTILITY_API std::vector<test_request *> wait_for_requests(const size_t count);
     TEST_UTILITY_API std::vector<pplx::task<test_request *>> next_requests(const size_t count);
 
+#if !defined(_MS_WINDOWS)
+    // The number of connections clients made to the server. Only counted when emulating network conditions.
+    TEST_UTILITY_API size_t connections() const;
+#endif
+
     // RAII pattern for test_http_server.
     class scoped_server
     {
@@ -138,6 +177,13 @@ public:
             m_p_server = new test_http_server(uri);
             VERIFY_ARE_EQUAL(0u, m_p_server->open());
         }
+#if !defined(_MS_WINDOWS)
+        scoped_server(const web::http::uri &uri, const network_conditions &conditions) 
+        {
+            m_p_server = new test_http_server(uri, conditions);
+            VERIFY_ARE_EQUAL(0u, m_p_server->open());
+        }
+#endif
         ~scoped_server()
         {
             VERIFY_ARE_EQUAL(0u, m_p_server->close());
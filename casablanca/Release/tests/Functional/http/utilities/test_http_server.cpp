@@ -27,6 +27,14 @@
 #include <agents.h>
 #endif
 #include <algorithm>
+#if !defined(_MS_WINDOWS)
+#include <array>
+#include <deque>
+#include <random>
+#include <thread>
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+#endif
 
 #include "uri.h"
 #include "test_http_server.h"
@@ -451,10 +459,300 @@ private:
     HANDLE m_request_queue;
 };
 #else
+// Forwards the connections made to the address the tests use on to the listener's own address, shaping the
+// traffic on the way to emulate network_conditions. Everything runs on the emulator's one thread.
+class network_emulator
+{
+public:
+    network_emulator(const web::http::uri &uri, const network_conditions &conditions)
+        : m_uri(uri)
+        , m_conditions(conditions)
+        , m_random(conditions.seed)
+        , m_service()
+        , m_acceptor(m_service)
+        , m_connections(0)
+    {
+        // Give the listener a free port of its own.
+        boost::asio::ip::tcp::acceptor probe(m_service, boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+        m_server_uri = web::http::uri_builder(uri).set_port(probe.local_endpoint().port()).to_uri();
+    }
+
+    ~network_emulator()
+    {
+        stop();
+    }
+
+    const web::http::uri &server_uri() const { return m_server_uri; }
+
+    size_t connections() const { return m_connections; }
+
+    unsigned long start()
+    {
+        try
+        {
+            boost::asio::ip::tcp::resolver resolver(m_service);
+            m_server_endpoint = *resolver.resolve(boost::asio::ip::tcp::resolver::query(
+                to_utf8string(m_server_uri.host()), std::to_string(m_server_uri.port())));
+            boost::asio::ip::tcp::endpoint endpoint = *resolver.resolve(boost::asio::ip::tcp::resolver::query(
+                to_utf8string(m_uri.host()), std::to_string(m_uri.port())));
+
+            m_acceptor.open(endpoint.protocol());
+            m_acceptor.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+            m_acceptor.bind(endpoint);
+            m_acceptor.listen();
+        }
+        catch (const boost::system::system_error &e)
+        {
+            return static_cast<unsigned long>(e.code().value());
+        }
+
+        m_work.reset(new boost::asio::io_service::work(m_service));
+        accept();
+        m_thread = std::thread([this]() { m_service.run(); });
+        return 0;
+    }
+
+    void stop()
+    {
+        if (!m_thread.joinable())
+        {
+            return;
+        }
+
+        m_service.post([this]()
+        {
+            boost::system::error_code ignore;
+            m_acceptor.close(ignore);
+            for (auto it = m_links.begin(); it != m_links.end(); ++it)
+            {
+                if (auto l = it->lock())
+                    l->close();
+            }
+            m_links.clear();
+        });
+        m_work.reset();
+        m_thread.join();
+    }
+
+private:
+    // One direction of a link: the data read from one socket, queued until it is due on the other.
+    struct pump
+    {
+        struct chunk
+        {
+            std::chrono::steady_clock::time_point due;
+            std::vector<char> data;
+            size_t offset;
+        };
+
+        pump(boost::asio::io_service &service, boost::asio::ip::tcp::socket &from, boost::asio::ip::tcp::socket &to, bool response)
+            : m_from(from), m_to(to), m_timer(service), m_response(response), m_writing(false), m_eof(false), m_forwarded(0)
+        {
+        }
+
+        boost::asio::ip::tcp::socket &m_from;
+        boost::asio::ip::tcp::socket &m_to;
+        boost::asio::steady_timer m_timer;
+        const bool m_response;
+        std::array<char, 16 * 1024> m_buffer;
+        std::deque<chunk> m_queue;
+        bool m_writing;
+        bool m_eof;
+        size_t m_forwarded;
+        std::chrono::steady_clock::time_point m_last_due;   // chunks are due in the order they were read
+        std::chrono::steady_clock::time_point m_next_send;  // the bandwidth allows the next write from then
+    };
+
+    // A connection from a client, and the emulator's connection on to the listener.
+    class link : public std::enable_shared_from_this<link>
+    {
+    public:
+        link(network_emulator &emulator)
+            : m_emulator(emulator)
+            , m_client(emulator.m_service)
+            , m_server(emulator.m_service)
+            , m_up(emulator.m_service, m_client, m_server, false)
+            , m_down(emulator.m_service, m_server, m_client, true)
+        {
+        }
+
+        boost::asio::ip::tcp::socket &client() { return m_client; }
+
+        void start()
+        {
+            auto self = shared_from_this();
+            m_server.async_connect(m_emulator.m_server_endpoint, [self](const boost::system::error_code &ec)
+            {
+                if (ec)
+                {
+                    self->close();
+                    return;
+                }
+                self->read(self->m_up);
+                self->read(self->m_down);
+            });
+        }
+
+        void close()
+        {
+            boost::system::error_code ignore;
+            m_up.m_timer.cancel(ignore);
+            m_down.m_timer.cancel(ignore);
+            m_client.close(ignore);
+            m_server.close(ignore);
+        }
+
+    private:
+        void read(pump &p)
+        {
+            auto self = shared_from_this();
+            p.m_from.async_read_some(boost::asio::buffer(p.m_buffer), [self, &p](const boost::system::error_code &ec, size_t size)
+            {
+                if (ec)
+                {
+                    p.m_eof = true;
+                    if (!p.m_writing)
+                        self->finish(p);
+                    return;
+                }
+
+                pump::chunk c;
+                c.due = std::max(std::chrono::steady_clock::now() + self->m_emulator.delay(), p.m_last_due);
+                c.data.assign(p.m_buffer.begin(), p.m_buffer.begin() + size);
+                c.offset = 0;
+                p.m_last_due = c.due;
+                p.m_queue.push_back(std::move(c));
+                if (!p.m_writing)
+                    self->write(p);
+                self->read(p);
+            });
+        }
+
+        void write(pump &p)
+        {
+            if (p.m_queue.empty())
+            {
+                p.m_writing = false;
+                if (p.m_eof)
+                    finish(p);
+                return;
+            }
+
+            p.m_writing = true;
+            auto self = shared_from_this();
+            p.m_timer.expires_at(std::max(p.m_queue.front().due, p.m_next_send));
+            p.m_timer.async_wait([self, &p](const boost::system::error_code &ec)
+            {
+                if (ec)
+                    return;
+
+                const network_conditions &conditions = self->m_emulator.m_conditions;
+                auto &front = p.m_queue.front();
+                size_t size = front.data.size() - front.offset;
+                if (conditions.max_write != 0)
+                    size = std::min(size, conditions.max_write);
+                if (p.m_response && conditions.reset_after != 0)
+                    size = std::min(size, conditions.reset_after - p.m_forwarded);
+
+                boost::asio::async_write(p.m_to, boost::asio::buffer(&front.data[front.offset], size),
+                    [self, &p](const boost::system::error_code &ec, size_t written)
+                {
+                    if (ec)
+                    {
+                        self->close();
+                        return;
+                    }
+
+                    const network_conditions &conditions = self->m_emulator.m_conditions;
+                    p.m_forwarded += written;
+                    if (p.m_response && conditions.reset_after != 0 && p.m_forwarded >= conditions.reset_after)
+                    {
+                        self->reset();
+                        return;
+                    }
+                    if (conditions.bandwidth != 0)
+                    {
+                        p.m_next_send = std::chrono::steady_clock::now() + std::chrono::microseconds(written * 1000000 / conditions.bandwidth);
+                    }
+
+                    auto &front = p.m_queue.front();
+                    front.offset += written;
+                    if (front.offset == front.data.size())
+                        p.m_queue.pop_front();
+                    self->write(p);
+                });
+            });
+        }
+
+        // Passes an end of stream on, once everything read before it has been written.
+        void finish(pump &p)
+        {
+            boost::system::error_code ignore;
+            p.m_to.shutdown(boost::asio::ip::tcp::socket::shutdown_send, ignore);
+        }
+
+        // Aborts the client's connection, so that it sees a reset instead of an orderly close.
+        void reset()
+        {
+            boost::system::error_code ignore;
+            m_client.set_option(boost::asio::socket_base::linger(true, 0), ignore);
+            close();
+        }
+
+        network_emulator &m_emulator;
+        boost::asio::ip::tcp::socket m_client;
+        boost::asio::ip::tcp::socket m_server;
+        pump m_up;
+        pump m_down;
+    };
+
+    void accept()
+    {
+        auto l = std::make_shared<link>(*this);
+        m_acceptor.async_accept(l->client(), [this, l](const boost::system::error_code &ec)
+        {
+            if (ec)
+            {
+                return;
+            }
+
+            ++m_connections;
+            m_links.erase(std::remove_if(m_links.begin(), m_links.end(), [](const std::weak_ptr<link> &w) { return w.expired(); }), m_links.end());
+            m_links.push_back(l);
+            l->start();
+            accept();
+        });
+    }
+
+    std::chrono::microseconds delay()
+    {
+        auto delay = std::chrono::duration_cast<std::chrono::microseconds>(m_conditions.latency);
+        if (m_conditions.jitter.count() > 0)
+        {
+            std::uniform_int_distribution<long long> jitter(0, std::chrono::duration_cast<std::chrono::microseconds>(m_conditions.jitter).count());
+            delay += std::chrono::microseconds(jitter(m_random));
+        }
+        return delay;
+    }
+
+    const web::http::uri m_uri;
+    web::http::uri m_server_uri;
+    const network_conditions m_conditions;
+    std::mt19937 m_random;
+    boost::asio::io_service m_service;
+    std::unique_ptr<boost::asio::io_service::work> m_work;
+    boost::asio::ip::tcp::acceptor m_acceptor;
+    boost::asio::ip::tcp::endpoint m_server_endpoint;
+    std::vector<std::weak_ptr<link>> m_links;
+    std::atomic<size_t> m_connections;
+    std::thread m_thread;
+};
+
 class _test_http_server
 {
 private:
     const std::string m_uri;
+    std::unique_ptr<network_emulator> m_emulator;
     typename web::http::listener::http_listener m_listener;
     pplx::critical_section m_lock;
     std::vector<pplx::task_completion_event<test_request*>> m_requests;
@@ -466,9 +764,10 @@ private:
 
     pplx::critical_section m_listen_lock;
 public:
-    _test_http_server(const utility::string_t& uri)
+    _test_http_server(const utility::string_t& uri, const network_conditions *conditions = nullptr)
         : m_uri(uri) 
-        , m_listener(web::http::listener::http_listener::create(uri))
+        , m_emulator(conditions != nullptr ? new network_emulator(uri, *conditions) : nullptr)
+        , m_listener(web::http::listener::http_listener::create(m_emulator ? m_emulator->server_uri() : web::http::uri(uri)))
         , m_cancel(0)
     {
         m_listener.support([&](web::http::http_request result) -> void
@@ -510,10 +809,22 @@ public:
         close();
     }
 
-    unsigned long open() { return m_listener.open(); }
+    unsigned long open()
+    {
+        auto error = m_listener.open();
+        if (error == 0 && m_emulator)
+        {
+            error = m_emulator->start();
+        }
+        return error;
+    }
     unsigned long close()
     {
         ++m_cancel;
+        if (m_emulator)
+        {
+            m_emulator->stop();
+        }
         return m_listener.close();
     }
 
@@ -584,6 +895,11 @@ public:
         }
         return requests;
     }
+
+    size_t connections() const
+    {
+        return m_emulator ? m_emulator->connections() : 0;
+    }
 };
 #endif
 
@@ -715,6 +1031,10 @@ unsigned long test_request::reply_impl(
 
 test_http_server::test_http_server(const web::http::uri &uri) { m_p_impl = new _test_http_server(uri.to_string()); }
 
+#if !defined(_MS_WINDOWS)
+test_http_server::test_http_server(const web::http::uri &uri, const network_conditions &conditions) { m_p_impl = new _test_http_server(uri.to_string(), &conditions); }
+#endif
+
 test_http_server::~test_http_server() { delete m_p_impl; }
 
 unsigned long test_http_server::open() { return m_p_impl->open(); }
@@ -729,4 +1049,8 @@ std::vector<test_request *> test_http_server::wait_for_requests(const size_t cou
 
 std::vector<pplx::task<test_request *>> test_http_server::next_requests(const size_t count) { return m_p_impl->next_requests(count); }
 
+#if !defined(_MS_WINDOWS)
+size_t test_http_server::connections() const { return m_p_impl->connections(); }
+#endif
+
 }}}}
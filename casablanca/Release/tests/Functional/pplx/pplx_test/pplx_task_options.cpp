@@ -422,5 +422,57 @@ TEST(scheduler_lifetime_nested)
     ev.wait();
 }
 
+#if !defined(_MS_WINDOWS)
+TEST(work_stealing_fan_out)
+{
+    auto sched = std::make_shared<pplx::details::work_stealing_scheduler>(4);
+    pplx::task_options options(sched);
+
+    // Each outer task spawns its children from a worker, so they go to that worker's deque and get stolen.
+    std::vector<pplx::task<int>> outer;
+    for (int i = 0; i < 50; ++i)
+    {
+        outer.push_back(pplx::create_task([i, sched]()
+        {
+            std::vector<pplx::task<int>> children;
+            for (int j = 0; j < 20; ++j)
+            {
+                children.push_back(pplx::create_task([i, j]() { return i * j; }, pplx::task_options(sched)));
+            }
+            int sum = 0;
+            auto results = pplx::when_all(children.begin(), children.end()).get();
+            for (auto it = results.begin(); it != results.end(); ++it)
+            {
+                sum += *it;
+            }
+            return sum;
+        }, options));
+    }
+
+    int total = 0;
+    auto results = pplx::when_all(outer.begin(), outer.end()).get();
+    for (auto it = results.begin(); it != results.end(); ++it)
+    {
+        total += *it;
+    }
+    VERIFY_ARE_EQUAL(total, (49 * 50 / 2) * (19 * 20 / 2));
+}
+
+TEST(work_stealing_blocking_chores)
+{
+    // A chore blocked on another one scheduled after it: the other worker must steal it.
+    auto sched = std::make_shared<pplx::details::work_stealing_scheduler>(2);
+    pplx::task_completion_event<int> tce;
+
+    auto waiter = pplx::create_task([tce, sched]()
+    {
+        pplx::create_task([tce]() { tce.set(42); }, pplx::task_options(sched));
+        return pplx::create_task(tce).get();
+    }, pplx::task_options(sched));
+
+    VERIFY_ARE_EQUAL(waiter.get(), 42);
+}
+#endif
+
 } // SUITE(pplx_task_options_tests)
 }}}   // namespaces
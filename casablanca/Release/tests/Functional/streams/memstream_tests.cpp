@@ -925,6 +925,46 @@ TEST(mem_buffer_alloc_commit)
     }
 }
 
+TEST(mem_buffer_reserve_take)
+{
+    std::vector<uint8_t> s(4000);
+    for (size_t i = 0; i < s.size(); ++i)
+    {
+        s[i] = static_cast<uint8_t>(i);
+    }
+
+    auto base = std::make_shared<concurrency::streams::details::basic_producer_consumer_buffer<uint8_t>>(512);
+    base->reserve(s.size());
+    concurrency::streams::streambuf<uint8_t> buf(base);
+    VERIFY_ARE_EQUAL(buf.putn(s.data(), 1000).get(), 1000);
+    VERIFY_ARE_EQUAL(buf.putn(s.data() + 1000, s.size() - 1000).get(), s.size() - 1000);
+
+    // Not while the write head is open
+    std::vector<uint8_t> taken;
+    VERIFY_IS_FALSE(base->try_take(taken));
+
+    VERIFY_IS_TRUE(buf.close(std::ios_base::out).get());
+    VERIFY_IS_TRUE(base->try_take(taken));
+    VERIFY_ARE_EQUAL(s, taken);
+    VERIFY_ARE_EQUAL(0, buf.in_avail());
+    VERIFY_ARE_EQUAL(concurrency::streams::streambuf<uint8_t>::traits::eof(), buf.getc().get());
+}
+
+TEST(mem_buffer_take_multiple_blocks)
+{
+    std::vector<uint8_t> s(2000, 'a');
+    auto base = std::make_shared<concurrency::streams::details::basic_producer_consumer_buffer<uint8_t>>(512);
+    concurrency::streams::streambuf<uint8_t> buf(base);
+    VERIFY_ARE_EQUAL(buf.putn(s.data(), 1000).get(), 1000);
+    VERIFY_ARE_EQUAL(buf.putn(s.data(), 1000).get(), 1000);
+    VERIFY_IS_TRUE(buf.close(std::ios_base::out).get());
+
+    // The data is in two blocks, so it cannot be moved out.
+    std::vector<uint8_t> taken;
+    VERIFY_IS_FALSE(base->try_take(taken));
+    VERIFY_ARE_EQUAL(s.size(), buf.in_avail());
+}
+
 TEST(string_buffer_seek_write)
 {
     stringstreambuf buf;